@@ -18,7 +18,10 @@ struct VertexOut
 VertexOut main(VetexIn vin)
 {
     VertexOut vout;
-    vout.PosH = mul(float4(vin.PosL, 1.0), worldViewProjection);
+    // precise, as in DepthVertexShader, so both compute bit-identical depth
+    // and the equal depth test after the prepass passes.
+    precise float4 posH = mul(float4(vin.PosL, 1.0), worldViewProjection);
+    vout.PosH = posH;
     vout.Color = vin.Color;
     return vout;
 }
\ No newline at end of file
@@ -0,0 +1,11 @@
+cbuffer Transform : register(b0)
+{
+    float4x4 worldViewProjection;
+};
+
+float4 main(float3 posL : POSITION) : SV_POSITION
+{
+    // precise, as in ColorVertexShader, so both compute bit-identical depth.
+    precise float4 posH = mul(float4(posL, 1.0), worldViewProjection);
+    return posH;
+}
\ No newline at end of file
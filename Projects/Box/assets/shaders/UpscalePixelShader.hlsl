@@ -0,0 +1,13 @@
+Texture2D sceneColor : register(t0);
+SamplerState linearClamp : register(s0);
+
+struct PixelIn
+{
+    float4 PosH : SV_POSITION;
+    float2 TexCoord : TEXCOORD;
+};
+
+float4 main(PixelIn pin) : SV_TARGET
+{
+    return sceneColor.Sample(linearClamp, pin.TexCoord);
+}
\ No newline at end of file
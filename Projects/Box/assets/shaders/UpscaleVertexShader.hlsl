@@ -0,0 +1,21 @@
+cbuffer Upscale : register(b0)
+{
+    float2 uvScale;
+};
+
+struct VertexOut
+{
+    float4 PosH : SV_POSITION;
+    float2 TexCoord : TEXCOORD;
+};
+
+// Full-screen triangle generated from the vertex id, no vertex buffer needed.
+VertexOut main(uint vertexId : SV_VertexID)
+{
+    float2 uv = float2((vertexId << 1) & 2, vertexId & 2);
+
+    VertexOut vout;
+    vout.PosH = float4(uv * float2(2.0, -2.0) + float2(-1.0, 1.0), 0.0, 1.0);
+    vout.TexCoord = uv * uvScale;
+    return vout;
+}
\ No newline at end of file
@@ -0,0 +1,91 @@
+// C
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <malloc.h>
+
+import <algorithm>;
+import <new>;
+
+import core.memory;
+
+// Replacement global allocation functions. Every block carries a small header
+// with its size and the memory tag that was current when it was allocated,
+// so AllocationCounter can keep live bytes per subsystem and Game can find
+// heap allocations on the steady-state frame path. The array and nothrow
+// forms forward to these, so they are counted as well.
+
+namespace
+{
+	struct AllocationHeader
+	{
+		std::size_t Size;
+		std::uint32_t Offset;
+		MemoryTag Tag;
+	};
+
+	constexpr std::size_t HeaderSize = 16;
+	static_assert(sizeof(AllocationHeader) <= HeaderSize);
+
+	void* Allocate(std::size_t size, std::size_t alignment)
+	{
+		// The header sits right in front of the block. Offsetting by the
+		// alignment keeps the block aligned and leaves room for the header.
+		alignment = std::max(alignment, HeaderSize);
+		std::size_t offset = alignment;
+
+		void* base = _aligned_malloc(size + offset, alignment);
+		if (!base) {
+			throw std::bad_alloc();
+		}
+
+		MemoryTag tag = AllocationCounter::CurrentTag();
+		std::byte* pointer = static_cast<std::byte*>(base) + offset;
+		new (pointer - HeaderSize) AllocationHeader{ size, static_cast<std::uint32_t>(offset), tag };
+		AllocationCounter::Record(size, tag);
+
+		return pointer;
+	}
+
+	void Free(void* pointer) noexcept
+	{
+		if (!pointer) {
+			return;
+		}
+
+		std::byte* bytes = static_cast<std::byte*>(pointer);
+		const AllocationHeader* header = reinterpret_cast<const AllocationHeader*>(bytes - HeaderSize);
+		AllocationCounter::Release(header->Size, header->Tag);
+		_aligned_free(bytes - header->Offset);
+	}
+}
+
+void* operator new(std::size_t size)
+{
+	return Allocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+	return Allocate(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void* pointer) noexcept
+{
+	Free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept
+{
+	Free(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept
+{
+	Free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t, std::align_val_t) noexcept
+{
+	Free(pointer);
+}
@@ -0,0 +1,385 @@
+module;
+// C
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+export module core.memory;
+
+import <algorithm>;
+import <array>;
+import <atomic>;
+import <memory>;
+import <memory_resource>;
+import <new>;
+import <string_view>;
+import <utility>;
+import <vector>;
+
+// Subsystem an allocation is charged to. Each thread has a current tag,
+// changed with MemoryTagScope, that the global operator new picks up.
+export enum class MemoryTag : std::uint8_t
+{
+	General,
+	Core,
+	Assets,
+	Streaming,
+	Rendering,
+	Interface,
+	Count,
+};
+
+export constexpr std::string_view MemoryTagName(MemoryTag tag)
+{
+	constexpr std::string_view names[] = { "General", "Core", "Assets", "Streaming", "Rendering", "Interface" };
+	return tag < MemoryTag::Count ? names[static_cast<std::size_t>(tag)] : "Unknown";
+}
+
+// Counts every call to the global operator new, in total and per tag. The
+// counters are fed by the replacement operators in AllocationHooks.cpp.
+export namespace AllocationCounter
+{
+	void Record(std::size_t bytes, MemoryTag tag);
+	void Release(std::size_t bytes, MemoryTag tag);
+
+	std::uint64_t Count();
+	std::uint64_t Allocations(MemoryTag tag);
+	std::int64_t LiveBytes(MemoryTag tag);
+
+	MemoryTag CurrentTag();
+	void SetCurrentTag(MemoryTag tag);
+}
+
+export class MemoryTagScope
+{
+public:
+	explicit MemoryTagScope(MemoryTag tag)
+		: previous_(AllocationCounter::CurrentTag())
+	{
+		AllocationCounter::SetCurrentTag(tag);
+	}
+
+	~MemoryTagScope()
+	{
+		AllocationCounter::SetCurrentTag(previous_);
+	}
+
+	MemoryTagScope(const MemoryTagScope&) = delete;
+	MemoryTagScope& operator=(const MemoryTagScope&) = delete;
+
+private:
+	MemoryTag previous_;
+};
+
+// Bump allocator for data that lives until the end of the frame. Deallocation
+// is a no-op; everything is released at once by Reset(). Allocations that do
+// not fit go to the heap, and the next Reset() grows the arena so that the
+// frame fits from then on.
+export class FrameArena : public std::pmr::memory_resource
+{
+public:
+	explicit FrameArena(std::size_t capacity);
+	~FrameArena() override;
+
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+
+	void Reset();
+
+	std::size_t Used() const { return offset_; }
+	std::size_t Capacity() const { return capacity_; }
+
+private:
+	void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+	void do_deallocate(void* pointer, std::size_t bytes, std::size_t alignment) override { }
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+private:
+	struct Overflow
+	{
+		void* Pointer;
+		std::size_t Bytes;
+		std::size_t Alignment;
+	};
+
+	std::byte* buffer_ = nullptr;
+	std::size_t capacity_ = 0;
+	std::size_t offset_ = 0;
+
+	std::vector<Overflow> overflows_;
+	std::size_t overflowBytes_ = 0;
+};
+
+// Empties a vector of per-frame scratch for a new frame. With frameMemory,
+// such as a FrameArena, the vector starts over on it, as the arena may have
+// been reset under the old storage. Without, it moves to the heap and keeps
+// its capacity from one frame to the next.
+export template <typename T>
+void ResetFrameVector(std::pmr::vector<T>& vector, std::pmr::memory_resource* frameMemory)
+{
+	std::pmr::memory_resource* memory = frameMemory ? frameMemory : std::pmr::get_default_resource();
+	if (frameMemory || vector.get_allocator().resource() != memory) {
+		// Assignment would keep the old resource, so the vector is rebuilt.
+		std::destroy_at(&vector);
+		std::construct_at(&vector, memory);
+	}
+	else {
+		vector.clear();
+	}
+}
+
+// Free-list allocator for blocks of a single size. Memory is taken from the
+// heap in chunks and only returned when the pool is destroyed. Requests that
+// do not fit a block are forwarded to the upstream resource, so the pool can
+// back node-based pmr containers directly. Not thread-safe.
+export class FixedPool : public std::pmr::memory_resource
+{
+public:
+	FixedPool(std::size_t blockSize, std::size_t blockAlignment, std::size_t blocksPerChunk = 64,
+		std::pmr::memory_resource* upstream = std::pmr::get_default_resource());
+	~FixedPool() override;
+
+	FixedPool(const FixedPool&) = delete;
+	FixedPool& operator=(const FixedPool&) = delete;
+
+	void* Allocate();
+	void Deallocate(void* block);
+
+	std::size_t BlockSize() const { return blockSize_; }
+
+private:
+	void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+	void do_deallocate(void* pointer, std::size_t bytes, std::size_t alignment) override;
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+	void AllocateChunk();
+
+private:
+	struct FreeBlock
+	{
+		FreeBlock* Next;
+	};
+
+	std::size_t blockSize_;
+	std::size_t blockAlignment_;
+	std::size_t blocksPerChunk_;
+	std::pmr::memory_resource* upstream_;
+
+	FreeBlock* freeList_ = nullptr;
+	std::vector<void*> chunks_;
+};
+
+// Typed front end of FixedPool. Objects are handed out as unique_ptrs that
+// return their storage to the pool.
+export template <typename T>
+class ObjectPool
+{
+public:
+	struct Deleter
+	{
+		ObjectPool* Pool = nullptr;
+
+		void operator()(T* object) const { Pool->Destroy(object); }
+	};
+
+	using Pointer = std::unique_ptr<T, Deleter>;
+
+public:
+	explicit ObjectPool(std::size_t objectsPerChunk = 16)
+		: blocks_(sizeof(T), alignof(T), objectsPerChunk)
+	{
+	}
+
+	template <typename... Args>
+	Pointer Create(Args&&... args)
+	{
+		void* memory = blocks_.Allocate();
+		try {
+			return Pointer(new (memory) T(std::forward<Args>(args)...), Deleter{ this });
+		}
+		catch (...) {
+			blocks_.Deallocate(memory);
+			throw;
+		}
+	}
+
+	void Destroy(T* object)
+	{
+		if (object) {
+			object->~T();
+			blocks_.Deallocate(object);
+		}
+	}
+
+private:
+	FixedPool blocks_;
+};
+
+module :private;
+
+namespace
+{
+	struct TagCounters
+	{
+		std::atomic<std::uint64_t> Allocations;
+		std::atomic<std::int64_t> LiveBytes;
+	};
+
+	std::atomic<std::uint64_t> allocationCount;
+	std::array<TagCounters, static_cast<std::size_t>(MemoryTag::Count)> tagCounters;
+	thread_local MemoryTag currentTag = MemoryTag::General;
+
+	constexpr std::size_t FrameArenaAlignment = 64;
+
+	std::size_t AlignUp(std::size_t value, std::size_t alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+}
+
+void AllocationCounter::Record(std::size_t bytes, MemoryTag tag)
+{
+	TagCounters& counters = tagCounters[static_cast<std::size_t>(tag)];
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+	counters.Allocations.fetch_add(1, std::memory_order_relaxed);
+	counters.LiveBytes.fetch_add(static_cast<std::int64_t>(bytes), std::memory_order_relaxed);
+}
+
+void AllocationCounter::Release(std::size_t bytes, MemoryTag tag)
+{
+	tagCounters[static_cast<std::size_t>(tag)].LiveBytes.fetch_sub(static_cast<std::int64_t>(bytes), std::memory_order_relaxed);
+}
+
+std::uint64_t AllocationCounter::Count()
+{
+	return allocationCount.load(std::memory_order_relaxed);
+}
+
+std::uint64_t AllocationCounter::Allocations(MemoryTag tag)
+{
+	return tagCounters[static_cast<std::size_t>(tag)].Allocations.load(std::memory_order_relaxed);
+}
+
+std::int64_t AllocationCounter::LiveBytes(MemoryTag tag)
+{
+	return tagCounters[static_cast<std::size_t>(tag)].LiveBytes.load(std::memory_order_relaxed);
+}
+
+MemoryTag AllocationCounter::CurrentTag()
+{
+	return currentTag;
+}
+
+void AllocationCounter::SetCurrentTag(MemoryTag tag)
+{
+	currentTag = tag;
+}
+
+FrameArena::FrameArena(std::size_t capacity)
+	: buffer_(static_cast<std::byte*>(::operator new(capacity, std::align_val_t{ FrameArenaAlignment }))),
+	capacity_(capacity)
+{
+}
+
+FrameArena::~FrameArena()
+{
+	for (const Overflow& overflow : overflows_) {
+		::operator delete(overflow.Pointer, overflow.Bytes, std::align_val_t{ overflow.Alignment });
+	}
+	::operator delete(buffer_, capacity_, std::align_val_t{ FrameArenaAlignment });
+}
+
+void FrameArena::Reset()
+{
+	if (!overflows_.empty()) {
+		for (const Overflow& overflow : overflows_) {
+			::operator delete(overflow.Pointer, overflow.Bytes, std::align_val_t{ overflow.Alignment });
+		}
+		overflows_.clear();
+
+		std::size_t capacity = AlignUp((capacity_ + overflowBytes_) * 3 / 2, FrameArenaAlignment);
+		::operator delete(buffer_, capacity_, std::align_val_t{ FrameArenaAlignment });
+		buffer_ = static_cast<std::byte*>(::operator new(capacity, std::align_val_t{ FrameArenaAlignment }));
+		capacity_ = capacity;
+		overflowBytes_ = 0;
+	}
+
+	offset_ = 0;
+}
+
+void* FrameArena::do_allocate(std::size_t bytes, std::size_t alignment)
+{
+	std::size_t offset = AlignUp(offset_, alignment);
+	if (offset + bytes <= capacity_ && alignment <= FrameArenaAlignment) {
+		offset_ = offset + bytes;
+		return buffer_ + offset;
+	}
+
+	void* pointer = ::operator new(bytes, std::align_val_t{ alignment });
+	overflows_.push_back({ pointer, bytes, alignment });
+	overflowBytes_ += bytes + alignment;
+	return pointer;
+}
+
+FixedPool::FixedPool(std::size_t blockSize, std::size_t blockAlignment, std::size_t blocksPerChunk,
+	std::pmr::memory_resource* upstream)
+	: blockSize_(AlignUp(std::max(blockSize, sizeof(FreeBlock)), std::max(blockAlignment, alignof(FreeBlock)))),
+	blockAlignment_(std::max(blockAlignment, alignof(FreeBlock))),
+	blocksPerChunk_(blocksPerChunk),
+	upstream_(upstream)
+{
+	assert(blocksPerChunk_ > 0);
+}
+
+FixedPool::~FixedPool()
+{
+	for (void* chunk : chunks_) {
+		upstream_->deallocate(chunk, blockSize_ * blocksPerChunk_, blockAlignment_);
+	}
+}
+
+void* FixedPool::Allocate()
+{
+	if (!freeList_) {
+		AllocateChunk();
+	}
+
+	FreeBlock* block = freeList_;
+	freeList_ = block->Next;
+	return block;
+}
+
+void FixedPool::Deallocate(void* block)
+{
+	FreeBlock* freeBlock = static_cast<FreeBlock*>(block);
+	freeBlock->Next = freeList_;
+	freeList_ = freeBlock;
+}
+
+void* FixedPool::do_allocate(std::size_t bytes, std::size_t alignment)
+{
+	if (bytes <= blockSize_ && alignment <= blockAlignment_) {
+		return Allocate();
+	}
+	return upstream_->allocate(bytes, alignment);
+}
+
+void FixedPool::do_deallocate(void* pointer, std::size_t bytes, std::size_t alignment)
+{
+	if (bytes <= blockSize_ && alignment <= blockAlignment_) {
+		Deallocate(pointer);
+	}
+	else {
+		upstream_->deallocate(pointer, bytes, alignment);
+	}
+}
+
+void FixedPool::AllocateChunk()
+{
+	std::byte* chunk = static_cast<std::byte*>(upstream_->allocate(blockSize_ * blocksPerChunk_, blockAlignment_));
+	chunks_.push_back(chunk);
+
+	for (std::size_t i = blocksPerChunk_; i > 0; --i) {
+		Deallocate(chunk + (i - 1) * blockSize_);
+	}
+}
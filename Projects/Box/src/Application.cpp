@@ -23,6 +23,8 @@ import <memory>;
 import <string>;
 
 import core;
+import core.memory;
+import diagnostics.latency;
 
 export class Application
 {
@@ -85,6 +87,8 @@ int Application::Run(Game* game)
 	ShowWindow(instance_->window_, SW_SHOWDEFAULT);
 	UpdateWindow(instance_->window_);
 
+	game->StartSimulation();
+
 	MSG msg = { 0 };
 	
 	while (msg.message != WM_QUIT) {
@@ -94,12 +98,16 @@ int Application::Run(Game* game)
 		}
 		else {
 			if (!game->IsPaused()) {
+				game->WaitForNextFrame();
+
 				// Start the Dear ImGui frame
 				ImGui_ImplDX11_NewFrame();
 				ImGui_ImplWin32_NewFrame();
 				ImGui::NewFrame();
 
-				game->Update();
+				if (!game->IsPipelined()) {
+					game->Update();
+				}
 				game->Render();
 				
 				// Render the Dear ImGui frame
@@ -109,7 +117,8 @@ int Application::Run(Game* game)
 				game->Present();
 			}
 			else {
-				Sleep(100);
+				// Nothing to do until a message resumes the game.
+				WaitMessage();
 			}
 		}
 	}
@@ -161,6 +170,16 @@ bool Application::InitInstance(Game* game)
 
 bool Application::InitImGui(Game* game)
 {
+	// Route ImGui allocations through operator new so they show up in memory accounting
+	ImGui::SetAllocatorFunctions(
+		[](size_t size, void*) -> void* {
+			MemoryTagScope memoryTag(MemoryTag::Interface);
+			return ::operator new(size);
+		},
+		[](void* pointer, void*) {
+			::operator delete(pointer);
+		});
+
 	// Setup Dear ImGui context
 	IMGUI_CHECKVERSION();
 	ImGui::CreateContext();
@@ -187,6 +206,20 @@ bool Application::InitImGui(Game* game)
 
 LRESULT CALLBACK Application::HandleMessage(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 {
+	// Stamp input before ImGui sees it, so latency covers input handled by the UI too.
+	switch (message) {
+	case WM_KEYDOWN:
+	case WM_SYSKEYDOWN:
+		LatencyTracker::Get().RecordInput(InputSource::Keyboard);
+		break;
+	case WM_LBUTTONDOWN:
+	case WM_RBUTTONDOWN:
+	case WM_MBUTTONDOWN:
+	case WM_MOUSEWHEEL:
+		LatencyTracker::Get().RecordInput(InputSource::Mouse);
+		break;
+	}
+
 	if (ImGui_ImplWin32_WndProcHandler(hWnd, message, wParam, lParam)) {
 		return true;
 	}
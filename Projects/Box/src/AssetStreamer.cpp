@@ -0,0 +1,374 @@
+module;
+// C
+#include <cstddef>
+#include <cstdint>
+
+export module resource.streaming;
+
+import <algorithm>;
+import <atomic>;
+import <chrono>;
+import <condition_variable>;
+import <coroutine>;
+import <exception>;
+import <functional>;
+import <mutex>;
+import <span>;
+import <stop_token>;
+import <thread>;
+import <vector>;
+
+import core.memory;
+import diagnostics.log;
+import resource.vfs;
+
+export enum class StreamPriority : std::uint8_t
+{
+	Low,
+	Normal,
+	High,
+	Critical,
+};
+
+// Return type for fire-and-forget loading coroutines. The coroutine starts
+// immediately and its frame is destroyed when it finishes. An exception
+// escaping the coroutine is logged and ends it, so whatever the coroutine
+// would have assigned afterwards is left as it was.
+export struct StreamTask
+{
+	struct promise_type
+	{
+		StreamTask get_return_object() noexcept { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() noexcept { }
+		void unhandled_exception() noexcept;
+	};
+};
+
+// Awaitables returned by AssetStreamer::Load/LoadAll. The awaiting coroutine
+// is resumed on the thread that calls AssetStreamer::ProcessCompletions.
+export class LoadAwaiter;
+export class BatchLoadAwaiter;
+
+export class AssetStreamer
+{
+public:
+	explicit AssetStreamer(const VirtualFileSystem& fileSystem, unsigned int ioThreadCount = 2);
+	// Loads not yet resumed are abandoned: coroutines waiting on them are
+	// destroyed without resuming, and their callbacks never run.
+	~AssetStreamer();
+
+	AssetStreamer(const AssetStreamer&) = delete;
+	AssetStreamer& operator=(const AssetStreamer&) = delete;
+
+	LoadAwaiter Load(AssetId id, StreamPriority priority = StreamPriority::Normal);
+	BatchLoadAwaiter LoadAll(std::span<const AssetId> ids, StreamPriority priority = StreamPriority::Normal);
+
+	// Callback flavour of Load. The callback runs on the main thread.
+	void Load(AssetId id, StreamPriority priority, std::function<void(AssetData)> onLoaded);
+
+	// Runs finished loads on the calling thread until the budget is used up.
+	// Whatever is left over is picked up by the next call.
+	void ProcessCompletions(std::chrono::microseconds budget);
+
+	std::size_t PendingCount() const { return pendingCount_.load(std::memory_order_relaxed); }
+
+	// True when no load is queued, being read or waiting for
+	// ProcessCompletions(). Call it on the thread that processes completions.
+	bool IsIdle();
+
+private:
+	friend class LoadAwaiter;
+	friend class BatchLoadAwaiter;
+
+	// Shared by every request of one co_await. The last request to finish
+	// schedules the continuation.
+	struct LoadGroup
+	{
+		std::atomic<std::size_t> Remaining = 0;
+		std::coroutine_handle<> Continuation;
+	};
+
+	struct Request
+	{
+		AssetId Id;
+		StreamPriority Priority;
+		std::uint64_t Sequence;
+		AssetData* Result = nullptr;
+		LoadGroup* Group = nullptr;
+		std::function<void(AssetData)> Callback;
+	};
+
+	struct Completion
+	{
+		std::coroutine_handle<> Continuation;
+		std::function<void(AssetData)> Callback;
+		AssetData Data;
+	};
+
+	static bool HasLowerPriority(const Request& a, const Request& b);
+
+	void Enqueue(AssetId id, StreamPriority priority, AssetData* result, LoadGroup* group);
+	void Enqueue(Request request);
+	void IoLoop(std::stop_token stopToken);
+	void Complete(Completion completion);
+
+private:
+	const VirtualFileSystem& fileSystem_;
+
+	// Pending requests, kept as a binary heap: highest priority first, then
+	// in submission order.
+	std::mutex requestMutex_;
+	std::condition_variable_any requestAvailable_;
+	std::vector<Request> requests_;
+	std::uint64_t nextSequence_ = 0;
+
+	std::mutex completionMutex_;
+	std::vector<Completion> completed_;
+
+	// Only touched by the thread calling ProcessCompletions.
+	std::vector<Completion> ready_;
+
+	std::atomic<std::size_t> pendingCount_ = 0;
+
+	std::vector<std::jthread> ioThreads_;
+};
+
+export class LoadAwaiter
+{
+public:
+	LoadAwaiter(AssetStreamer& streamer, AssetId id, StreamPriority priority)
+		: streamer_(streamer), id_(id), priority_(priority)
+	{
+	}
+
+	bool await_ready() const noexcept { return false; }
+
+	void await_suspend(std::coroutine_handle<> continuation)
+	{
+		group_.Remaining = 1;
+		group_.Continuation = continuation;
+		streamer_.Enqueue(id_, priority_, &result_, &group_);
+	}
+
+	AssetData await_resume() { return std::move(result_); }
+
+private:
+	AssetStreamer& streamer_;
+	AssetId id_;
+	StreamPriority priority_;
+	AssetData result_;
+	AssetStreamer::LoadGroup group_;
+};
+
+export class BatchLoadAwaiter
+{
+public:
+	BatchLoadAwaiter(AssetStreamer& streamer, std::span<const AssetId> ids, StreamPriority priority)
+		: streamer_(streamer), ids_(ids), priority_(priority)
+	{
+	}
+
+	bool await_ready() const noexcept { return ids_.empty(); }
+
+	void await_suspend(std::coroutine_handle<> continuation)
+	{
+		results_.resize(ids_.size());
+		group_.Remaining = ids_.size();
+		group_.Continuation = continuation;
+		for (std::size_t i = 0; i < ids_.size(); ++i) {
+			streamer_.Enqueue(ids_[i], priority_, &results_[i], &group_);
+		}
+	}
+
+	std::vector<AssetData> await_resume() { return std::move(results_); }
+
+private:
+	AssetStreamer& streamer_;
+	std::span<const AssetId> ids_;
+	StreamPriority priority_;
+	std::vector<AssetData> results_;
+	AssetStreamer::LoadGroup group_;
+};
+
+module :private;
+
+void StreamTask::promise_type::unhandled_exception() noexcept
+{
+	try {
+		throw;
+	}
+	catch (const std::exception& exception) {
+		LogError(LogCategory::Resource, "Loading task failed: {}", exception.what());
+	}
+	catch (...) {
+		LogError(LogCategory::Resource, "Loading task failed");
+	}
+}
+
+AssetStreamer::AssetStreamer(const VirtualFileSystem& fileSystem, unsigned int ioThreadCount)
+	: fileSystem_(fileSystem)
+{
+	ioThreads_.reserve(ioThreadCount);
+	for (unsigned int i = 0; i < ioThreadCount; ++i) {
+		ioThreads_.emplace_back([this](std::stop_token stopToken) { IoLoop(stopToken); });
+	}
+}
+
+AssetStreamer::~AssetStreamer()
+{
+	for (auto& thread : ioThreads_) {
+		thread.request_stop();
+	}
+	ioThreads_.clear();
+
+	// The awaiters and groups requests point into live in the coroutine
+	// frames, so every handle is taken before any frame is destroyed. The
+	// requests of a batch share one.
+	std::vector<std::coroutine_handle<>> abandoned;
+	for (const Request& request : requests_) {
+		if (request.Group) {
+			abandoned.push_back(request.Group->Continuation);
+		}
+	}
+	for (const std::vector<Completion>* completions : { &completed_, &ready_ }) {
+		for (const Completion& completion : *completions) {
+			if (completion.Continuation) {
+				abandoned.push_back(completion.Continuation);
+			}
+		}
+	}
+	std::ranges::sort(abandoned, {}, [](std::coroutine_handle<> handle) { return handle.address(); });
+	abandoned.erase(std::ranges::unique(abandoned).begin(), abandoned.end());
+
+	requests_.clear();
+	completed_.clear();
+	ready_.clear();
+	for (std::coroutine_handle<> continuation : abandoned) {
+		continuation.destroy();
+	}
+}
+
+LoadAwaiter AssetStreamer::Load(AssetId id, StreamPriority priority)
+{
+	return LoadAwaiter(*this, id, priority);
+}
+
+BatchLoadAwaiter AssetStreamer::LoadAll(std::span<const AssetId> ids, StreamPriority priority)
+{
+	return BatchLoadAwaiter(*this, ids, priority);
+}
+
+void AssetStreamer::Load(AssetId id, StreamPriority priority, std::function<void(AssetData)> onLoaded)
+{
+	Request request{ .Id = id, .Priority = priority };
+	request.Callback = std::move(onLoaded);
+	Enqueue(std::move(request));
+}
+
+void AssetStreamer::ProcessCompletions(std::chrono::microseconds budget)
+{
+	{
+		std::lock_guard<std::mutex> lock(completionMutex_);
+		for (Completion& completion : completed_) {
+			ready_.push_back(std::move(completion));
+		}
+		completed_.clear();
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	std::size_t processed = 0;
+	while (processed < ready_.size()) {
+		Completion completion = std::move(ready_[processed++]);
+		if (completion.Continuation) {
+			completion.Continuation.resume();
+		}
+		else {
+			completion.Callback(std::move(completion.Data));
+		}
+
+		if (std::chrono::steady_clock::now() - start >= budget) {
+			break;
+		}
+	}
+	ready_.erase(ready_.begin(), ready_.begin() + processed);
+}
+
+bool AssetStreamer::HasLowerPriority(const Request& a, const Request& b)
+{
+	if (a.Priority != b.Priority) {
+		return a.Priority < b.Priority;
+	}
+	return a.Sequence > b.Sequence;
+}
+
+void AssetStreamer::Enqueue(AssetId id, StreamPriority priority, AssetData* result, LoadGroup* group)
+{
+	Enqueue(Request{ .Id = id, .Priority = priority, .Result = result, .Group = group });
+}
+
+void AssetStreamer::Enqueue(Request request)
+{
+	pendingCount_.fetch_add(1, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lock(requestMutex_);
+		request.Sequence = nextSequence_++;
+		requests_.push_back(std::move(request));
+		std::push_heap(requests_.begin(), requests_.end(), HasLowerPriority);
+	}
+	requestAvailable_.notify_one();
+}
+
+void AssetStreamer::IoLoop(std::stop_token stopToken)
+{
+	MemoryTagScope memoryTag(MemoryTag::Streaming);
+
+	// Stops with requests still queued, which the destructor abandons.
+	while (!stopToken.stop_requested()) {
+		Request request;
+		{
+			std::unique_lock<std::mutex> lock(requestMutex_);
+			if (!requestAvailable_.wait(lock, stopToken, [this] { return !requests_.empty(); })) {
+				return;
+			}
+			std::pop_heap(requests_.begin(), requests_.end(), HasLowerPriority);
+			request = std::move(requests_.back());
+			requests_.pop_back();
+		}
+
+		// Reading also decompresses, so several I/O threads keep both the
+		// disk and the decompressor busy.
+		AssetData data = fileSystem_.Read(request.Id);
+
+		if (request.Group) {
+			*request.Result = std::move(data);
+			if (request.Group->Remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+				Complete(Completion{ .Continuation = request.Group->Continuation });
+			}
+		}
+		else {
+			Complete(Completion{ .Callback = std::move(request.Callback), .Data = std::move(data) });
+		}
+
+		// Only after the completion is queued, so IsIdle() never sees a load
+		// that is neither pending nor completed.
+		pendingCount_.fetch_sub(1, std::memory_order_release);
+	}
+}
+
+bool AssetStreamer::IsIdle()
+{
+	if (pendingCount_.load(std::memory_order_acquire) > 0 || !ready_.empty()) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(completionMutex_);
+	return completed_.empty();
+}
+
+void AssetStreamer::Complete(Completion completion)
+{
+	std::lock_guard<std::mutex> lock(completionMutex_);
+	completed_.push_back(std::move(completion));
+}
@@ -0,0 +1,599 @@
+module;
+// C
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+// Windows
+#include <d3d11.h>
+
+// ImGui
+#include "imgui.h"
+
+export module diagnostics.benchmark;
+
+import <algorithm>;
+import <charconv>;
+import <chrono>;
+import <filesystem>;
+import <format>;
+import <fstream>;
+import <iostream>;
+import <limits>;
+import <sstream>;
+import <string>;
+import <string_view>;
+import <vector>;
+
+import core;
+import diagnostics.golden;
+import diagnostics.gpu;
+import diagnostics.render;
+import render.context;
+
+// Command line of a headless benchmark run:
+//
+//   --benchmark                 run headless instead of opening a window
+//   --frames=N --warmup=N       measured frames and unmeasured frames before them
+//   --objects=N                 demo specific scene size
+//   --resolution=WxH            back buffer size
+//   --threads=N                 worker threads of the default thread pool
+//   --driver=null|warp|hardware null draws nothing and needs no GPU
+//   --csv=PATH                  per frame times
+//   --json=PATH                 summary metrics
+//   --baseline=PATH             fail if a metric regressed against this summary
+//   --threshold=PERCENT         allowed regression, 5 by default
+//   --max-frame-allocations=N   fail if a measured frame calls operator new more
+//                               often, 0 checks for allocation-free frames
+//   --compare=PATH              compare PATH against the baseline without running
+//   --microbenchmarks[=FILTER]  run the microbenchmarks whose name contains FILTER
+//   --replay=PATH               measure the frames of a recorded session instead
+//                               of --frames, implies --benchmark
+//   --capture=PATH              capture the last measured frame, see Game::CaptureFrame()
+//   --play-capture=PATH         replay a capture --frames times without the game
+//   --capture-target=d3d|cpu    replay on a --driver device or on the CPU only
+//   --screenshot=PATH           write the last frame to a PNG
+//   --video=PATH                write the measured frames to a Y4M video
+//   --gpu-profile=PATH          write the GPU times of the passes as JSON, see GpuProfiler
+//   --golden=DIR                render the captures in DIR on the --capture-target
+//                               and compare them with their golden images, see
+//                               RunGoldenTest()
+//   --golden-images=DIR         compare the PNGs in DIR with the goldens instead
+//   --update-golden             write the new images as the goldens
+//   --pixel-tolerance=N         largest channel difference that counts as equal
+//   --different-pixels=PERCENT  share of pixels that may differ by more
+//   --min-ssim=X                lowest mean SSIM of the luma
+export struct BenchmarkOptions
+{
+	bool Enabled = false;
+	int Frames = 1000;
+	int WarmupFrames = 100;
+	int Objects = 0;
+	int Width = 1280;
+	int Height = 720;
+	unsigned int Threads = 0;
+	D3D_DRIVER_TYPE Driver = D3D_DRIVER_TYPE_NULL;
+
+	std::filesystem::path CsvPath;
+	std::filesystem::path JsonPath;
+	std::filesystem::path BaselinePath;
+	std::filesystem::path ComparePath;
+	std::filesystem::path ReplayPath;
+	std::filesystem::path CapturePath;
+	std::filesystem::path PlayCapturePath;
+	bool CaptureOnCpu = false;
+	std::filesystem::path ScreenshotPath;
+	std::filesystem::path VideoPath;
+	std::filesystem::path GpuProfilePath;
+	double Threshold = 5.0;
+	// Negative when not checked.
+	std::int64_t MaxFrameAllocations = -1;
+
+	std::filesystem::path GoldenPath;
+	std::filesystem::path GoldenImagesPath;
+	bool UpdateGolden = false;
+	ImageTolerance Tolerance;
+
+	bool Microbenchmarks = false;
+	std::string MicrobenchmarkFilter;
+
+	// Picks the benchmark options out of the command line and leaves the rest.
+	// Returns false if one of them is malformed.
+	bool Parse(int argc, char* argv[]);
+};
+
+export struct BenchmarkMetric
+{
+	std::string Name;
+	double Value = 0.0;
+};
+
+// Frame times of a run and the metrics derived from them. Every metric but
+// the frame count is lower-is-better. Frames added with render statistics
+// also report their per-frame means.
+export class BenchmarkReport
+{
+public:
+	void AddFrame(double milliseconds, std::uint64_t heapAllocations);
+	void AddFrame(double milliseconds, std::uint64_t heapAllocations, const RenderStatistics& render);
+	std::vector<BenchmarkMetric> Summarize() const;
+	// Most heap allocations of a single frame.
+	std::uint64_t MaxHeapAllocations() const;
+
+	bool WriteCsv(const std::filesystem::path& path) const;
+
+	static bool WriteJson(const std::filesystem::path& path, const std::vector<BenchmarkMetric>& metrics);
+	static bool ReadJson(const std::filesystem::path& path, std::vector<BenchmarkMetric>& metrics);
+
+	// Prints both side by side. Returns false if a metric of current is worse
+	// than in baseline by more than threshold percent.
+	static bool Compare(const std::vector<BenchmarkMetric>& baseline, const std::vector<BenchmarkMetric>& current, double threshold);
+
+private:
+	struct Frame
+	{
+		double Milliseconds;
+		std::uint64_t HeapAllocations;
+		RenderStatistics Render;
+	};
+
+	std::vector<Frame> frames_;
+	bool renderStatistics_ = false;
+};
+
+export class Benchmark
+{
+public:
+	// Runs the game headless for the configured frames, writes the requested
+	// reports and returns the process exit code. A replay first runs the
+	// warm-up frames and then until streaming is idle, so every replayed frame
+	// sees the same loaded assets, and measures one frame per recorded frame.
+	static int Run(Game& game, const BenchmarkOptions& options);
+
+	// Writes, prints and compares metrics as a run would. For runs that do
+	// not go through Run(), such as the microbenchmarks.
+	static int Report(const std::vector<BenchmarkMetric>& metrics, const BenchmarkOptions& options);
+};
+
+module :private;
+
+namespace
+{
+	template <typename T>
+	bool ParseNumber(std::string_view text, T& value)
+	{
+		auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+		return error == std::errc() && end == text.data() + text.size();
+	}
+
+	std::string_view OptionValue(std::string_view argument)
+	{
+		return argument.substr(argument.find('=') + 1);
+	}
+}
+
+bool BenchmarkOptions::Parse(int argc, char* argv[])
+{
+	bool valid = true;
+	for (int i = 1; i < argc; ++i) {
+		std::string_view argument = argv[i];
+		std::string_view value = OptionValue(argument);
+
+		if (argument == "--benchmark") {
+			Enabled = true;
+		}
+		else if (argument.starts_with("--frames=")) {
+			valid &= ParseNumber(value, Frames) && Frames > 0;
+		}
+		else if (argument.starts_with("--warmup=")) {
+			valid &= ParseNumber(value, WarmupFrames) && WarmupFrames >= 0;
+		}
+		else if (argument.starts_with("--objects=")) {
+			valid &= ParseNumber(value, Objects) && Objects > 0;
+		}
+		else if (argument.starts_with("--resolution=")) {
+			std::size_t separator = value.find('x');
+			valid &= separator != std::string_view::npos &&
+				ParseNumber(value.substr(0, separator), Width) && Width > 0 &&
+				ParseNumber(value.substr(separator + 1), Height) && Height > 0;
+		}
+		else if (argument.starts_with("--threads=")) {
+			valid &= ParseNumber(value, Threads) && Threads > 0;
+		}
+		else if (argument.starts_with("--driver=")) {
+			if (value == "null") {
+				Driver = D3D_DRIVER_TYPE_NULL;
+			}
+			else if (value == "warp") {
+				Driver = D3D_DRIVER_TYPE_WARP;
+			}
+			else if (value == "hardware") {
+				Driver = D3D_DRIVER_TYPE_HARDWARE;
+			}
+			else {
+				valid = false;
+			}
+		}
+		else if (argument.starts_with("--csv=")) {
+			CsvPath = value;
+		}
+		else if (argument.starts_with("--json=")) {
+			JsonPath = value;
+		}
+		else if (argument.starts_with("--baseline=")) {
+			BaselinePath = value;
+		}
+		else if (argument.starts_with("--threshold=")) {
+			valid &= ParseNumber(value, Threshold) && Threshold >= 0.0;
+		}
+		else if (argument.starts_with("--max-frame-allocations=")) {
+			valid &= ParseNumber(value, MaxFrameAllocations) && MaxFrameAllocations >= 0;
+		}
+		else if (argument.starts_with("--compare=")) {
+			ComparePath = value;
+		}
+		else if (argument.starts_with("--replay=")) {
+			Enabled = true;
+			ReplayPath = value;
+		}
+		else if (argument.starts_with("--capture=")) {
+			CapturePath = value;
+		}
+		else if (argument.starts_with("--play-capture=")) {
+			PlayCapturePath = value;
+		}
+		else if (argument.starts_with("--capture-target=")) {
+			valid &= value == "d3d" || value == "cpu";
+			CaptureOnCpu = value == "cpu";
+		}
+		else if (argument.starts_with("--screenshot=")) {
+			ScreenshotPath = value;
+		}
+		else if (argument.starts_with("--video=")) {
+			VideoPath = value;
+		}
+		else if (argument.starts_with("--gpu-profile=")) {
+			GpuProfilePath = value;
+		}
+		else if (argument.starts_with("--golden=")) {
+			GoldenPath = value;
+		}
+		else if (argument.starts_with("--golden-images=")) {
+			GoldenImagesPath = value;
+		}
+		else if (argument == "--update-golden") {
+			UpdateGolden = true;
+		}
+		else if (argument.starts_with("--pixel-tolerance=")) {
+			valid &= ParseNumber(value, Tolerance.Channel) && Tolerance.Channel >= 0 && Tolerance.Channel < 255;
+		}
+		else if (argument.starts_with("--different-pixels=")) {
+			valid &= ParseNumber(value, Tolerance.DifferentPixels) && Tolerance.DifferentPixels >= 0.0;
+		}
+		else if (argument.starts_with("--min-ssim=")) {
+			valid &= ParseNumber(value, Tolerance.Ssim) && Tolerance.Ssim <= 1.0;
+		}
+		else if (argument == "--microbenchmarks") {
+			Microbenchmarks = true;
+		}
+		else if (argument.starts_with("--microbenchmarks=")) {
+			Microbenchmarks = true;
+			MicrobenchmarkFilter = value;
+		}
+		else {
+			continue;
+		}
+
+		if (!valid) {
+			std::cerr << "Invalid benchmark option " << argument << "\n";
+			return false;
+		}
+	}
+
+	if (!ComparePath.empty() && BaselinePath.empty()) {
+		std::cerr << "--compare needs a --baseline\n";
+		return false;
+	}
+	if (!GoldenImagesPath.empty() && GoldenPath.empty()) {
+		std::cerr << "--golden-images needs a --golden\n";
+		return false;
+	}
+	return true;
+}
+
+void BenchmarkReport::AddFrame(double milliseconds, std::uint64_t heapAllocations)
+{
+	frames_.push_back({ milliseconds, heapAllocations });
+}
+
+void BenchmarkReport::AddFrame(double milliseconds, std::uint64_t heapAllocations, const RenderStatistics& render)
+{
+	frames_.push_back({ milliseconds, heapAllocations, render });
+	renderStatistics_ = true;
+}
+
+std::uint64_t BenchmarkReport::MaxHeapAllocations() const
+{
+	std::uint64_t allocations = 0;
+	for (const Frame& frame : frames_) {
+		allocations = std::max(allocations, frame.HeapAllocations);
+	}
+	return allocations;
+}
+
+std::vector<BenchmarkMetric> BenchmarkReport::Summarize() const
+{
+	std::vector<BenchmarkMetric> metrics;
+	metrics.push_back({ "frames", static_cast<double>(frames_.size()) });
+	if (frames_.empty()) {
+		return metrics;
+	}
+
+	std::vector<double> times;
+	times.reserve(frames_.size());
+	double totalTime = 0.0;
+	double totalAllocations = 0.0;
+	for (const Frame& frame : frames_) {
+		times.push_back(frame.Milliseconds);
+		totalTime += frame.Milliseconds;
+		totalAllocations += static_cast<double>(frame.HeapAllocations);
+	}
+	std::sort(times.begin(), times.end());
+
+	auto percentile = [&](double p) { return times[static_cast<std::size_t>(p * (times.size() - 1) + 0.5)]; };
+	metrics.push_back({ "frame_ms_mean", totalTime / times.size() });
+	metrics.push_back({ "frame_ms_min", times.front() });
+	metrics.push_back({ "frame_ms_p50", percentile(0.5) });
+	metrics.push_back({ "frame_ms_p90", percentile(0.9) });
+	metrics.push_back({ "frame_ms_p95", percentile(0.95) });
+	metrics.push_back({ "frame_ms_p99", percentile(0.99) });
+	metrics.push_back({ "frame_ms_max", times.back() });
+	metrics.push_back({ "heap_allocations_per_frame", totalAllocations / times.size() });
+
+	if (renderStatistics_) {
+		auto mean = [&](std::uint64_t RenderStatistics::* counter) {
+			double total = 0.0;
+			for (const Frame& frame : frames_) {
+				total += static_cast<double>(frame.Render.*counter);
+			}
+			return total / frames_.size();
+		};
+		metrics.push_back({ "draw_calls_per_frame", mean(&RenderStatistics::DrawCalls) });
+		metrics.push_back({ "instances_per_frame", mean(&RenderStatistics::Instances) });
+		metrics.push_back({ "primitives_per_frame", mean(&RenderStatistics::Primitives) });
+		metrics.push_back({ "state_changes_per_frame", mean(&RenderStatistics::StateChanges) });
+		metrics.push_back({ "constant_buffer_bytes_per_frame", mean(&RenderStatistics::ConstantBufferBytes) });
+		metrics.push_back({ "buffer_bytes_per_frame", mean(&RenderStatistics::BufferBytes) });
+		metrics.push_back({ "maps_per_frame", mean(&RenderStatistics::Maps) });
+		metrics.push_back({ "unmaps_per_frame", mean(&RenderStatistics::Unmaps) });
+		metrics.push_back({ "resources_created_per_frame", mean(&RenderStatistics::ResourcesCreated) });
+	}
+	return metrics;
+}
+
+bool BenchmarkReport::WriteCsv(const std::filesystem::path& path) const
+{
+	std::ofstream file(path, std::ios::trunc);
+	if (!file) {
+		std::cerr << "Failed to open benchmark csv " << path << "\n";
+		return false;
+	}
+
+	file << "frame,frame_ms,heap_allocations";
+	if (renderStatistics_) {
+		file << ",draw_calls,instances,primitives,state_changes,constant_buffer_bytes,buffer_bytes,maps,unmaps,resources_created";
+	}
+	file << "\n";
+
+	for (std::size_t i = 0; i < frames_.size(); ++i) {
+		const Frame& frame = frames_[i];
+		file << std::format("{},{:.4f},{}", i, frame.Milliseconds, frame.HeapAllocations);
+		if (renderStatistics_) {
+			const RenderStatistics& render = frame.Render;
+			file << std::format(",{},{},{},{},{},{},{},{},{}", render.DrawCalls, render.Instances, render.Primitives, render.StateChanges,
+				render.ConstantBufferBytes, render.BufferBytes, render.Maps, render.Unmaps, render.ResourcesCreated);
+		}
+		file << "\n";
+	}
+	return true;
+}
+
+bool BenchmarkReport::WriteJson(const std::filesystem::path& path, const std::vector<BenchmarkMetric>& metrics)
+{
+	std::ofstream file(path, std::ios::trunc);
+	if (!file) {
+		std::cerr << "Failed to open benchmark json " << path << "\n";
+		return false;
+	}
+
+	file << "{\n";
+	for (std::size_t i = 0; i < metrics.size(); ++i) {
+		file << std::format("  \"{}\": {:.6g}{}\n", metrics[i].Name, metrics[i].Value, i + 1 < metrics.size() ? "," : "");
+	}
+	file << "}\n";
+	return true;
+}
+
+bool BenchmarkReport::ReadJson(const std::filesystem::path& path, std::vector<BenchmarkMetric>& metrics)
+{
+	std::ifstream file(path);
+	if (!file) {
+		std::cerr << "Failed to open benchmark json " << path << "\n";
+		return false;
+	}
+
+	std::stringstream stream;
+	stream << file.rdbuf();
+	std::string text = stream.str();
+
+	// Only reads what WriteJson() writes: one flat object of numbers.
+	metrics.clear();
+	std::size_t position = 0;
+	while ((position = text.find('"', position)) != std::string::npos) {
+		std::size_t nameEnd = text.find('"', position + 1);
+		std::size_t colon = text.find(':', nameEnd);
+		if (nameEnd == std::string::npos || colon == std::string::npos) {
+			break;
+		}
+
+		std::size_t valueBegin = text.find_first_not_of(" \t\r\n", colon + 1);
+		std::size_t valueEnd = text.find_first_of(",}\r\n", valueBegin);
+		BenchmarkMetric& metric = metrics.emplace_back();
+		metric.Name = text.substr(position + 1, nameEnd - position - 1);
+		if (valueBegin == std::string::npos || !ParseNumber(std::string_view(text).substr(valueBegin, valueEnd - valueBegin), metric.Value)) {
+			std::cerr << "Malformed benchmark json " << path << "\n";
+			return false;
+		}
+		position = valueEnd;
+	}
+	return true;
+}
+
+bool BenchmarkReport::Compare(const std::vector<BenchmarkMetric>& baseline, const std::vector<BenchmarkMetric>& current, double threshold)
+{
+	bool passed = true;
+	std::cout << std::format("{:<40} {:>12} {:>12} {:>9}\n", "metric", "baseline", "current", "change");
+	for (const BenchmarkMetric& metric : current) {
+		auto reference = std::find_if(baseline.begin(), baseline.end(), [&](const BenchmarkMetric& other) { return other.Name == metric.Name; });
+		if (reference == baseline.end() || metric.Name == "frames") {
+			continue;
+		}
+
+		// Any increase over a zero baseline, e.g. of a count, is a regression.
+		double change = 0.0;
+		if (reference->Value != 0.0) {
+			change = (metric.Value - reference->Value) / reference->Value * 100.0;
+		}
+		else if (metric.Value != 0.0) {
+			change = metric.Value > 0.0 ? std::numeric_limits<double>::infinity() : -std::numeric_limits<double>::infinity();
+		}
+		bool regressed = change > threshold;
+		passed &= !regressed;
+		std::cout << std::format("{:<40} {:>12.4f} {:>12.4f} {:>+8.1f}%{}\n", metric.Name, reference->Value, metric.Value, change, regressed ? "  REGRESSED" : "");
+	}
+	return passed;
+}
+
+int Benchmark::Run(Game& game, const BenchmarkOptions& options)
+{
+	// ImGui without platform and renderer backends: the demos still build
+	// their panels every frame, but nothing is drawn.
+	IMGUI_CHECKVERSION();
+	ImGui::CreateContext();
+	ImGuiIO& io = ImGui::GetIO();
+	io.IniFilename = nullptr;
+	io.DisplaySize = ImVec2(static_cast<float>(game.ScreenWidth()), static_cast<float>(game.ScreenHeight()));
+	unsigned char* fontPixels;
+	int fontWidth, fontHeight;
+	io.Fonts->GetTexDataAsRGBA32(&fontPixels, &fontWidth, &fontHeight);
+
+	if (!game.Startup(nullptr)) {
+		ImGui::DestroyContext();
+		return EXIT_FAILURE;
+	}
+
+	bool replay = !options.ReplayPath.empty();
+	if (replay && game.IsPipelined()) {
+		std::cerr << "Replays can not be pipelined\n";
+		game.Shutdown();
+		ImGui::DestroyContext();
+		return EXIT_FAILURE;
+	}
+
+	game.StartSimulation();
+	if (!options.VideoPath.empty() && !game.Readback().StartVideo(options.VideoPath)) {
+		game.Shutdown();
+		ImGui::DestroyContext();
+		return EXIT_FAILURE;
+	}
+
+	BenchmarkReport report;
+	std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+	for (int frame = 0; ; ++frame) {
+		if (replay) {
+			if (game.IsReplaying()) {
+				if (game.IsReplayFinished()) {
+					break;
+				}
+			}
+			else if (frame >= options.WarmupFrames && game.Streamer().IsIdle()) {
+				if (!game.StartReplay(options.ReplayPath)) {
+					game.Shutdown();
+					ImGui::DestroyContext();
+					return EXIT_FAILURE;
+				}
+				frameStart = std::chrono::steady_clock::now();
+				continue;
+			}
+		}
+		else if (frame == options.WarmupFrames + options.Frames) {
+			break;
+		}
+
+		game.WaitForNextFrame();
+
+		bool lastFrame = replay ? game.ReplayFramesPlayed() + 1 == game.ReplayFrameCount() : frame + 1 == options.WarmupFrames + options.Frames;
+		if (lastFrame && !options.CapturePath.empty()) {
+			game.CaptureFrame(options.CapturePath);
+		}
+		if (lastFrame && !options.ScreenshotPath.empty()) {
+			game.Readback().Screenshot(options.ScreenshotPath);
+		}
+
+		io.DeltaTime = 1.0f / 60.0f;
+		ImGui::NewFrame();
+
+		if (!game.IsPipelined()) {
+			game.Update();
+		}
+		game.Render();
+
+		ImGui::Render();
+		game.Present();
+
+		std::chrono::steady_clock::time_point frameEnd = std::chrono::steady_clock::now();
+		if (replay ? game.IsReplaying() : frame >= options.WarmupFrames) {
+			report.AddFrame(std::chrono::duration<double, std::milli>(frameEnd - frameStart).count(), game.HeapAllocationsLastFrame(),
+				RenderStatisticsTracker::Get().LastFrame());
+		}
+		frameStart = frameEnd;
+	}
+
+	bool profiled = options.GpuProfilePath.empty() || game.Profiler().DumpJson(options.GpuProfilePath);
+	game.Shutdown();
+	ImGui::DestroyContext();
+
+	if (!profiled) {
+		return EXIT_FAILURE;
+	}
+	if (!options.CsvPath.empty() && !report.WriteCsv(options.CsvPath)) {
+		return EXIT_FAILURE;
+	}
+
+	int result = Report(report.Summarize(), options);
+	if (options.MaxFrameAllocations >= 0 && report.MaxHeapAllocations() > static_cast<std::uint64_t>(options.MaxFrameAllocations)) {
+		std::cerr << std::format("A frame allocated {} times, more than the allowed {}\n", report.MaxHeapAllocations(), options.MaxFrameAllocations);
+		result = EXIT_FAILURE;
+	}
+	return result;
+}
+
+int Benchmark::Report(const std::vector<BenchmarkMetric>& metrics, const BenchmarkOptions& options)
+{
+	if (!options.JsonPath.empty() && !BenchmarkReport::WriteJson(options.JsonPath, metrics)) {
+		return EXIT_FAILURE;
+	}
+
+	if (options.BaselinePath.empty()) {
+		for (const BenchmarkMetric& metric : metrics) {
+			std::cout << std::format("{:<40} {:>12.4f}\n", metric.Name, metric.Value);
+		}
+		return EXIT_SUCCESS;
+	}
+
+	std::vector<BenchmarkMetric> baseline;
+	if (!BenchmarkReport::ReadJson(options.BaselinePath, baseline)) {
+		return EXIT_FAILURE;
+	}
+	return BenchmarkReport::Compare(baseline, metrics, options.Threshold) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
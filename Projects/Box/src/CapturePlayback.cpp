@@ -0,0 +1,223 @@
+module;
+// C
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+export module diagnostics.playback;
+
+import <algorithm>;
+import <chrono>;
+import <filesystem>;
+import <format>;
+import <iostream>;
+import <memory>;
+import <mutex>;
+import <string>;
+import <vector>;
+
+import core.threading;
+import diagnostics.benchmark;
+import diagnostics.golden;
+import render.capture;
+import render.context;
+import render.software;
+import resource.png;
+
+// Replays --play-capture for the warm-up and measured frames and reports
+// frame times and the mean time of every command per frame.
+export int RunCapturePlayback(const BenchmarkOptions& options);
+
+// Renders every capture in --golden, DIR/NAME.gcap, on the software
+// rasterizer with --capture-target=cpu or on a --driver device, and
+// compares it with DIR/NAME.cpu.png or DIR/NAME.d3d.png. DIR/NAME.mask.png
+// is its tolerance mask if there is one. Failures write the difference to
+// DIR/NAME.cpu.diff.png or DIR/NAME.d3d.diff.png. With --golden-images,
+// DIR/NAME.png is compared with the golden NAME.png instead and the
+// difference written next to it. Images are compared in parallel.
+export int RunGoldenTest(const BenchmarkOptions& options);
+
+module :private;
+
+namespace
+{
+	// Renders the single frame of a capture. The device target is shared by
+	// every worker.
+	bool RenderCapture(const std::filesystem::path& path, D3D11CaptureTarget* device, std::mutex& deviceMutex, PngImage& image)
+	{
+		CaptureFile capture;
+		if (!capture.Load(path)) {
+			return false;
+		}
+
+		CaptureTimings timings;
+		image.Width = static_cast<int>(std::max(capture.Width(), 1u));
+		image.Height = static_cast<int>(std::max(capture.Height(), 1u));
+		if (!device) {
+			SoftwareCaptureTarget target;
+			target.Load(capture);
+			PlayCapture(capture, target, timings);
+			image.Rgba = target.Pixels();
+			return true;
+		}
+
+		std::lock_guard<std::mutex> lock(deviceMutex);
+		if (!device->Load(capture)) {
+			return false;
+		}
+		PlayCapture(capture, *device, timings);
+		return device->ReadPixels(image.Rgba);
+	}
+
+	bool WriteImage(const std::filesystem::path& path, const PngImage& image)
+	{
+		std::vector<std::uint8_t> rgb(std::size_t(image.Width) * image.Height * 3);
+		ConvertRgbaToRgb(image.Rgba.data(), rgb.data(), std::size_t(image.Width) * image.Height, false);
+		return WritePng(path, rgb.data(), image.Width, image.Height);
+	}
+}
+
+int RunCapturePlayback(const BenchmarkOptions& options)
+{
+	CaptureFile capture;
+	if (!capture.Load(options.PlayCapturePath)) {
+		return EXIT_FAILURE;
+	}
+
+	std::unique_ptr<CaptureTarget> target;
+	if (options.CaptureOnCpu) {
+		target = std::make_unique<CpuCaptureTarget>();
+	}
+	else {
+		target = std::make_unique<D3D11CaptureTarget>(options.Driver);
+	}
+	if (!target->Load(capture)) {
+		return EXIT_FAILURE;
+	}
+
+	BenchmarkReport report;
+	CaptureTimings timings;
+	for (int frame = 0; frame < options.WarmupFrames + options.Frames; ++frame) {
+		// Only the measured frames count towards the command times.
+		if (frame == options.WarmupFrames) {
+			timings = CaptureTimings();
+		}
+		double seconds = PlayCapture(capture, *target, timings);
+		if (frame >= options.WarmupFrames) {
+			report.AddFrame(seconds * 1000.0, 0);
+		}
+	}
+
+	if (!options.CsvPath.empty() && !report.WriteCsv(options.CsvPath)) {
+		return EXIT_FAILURE;
+	}
+
+	std::vector<BenchmarkMetric> metrics = report.Summarize();
+	double frames = static_cast<double>(std::max<std::uint64_t>(timings.Frames, 1));
+	for (std::size_t command = 0; command < timings.Commands.size(); ++command) {
+		const CaptureTimings::Command& timing = timings.Commands[command];
+		if (timing.Count > 0) {
+			metrics.push_back({ std::format("{}_us_per_frame", CaptureCommandName(static_cast<CaptureCommand>(command))), timing.Seconds * 1e6 / frames });
+		}
+	}
+	metrics.push_back({ "EndFrame_us_per_frame", timings.EndFrame.Seconds * 1e6 / frames });
+
+	if (auto* cpuTarget = dynamic_cast<CpuCaptureTarget*>(target.get())) {
+		double playedFrames = static_cast<double>(options.WarmupFrames + options.Frames);
+		metrics.push_back({ "invalid_draws_per_frame", cpuTarget->GetStatistics().InvalidDraws / playedFrames });
+	}
+	return Benchmark::Report(metrics, options);
+}
+
+int RunGoldenTest(const BenchmarkOptions& options)
+{
+	using Clock = std::chrono::steady_clock;
+	Clock::time_point start = Clock::now();
+
+	// Either captures to render or images rendered elsewhere. Masks and
+	// earlier differences next to them are not inputs.
+	bool rendering = options.GoldenImagesPath.empty();
+	std::filesystem::path directory = rendering ? options.GoldenPath : options.GoldenImagesPath;
+	std::vector<std::filesystem::path> inputs;
+	std::error_code error;
+	for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(directory, error)) {
+		std::filesystem::path path = entry.path();
+		std::filesystem::path secondExtension = path.stem().extension();
+		if (path.extension() == (rendering ? ".gcap" : ".png") && secondExtension != ".mask" && secondExtension != ".diff") {
+			inputs.push_back(path);
+		}
+	}
+	if (error || inputs.empty()) {
+		std::cerr << "Nothing to compare in " << directory << "\n";
+		return EXIT_FAILURE;
+	}
+	std::sort(inputs.begin(), inputs.end());
+
+	std::string target = options.CaptureOnCpu ? "cpu" : "d3d";
+	std::unique_ptr<D3D11CaptureTarget> device;
+	std::mutex deviceMutex;
+	if (rendering && !options.CaptureOnCpu) {
+		device = std::make_unique<D3D11CaptureTarget>(options.Driver);
+	}
+
+	// Every worker loads, renders and compares one image at a time, so only
+	// as many images as there are workers are in memory at once.
+	std::vector<std::string> failures(inputs.size());
+	ThreadPool::Default()->ParallelFor(inputs.size(), [&](std::size_t i) {
+		std::string name = inputs[i].stem().string();
+		std::filesystem::path golden = options.GoldenPath / (rendering ? name + "." + target + ".png" : name + ".png");
+		std::filesystem::path maskPath = options.GoldenPath / (name + ".mask.png");
+		std::filesystem::path diff = rendering ? options.GoldenPath / (name + "." + target + ".diff.png") : directory / (name + ".diff.png");
+
+		PngImage actual;
+		if (rendering ? !RenderCapture(inputs[i], device.get(), deviceMutex, actual) : !ReadPng(inputs[i], actual)) {
+			failures[i] = std::format("{}: could not be {}", name, rendering ? "rendered" : "read");
+			return;
+		}
+		if (options.UpdateGolden) {
+			if (!WriteImage(golden, actual)) {
+				failures[i] = std::format("{}: golden image could not be written", name);
+			}
+			return;
+		}
+
+		PngImage expected;
+		PngImage mask;
+		bool masked = std::filesystem::exists(maskPath);
+		if (!ReadPng(golden, expected) || (masked && !ReadPng(maskPath, mask))) {
+			failures[i] = std::format("{}: no golden image, write it with --update-golden", name);
+			return;
+		}
+		if (masked && (mask.Width != expected.Width || mask.Height != expected.Height)) {
+			failures[i] = std::format("{}: mask is {}x{}, the golden image {}x{}", name, mask.Width, mask.Height, expected.Width, expected.Height);
+			return;
+		}
+
+		ImageComparison comparison = CompareImages(expected, actual, masked ? &mask : nullptr, options.Tolerance);
+		if (!comparison.SizeMatches) {
+			failures[i] = std::format("{}: is {}x{}, the golden image {}x{}", name, actual.Width, actual.Height, expected.Width, expected.Height);
+		}
+		else if (!comparison.Passes(options.Tolerance)) {
+			WriteDiffHeatmap(diff, expected, actual, masked ? &mask : nullptr, options.Tolerance);
+			failures[i] = std::format("{}: {} of {} pixels differ, by up to {}, SSIM {:.4f}, see {}",
+				name, comparison.DifferentPixels, comparison.ComparedPixels, comparison.MaxDifference, comparison.Ssim, diff.string());
+		}
+	});
+
+	std::size_t failed = 0;
+	for (const std::string& failure : failures) {
+		if (!failure.empty()) {
+			std::cout << failure << "\n";
+			++failed;
+		}
+	}
+
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	if (options.UpdateGolden) {
+		std::cout << std::format("Wrote {} of {} golden images in {:.2f} s\n", inputs.size() - failed, inputs.size(), seconds);
+	}
+	else {
+		std::cout << std::format("{} of {} images match their golden images in {:.2f} s\n", inputs.size() - failed, inputs.size(), seconds);
+	}
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,591 @@
+module;
+// C
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+export module render.capture;
+
+import <algorithm>;
+import <array>;
+import <chrono>;
+import <filesystem>;
+import <fstream>;
+import <iostream>;
+import <iterator>;
+import <span>;
+import <vector>;
+
+// A capture is the objects a frame's commands refer to and the commands
+// themselves, recorded by RenderContext. Nothing here depends on Direct3D:
+// enums and descriptions are stored with their D3D11 values, so captures can
+// be inspected and replayed on the CPU anywhere and on D3D11 on Windows.
+//
+//   header   "GCAP", version, width, height, object count, command count
+//   object   kind, payload size, payload      (object ids are 1-based, in order)
+//   command  command, payload size, payload
+
+export using CaptureObject = std::uint32_t;
+export constexpr CaptureObject NullCaptureObject = 0;
+
+export enum class CaptureObjectKind : std::uint32_t
+{
+	// CaptureBufferDesc, then ByteWidth bytes of initial contents.
+	Buffer,
+	// Shader bytecode. Empty when the bytecode was not known at capture.
+	VertexShader,
+	PixelShader,
+	// CaptureInputElement count, the elements, then the vertex shader bytecode.
+	InputLayout,
+	// D3D11_RASTERIZER_DESC and D3D11_DEPTH_STENCIL_DESC as they are.
+	RasterizerState,
+	DepthStencilState,
+};
+
+export enum class CaptureCommand : std::uint32_t
+{
+	SetPrimitiveTopology,	// topology
+	SetInputLayout,			// object
+	SetVertexShader,		// object
+	SetPixelShader,			// object
+	SetRasterizerState,		// object
+	SetDepthStencilState,	// object, stencil reference
+	SetConstantBuffers,		// stage, start slot, count, objects
+	SetVertexBuffers,		// start slot, count, CaptureVertexBuffer each
+	SetIndexBuffer,			// object, format, offset
+	UpdateBuffer,			// object, contents
+	Draw,					// vertex count, start vertex
+	DrawIndexed,			// index count, start index, base vertex
+	WriteBuffer,			// object, offset, discard, contents
+	Count
+};
+
+export enum class CaptureShaderStage : std::uint32_t
+{
+	Vertex,
+	Pixel,
+};
+
+// Mirrors D3D11_BUFFER_DESC.
+export struct CaptureBufferDesc
+{
+	std::uint32_t ByteWidth;
+	std::uint32_t Usage;
+	std::uint32_t BindFlags;
+	std::uint32_t CPUAccessFlags;
+	std::uint32_t MiscFlags;
+	std::uint32_t StructureByteStride;
+};
+
+// D3D11_INPUT_ELEMENT_DESC with the semantic name inline.
+export struct CaptureInputElement
+{
+	std::array<char, 32> SemanticName;
+	std::uint32_t SemanticIndex;
+	std::uint32_t Format;
+	std::uint32_t InputSlot;
+	std::uint32_t AlignedByteOffset;
+	std::uint32_t InputSlotClass;
+	std::uint32_t InstanceDataStepRate;
+};
+
+export struct CaptureVertexBuffer
+{
+	CaptureObject Buffer;
+	std::uint32_t Stride;
+	std::uint32_t Offset;
+};
+
+export struct CaptureRecord
+{
+	std::uint32_t Type;
+	std::span<const std::byte> Payload;
+};
+
+// Reads a trivially copyable value at offset of a record payload, or a zero
+// value past its end.
+export template <typename T>
+T ReadCapture(std::span<const std::byte> payload, std::size_t offset = 0)
+{
+	T value{};
+	if (offset + sizeof(T) <= payload.size()) {
+		std::memcpy(&value, payload.data() + offset, sizeof(T));
+	}
+	return value;
+}
+
+export class CaptureWriter
+{
+public:
+	void Begin(std::uint32_t width, std::uint32_t height);
+
+	CaptureObject AddObject(CaptureObjectKind kind, std::span<const std::byte> payload);
+
+	// A command's payload is everything written until EndCommand().
+	void BeginCommand(CaptureCommand command);
+	void Write(const void* data, std::size_t size);
+	template <typename T>
+	void Write(const T& value) { Write(&value, sizeof(T)); }
+	void EndCommand();
+
+	bool Save(const std::filesystem::path& path) const;
+
+	std::uint32_t CommandCount() const { return commandCount_; }
+
+private:
+	std::uint32_t width_ = 0;
+	std::uint32_t height_ = 0;
+	std::vector<std::byte> objects_;
+	std::vector<std::byte> commands_;
+	std::size_t commandStart_ = 0;
+	std::uint32_t objectCount_ = 0;
+	std::uint32_t commandCount_ = 0;
+};
+
+export class CaptureFile
+{
+public:
+	bool Load(const std::filesystem::path& path);
+
+	std::uint32_t Width() const { return width_; }
+	std::uint32_t Height() const { return height_; }
+
+	// Object i has id i + 1.
+	std::span<const CaptureRecord> Objects() const { return objects_; }
+	std::span<const CaptureRecord> Commands() const { return commands_; }
+
+private:
+	std::vector<std::byte> data_;
+	std::uint32_t width_ = 0;
+	std::uint32_t height_ = 0;
+	std::vector<CaptureRecord> objects_;
+	std::vector<CaptureRecord> commands_;
+};
+
+// Executes captures. Objects are created once per target, frames can be
+// played any number of times after that.
+export class CaptureTarget
+{
+public:
+	virtual ~CaptureTarget() = default;
+
+	virtual bool Load(const CaptureFile& capture) = 0;
+	virtual void BeginFrame() { }
+	virtual void Execute(CaptureCommand command, std::span<const std::byte> payload) = 0;
+	// Waits until the frame has been executed.
+	virtual void EndFrame() { }
+};
+
+// Time spent in the target per command, over all played frames.
+export struct CaptureTimings
+{
+	struct Command
+	{
+		std::uint64_t Count = 0;
+		double Seconds = 0.0;
+	};
+
+	std::array<Command, static_cast<std::size_t>(CaptureCommand::Count)> Commands;
+	Command EndFrame;
+	std::uint64_t Frames = 0;
+};
+
+export const char* CaptureCommandName(CaptureCommand command);
+
+// Plays the commands of one frame, timing every one of them. Returns the
+// seconds the frame took, including EndFrame().
+export double PlayCapture(const CaptureFile& capture, CaptureTarget& target, CaptureTimings& timings);
+
+// Replays on the CPU only: tracks the bound state, applies buffer updates to
+// shadow copies and validates every draw against what is bound, roughly the
+// work a driver does on submission. Nothing is rasterized.
+export class CpuCaptureTarget : public CaptureTarget
+{
+public:
+	struct Statistics
+	{
+		std::uint64_t Draws = 0;
+		std::uint64_t Primitives = 0;
+		std::uint64_t BytesUpdated = 0;
+		std::uint64_t InvalidDraws = 0;
+	};
+
+public:
+	bool Load(const CaptureFile& capture) override;
+	void Execute(CaptureCommand command, std::span<const std::byte> payload) override;
+
+	const Statistics& GetStatistics() const { return statistics_; }
+
+private:
+	struct Object
+	{
+		CaptureObjectKind Kind;
+		// Shadow copy of a buffer.
+		std::vector<std::byte> Contents;
+		// Vertex buffer slots an input layout reads.
+		std::uint32_t Slots = 0;
+	};
+
+	Object* Find(CaptureObject id, CaptureObjectKind kind);
+	bool ValidateDraw(std::uint32_t maxVertex);
+	void CountPrimitives(std::uint32_t vertexCount);
+
+	std::vector<Object> objects_;
+
+	std::uint32_t topology_ = 0;
+	CaptureObject inputLayout_ = NullCaptureObject;
+	CaptureObject vertexShader_ = NullCaptureObject;
+	CaptureObject pixelShader_ = NullCaptureObject;
+	std::array<CaptureVertexBuffer, 16> vertexBuffers_{};
+	CaptureVertexBuffer indexBuffer_{};
+	std::uint32_t indexFormat_ = 0;
+
+	Statistics statistics_;
+};
+
+module :private;
+
+namespace
+{
+	constexpr std::array<char, 4> Magic = { 'G', 'C', 'A', 'P' };
+	constexpr std::uint32_t Version = 1;
+
+	struct Header
+	{
+		std::array<char, 4> Magic;
+		std::uint32_t Version;
+		std::uint32_t Width;
+		std::uint32_t Height;
+		std::uint32_t ObjectCount;
+		std::uint32_t CommandCount;
+	};
+
+	struct RecordHeader
+	{
+		std::uint32_t Type;
+		std::uint32_t Size;
+	};
+
+	// The D3D11 values the CPU target needs.
+	constexpr std::uint32_t PointList = 1;
+	constexpr std::uint32_t LineList = 2;
+	constexpr std::uint32_t LineStrip = 3;
+	constexpr std::uint32_t TriangleList = 4;
+	constexpr std::uint32_t TriangleStrip = 5;
+	constexpr std::uint32_t IndexFormat32 = 42;
+	constexpr std::uint32_t IndexFormat16 = 57;
+
+	void Append(std::vector<std::byte>& bytes, const void* data, std::size_t size)
+	{
+		const std::byte* begin = static_cast<const std::byte*>(data);
+		bytes.insert(bytes.end(), begin, begin + size);
+	}
+
+	bool ReadRecords(std::span<const std::byte> data, std::size_t& position, std::uint32_t count, std::vector<CaptureRecord>& records)
+	{
+		records.clear();
+		records.reserve(count);
+		for (std::uint32_t i = 0; i < count; ++i) {
+			RecordHeader header = ReadCapture<RecordHeader>(data, position);
+			position += sizeof(RecordHeader);
+			if (position > data.size() || header.Size > data.size() - position) {
+				return false;
+			}
+			records.push_back(CaptureRecord{ header.Type, data.subspan(position, header.Size) });
+			position += header.Size;
+		}
+		return true;
+	}
+}
+
+void CaptureWriter::Begin(std::uint32_t width, std::uint32_t height)
+{
+	width_ = width;
+	height_ = height;
+	objects_.clear();
+	commands_.clear();
+	objectCount_ = 0;
+	commandCount_ = 0;
+}
+
+CaptureObject CaptureWriter::AddObject(CaptureObjectKind kind, std::span<const std::byte> payload)
+{
+	RecordHeader header{ static_cast<std::uint32_t>(kind), static_cast<std::uint32_t>(payload.size()) };
+	Append(objects_, &header, sizeof(header));
+	Append(objects_, payload.data(), payload.size());
+	return ++objectCount_;
+}
+
+void CaptureWriter::BeginCommand(CaptureCommand command)
+{
+	// The size is patched by EndCommand().
+	commandStart_ = commands_.size();
+	RecordHeader header{ static_cast<std::uint32_t>(command), 0 };
+	Append(commands_, &header, sizeof(header));
+}
+
+void CaptureWriter::Write(const void* data, std::size_t size)
+{
+	Append(commands_, data, size);
+}
+
+void CaptureWriter::EndCommand()
+{
+	std::uint32_t size = static_cast<std::uint32_t>(commands_.size() - commandStart_ - sizeof(RecordHeader));
+	std::memcpy(commands_.data() + commandStart_ + offsetof(RecordHeader, Size), &size, sizeof(size));
+	++commandCount_;
+}
+
+bool CaptureWriter::Save(const std::filesystem::path& path) const
+{
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file) {
+		std::cerr << "Failed to open capture " << path << "\n";
+		return false;
+	}
+
+	Header header{ Magic, Version, width_, height_, objectCount_, commandCount_ };
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(objects_.data()), objects_.size());
+	file.write(reinterpret_cast<const char*>(commands_.data()), commands_.size());
+	return file.good();
+}
+
+bool CaptureFile::Load(const std::filesystem::path& path)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		std::cerr << "Failed to open capture " << path << "\n";
+		return false;
+	}
+
+	std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	data_.resize(bytes.size());
+	std::memcpy(data_.data(), bytes.data(), bytes.size());
+
+	Header header = ReadCapture<Header>(data_);
+	if (data_.size() < sizeof(header) || header.Magic != Magic || header.Version != Version) {
+		std::cerr << "Capture " << path << " has an unknown format\n";
+		return false;
+	}
+
+	std::size_t position = sizeof(header);
+	if (!ReadRecords(data_, position, header.ObjectCount, objects_) || !ReadRecords(data_, position, header.CommandCount, commands_)) {
+		std::cerr << "Capture " << path << " is truncated\n";
+		return false;
+	}
+
+	width_ = header.Width;
+	height_ = header.Height;
+	return true;
+}
+
+const char* CaptureCommandName(CaptureCommand command)
+{
+	switch (command) {
+	case CaptureCommand::SetPrimitiveTopology: return "SetPrimitiveTopology";
+	case CaptureCommand::SetInputLayout: return "SetInputLayout";
+	case CaptureCommand::SetVertexShader: return "SetVertexShader";
+	case CaptureCommand::SetPixelShader: return "SetPixelShader";
+	case CaptureCommand::SetRasterizerState: return "SetRasterizerState";
+	case CaptureCommand::SetDepthStencilState: return "SetDepthStencilState";
+	case CaptureCommand::SetConstantBuffers: return "SetConstantBuffers";
+	case CaptureCommand::SetVertexBuffers: return "SetVertexBuffers";
+	case CaptureCommand::SetIndexBuffer: return "SetIndexBuffer";
+	case CaptureCommand::UpdateBuffer: return "UpdateBuffer";
+	case CaptureCommand::Draw: return "Draw";
+	case CaptureCommand::DrawIndexed: return "DrawIndexed";
+	case CaptureCommand::WriteBuffer: return "WriteBuffer";
+	default: return "Unknown";
+	}
+}
+
+double PlayCapture(const CaptureFile& capture, CaptureTarget& target, CaptureTimings& timings)
+{
+	using Clock = std::chrono::steady_clock;
+
+	Clock::time_point frameStart = Clock::now();
+	target.BeginFrame();
+
+	Clock::time_point start = Clock::now();
+	for (const CaptureRecord& record : capture.Commands()) {
+		if (record.Type >= static_cast<std::uint32_t>(CaptureCommand::Count)) {
+			continue;
+		}
+
+		CaptureCommand command = static_cast<CaptureCommand>(record.Type);
+		target.Execute(command, record.Payload);
+
+		Clock::time_point end = Clock::now();
+		CaptureTimings::Command& timing = timings.Commands[record.Type];
+		++timing.Count;
+		timing.Seconds += std::chrono::duration<double>(end - start).count();
+		start = end;
+	}
+
+	target.EndFrame();
+	Clock::time_point frameEnd = Clock::now();
+	++timings.EndFrame.Count;
+	timings.EndFrame.Seconds += std::chrono::duration<double>(frameEnd - start).count();
+	++timings.Frames;
+
+	return std::chrono::duration<double>(frameEnd - frameStart).count();
+}
+
+bool CpuCaptureTarget::Load(const CaptureFile& capture)
+{
+	objects_.clear();
+	objects_.reserve(capture.Objects().size());
+	for (const CaptureRecord& record : capture.Objects()) {
+		Object object{ static_cast<CaptureObjectKind>(record.Type) };
+		if (object.Kind == CaptureObjectKind::Buffer) {
+			std::span<const std::byte> contents = record.Payload.subspan(std::min(sizeof(CaptureBufferDesc), record.Payload.size()));
+			object.Contents.assign(contents.begin(), contents.end());
+			object.Contents.resize(ReadCapture<CaptureBufferDesc>(record.Payload).ByteWidth);
+		}
+		else if (object.Kind == CaptureObjectKind::InputLayout) {
+			std::uint32_t count = ReadCapture<std::uint32_t>(record.Payload);
+			for (std::uint32_t i = 0; i < count; ++i) {
+				CaptureInputElement element = ReadCapture<CaptureInputElement>(record.Payload, 4 + i * sizeof(CaptureInputElement));
+				object.Slots |= 1u << (element.InputSlot % 32);
+			}
+		}
+		objects_.push_back(std::move(object));
+	}
+	return true;
+}
+
+CpuCaptureTarget::Object* CpuCaptureTarget::Find(CaptureObject id, CaptureObjectKind kind)
+{
+	if (id == NullCaptureObject || id > objects_.size() || objects_[id - 1].Kind != kind) {
+		return nullptr;
+	}
+	return &objects_[id - 1];
+}
+
+void CpuCaptureTarget::Execute(CaptureCommand command, std::span<const std::byte> payload)
+{
+	switch (command) {
+	case CaptureCommand::SetPrimitiveTopology:
+		topology_ = ReadCapture<std::uint32_t>(payload);
+		break;
+	case CaptureCommand::SetInputLayout:
+		inputLayout_ = ReadCapture<CaptureObject>(payload);
+		break;
+	case CaptureCommand::SetVertexShader:
+		vertexShader_ = ReadCapture<CaptureObject>(payload);
+		break;
+	case CaptureCommand::SetPixelShader:
+		pixelShader_ = ReadCapture<CaptureObject>(payload);
+		break;
+	case CaptureCommand::SetVertexBuffers: {
+		std::uint32_t startSlot = ReadCapture<std::uint32_t>(payload);
+		std::uint32_t count = ReadCapture<std::uint32_t>(payload, 4);
+		for (std::uint32_t i = 0; i < count && startSlot + i < vertexBuffers_.size(); ++i) {
+			vertexBuffers_[startSlot + i] = ReadCapture<CaptureVertexBuffer>(payload, 8 + i * sizeof(CaptureVertexBuffer));
+		}
+		break;
+	}
+	case CaptureCommand::SetIndexBuffer:
+		indexBuffer_.Buffer = ReadCapture<CaptureObject>(payload);
+		indexFormat_ = ReadCapture<std::uint32_t>(payload, 4);
+		indexBuffer_.Offset = ReadCapture<std::uint32_t>(payload, 8);
+		indexBuffer_.Stride = indexFormat_ == IndexFormat16 ? 2 : 4;
+		break;
+	case CaptureCommand::UpdateBuffer: {
+		CaptureObject id = ReadCapture<CaptureObject>(payload);
+		if (Object* buffer = Find(id, CaptureObjectKind::Buffer)) {
+			std::span<const std::byte> contents = payload.subspan(sizeof(CaptureObject));
+			std::size_t size = std::min(contents.size(), buffer->Contents.size());
+			std::memcpy(buffer->Contents.data(), contents.data(), size);
+			statistics_.BytesUpdated += size;
+		}
+		break;
+	}
+	case CaptureCommand::WriteBuffer: {
+		CaptureObject id = ReadCapture<CaptureObject>(payload);
+		std::uint32_t offset = ReadCapture<std::uint32_t>(payload, 4);
+		if (Object* buffer = Find(id, CaptureObjectKind::Buffer); buffer && payload.size() >= 12 && offset <= buffer->Contents.size()) {
+			std::span<const std::byte> contents = payload.subspan(12);
+			std::size_t size = std::min(contents.size(), buffer->Contents.size() - offset);
+			std::memcpy(buffer->Contents.data() + offset, contents.data(), size);
+			statistics_.BytesUpdated += size;
+		}
+		break;
+	}
+	case CaptureCommand::Draw: {
+		std::uint32_t vertexCount = ReadCapture<std::uint32_t>(payload);
+		std::uint32_t startVertex = ReadCapture<std::uint32_t>(payload, 4);
+		if (vertexCount > 0 && ValidateDraw(startVertex + vertexCount - 1)) {
+			CountPrimitives(vertexCount);
+		}
+		break;
+	}
+	case CaptureCommand::DrawIndexed: {
+		std::uint32_t indexCount = ReadCapture<std::uint32_t>(payload);
+		std::uint32_t startIndex = ReadCapture<std::uint32_t>(payload, 4);
+		std::int32_t baseVertex = ReadCapture<std::int32_t>(payload, 8);
+
+		const Object* indices = Find(indexBuffer_.Buffer, CaptureObjectKind::Buffer);
+		std::size_t first = indexBuffer_.Offset + std::size_t(startIndex) * indexBuffer_.Stride;
+		if (!indices || indexCount == 0 || first + std::size_t(indexCount) * indexBuffer_.Stride > indices->Contents.size()) {
+			++statistics_.InvalidDraws;
+			break;
+		}
+
+		// The highest vertex the draw reads decides which buffers are big enough.
+		std::uint32_t maxIndex = 0;
+		const std::byte* data = indices->Contents.data() + first;
+		for (std::uint32_t i = 0; i < indexCount; ++i) {
+			std::uint32_t index = 0;
+			std::memcpy(&index, data + i * indexBuffer_.Stride, indexBuffer_.Stride);
+			maxIndex = std::max(maxIndex, index);
+		}
+
+		std::int64_t maxVertex = std::int64_t(maxIndex) + baseVertex;
+		if (maxVertex >= 0 && ValidateDraw(static_cast<std::uint32_t>(maxVertex))) {
+			CountPrimitives(indexCount);
+		}
+		break;
+	}
+	default:
+		// Constant buffers and states are not needed to validate draws.
+		break;
+	}
+}
+
+bool CpuCaptureTarget::ValidateDraw(std::uint32_t maxVertex)
+{
+	bool valid = Find(vertexShader_, CaptureObjectKind::VertexShader) != nullptr;
+
+	// Only the slots the input layout reads have to hold the vertices. Without
+	// a layout the vertex shader generates them.
+	if (const Object* layout = Find(inputLayout_, CaptureObjectKind::InputLayout)) {
+		for (std::uint32_t slot = 0; slot < vertexBuffers_.size(); ++slot) {
+			if ((layout->Slots & (1u << slot)) == 0) {
+				continue;
+			}
+			const CaptureVertexBuffer& binding = vertexBuffers_[slot];
+			const Object* buffer = Find(binding.Buffer, CaptureObjectKind::Buffer);
+			valid &= buffer && binding.Offset + (std::size_t(maxVertex) + 1) * binding.Stride <= buffer->Contents.size();
+		}
+	}
+
+	if (!valid) {
+		++statistics_.InvalidDraws;
+	}
+	return valid;
+}
+
+void CpuCaptureTarget::CountPrimitives(std::uint32_t vertexCount)
+{
+	++statistics_.Draws;
+	switch (topology_) {
+	case PointList: statistics_.Primitives += vertexCount; break;
+	case LineList: statistics_.Primitives += vertexCount / 2; break;
+	case LineStrip: statistics_.Primitives += vertexCount > 0 ? vertexCount - 1 : 0; break;
+	case TriangleList: statistics_.Primitives += vertexCount / 3; break;
+	case TriangleStrip: statistics_.Primitives += vertexCount > 1 ? vertexCount - 2 : 0; break;
+	default: break;
+	}
+}
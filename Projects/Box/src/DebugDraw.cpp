@@ -0,0 +1,273 @@
+module;
+// C
+#include <cstddef>
+#include <cstdint>
+
+// Windows
+#include <DirectXMath.h>
+#include <d3d11.h>
+#include <wrl.h>
+
+export module render.debug;
+
+import <algorithm>;
+import <atomic>;
+import <iterator>;
+import <memory>;
+import <mutex>;
+import <thread>;
+import <vector>;
+
+import diagnostics.memory;
+import pipeline;
+import render.context;
+import resource.registry;
+import utility;
+import vertex;
+
+// Lines, wire boxes, spheres and frusta for debugging, drawn over the scene.
+// Shapes can be added from any thread: every thread appends to a batch of its
+// own, and Render() merges the batches into one dynamic vertex buffer and
+// draws them as a line list, in one draw call unless there are more than
+// BufferVertices vertices. Shapes are drawn once, by the next Render().
+export class DebugDraw
+{
+public:
+	static constexpr std::size_t BufferVertices = 64 * 1024;
+	static constexpr int SphereSegments = 24;
+
+public:
+	DebugDraw();
+
+	DebugDraw(const DebugDraw&) = delete;
+	DebugDraw& operator=(const DebugDraw&) = delete;
+
+	void Initialize(ID3D11Device* device);
+
+	void Line(const DirectX::XMFLOAT3& from, const DirectX::XMFLOAT3& to, const DirectX::XMFLOAT4& color);
+	void Box(const DirectX::XMFLOAT3& center, const DirectX::XMFLOAT3& extents, const DirectX::XMFLOAT4& color);
+	// The box in the space of world.
+	void Box(const DirectX::XMFLOAT3& center, const DirectX::XMFLOAT3& extents, DirectX::FXMMATRIX world, const DirectX::XMFLOAT4& color);
+	// Three great circles.
+	void Sphere(const DirectX::XMFLOAT3& center, float radius, const DirectX::XMFLOAT4& color);
+	// The volume viewProjection maps to the clip space cube.
+	void Frustum(DirectX::FXMMATRIX viewProjection, const DirectX::XMFLOAT4& color);
+
+	// Render thread. Draws and clears everything added so far. The pipeline
+	// draws Vertex::PosColor line lists, transformed by the matrix in vertex
+	// shader constant buffer 0, as ColorVertexShader does.
+	void Render(RenderContext& context, const ResourceRegistry& registry, const GraphicsPipeline* pipeline, DirectX::FXMMATRIX viewProjection);
+
+	// Vertices drawn by the last Render().
+	std::size_t LastVertexCount() const { return lastVertexCount_; }
+
+private:
+	struct Batch
+	{
+		std::thread::id Thread;
+		std::mutex Mutex;
+		std::vector<Vertex::PosColor> Vertices;
+	};
+
+	Batch& ThreadBatch();
+	void AddLines(const DirectX::XMFLOAT3* points, const std::uint8_t* edges, std::size_t edgeCount, const DirectX::XMFLOAT4& color);
+
+private:
+	// Tells instances apart in the per-thread cache, even at a reused address.
+	std::uint64_t id_;
+
+	std::mutex batchesMutex_;
+	std::vector<std::unique_ptr<Batch>> batches_;
+
+	std::vector<Vertex::PosColor> vertices_;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> vertexBuffer_;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> transformBuffer_;
+	std::size_t bufferCursor_ = 0;
+	std::size_t lastVertexCount_ = 0;
+};
+
+module :private;
+
+namespace
+{
+	std::atomic<std::uint64_t> nextDebugDrawId = 1;
+
+	// The eight corners are ordered by bit: x is bit 0, y bit 1 and z bit 2.
+	constexpr std::uint8_t BoxEdges[] = {
+		0, 1, 2, 3, 4, 5, 6, 7,
+		0, 2, 1, 3, 4, 6, 5, 7,
+		0, 4, 1, 5, 2, 6, 3, 7,
+	};
+}
+
+DebugDraw::DebugDraw()
+	: id_(nextDebugDrawId++)
+{
+}
+
+void DebugDraw::Initialize(ID3D11Device* device)
+{
+	D3D11_BUFFER_DESC desc;
+	ZeroMemory(&desc, sizeof(desc));
+	desc.Usage = D3D11_USAGE_DYNAMIC;
+	desc.ByteWidth = static_cast<UINT>(BufferVertices * sizeof(Vertex::PosColor));
+	desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	ThrowIfFailed(device->CreateBuffer(&desc, nullptr, vertexBuffer_.ReleaseAndGetAddressOf()));
+	MemoryTracker::Get().TrackBuffer(vertexBuffer_.Get());
+
+	desc.ByteWidth = sizeof(DirectX::XMFLOAT4X4);
+	desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	ThrowIfFailed(device->CreateBuffer(&desc, nullptr, transformBuffer_.ReleaseAndGetAddressOf()));
+	MemoryTracker::Get().TrackBuffer(transformBuffer_.Get());
+
+	bufferCursor_ = 0;
+}
+
+DebugDraw::Batch& DebugDraw::ThreadBatch()
+{
+	// Threads usually draw into one instance, which then takes no lock.
+	struct Cache
+	{
+		std::uint64_t Owner = 0;
+		Batch* Value = nullptr;
+	};
+	thread_local Cache cache;
+	if (cache.Owner == id_) {
+		return *cache.Value;
+	}
+
+	std::thread::id thread = std::this_thread::get_id();
+	std::lock_guard<std::mutex> lock(batchesMutex_);
+	auto found = std::find_if(batches_.begin(), batches_.end(), [&](const std::unique_ptr<Batch>& batch) { return batch->Thread == thread; });
+	if (found == batches_.end()) {
+		found = batches_.insert(batches_.end(), std::make_unique<Batch>());
+		(*found)->Thread = thread;
+	}
+	cache = { id_, found->get() };
+	return **found;
+}
+
+void DebugDraw::AddLines(const DirectX::XMFLOAT3* points, const std::uint8_t* edges, std::size_t edgeCount, const DirectX::XMFLOAT4& color)
+{
+	Batch& batch = ThreadBatch();
+	std::lock_guard<std::mutex> lock(batch.Mutex);
+	for (std::size_t i = 0; i < edgeCount * 2; ++i) {
+		batch.Vertices.push_back({ points[edges[i]], color });
+	}
+}
+
+void DebugDraw::Line(const DirectX::XMFLOAT3& from, const DirectX::XMFLOAT3& to, const DirectX::XMFLOAT4& color)
+{
+	Batch& batch = ThreadBatch();
+	std::lock_guard<std::mutex> lock(batch.Mutex);
+	batch.Vertices.push_back({ from, color });
+	batch.Vertices.push_back({ to, color });
+}
+
+void DebugDraw::Box(const DirectX::XMFLOAT3& center, const DirectX::XMFLOAT3& extents, const DirectX::XMFLOAT4& color)
+{
+	DirectX::XMFLOAT3 corners[8];
+	for (int i = 0; i < 8; ++i) {
+		corners[i].x = center.x + (i & 1 ? extents.x : -extents.x);
+		corners[i].y = center.y + (i & 2 ? extents.y : -extents.y);
+		corners[i].z = center.z + (i & 4 ? extents.z : -extents.z);
+	}
+	AddLines(corners, BoxEdges, std::size(BoxEdges) / 2, color);
+}
+
+void DebugDraw::Box(const DirectX::XMFLOAT3& center, const DirectX::XMFLOAT3& extents, DirectX::FXMMATRIX world, const DirectX::XMFLOAT4& color)
+{
+	DirectX::XMFLOAT3 corners[8];
+	for (int i = 0; i < 8; ++i) {
+		DirectX::XMVECTOR corner = DirectX::XMVectorSet(
+			center.x + (i & 1 ? extents.x : -extents.x),
+			center.y + (i & 2 ? extents.y : -extents.y),
+			center.z + (i & 4 ? extents.z : -extents.z),
+			1.0f);
+		DirectX::XMStoreFloat3(&corners[i], DirectX::XMVector3TransformCoord(corner, world));
+	}
+	AddLines(corners, BoxEdges, std::size(BoxEdges) / 2, color);
+}
+
+void DebugDraw::Sphere(const DirectX::XMFLOAT3& center, float radius, const DirectX::XMFLOAT4& color)
+{
+	// One circle around each axis.
+	DirectX::XMFLOAT3 points[3][SphereSegments];
+	for (int i = 0; i < SphereSegments; ++i) {
+		float sine, cosine;
+		DirectX::XMScalarSinCos(&sine, &cosine, DirectX::XM_2PI * i / SphereSegments);
+		sine *= radius;
+		cosine *= radius;
+		points[0][i] = DirectX::XMFLOAT3(center.x, center.y + cosine, center.z + sine);
+		points[1][i] = DirectX::XMFLOAT3(center.x + cosine, center.y, center.z + sine);
+		points[2][i] = DirectX::XMFLOAT3(center.x + cosine, center.y + sine, center.z);
+	}
+
+	Batch& batch = ThreadBatch();
+	std::lock_guard<std::mutex> lock(batch.Mutex);
+	for (const auto& circle : points) {
+		for (int i = 0; i < SphereSegments; ++i) {
+			batch.Vertices.push_back({ circle[i], color });
+			batch.Vertices.push_back({ circle[(i + 1) % SphereSegments], color });
+		}
+	}
+}
+
+void DebugDraw::Frustum(DirectX::FXMMATRIX viewProjection, const DirectX::XMFLOAT4& color)
+{
+	DirectX::XMMATRIX inverse = DirectX::XMMatrixInverse(nullptr, viewProjection);
+	DirectX::XMFLOAT3 corners[8];
+	for (int i = 0; i < 8; ++i) {
+		DirectX::XMVECTOR corner = DirectX::XMVectorSet(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, i & 4 ? 1.0f : 0.0f, 1.0f);
+		DirectX::XMStoreFloat3(&corners[i], DirectX::XMVector3TransformCoord(corner, inverse));
+	}
+	AddLines(corners, BoxEdges, std::size(BoxEdges) / 2, color);
+}
+
+void DebugDraw::Render(RenderContext& context, const ResourceRegistry& registry, const GraphicsPipeline* pipeline, DirectX::FXMMATRIX viewProjection)
+{
+	// Each batch is only locked while it is copied out.
+	vertices_.clear();
+	{
+		std::lock_guard<std::mutex> lock(batchesMutex_);
+		for (const std::unique_ptr<Batch>& batch : batches_) {
+			std::lock_guard<std::mutex> batchLock(batch->Mutex);
+			vertices_.insert(vertices_.end(), batch->Vertices.begin(), batch->Vertices.end());
+			batch->Vertices.clear();
+		}
+	}
+
+	lastVertexCount_ = 0;
+	if (vertices_.empty() || !pipeline || !vertexBuffer_) {
+		return;
+	}
+
+	DirectX::XMFLOAT4X4 transform;
+	DirectX::XMStoreFloat4x4(&transform, DirectX::XMMatrixTranspose(viewProjection));
+	context.UpdateBuffer(transformBuffer_.Get(), &transform, sizeof(transform));
+
+	pipeline->Apply(context, registry);
+	context.SetVSConstantBuffers(0, 1, transformBuffer_.GetAddressOf());
+	UINT stride = sizeof(Vertex::PosColor);
+	UINT offset = 0;
+	context.SetVertexBuffers(0, 1, vertexBuffer_.GetAddressOf(), &stride, &offset);
+
+	// Appended after what earlier frames wrote, which the GPU may still be
+	// drawing. Only a full buffer is discarded and started over.
+	for (std::size_t first = 0; first < vertices_.size(); ) {
+		std::size_t count = std::min(vertices_.size() - first, BufferVertices);
+		bool discard = bufferCursor_ + count > BufferVertices;
+		if (discard) {
+			bufferCursor_ = 0;
+		}
+
+		context.WriteBuffer(vertexBuffer_.Get(), bufferCursor_ * sizeof(Vertex::PosColor), vertices_.data() + first,
+			count * sizeof(Vertex::PosColor), discard || bufferCursor_ == 0);
+		context.Draw(static_cast<UINT>(count), static_cast<UINT>(bufferCursor_));
+
+		bufferCursor_ += count;
+		first += count;
+	}
+	lastVertexCount_ = vertices_.size();
+}
@@ -0,0 +1,735 @@
+module;
+// C
+#include <cassert>
+#include <cfloat>
+#include <cstddef>
+#include <cstdint>
+
+// Windows
+#include <DirectXMath.h>
+
+export module spatial.bvh;
+
+import <algorithm>;
+import <array>;
+import <span>;
+import <vector>;
+
+import core.threading;
+
+export struct Aabb
+{
+	DirectX::XMFLOAT3 Min;
+	DirectX::XMFLOAT3 Max;
+
+	bool Contains(const Aabb& other) const
+	{
+		return Min.x <= other.Min.x && Min.y <= other.Min.y && Min.z <= other.Min.z &&
+			other.Max.x <= Max.x && other.Max.y <= Max.y && other.Max.z <= Max.z;
+	}
+
+	bool Overlaps(const Aabb& other) const
+	{
+		return Min.x <= other.Max.x && Min.y <= other.Max.y && Min.z <= other.Max.z &&
+			other.Min.x <= Max.x && other.Min.y <= Max.y && other.Min.z <= Max.z;
+	}
+
+	float SurfaceArea() const
+	{
+		float x = Max.x - Min.x;
+		float y = Max.y - Min.y;
+		float z = Max.z - Min.z;
+		return 2.0f * (x * y + y * z + z * x);
+	}
+
+	static Aabb Union(const Aabb& a, const Aabb& b)
+	{
+		return {
+			DirectX::XMFLOAT3(std::min(a.Min.x, b.Min.x), std::min(a.Min.y, b.Min.y), std::min(a.Min.z, b.Min.z)),
+			DirectX::XMFLOAT3(std::max(a.Max.x, b.Max.x), std::max(a.Max.y, b.Max.y), std::max(a.Max.z, b.Max.z)),
+		};
+	}
+
+	// Bounds of the box [-extents, extents] around center after transform.
+	static Aabb Transform(const DirectX::XMFLOAT3& center, const DirectX::XMFLOAT3& extents, DirectX::FXMMATRIX transform);
+};
+
+export struct BvhRay
+{
+	DirectX::XMFLOAT3 Origin;
+	// Hit distances are in units of the direction's length.
+	DirectX::XMFLOAT3 Direction;
+	float MaxDistance = FLT_MAX;
+};
+
+// Distance along the ray to the box, or a negative value for a miss.
+export float IntersectRay(const BvhRay& ray, const Aabb& bounds);
+
+export using BvhProxy = std::int32_t;
+export constexpr BvhProxy NullProxy = -1;
+
+export struct BvhRayHit
+{
+	BvhProxy Proxy = NullProxy;
+	float Distance = FLT_MAX;
+};
+
+// Dynamic bounding volume hierarchy over axis-aligned boxes.
+//
+// Leaves store fattened bounds, so an object moving a little does not touch
+// the tree at all. Insertion walks down choosing the branch that adds the
+// least surface area, and every node on the way back up is rotated when
+// swapping a child with a grandchild reduces the surface area (the SAH cost
+// of the tree) and rebalanced when its subtrees' heights drift apart.
+//
+// Queries are read-only and may run concurrently with each other, but not
+// with changes to the tree.
+export class DynamicBvh
+{
+public:
+	// Added to each side of the bounds of inserted and moved proxies.
+	static constexpr float FatMargin = 0.1f;
+
+public:
+	BvhProxy Insert(const Aabb& bounds, std::uint64_t userData);
+	void Remove(BvhProxy proxy);
+
+	// Returns true if the proxy left its fat bounds and was reinserted.
+	bool Move(BvhProxy proxy, const Aabb& bounds);
+
+	void Clear();
+
+	const Aabb& FatBounds(BvhProxy proxy) const { return nodes_[proxy].Bounds; }
+	std::uint64_t UserData(BvhProxy proxy) const { return nodes_[proxy].UserData; }
+
+	std::size_t ProxyCount() const { return proxyCount_; }
+	int Height() const { return root_ != NullProxy ? nodes_[root_].Height : 0; }
+
+	// Total surface area of the internal nodes relative to the root. Lower
+	// means cheaper queries.
+	float AreaRatio() const;
+
+	// Calls callback(proxy) for every proxy whose fat bounds overlap bounds,
+	// until it returns false.
+	template <typename Callback>
+	void QueryOverlap(const Aabb& bounds, Callback&& callback) const;
+
+	// Finds the nearest hit. hitTest(proxy, ray, maxDistance) tests the
+	// object itself and returns its hit distance, or a negative value for a
+	// miss. Nodes are visited near to far, and anything beyond the nearest
+	// hit so far is skipped.
+	template <typename HitTest>
+	BvhRayHit RayCast(const BvhRay& ray, HitTest&& hitTest) const;
+
+	// RayCast() for each ray, spread over the thread pool. hitTest is called
+	// concurrently.
+	template <typename HitTest>
+	void RayCastBatch(std::span<const BvhRay> rays, std::span<BvhRayHit> hits, HitTest&& hitTest,
+		ThreadPool* threadPool = ThreadPool::Default()) const;
+
+	// QueryOverlap() for each box, spread over the thread pool. Calls
+	// callback(queryIndex, proxy) concurrently, but never concurrently for
+	// the same query.
+	template <typename Callback>
+	void QueryOverlapBatch(std::span<const Aabb> queries, Callback&& callback,
+		ThreadPool* threadPool = ThreadPool::Default()) const;
+
+private:
+	struct Node
+	{
+		Aabb Bounds;
+		std::uint64_t UserData = 0;
+		// Next free node while on the free list.
+		BvhProxy Parent = NullProxy;
+		BvhProxy Child1 = NullProxy;
+		BvhProxy Child2 = NullProxy;
+		// Leaves are 0, free nodes -1.
+		int Height = 0;
+
+		bool IsLeaf() const { return Child1 == NullProxy; }
+	};
+
+	// Ray prepared for slab tests against many boxes, four lanes at a time.
+	struct RaySlabs
+	{
+		explicit RaySlabs(const BvhRay& ray);
+
+		// Entry distance into bounds, or a negative value if the ray misses
+		// them within maxDistance.
+		float Intersect(const Aabb& bounds, float maxDistance) const;
+
+		DirectX::XMVECTOR Origin;
+		DirectX::XMVECTOR InverseDirection;
+	};
+
+	// Traversal stack that only allocates for unusually deep trees.
+	template <typename T>
+	class Stack
+	{
+	public:
+		void Push(const T& value)
+		{
+			if (count_ < local_.size()) {
+				local_[count_] = value;
+			}
+			else {
+				overflow_.push_back(value);
+			}
+			++count_;
+		}
+
+		T Pop()
+		{
+			--count_;
+			if (count_ < local_.size()) {
+				return local_[count_];
+			}
+			T value = overflow_.back();
+			overflow_.pop_back();
+			return value;
+		}
+
+		bool Empty() const { return count_ == 0; }
+
+	private:
+		std::array<T, 64> local_;
+		std::vector<T> overflow_;
+		std::size_t count_ = 0;
+	};
+
+	struct StackEntry
+	{
+		BvhProxy Node;
+		float Distance;
+	};
+
+	BvhProxy AllocateNode();
+	void FreeNode(BvhProxy node);
+
+	void InsertLeaf(BvhProxy leaf);
+	void RemoveLeaf(BvhProxy leaf);
+
+	// Refits, rebalances and rotates each node from index up to the root.
+	void FixUpwards(BvhProxy index);
+	BvhProxy Balance(BvhProxy index);
+	void Rotate(BvhProxy index);
+	void Refit(BvhProxy index);
+
+private:
+	std::vector<Node> nodes_;
+	BvhProxy root_ = NullProxy;
+	BvhProxy freeList_ = NullProxy;
+	std::size_t proxyCount_ = 0;
+};
+
+template <typename Callback>
+void DynamicBvh::QueryOverlap(const Aabb& bounds, Callback&& callback) const
+{
+	if (root_ == NullProxy) {
+		return;
+	}
+
+	Stack<BvhProxy> stack;
+	stack.Push(root_);
+	while (!stack.Empty()) {
+		const Node& node = nodes_[stack.Pop()];
+		if (!node.Bounds.Overlaps(bounds)) {
+			continue;
+		}
+
+		if (node.IsLeaf()) {
+			if (!callback(static_cast<BvhProxy>(&node - nodes_.data()))) {
+				return;
+			}
+		}
+		else {
+			stack.Push(node.Child1);
+			stack.Push(node.Child2);
+		}
+	}
+}
+
+template <typename HitTest>
+BvhRayHit DynamicBvh::RayCast(const BvhRay& ray, HitTest&& hitTest) const
+{
+	if (root_ == NullProxy) {
+		return BvhRayHit();
+	}
+
+	RaySlabs slabs(ray);
+	float rootDistance = slabs.Intersect(nodes_[root_].Bounds, ray.MaxDistance);
+	if (rootDistance < 0.0f) {
+		return BvhRayHit();
+	}
+
+	BvhRayHit hit;
+	hit.Distance = ray.MaxDistance;
+
+	Stack<StackEntry> stack;
+	stack.Push({ root_, rootDistance });
+	while (!stack.Empty()) {
+		StackEntry entry = stack.Pop();
+		if (entry.Distance > hit.Distance) {
+			continue;
+		}
+
+		const Node& node = nodes_[entry.Node];
+		if (node.IsLeaf()) {
+			float distance = hitTest(entry.Node, ray, hit.Distance);
+			if (distance >= 0.0f && distance < hit.Distance) {
+				hit.Proxy = entry.Node;
+				hit.Distance = distance;
+			}
+			continue;
+		}
+
+		float distance1 = slabs.Intersect(nodes_[node.Child1].Bounds, hit.Distance);
+		float distance2 = slabs.Intersect(nodes_[node.Child2].Bounds, hit.Distance);
+
+		// Push the nearer child last so it is visited first.
+		StackEntry near{ node.Child1, distance1 };
+		StackEntry far{ node.Child2, distance2 };
+		if (distance2 >= 0.0f && (distance1 < 0.0f || distance2 < distance1)) {
+			std::swap(near, far);
+		}
+		if (far.Distance >= 0.0f) {
+			stack.Push(far);
+		}
+		if (near.Distance >= 0.0f) {
+			stack.Push(near);
+		}
+	}
+
+	if (hit.Proxy == NullProxy) {
+		hit.Distance = FLT_MAX;
+	}
+	return hit;
+}
+
+template <typename HitTest>
+void DynamicBvh::RayCastBatch(std::span<const BvhRay> rays, std::span<BvhRayHit> hits, HitTest&& hitTest, ThreadPool* threadPool) const
+{
+	assert(hits.size() >= rays.size());
+
+	constexpr std::size_t BatchSize = 256;
+	threadPool->ParallelFor((rays.size() + BatchSize - 1) / BatchSize, [&](std::size_t batch) {
+		std::size_t end = std::min(rays.size(), (batch + 1) * BatchSize);
+		for (std::size_t i = batch * BatchSize; i < end; ++i) {
+			hits[i] = RayCast(rays[i], hitTest);
+		}
+	});
+}
+
+template <typename Callback>
+void DynamicBvh::QueryOverlapBatch(std::span<const Aabb> queries, Callback&& callback, ThreadPool* threadPool) const
+{
+	constexpr std::size_t BatchSize = 64;
+	threadPool->ParallelFor((queries.size() + BatchSize - 1) / BatchSize, [&](std::size_t batch) {
+		std::size_t end = std::min(queries.size(), (batch + 1) * BatchSize);
+		for (std::size_t i = batch * BatchSize; i < end; ++i) {
+			QueryOverlap(queries[i], [&callback, i](BvhProxy proxy) { return callback(i, proxy); });
+		}
+	});
+}
+
+module :private;
+
+Aabb Aabb::Transform(const DirectX::XMFLOAT3& center, const DirectX::XMFLOAT3& extents, DirectX::FXMMATRIX transform)
+{
+	using namespace DirectX;
+
+	// The transformed center plus the extents projected onto each axis.
+	XMVECTOR newCenter = XMVector3Transform(XMLoadFloat3(&center), transform);
+	XMVECTOR newExtents = XMVectorMultiply(XMVectorSplatX(XMLoadFloat3(&extents)), XMVectorAbs(transform.r[0]));
+	newExtents = XMVectorMultiplyAdd(XMVectorSplatY(XMLoadFloat3(&extents)), XMVectorAbs(transform.r[1]), newExtents);
+	newExtents = XMVectorMultiplyAdd(XMVectorSplatZ(XMLoadFloat3(&extents)), XMVectorAbs(transform.r[2]), newExtents);
+
+	Aabb bounds;
+	XMStoreFloat3(&bounds.Min, XMVectorSubtract(newCenter, newExtents));
+	XMStoreFloat3(&bounds.Max, XMVectorAdd(newCenter, newExtents));
+	return bounds;
+}
+
+float IntersectRay(const BvhRay& ray, const Aabb& bounds)
+{
+	float nearDistance = 0.0f;
+	float farDistance = ray.MaxDistance;
+
+	const float* origin = &ray.Origin.x;
+	const float* direction = &ray.Direction.x;
+	const float* minimum = &bounds.Min.x;
+	const float* maximum = &bounds.Max.x;
+	for (int axis = 0; axis < 3; ++axis) {
+		if (direction[axis] == 0.0f) {
+			if (origin[axis] < minimum[axis] || origin[axis] > maximum[axis]) {
+				return -1.0f;
+			}
+			continue;
+		}
+
+		float inverse = 1.0f / direction[axis];
+		float t1 = (minimum[axis] - origin[axis]) * inverse;
+		float t2 = (maximum[axis] - origin[axis]) * inverse;
+		nearDistance = std::max(nearDistance, std::min(t1, t2));
+		farDistance = std::min(farDistance, std::max(t1, t2));
+	}
+
+	return nearDistance <= farDistance ? nearDistance : -1.0f;
+}
+
+DynamicBvh::RaySlabs::RaySlabs(const BvhRay& ray)
+{
+	using namespace DirectX;
+
+	// The w lane takes part in the min/max reductions below. With w = 0 in
+	// the origin and 1 in the direction it contributes zero to the entry
+	// distance, which is the clamp to the ray start. Zero direction
+	// components give infinities, which the slab test handles.
+	Origin = XMLoadFloat3(&ray.Origin);
+	InverseDirection = XMVectorReciprocal(XMVectorSetW(XMLoadFloat3(&ray.Direction), 1.0f));
+}
+
+float DynamicBvh::RaySlabs::Intersect(const Aabb& bounds, float maxDistance) const
+{
+	using namespace DirectX;
+
+	XMVECTOR t1 = XMVectorMultiply(XMVectorSubtract(XMLoadFloat3(&bounds.Min), Origin), InverseDirection);
+	XMVECTOR t2 = XMVectorMultiply(XMVectorSubtract(XMLoadFloat3(&bounds.Max), Origin), InverseDirection);
+
+	XMVECTOR nearDistance = XMVectorMin(t1, t2);
+	XMVECTOR farDistance = XMVectorSelect(XMVectorMax(t1, t2), XMVectorReplicate(maxDistance), XMVectorSelectControl(0, 0, 0, 1));
+
+	nearDistance = XMVectorMax(nearDistance, XMVectorSwizzle<2, 3, 0, 1>(nearDistance));
+	nearDistance = XMVectorMax(nearDistance, XMVectorSwizzle<1, 0, 3, 2>(nearDistance));
+	farDistance = XMVectorMin(farDistance, XMVectorSwizzle<2, 3, 0, 1>(farDistance));
+	farDistance = XMVectorMin(farDistance, XMVectorSwizzle<1, 0, 3, 2>(farDistance));
+
+	float entry = XMVectorGetX(nearDistance);
+	return entry <= XMVectorGetX(farDistance) ? entry : -1.0f;
+}
+
+BvhProxy DynamicBvh::Insert(const Aabb& bounds, std::uint64_t userData)
+{
+	BvhProxy leaf = AllocateNode();
+	Node& node = nodes_[leaf];
+	node.Bounds.Min = DirectX::XMFLOAT3(bounds.Min.x - FatMargin, bounds.Min.y - FatMargin, bounds.Min.z - FatMargin);
+	node.Bounds.Max = DirectX::XMFLOAT3(bounds.Max.x + FatMargin, bounds.Max.y + FatMargin, bounds.Max.z + FatMargin);
+	node.UserData = userData;
+	node.Height = 0;
+
+	InsertLeaf(leaf);
+	++proxyCount_;
+	return leaf;
+}
+
+void DynamicBvh::Remove(BvhProxy proxy)
+{
+	assert(proxy >= 0 && proxy < static_cast<BvhProxy>(nodes_.size()) && nodes_[proxy].IsLeaf());
+
+	RemoveLeaf(proxy);
+	FreeNode(proxy);
+	--proxyCount_;
+}
+
+bool DynamicBvh::Move(BvhProxy proxy, const Aabb& bounds)
+{
+	assert(proxy >= 0 && proxy < static_cast<BvhProxy>(nodes_.size()) && nodes_[proxy].IsLeaf());
+
+	if (nodes_[proxy].Bounds.Contains(bounds)) {
+		return false;
+	}
+
+	RemoveLeaf(proxy);
+	Node& node = nodes_[proxy];
+	node.Bounds.Min = DirectX::XMFLOAT3(bounds.Min.x - FatMargin, bounds.Min.y - FatMargin, bounds.Min.z - FatMargin);
+	node.Bounds.Max = DirectX::XMFLOAT3(bounds.Max.x + FatMargin, bounds.Max.y + FatMargin, bounds.Max.z + FatMargin);
+	InsertLeaf(proxy);
+	return true;
+}
+
+void DynamicBvh::Clear()
+{
+	nodes_.clear();
+	root_ = NullProxy;
+	freeList_ = NullProxy;
+	proxyCount_ = 0;
+}
+
+float DynamicBvh::AreaRatio() const
+{
+	if (root_ == NullProxy) {
+		return 0.0f;
+	}
+
+	float totalArea = 0.0f;
+	for (const Node& node : nodes_) {
+		if (node.Height > 0) {
+			totalArea += node.Bounds.SurfaceArea();
+		}
+	}
+	float rootArea = nodes_[root_].Bounds.SurfaceArea();
+	return rootArea > 0.0f ? totalArea / rootArea : 0.0f;
+}
+
+BvhProxy DynamicBvh::AllocateNode()
+{
+	if (freeList_ == NullProxy) {
+		nodes_.emplace_back();
+		return static_cast<BvhProxy>(nodes_.size() - 1);
+	}
+
+	BvhProxy node = freeList_;
+	freeList_ = nodes_[node].Parent;
+	nodes_[node] = Node();
+	return node;
+}
+
+void DynamicBvh::FreeNode(BvhProxy node)
+{
+	nodes_[node].Parent = freeList_;
+	nodes_[node].Height = -1;
+	freeList_ = node;
+}
+
+void DynamicBvh::InsertLeaf(BvhProxy leaf)
+{
+	if (root_ == NullProxy) {
+		root_ = leaf;
+		nodes_[root_].Parent = NullProxy;
+		return;
+	}
+
+	// Walk down to the sibling where the new leaf adds the least area. Going
+	// down a level costs the growth of the node passed through; stopping
+	// creates a new parent over the node and the leaf.
+	const Aabb& leafBounds = nodes_[leaf].Bounds;
+	BvhProxy index = root_;
+	while (!nodes_[index].IsLeaf()) {
+		const Node& node = nodes_[index];
+		float area = node.Bounds.SurfaceArea();
+		float combinedArea = Aabb::Union(node.Bounds, leafBounds).SurfaceArea();
+
+		float cost = 2.0f * combinedArea;
+		float inheritanceCost = 2.0f * (combinedArea - area);
+
+		auto descendCost = [&](BvhProxy child) {
+			const Node& childNode = nodes_[child];
+			float childCost = Aabb::Union(childNode.Bounds, leafBounds).SurfaceArea();
+			if (!childNode.IsLeaf()) {
+				childCost -= childNode.Bounds.SurfaceArea();
+			}
+			return childCost + inheritanceCost;
+		};
+		float cost1 = descendCost(node.Child1);
+		float cost2 = descendCost(node.Child2);
+
+		if (cost < cost1 && cost < cost2) {
+			break;
+		}
+		index = cost1 < cost2 ? node.Child1 : node.Child2;
+	}
+
+	BvhProxy sibling = index;
+	BvhProxy oldParent = nodes_[sibling].Parent;
+	BvhProxy newParent = AllocateNode();
+
+	Node& parent = nodes_[newParent];
+	parent.Parent = oldParent;
+	parent.Bounds = Aabb::Union(nodes_[sibling].Bounds, nodes_[leaf].Bounds);
+	parent.Height = nodes_[sibling].Height + 1;
+	parent.Child1 = sibling;
+	parent.Child2 = leaf;
+	nodes_[sibling].Parent = newParent;
+	nodes_[leaf].Parent = newParent;
+
+	if (oldParent != NullProxy) {
+		if (nodes_[oldParent].Child1 == sibling) {
+			nodes_[oldParent].Child1 = newParent;
+		}
+		else {
+			nodes_[oldParent].Child2 = newParent;
+		}
+	}
+	else {
+		root_ = newParent;
+	}
+
+	FixUpwards(nodes_[leaf].Parent);
+}
+
+void DynamicBvh::RemoveLeaf(BvhProxy leaf)
+{
+	if (leaf == root_) {
+		root_ = NullProxy;
+		return;
+	}
+
+	BvhProxy parent = nodes_[leaf].Parent;
+	BvhProxy grandParent = nodes_[parent].Parent;
+	BvhProxy sibling = nodes_[parent].Child1 == leaf ? nodes_[parent].Child2 : nodes_[parent].Child1;
+
+	FreeNode(parent);
+	nodes_[sibling].Parent = grandParent;
+	if (grandParent == NullProxy) {
+		root_ = sibling;
+		return;
+	}
+
+	if (nodes_[grandParent].Child1 == parent) {
+		nodes_[grandParent].Child1 = sibling;
+	}
+	else {
+		nodes_[grandParent].Child2 = sibling;
+	}
+	FixUpwards(grandParent);
+}
+
+void DynamicBvh::FixUpwards(BvhProxy index)
+{
+	while (index != NullProxy) {
+		index = Balance(index);
+		Refit(index);
+		Rotate(index);
+		index = nodes_[index].Parent;
+	}
+}
+
+void DynamicBvh::Refit(BvhProxy index)
+{
+	Node& node = nodes_[index];
+	const Node& child1 = nodes_[node.Child1];
+	const Node& child2 = nodes_[node.Child2];
+	node.Bounds = Aabb::Union(child1.Bounds, child2.Bounds);
+	node.Height = 1 + std::max(child1.Height, child2.Height);
+}
+
+// Lifts the taller child of index into its place when the heights of its
+// subtrees differ by more than one. Keeps the tree shallow where surface
+// area alone cannot, e.g. for many identical boxes. Returns the node now at
+// index's position.
+BvhProxy DynamicBvh::Balance(BvhProxy indexA)
+{
+	Node& a = nodes_[indexA];
+	if (a.IsLeaf()) {
+		return indexA;
+	}
+
+	BvhProxy indexB = a.Child1;
+	BvhProxy indexC = a.Child2;
+	int balance = nodes_[indexC].Height - nodes_[indexB].Height;
+	if (balance >= -1 && balance <= 1) {
+		return indexA;
+	}
+
+	// Child is the taller one, stays the shorter one.
+	BvhProxy child = balance > 1 ? indexC : indexB;
+	BvhProxy stays = balance > 1 ? indexB : indexC;
+	Node& c = nodes_[child];
+	BvhProxy indexF = c.Child1;
+	BvhProxy indexG = c.Child2;
+
+	// The child takes a's place and a becomes its child.
+	c.Child1 = indexA;
+	c.Parent = a.Parent;
+	a.Parent = child;
+	if (c.Parent != NullProxy) {
+		if (nodes_[c.Parent].Child1 == indexA) {
+			nodes_[c.Parent].Child1 = child;
+		}
+		else {
+			nodes_[c.Parent].Child2 = child;
+		}
+	}
+	else {
+		root_ = child;
+	}
+
+	// The child keeps its taller grandchild and hands the other to a.
+	if (nodes_[indexF].Height < nodes_[indexG].Height) {
+		std::swap(indexF, indexG);
+	}
+	c.Child2 = indexF;
+	a.Child1 = stays;
+	a.Child2 = indexG;
+	nodes_[indexG].Parent = indexA;
+
+	Refit(indexA);
+	Refit(child);
+	return child;
+}
+
+// Swaps a child of index with a grandchild on the other side if that reduces
+// the surface area of the node between them.
+void DynamicBvh::Rotate(BvhProxy indexA)
+{
+	Node& a = nodes_[indexA];
+	BvhProxy indexB = a.Child1;
+	BvhProxy indexC = a.Child2;
+	const Node& b = nodes_[indexB];
+	const Node& c = nodes_[indexC];
+
+	enum class Rotation { None, BF, BG, CD, CE };
+	Rotation best = Rotation::None;
+	float bestGain = 0.0f;
+
+	auto consider = [&](Rotation rotation, float oldArea, const Aabb& first, const Aabb& second) {
+		float gain = oldArea - Aabb::Union(first, second).SurfaceArea();
+		if (gain > bestGain) {
+			best = rotation;
+			bestGain = gain;
+		}
+	};
+
+	if (!c.IsLeaf()) {
+		float area = c.Bounds.SurfaceArea();
+		consider(Rotation::BF, area, b.Bounds, nodes_[c.Child2].Bounds);
+		consider(Rotation::BG, area, b.Bounds, nodes_[c.Child1].Bounds);
+	}
+	if (!b.IsLeaf()) {
+		float area = b.Bounds.SurfaceArea();
+		consider(Rotation::CD, area, c.Bounds, nodes_[b.Child2].Bounds);
+		consider(Rotation::CE, area, c.Bounds, nodes_[b.Child1].Bounds);
+	}
+
+	// The child of a trades places with a grandchild under the other child.
+	auto swap = [&](BvhProxy child, BvhProxy otherChild, bool grandChildIsFirst) {
+		Node& other = nodes_[otherChild];
+		BvhProxy grandChild = grandChildIsFirst ? other.Child1 : other.Child2;
+
+		if (a.Child1 == child) {
+			a.Child1 = grandChild;
+		}
+		else {
+			a.Child2 = grandChild;
+		}
+		nodes_[grandChild].Parent = indexA;
+
+		if (grandChildIsFirst) {
+			other.Child1 = child;
+		}
+		else {
+			other.Child2 = child;
+		}
+		nodes_[child].Parent = otherChild;
+
+		Refit(otherChild);
+		Refit(indexA);
+	};
+
+	switch (best) {
+	case Rotation::None:
+		break;
+	case Rotation::BF:
+		swap(indexB, indexC, true);
+		break;
+	case Rotation::BG:
+		swap(indexB, indexC, false);
+		break;
+	case Rotation::CD:
+		swap(indexC, indexB, true);
+		break;
+	case Rotation::CE:
+		swap(indexC, indexB, false);
+		break;
+	}
+}
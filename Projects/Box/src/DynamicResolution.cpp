@@ -0,0 +1,101 @@
+module;
+// C
+#include <cmath>
+
+export module core.resolution;
+
+import <algorithm>;
+
+// Chooses the render scale from measured frame times. A PI controller drives
+// the scale towards the frame budget: the proportional term reacts to the
+// current error and the integral term, which also holds the scale, removes
+// the steady-state error. Two kinds of hysteresis keep the scale from
+// hunting: errors inside the dead band are ignored, and the scale only
+// changes in steps of at least MinScaleStep.
+export class ResolutionController
+{
+public:
+	struct Settings
+	{
+		float TargetFrameMilliseconds = 16.0f;
+		float MinScale = 0.5f;
+		float MaxScale = 1.0f;
+
+		float ProportionalGain = 0.15f;
+		float IntegralGain = 0.05f;
+
+		// Relative frame time error treated as on target.
+		float DeadBand = 0.05f;
+		float MinScaleStep = 0.05f;
+
+		// Weight of the newest frame in the smoothed frame time.
+		float Smoothing = 0.2f;
+	};
+
+public:
+	ResolutionController() { Configure(Settings()); }
+	explicit ResolutionController(const Settings& settings) { Configure(settings); }
+
+	void Configure(const Settings& settings);
+	const Settings& GetSettings() const { return settings_; }
+
+	// Feeds one frame time and returns the scale to render the next frame at.
+	float Update(float frameMilliseconds);
+
+	// Back to full scale, e.g. after a pause or a resize.
+	void Reset();
+
+	float Scale() const { return scale_; }
+	float SmoothedFrameMilliseconds() const { return smoothedFrameMilliseconds_; }
+
+private:
+	Settings settings_;
+	float scale_ = 1.0f;
+	float integral_ = 1.0f;
+	float smoothedFrameMilliseconds_ = 0.0f;
+};
+
+module :private;
+
+void ResolutionController::Configure(const Settings& settings)
+{
+	settings_ = settings;
+	settings_.MinScale = std::clamp(settings_.MinScale, 0.1f, 1.0f);
+	settings_.MaxScale = std::clamp(settings_.MaxScale, settings_.MinScale, 1.0f);
+	Reset();
+}
+
+float ResolutionController::Update(float frameMilliseconds)
+{
+	if (smoothedFrameMilliseconds_ <= 0.0f) {
+		smoothedFrameMilliseconds_ = frameMilliseconds;
+	}
+	else {
+		smoothedFrameMilliseconds_ += settings_.Smoothing * (frameMilliseconds - smoothedFrameMilliseconds_);
+	}
+
+	// Positive when there is headroom, negative when over budget.
+	float error = (settings_.TargetFrameMilliseconds - smoothedFrameMilliseconds_) / settings_.TargetFrameMilliseconds;
+	if (std::abs(error) < settings_.DeadBand) {
+		error = 0.0f;
+	}
+
+	// Clamping the integral is the anti-windup: a long stretch at the limit
+	// does not have to be unwound before the scale can move again.
+	integral_ = std::clamp(integral_ + settings_.IntegralGain * error, settings_.MinScale, settings_.MaxScale);
+	float target = std::clamp(integral_ + settings_.ProportionalGain * error, settings_.MinScale, settings_.MaxScale);
+
+	bool atLimit = target == settings_.MinScale || target == settings_.MaxScale;
+	if (std::abs(target - scale_) >= settings_.MinScaleStep || (atLimit && target != scale_)) {
+		scale_ = target;
+	}
+
+	return scale_;
+}
+
+void ResolutionController::Reset()
+{
+	scale_ = settings_.MaxScale;
+	integral_ = settings_.MaxScale;
+	smoothedFrameMilliseconds_ = 0.0f;
+}
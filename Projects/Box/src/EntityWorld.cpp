@@ -0,0 +1,644 @@
+module;
+// C
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+export module core.entities;
+
+import <algorithm>;
+import <array>;
+import <atomic>;
+import <bit>;
+import <functional>;
+import <memory>;
+import <mutex>;
+import <type_traits>;
+import <utility>;
+import <vector>;
+
+import core.threading;
+
+export struct Entity
+{
+	std::uint32_t Index = UINT32_MAX;
+	std::uint32_t Generation = 0;
+
+	bool operator==(const Entity&) const = default;
+};
+
+export constexpr Entity NullEntity{};
+
+export using ComponentMask = std::uint64_t;
+export constexpr std::size_t MaxComponentTypes = 64;
+
+// How an archetype stores one component type without knowing it.
+export struct ComponentInfo
+{
+	std::uint32_t Id;
+	std::uint32_t Size;
+	std::uint32_t Alignment;
+	// Move constructs destination from source, then destroys source.
+	void (*Relocate)(void* destination, void* source);
+	void (*Destroy)(void* component);
+};
+
+inline std::uint32_t NextComponentId()
+{
+	static std::atomic<std::uint32_t> next = 0;
+	return next++;
+}
+
+// Ids are handed out on first use, so they differ from run to run.
+export template <typename T>
+const ComponentInfo& ComponentOf()
+{
+	static_assert(std::is_same_v<T, std::remove_cvref_t<T>>);
+	static const ComponentInfo info{
+		NextComponentId(),
+		sizeof(T),
+		alignof(T),
+		[](void* destination, void* source) {
+			new (destination) T(std::move(*static_cast<T*>(source)));
+			static_cast<T*>(source)->~T();
+		},
+		[](void* component) { static_cast<T*>(component)->~T(); },
+	};
+	assert(info.Id < MaxComponentTypes);
+	return info;
+}
+
+export template <typename... Ts>
+ComponentMask MaskOf()
+{
+	return (ComponentMask(0) | ... | (ComponentMask(1) << ComponentOf<std::remove_cv_t<Ts>>().Id));
+}
+
+// All entities with exactly the same set of components. They are stored in
+// fixed size chunks, and within a chunk every component type has its own
+// array (structure of arrays), so a query walks memory linearly. Rows are
+// kept packed: removing one moves the archetype's last row into the hole.
+export class Archetype
+{
+public:
+	static constexpr std::size_t ChunkBytes = 16 * 1024;
+	static constexpr std::size_t ChunkAlignment = 64;
+
+	struct Chunk
+	{
+		std::byte* Data = nullptr;
+		std::uint32_t Count = 0;
+	};
+
+public:
+	Archetype(ComponentMask mask, std::vector<const ComponentInfo*> components);
+	~Archetype();
+
+	Archetype(const Archetype&) = delete;
+	Archetype& operator=(const Archetype&) = delete;
+
+	ComponentMask Mask() const { return mask_; }
+	const std::vector<const ComponentInfo*>& Components() const { return components_; }
+	bool Has(std::uint32_t componentId) const { return (mask_ >> componentId) & 1; }
+
+	std::uint32_t ChunkCapacity() const { return capacity_; }
+	std::size_t ChunkCount() const { return chunks_.size(); }
+	const Chunk& GetChunk(std::size_t index) const { return chunks_[index]; }
+	std::size_t Count() const;
+
+	Entity* Entities(const Chunk& chunk) const { return reinterpret_cast<Entity*>(chunk.Data); }
+
+	void* Component(const Chunk& chunk, std::uint32_t row, std::uint32_t componentId) const
+	{
+		assert(Has(componentId));
+		return chunk.Data + offsets_[componentId] + row * sizes_[componentId];
+	}
+
+	template <typename T>
+	T* Components(const Chunk& chunk) const
+	{
+		return static_cast<T*>(Component(chunk, 0, ComponentOf<std::remove_cv_t<T>>().Id));
+	}
+
+	// Appends a row for entity. Its components are left unconstructed.
+	std::pair<std::uint32_t, std::uint32_t> Allocate(Entity entity);
+
+	// Fills the hole left by a row whose components were already destroyed or
+	// moved out. Returns the entity moved into the hole, or NullEntity.
+	Entity Free(std::uint32_t chunk, std::uint32_t row);
+
+private:
+	ComponentMask mask_;
+	std::vector<const ComponentInfo*> components_;
+	std::array<std::uint32_t, MaxComponentTypes> offsets_;
+	std::array<std::uint32_t, MaxComponentTypes> sizes_;
+	std::uint32_t capacity_ = 0;
+	std::size_t chunkBytes_ = ChunkBytes;
+	std::vector<Chunk> chunks_;
+};
+
+export class EntityWorld;
+
+// Structural changes recorded while the world is being iterated, applied
+// later by EntityWorld::Playback(). Safe to record into from several
+// threads. Commands on entities that are gone by playback are ignored.
+export class CommandBuffer
+{
+public:
+	template <typename... Ts>
+	void Create(Ts... components);
+	void Destroy(Entity entity);
+	template <typename T>
+	void Add(Entity entity, T component);
+	template <typename T>
+	void Remove(Entity entity);
+
+	bool Empty() const { return commands_.empty(); }
+
+private:
+	friend class EntityWorld;
+
+	void Record(std::function<void(EntityWorld&)> command);
+
+private:
+	std::mutex mutex_;
+	std::vector<std::function<void(EntityWorld&)>> commands_;
+};
+
+// Entities grouped into archetypes by their component set. Queries name the
+// component types they need and visit every archetype that has them, one
+// chunk at a time.
+//
+// Entities may not be created, destroyed or change their component set while
+// a query runs; record those into a CommandBuffer instead.
+export class EntityWorld
+{
+public:
+	explicit EntityWorld(ThreadPool* threadPool = ThreadPool::Default());
+
+	EntityWorld(const EntityWorld&) = delete;
+	EntityWorld& operator=(const EntityWorld&) = delete;
+
+	template <typename... Ts>
+	Entity Create(Ts... components);
+	void Destroy(Entity entity);
+	bool IsAlive(Entity entity) const;
+
+	// Replaces the component if the entity already has one.
+	template <typename T>
+	void Add(Entity entity, T component);
+	template <typename T>
+	void Remove(Entity entity);
+	template <typename T>
+	bool Has(Entity entity) const;
+	// The pointer is invalidated by any structural change.
+	template <typename T>
+	T* Get(Entity entity);
+
+	std::size_t EntityCount() const { return entityCount_; }
+	std::size_t ArchetypeCount() const { return archetypes_.size(); }
+
+	// function(Ts&...) for every entity that has all of Ts.
+	template <typename... Ts, typename Function>
+	void ForEach(Function&& function);
+
+	// function(count, entities, Ts*...) for every chunk that has all of Ts.
+	// The arrays are count long and contiguous.
+	template <typename... Ts, typename Function>
+	void ForEachChunk(Function&& function);
+
+	// As above, with chunks spread over the thread pool. function is called
+	// concurrently and must only touch its own chunk.
+	template <typename... Ts, typename Function>
+	void ParallelForEach(Function&& function);
+	template <typename... Ts, typename Function>
+	void ParallelForEachChunk(Function&& function);
+
+	void Playback(CommandBuffer& commands);
+
+private:
+	struct Record
+	{
+		Archetype* Owner = nullptr;
+		std::uint32_t Chunk = 0;
+		std::uint32_t Row = 0;
+		std::uint32_t Generation = 0;
+	};
+
+	struct Query
+	{
+		ComponentMask Mask = 0;
+		std::size_t ArchetypeCount = 0;
+		std::vector<Archetype*> Archetypes;
+	};
+
+	Archetype& FindArchetype(ComponentMask mask, std::vector<const ComponentInfo*> components);
+	const std::vector<Archetype*>& Match(ComponentMask mask);
+	Entity AllocateEntity();
+	void Place(Entity entity, Archetype& archetype);
+	// Moves the entity to archetype, keeping the components both share and
+	// destroying the rest.
+	void MoveEntity(Entity entity, Archetype& archetype);
+	void* Component(Entity entity, std::uint32_t componentId) const;
+
+private:
+	ThreadPool* threadPool_;
+
+	std::vector<std::unique_ptr<Archetype>> archetypes_;
+	std::vector<Query> queries_;
+
+	std::vector<Record> records_;
+	std::vector<std::uint32_t> freeIndices_;
+	std::size_t entityCount_ = 0;
+
+	std::vector<std::pair<Archetype*, std::size_t>> parallelChunks_;
+};
+
+template <typename... Ts>
+void CommandBuffer::Create(Ts... components)
+{
+	Record([... components = std::move(components)](EntityWorld& world) mutable {
+		world.Create(std::move(components)...);
+	});
+}
+
+template <typename T>
+void CommandBuffer::Add(Entity entity, T component)
+{
+	Record([entity, component = std::move(component)](EntityWorld& world) mutable {
+		if (world.IsAlive(entity)) {
+			world.Add(entity, std::move(component));
+		}
+	});
+}
+
+template <typename T>
+void CommandBuffer::Remove(Entity entity)
+{
+	Record([entity](EntityWorld& world) {
+		if (world.IsAlive(entity)) {
+			world.Remove<T>(entity);
+		}
+	});
+}
+
+template <typename... Ts>
+Entity EntityWorld::Create(Ts... components)
+{
+	ComponentMask mask = MaskOf<Ts...>();
+	assert(std::popcount(mask) == sizeof...(Ts));
+
+	Entity entity = AllocateEntity();
+	Archetype& archetype = FindArchetype(mask, { &ComponentOf<Ts>()... });
+	Place(entity, archetype);
+
+	const Record& record = records_[entity.Index];
+	const Archetype::Chunk& chunk = archetype.GetChunk(record.Chunk);
+	(new (archetype.Components<Ts>(chunk) + record.Row) Ts(std::move(components)), ...);
+	return entity;
+}
+
+template <typename T>
+void EntityWorld::Add(Entity entity, T component)
+{
+	assert(IsAlive(entity));
+
+	const ComponentInfo& info = ComponentOf<T>();
+	if (T* existing = Get<T>(entity)) {
+		*existing = std::move(component);
+		return;
+	}
+
+	Archetype& source = *records_[entity.Index].Owner;
+	std::vector<const ComponentInfo*> components = source.Components();
+	components.push_back(&info);
+	MoveEntity(entity, FindArchetype(source.Mask() | (ComponentMask(1) << info.Id), std::move(components)));
+
+	new (Component(entity, info.Id)) T(std::move(component));
+}
+
+template <typename T>
+void EntityWorld::Remove(Entity entity)
+{
+	assert(IsAlive(entity));
+
+	const ComponentInfo& info = ComponentOf<T>();
+	Archetype& source = *records_[entity.Index].Owner;
+	if (!source.Has(info.Id)) {
+		return;
+	}
+
+	std::vector<const ComponentInfo*> components = source.Components();
+	std::erase(components, &info);
+	MoveEntity(entity, FindArchetype(source.Mask() & ~(ComponentMask(1) << info.Id), std::move(components)));
+}
+
+template <typename T>
+bool EntityWorld::Has(Entity entity) const
+{
+	return IsAlive(entity) && records_[entity.Index].Owner->Has(ComponentOf<T>().Id);
+}
+
+template <typename T>
+T* EntityWorld::Get(Entity entity)
+{
+	return Has<T>(entity) ? static_cast<T*>(Component(entity, ComponentOf<T>().Id)) : nullptr;
+}
+
+template <typename... Ts, typename Function>
+void EntityWorld::ForEach(Function&& function)
+{
+	ForEachChunk<Ts...>([&function](std::size_t count, const Entity*, Ts*... components) {
+		for (std::size_t i = 0; i < count; ++i) {
+			function(components[i]...);
+		}
+	});
+}
+
+template <typename... Ts, typename Function>
+void EntityWorld::ForEachChunk(Function&& function)
+{
+	for (Archetype* archetype : Match(MaskOf<Ts...>())) {
+		for (std::size_t i = 0; i < archetype->ChunkCount(); ++i) {
+			const Archetype::Chunk& chunk = archetype->GetChunk(i);
+			function(static_cast<std::size_t>(chunk.Count), archetype->Entities(chunk), archetype->template Components<Ts>(chunk)...);
+		}
+	}
+}
+
+template <typename... Ts, typename Function>
+void EntityWorld::ParallelForEach(Function&& function)
+{
+	ParallelForEachChunk<Ts...>([&function](std::size_t count, const Entity*, Ts*... components) {
+		for (std::size_t i = 0; i < count; ++i) {
+			function(components[i]...);
+		}
+	});
+}
+
+template <typename... Ts, typename Function>
+void EntityWorld::ParallelForEachChunk(Function&& function)
+{
+	parallelChunks_.clear();
+	for (Archetype* archetype : Match(MaskOf<Ts...>())) {
+		for (std::size_t i = 0; i < archetype->ChunkCount(); ++i) {
+			parallelChunks_.emplace_back(archetype, i);
+		}
+	}
+
+	threadPool_->ParallelFor(parallelChunks_.size(), [this, &function](std::size_t index) {
+		auto [archetype, chunkIndex] = parallelChunks_[index];
+		const Archetype::Chunk& chunk = archetype->GetChunk(chunkIndex);
+		function(static_cast<std::size_t>(chunk.Count), archetype->Entities(chunk), archetype->template Components<Ts>(chunk)...);
+	});
+}
+
+module :private;
+
+namespace
+{
+	std::size_t AlignUp(std::size_t value, std::size_t alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+}
+
+Archetype::Archetype(ComponentMask mask, std::vector<const ComponentInfo*> components)
+	: mask_(mask), components_(std::move(components))
+{
+	// Largest alignment first keeps the padding between arrays small.
+	std::sort(components_.begin(), components_.end(), [](const ComponentInfo* a, const ComponentInfo* b) {
+		return a->Alignment != b->Alignment ? a->Alignment > b->Alignment : a->Id < b->Id;
+	});
+	offsets_.fill(UINT32_MAX);
+	sizes_.fill(0);
+
+	std::size_t rowBytes = sizeof(Entity);
+	for (const ComponentInfo* component : components_) {
+		rowBytes += component->Size;
+		sizes_[component->Id] = component->Size;
+	}
+
+	auto layout = [this](std::size_t capacity) {
+		std::size_t offset = capacity * sizeof(Entity);
+		for (const ComponentInfo* component : components_) {
+			offset = AlignUp(offset, component->Alignment);
+			offsets_[component->Id] = static_cast<std::uint32_t>(offset);
+			offset += capacity * component->Size;
+		}
+		return offset;
+	};
+
+	// Entities too large for a chunk get a chunk of their own.
+	std::size_t capacity = std::max<std::size_t>(ChunkBytes / rowBytes, 1);
+	while (capacity > 1 && layout(capacity) > ChunkBytes) {
+		--capacity;
+	}
+	capacity_ = static_cast<std::uint32_t>(capacity);
+	chunkBytes_ = std::max(layout(capacity), ChunkBytes);
+}
+
+Archetype::~Archetype()
+{
+	for (Chunk& chunk : chunks_) {
+		for (const ComponentInfo* component : components_) {
+			for (std::uint32_t row = 0; row < chunk.Count; ++row) {
+				component->Destroy(Component(chunk, row, component->Id));
+			}
+		}
+		::operator delete(chunk.Data, std::align_val_t(ChunkAlignment));
+	}
+}
+
+std::size_t Archetype::Count() const
+{
+	return chunks_.empty() ? 0 : (chunks_.size() - 1) * capacity_ + chunks_.back().Count;
+}
+
+std::pair<std::uint32_t, std::uint32_t> Archetype::Allocate(Entity entity)
+{
+	if (chunks_.empty() || chunks_.back().Count == capacity_) {
+		Chunk& chunk = chunks_.emplace_back();
+		chunk.Data = static_cast<std::byte*>(::operator new(chunkBytes_, std::align_val_t(ChunkAlignment)));
+	}
+
+	Chunk& chunk = chunks_.back();
+	std::uint32_t row = chunk.Count++;
+	Entities(chunk)[row] = entity;
+	return { static_cast<std::uint32_t>(chunks_.size() - 1), row };
+}
+
+Entity Archetype::Free(std::uint32_t chunkIndex, std::uint32_t row)
+{
+	Chunk& last = chunks_.back();
+	std::uint32_t lastRow = last.Count - 1;
+	Entity moved = NullEntity;
+
+	if (chunkIndex != chunks_.size() - 1 || row != lastRow) {
+		Chunk& chunk = chunks_[chunkIndex];
+		for (const ComponentInfo* component : components_) {
+			component->Relocate(Component(chunk, row, component->Id), Component(last, lastRow, component->Id));
+		}
+		moved = Entities(last)[lastRow];
+		Entities(chunk)[row] = moved;
+	}
+
+	if (--last.Count == 0) {
+		::operator delete(last.Data, std::align_val_t(ChunkAlignment));
+		chunks_.pop_back();
+	}
+	return moved;
+}
+
+void CommandBuffer::Destroy(Entity entity)
+{
+	Record([entity](EntityWorld& world) {
+		if (world.IsAlive(entity)) {
+			world.Destroy(entity);
+		}
+	});
+}
+
+void CommandBuffer::Record(std::function<void(EntityWorld&)> command)
+{
+	std::lock_guard lock(mutex_);
+	commands_.push_back(std::move(command));
+}
+
+EntityWorld::EntityWorld(ThreadPool* threadPool)
+	: threadPool_(threadPool)
+{
+}
+
+void EntityWorld::Destroy(Entity entity)
+{
+	assert(IsAlive(entity));
+
+	Record& record = records_[entity.Index];
+	Archetype& archetype = *record.Owner;
+	const Archetype::Chunk& chunk = archetype.GetChunk(record.Chunk);
+	for (const ComponentInfo* component : archetype.Components()) {
+		component->Destroy(archetype.Component(chunk, record.Row, component->Id));
+	}
+
+	Entity moved = archetype.Free(record.Chunk, record.Row);
+	if (moved != NullEntity) {
+		records_[moved.Index].Chunk = record.Chunk;
+		records_[moved.Index].Row = record.Row;
+	}
+
+	record.Owner = nullptr;
+	++record.Generation;
+	freeIndices_.push_back(entity.Index);
+	--entityCount_;
+}
+
+bool EntityWorld::IsAlive(Entity entity) const
+{
+	return entity.Index < records_.size() && records_[entity.Index].Generation == entity.Generation && records_[entity.Index].Owner;
+}
+
+void EntityWorld::Playback(CommandBuffer& commands)
+{
+	std::vector<std::function<void(EntityWorld&)>> recorded;
+	{
+		std::lock_guard lock(commands.mutex_);
+		recorded.swap(commands.commands_);
+	}
+
+	for (auto& command : recorded) {
+		command(*this);
+	}
+
+	// Hand the storage back so the next frame's commands do not allocate.
+	recorded.clear();
+	std::lock_guard lock(commands.mutex_);
+	if (commands.commands_.empty()) {
+		commands.commands_.swap(recorded);
+	}
+}
+
+Archetype& EntityWorld::FindArchetype(ComponentMask mask, std::vector<const ComponentInfo*> components)
+{
+	for (auto& archetype : archetypes_) {
+		if (archetype->Mask() == mask) {
+			return *archetype;
+		}
+	}
+	return *archetypes_.emplace_back(std::make_unique<Archetype>(mask, std::move(components)));
+}
+
+const std::vector<Archetype*>& EntityWorld::Match(ComponentMask mask)
+{
+	auto query = std::find_if(queries_.begin(), queries_.end(), [mask](const Query& query) { return query.Mask == mask; });
+	if (query == queries_.end()) {
+		query = queries_.insert(queries_.end(), Query{ mask });
+	}
+
+	// Archetypes are never removed, so only the new ones need checking.
+	for (; query->ArchetypeCount < archetypes_.size(); ++query->ArchetypeCount) {
+		Archetype* archetype = archetypes_[query->ArchetypeCount].get();
+		if ((archetype->Mask() & mask) == mask) {
+			query->Archetypes.push_back(archetype);
+		}
+	}
+	return query->Archetypes;
+}
+
+Entity EntityWorld::AllocateEntity()
+{
+	std::uint32_t index;
+	if (!freeIndices_.empty()) {
+		index = freeIndices_.back();
+		freeIndices_.pop_back();
+	}
+	else {
+		index = static_cast<std::uint32_t>(records_.size());
+		records_.emplace_back();
+	}
+
+	++entityCount_;
+	return Entity{ index, records_[index].Generation };
+}
+
+void EntityWorld::Place(Entity entity, Archetype& archetype)
+{
+	auto [chunk, row] = archetype.Allocate(entity);
+	Record& record = records_[entity.Index];
+	record.Owner = &archetype;
+	record.Chunk = chunk;
+	record.Row = row;
+}
+
+void EntityWorld::MoveEntity(Entity entity, Archetype& archetype)
+{
+	Record source = records_[entity.Index];
+	const Archetype::Chunk& sourceChunk = source.Owner->GetChunk(source.Chunk);
+
+	Place(entity, archetype);
+	const Record& target = records_[entity.Index];
+	const Archetype::Chunk& targetChunk = archetype.GetChunk(target.Chunk);
+
+	for (const ComponentInfo* component : source.Owner->Components()) {
+		void* from = source.Owner->Component(sourceChunk, source.Row, component->Id);
+		if (archetype.Has(component->Id)) {
+			component->Relocate(archetype.Component(targetChunk, target.Row, component->Id), from);
+		}
+		else {
+			component->Destroy(from);
+		}
+	}
+
+	Entity moved = source.Owner->Free(source.Chunk, source.Row);
+	if (moved != NullEntity) {
+		records_[moved.Index].Chunk = source.Chunk;
+		records_[moved.Index].Row = source.Row;
+	}
+}
+
+void* EntityWorld::Component(Entity entity, std::uint32_t componentId) const
+{
+	const Record& record = records_[entity.Index];
+	return record.Owner->Component(record.Owner->GetChunk(record.Chunk), record.Row, componentId);
+}
@@ -0,0 +1,156 @@
+module;
+// C
+#include <cstdint>
+
+export module core.pacing;
+
+import <algorithm>;
+import <chrono>;
+import <thread>;
+
+// Time source for FramePacer. Replaceable so pacing can be driven by a fake
+// clock instead of real time.
+export class PacingClock
+{
+public:
+	using Duration = std::chrono::nanoseconds;
+	using TimePoint = std::chrono::time_point<std::chrono::steady_clock, Duration>;
+
+	virtual ~PacingClock() = default;
+
+	virtual TimePoint Now() = 0;
+
+	// Coarse wait. May return late by up to the scheduler granularity.
+	virtual void Sleep(Duration duration) = 0;
+
+	// Called while busy-waiting for the last stretch before a deadline.
+	virtual void Spin() = 0;
+};
+
+export class SteadyPacingClock : public PacingClock
+{
+public:
+	static SteadyPacingClock& Get();
+
+	TimePoint Now() override { return std::chrono::steady_clock::now(); }
+	void Sleep(Duration duration) override { std::this_thread::sleep_for(duration); }
+	void Spin() override { std::this_thread::yield(); }
+};
+
+// Caps the frame rate by waiting until the next frame deadline. Deadlines
+// advance by a fixed period rather than from when the wait returned, so
+// wake-up errors do not accumulate. The wait sleeps until SpinThreshold
+// before the deadline and spins for the rest, since sleeping alone can
+// overshoot by a whole scheduler tick.
+export class FramePacer
+{
+public:
+	struct Settings
+	{
+		// Zero means uncapped.
+		double TargetFps = 0.0;
+		bool VSync = false;
+		// Frames the swap chain may queue ahead of the display.
+		std::uint32_t MaxFrameLatency = 2;
+		PacingClock::Duration SpinThreshold = std::chrono::microseconds(1500);
+	};
+
+public:
+	explicit FramePacer(PacingClock& clock = SteadyPacingClock::Get());
+
+	void Configure(const Settings& settings);
+	const Settings& GetSettings() const { return settings_; }
+
+	// Blocks until the next frame is due and returns the time waited.
+	PacingClock::Duration Wait();
+
+	// Forgets the schedule, e.g. after a pause.
+	void Reset();
+
+	// Time between the last two returns from Wait().
+	PacingClock::Duration LastFrameInterval() const { return lastInterval_; }
+
+	// How far the last frame started from its deadline.
+	PacingClock::Duration LastFrameError() const { return lastError_; }
+
+private:
+	PacingClock& clock_;
+	Settings settings_;
+	PacingClock::Duration period_ = PacingClock::Duration::zero();
+
+	PacingClock::TimePoint deadline_;
+	PacingClock::TimePoint lastFrameStart_;
+	bool scheduled_ = false;
+
+	PacingClock::Duration lastInterval_ = PacingClock::Duration::zero();
+	PacingClock::Duration lastError_ = PacingClock::Duration::zero();
+};
+
+module :private;
+
+SteadyPacingClock& SteadyPacingClock::Get()
+{
+	static SteadyPacingClock clock;
+	return clock;
+}
+
+FramePacer::FramePacer(PacingClock& clock)
+	: clock_(clock)
+{
+}
+
+void FramePacer::Configure(const Settings& settings)
+{
+	settings_ = settings;
+	settings_.MaxFrameLatency = std::clamp<std::uint32_t>(settings_.MaxFrameLatency, 1, 16);
+
+	period_ = settings_.TargetFps > 0.0
+		? std::chrono::duration_cast<PacingClock::Duration>(std::chrono::duration<double>(1.0 / settings_.TargetFps))
+		: PacingClock::Duration::zero();
+	Reset();
+}
+
+PacingClock::Duration FramePacer::Wait()
+{
+	PacingClock::TimePoint start = clock_.Now();
+
+	if (period_ > PacingClock::Duration::zero()) {
+		if (!scheduled_) {
+			deadline_ = start;
+			scheduled_ = true;
+		}
+
+		// More than a frame behind: start a new schedule instead of rushing
+		// out frames to catch up.
+		if (start - deadline_ > period_) {
+			deadline_ = start;
+		}
+
+		PacingClock::TimePoint now = start;
+		if (deadline_ - now > settings_.SpinThreshold) {
+			clock_.Sleep(deadline_ - now - settings_.SpinThreshold);
+			now = clock_.Now();
+		}
+		while (now < deadline_) {
+			clock_.Spin();
+			now = clock_.Now();
+		}
+	}
+
+	PacingClock::TimePoint frameStart = clock_.Now();
+	lastError_ = scheduled_ ? frameStart - deadline_ : PacingClock::Duration::zero();
+	lastInterval_ = lastFrameStart_ != PacingClock::TimePoint() ? frameStart - lastFrameStart_ : PacingClock::Duration::zero();
+	lastFrameStart_ = frameStart;
+
+	if (scheduled_) {
+		deadline_ += period_;
+	}
+
+	return frameStart - start;
+}
+
+void FramePacer::Reset()
+{
+	scheduled_ = false;
+	lastFrameStart_ = PacingClock::TimePoint();
+}
@@ -0,0 +1,520 @@
+module;
+// C
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <tmmintrin.h>
+
+// Windows
+#include <d3d11.h>
+#include <wrl.h>
+
+export module render.readback;
+
+import <algorithm>;
+import <array>;
+import <atomic>;
+import <condition_variable>;
+import <filesystem>;
+import <format>;
+import <fstream>;
+import <map>;
+import <memory>;
+import <mutex>;
+import <span>;
+import <utility>;
+import <vector>;
+
+import core.threading;
+import diagnostics.log;
+import resource.png;
+import utility;
+
+// Converts an RGBA8 image to planar YUV 4:2:0 with BT.601 full range
+// coefficients, as JPEG and Y4M's C420jpeg use. Each chroma sample is taken
+// from the average of its 2x2 block. u and v are (width + 1) / 2 wide.
+export void ConvertRgbaToI420(const std::uint8_t* rgba, std::size_t pitch, int width, int height, bool bgra,
+	std::uint8_t* y, std::uint8_t* u, std::uint8_t* v);
+
+// Reads finished frames back from the GPU for screenshots and video without
+// stalling. Each captured frame is copied into the next staging texture of
+// a ring and mapped a few frames later, once the copy has certainly
+// completed. Maps never wait: if the GPU is that far behind, or the encoders
+// have no buffer free, the frame is dropped and counted instead.
+//
+// Conversion and encoding run on a pool of their own. Sharing the default
+// pool would put disk writes in front of the ParallelFor() helpers the
+// frame itself waits for.
+export class FrameReadback
+{
+public:
+	struct Statistics
+	{
+		std::uint64_t Captured = 0;
+		std::uint64_t Dropped = 0;
+		std::uint64_t Written = 0;
+	};
+
+public:
+	explicit FrameReadback(unsigned int encoderThreads = 2);
+	~FrameReadback();
+
+	FrameReadback(const FrameReadback&) = delete;
+	FrameReadback& operator=(const FrameReadback&) = delete;
+
+	// latency is how many frames behind frames are mapped.
+	void Initialize(ID3D11Device* device, std::size_t latency = 3);
+
+	// Writes the next captured frame to a PNG.
+	void Screenshot(const std::filesystem::path& path);
+
+	// Writes every captured frame to a Y4M video, raw YUV 4:2:0 that ffmpeg
+	// and most players read. Frames of another size than the first are dropped.
+	bool StartVideo(const std::filesystem::path& path, int framesPerSecond = 60);
+	void StopVideo();
+	bool IsRecordingVideo() const { return video_ != nullptr; }
+
+	// Call once per frame with the finished frame, on the thread that owns
+	// context. Only copies when a screenshot or video wants the frame.
+	void Capture(ID3D11DeviceContext* context, ID3D11Texture2D* frame);
+
+	// Reads back every frame in flight, waiting for the GPU, and waits until
+	// they are written.
+	void Flush(ID3D11DeviceContext* context);
+
+	Statistics GetStatistics() const;
+
+private:
+	struct VideoStream
+	{
+		std::mutex Mutex;
+		std::ofstream File;
+		int Width = 0;
+		int Height = 0;
+		// Frames are converted in parallel but written in order.
+		std::uint64_t NextFrame = 0;
+		std::uint64_t SubmittedFrames = 0;
+		std::map<std::uint64_t, std::vector<std::uint8_t>> Converted;
+	};
+
+	struct Slot
+	{
+		Microsoft::WRL::ComPtr<ID3D11Texture2D> Staging;
+		D3D11_TEXTURE2D_DESC Desc{};
+		bool InFlight = false;
+		std::filesystem::path Screenshot;
+		std::shared_ptr<VideoStream> Video;
+	};
+
+	struct Frame
+	{
+		std::vector<std::uint8_t> Pixels;
+		int Width = 0;
+		int Height = 0;
+		bool Bgra = false;
+		std::filesystem::path Screenshot;
+		std::shared_ptr<VideoStream> Video;
+		std::uint64_t VideoFrame = 0;
+	};
+
+	void ReadCompleted(ID3D11DeviceContext* context, bool wait);
+	void Encode(Frame& frame);
+	bool AcquireBuffer(std::vector<std::uint8_t>& buffer);
+	void ReleaseBuffer(std::vector<std::uint8_t> buffer);
+
+private:
+	ID3D11Device* device_ = nullptr;
+	std::vector<Slot> slots_;
+	std::size_t nextSlot_ = 0;
+
+	std::filesystem::path pendingScreenshot_;
+	std::shared_ptr<VideoStream> video_;
+
+	std::mutex mutex_;
+	std::condition_variable idle_;
+	std::vector<std::vector<std::uint8_t>> freeBuffers_;
+	std::size_t buffersInUse_ = 0;
+	std::size_t maxBuffers_ = 0;
+	std::size_t encoding_ = 0;
+
+	std::atomic<std::uint64_t> captured_ = 0;
+	std::atomic<std::uint64_t> dropped_ = 0;
+	std::atomic<std::uint64_t> written_ = 0;
+
+	// Last, so its workers are gone before the state they use.
+	ThreadPool encoders_;
+};
+
+module :private;
+
+namespace
+{
+	// BT.601 full range in 1.14 fixed point, in R, G, B order.
+	constexpr int FixedShift = 14;
+	constexpr std::array<int, 3> YWeights = { 4899, 9617, 1868 };
+	constexpr std::array<int, 3> UWeights = { -2765, -5427, 8192 };
+	constexpr std::array<int, 3> VWeights = { 8192, -6860, -1332 };
+
+	std::uint8_t ClampByte(int value)
+	{
+		return static_cast<std::uint8_t>(value < 0 ? 0 : value > 255 ? 255 : value);
+	}
+
+	int Weigh(const std::array<int, 3>& weights, int r, int g, int b)
+	{
+		return weights[0] * r + weights[1] * g + weights[2] * b;
+	}
+
+	// madd weights for two pixels of 16-bit RGBA, with red and blue swapped
+	// for BGRA sources.
+	__m128i PixelWeights(const std::array<int, 3>& weights, bool bgra)
+	{
+		short r = static_cast<short>(weights[bgra ? 2 : 0]);
+		short g = static_cast<short>(weights[1]);
+		short b = static_cast<short>(weights[bgra ? 0 : 2]);
+		return _mm_setr_epi16(r, g, b, 0, r, g, b, 0);
+	}
+
+	// Weighted sums of four RGBA8 pixels as 32-bit lanes.
+	__m128i WeighPixels(__m128i pixels, __m128i weights)
+	{
+		__m128i zero = _mm_setzero_si128();
+		__m128i low = _mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), weights);
+		__m128i high = _mm_madd_epi16(_mm_unpackhi_epi8(pixels, zero), weights);
+		return _mm_hadd_epi32(low, high);
+	}
+
+	void ConvertLuma(const std::uint8_t* rgba, std::uint8_t* y, int width, bool bgra)
+	{
+		__m128i weights = PixelWeights(YWeights, bgra);
+		__m128i round = _mm_set1_epi32(1 << (FixedShift - 1));
+
+		int x = 0;
+		for (; x + 16 <= width; x += 16) {
+			__m128i sums[4];
+			for (int i = 0; i < 4; ++i) {
+				__m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgba + (x + i * 4) * 4));
+				sums[i] = _mm_srai_epi32(_mm_add_epi32(WeighPixels(pixels, weights), round), FixedShift);
+			}
+			__m128i words = _mm_packs_epi32(sums[0], sums[1]);
+			__m128i moreWords = _mm_packs_epi32(sums[2], sums[3]);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(y + x), _mm_packus_epi16(words, moreWords));
+		}
+
+		for (; x < width; ++x) {
+			const std::uint8_t* pixel = rgba + x * 4;
+			int r = pixel[bgra ? 2 : 0], g = pixel[1], b = pixel[bgra ? 0 : 2];
+			y[x] = ClampByte((Weigh(YWeights, r, g, b) + (1 << (FixedShift - 1))) >> FixedShift);
+		}
+	}
+
+	// One row of chroma from two rows of pixels. below may equal above for
+	// the last row of an odd height.
+	void ConvertChroma(const std::uint8_t* above, const std::uint8_t* below, std::uint8_t* u, std::uint8_t* v, int width, bool bgra)
+	{
+		// The 2x2 sums are twice the vertical average, hence one more bit.
+		constexpr int Shift = FixedShift + 1;
+		__m128i uWeights = PixelWeights(UWeights, bgra);
+		__m128i vWeights = PixelWeights(VWeights, bgra);
+		__m128i offset = _mm_set1_epi32((128 << Shift) + (1 << (Shift - 1)));
+		__m128i zero = _mm_setzero_si128();
+
+		int x = 0;
+		for (; x + 16 <= width; x += 16) {
+			__m128i us[2];
+			__m128i vs[2];
+			for (int i = 0; i < 2; ++i) {
+				// Eight pixels in two loads. Vertical pairs are averaged as
+				// bytes, horizontal pairs summed as words.
+				__m128i sums[2];
+				for (int j = 0; j < 2; ++j) {
+					int offsetBytes = (x + i * 8 + j * 4) * 4;
+					__m128i rows = _mm_avg_epu8(
+						_mm_loadu_si128(reinterpret_cast<const __m128i*>(above + offsetBytes)),
+						_mm_loadu_si128(reinterpret_cast<const __m128i*>(below + offsetBytes)));
+					__m128i low = _mm_unpacklo_epi8(rows, zero);
+					__m128i high = _mm_unpackhi_epi8(rows, zero);
+					sums[j] = _mm_unpacklo_epi64(_mm_add_epi16(low, _mm_srli_si128(low, 8)), _mm_add_epi16(high, _mm_srli_si128(high, 8)));
+				}
+				// Each 2x2 sum is one 64-bit lane of RGBA words.
+				us[i] = _mm_srai_epi32(_mm_add_epi32(_mm_hadd_epi32(_mm_madd_epi16(sums[0], uWeights), _mm_madd_epi16(sums[1], uWeights)), offset), Shift);
+				vs[i] = _mm_srai_epi32(_mm_add_epi32(_mm_hadd_epi32(_mm_madd_epi16(sums[0], vWeights), _mm_madd_epi16(sums[1], vWeights)), offset), Shift);
+			}
+			__m128i uBytes = _mm_packus_epi16(_mm_packs_epi32(us[0], us[1]), zero);
+			__m128i vBytes = _mm_packus_epi16(_mm_packs_epi32(vs[0], vs[1]), zero);
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(u + x / 2), uBytes);
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(v + x / 2), vBytes);
+		}
+
+		for (; x < width; x += 2) {
+			// The last column of an odd width is its own pair.
+			int right = x + 1 < width ? x + 1 : x;
+			int sum[3];
+			for (int channel = 0; channel < 3; ++channel) {
+				int source = bgra ? 2 - channel : channel;
+				int leftAverage = (above[x * 4 + source] + below[x * 4 + source] + 1) >> 1;
+				int rightAverage = (above[right * 4 + source] + below[right * 4 + source] + 1) >> 1;
+				sum[channel] = leftAverage + rightAverage;
+			}
+			int round = 1 << (Shift - 1);
+			u[x / 2] = ClampByte(((128 << Shift) + Weigh(UWeights, sum[0], sum[1], sum[2]) + round) >> Shift);
+			v[x / 2] = ClampByte(((128 << Shift) + Weigh(VWeights, sum[0], sum[1], sum[2]) + round) >> Shift);
+		}
+	}
+}
+
+void ConvertRgbaToI420(const std::uint8_t* rgba, std::size_t pitch, int width, int height, bool bgra,
+	std::uint8_t* y, std::uint8_t* u, std::uint8_t* v)
+{
+	int chromaWidth = (width + 1) / 2;
+	for (int row = 0; row < height; row += 2) {
+		const std::uint8_t* above = rgba + row * pitch;
+		const std::uint8_t* below = row + 1 < height ? above + pitch : above;
+
+		ConvertLuma(above, y + row * width, width, bgra);
+		if (row + 1 < height) {
+			ConvertLuma(below, y + (row + 1) * width, width, bgra);
+		}
+		ConvertChroma(above, below, u + row / 2 * chromaWidth, v + row / 2 * chromaWidth, width, bgra);
+	}
+}
+
+FrameReadback::FrameReadback(unsigned int encoderThreads)
+	: encoders_(encoderThreads)
+{
+}
+
+FrameReadback::~FrameReadback()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	idle_.wait(lock, [this] { return encoding_ == 0; });
+}
+
+void FrameReadback::Initialize(ID3D11Device* device, std::size_t latency)
+{
+	assert(latency > 0);
+	device_ = device;
+	slots_.clear();
+	slots_.resize(latency);
+	nextSlot_ = 0;
+
+	// Enough for every slot to be read back while as many frames encode.
+	maxBuffers_ = latency * 2;
+}
+
+void FrameReadback::Screenshot(const std::filesystem::path& path)
+{
+	pendingScreenshot_ = path;
+}
+
+bool FrameReadback::StartVideo(const std::filesystem::path& path, int framesPerSecond)
+{
+	auto video = std::make_shared<VideoStream>();
+	video->File.open(path, std::ios::binary | std::ios::trunc);
+	if (!video->File) {
+		LogError(LogCategory::Render, "Failed to open video {}", path.string());
+		return false;
+	}
+
+	// The header needs the size, so it is written with the first frame.
+	video->File << std::format("YUV4MPEG2 F{}:1 Ip A1:1 C420jpeg", framesPerSecond);
+	video_ = std::move(video);
+	return true;
+}
+
+void FrameReadback::StopVideo()
+{
+	// Frames still in flight hold the stream and finish writing it.
+	video_.reset();
+}
+
+void FrameReadback::Capture(ID3D11DeviceContext* context, ID3D11Texture2D* frame)
+{
+	ReadCompleted(context, false);
+
+	if (pendingScreenshot_.empty() && !video_) {
+		return;
+	}
+
+	D3D11_TEXTURE2D_DESC desc;
+	frame->GetDesc(&desc);
+	bool supported = desc.Format == DXGI_FORMAT_R8G8B8A8_UNORM || desc.Format == DXGI_FORMAT_R8G8B8A8_UNORM_SRGB ||
+		desc.Format == DXGI_FORMAT_B8G8R8A8_UNORM || desc.Format == DXGI_FORMAT_B8G8R8A8_UNORM_SRGB;
+	if (!supported || desc.SampleDesc.Count != 1) {
+		LogWarning(LogCategory::Render, "Frames of this format can not be read back");
+		pendingScreenshot_.clear();
+		StopVideo();
+		return;
+	}
+
+	// The GPU is more frames behind than the ring is long.
+	Slot& slot = slots_[nextSlot_];
+	if (slot.InFlight) {
+		++dropped_;
+		return;
+	}
+
+	if (!slot.Staging || slot.Desc.Width != desc.Width || slot.Desc.Height != desc.Height || slot.Desc.Format != desc.Format) {
+		D3D11_TEXTURE2D_DESC stagingDesc = desc;
+		stagingDesc.MipLevels = 1;
+		stagingDesc.ArraySize = 1;
+		stagingDesc.Usage = D3D11_USAGE_STAGING;
+		stagingDesc.BindFlags = 0;
+		stagingDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		stagingDesc.MiscFlags = 0;
+		ThrowIfFailed(device_->CreateTexture2D(&stagingDesc, nullptr, slot.Staging.ReleaseAndGetAddressOf()));
+		slot.Desc = stagingDesc;
+	}
+
+	context->CopySubresourceRegion(slot.Staging.Get(), 0, 0, 0, 0, frame, 0, nullptr);
+	slot.InFlight = true;
+	slot.Screenshot = std::exchange(pendingScreenshot_, {});
+	slot.Video = video_;
+	nextSlot_ = (nextSlot_ + 1) % slots_.size();
+	++captured_;
+}
+
+void FrameReadback::Flush(ID3D11DeviceContext* context)
+{
+	ReadCompleted(context, true);
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	idle_.wait(lock, [this] { return encoding_ == 0; });
+}
+
+FrameReadback::Statistics FrameReadback::GetStatistics() const
+{
+	return Statistics{ captured_.load(), dropped_.load(), written_.load() };
+}
+
+void FrameReadback::ReadCompleted(ID3D11DeviceContext* context, bool wait)
+{
+	// Oldest first, and stop at the first copy that is not done: the later
+	// ones were queued after it.
+	for (std::size_t i = 0; i < slots_.size(); ++i) {
+		Slot& slot = slots_[(nextSlot_ + i) % slots_.size()];
+		if (!slot.InFlight) {
+			continue;
+		}
+
+		D3D11_MAPPED_SUBRESOURCE mapped;
+		HRESULT hr = context->Map(slot.Staging.Get(), 0, D3D11_MAP_READ, wait ? 0 : D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped);
+		if (hr == DXGI_ERROR_WAS_STILL_DRAWING) {
+			break;
+		}
+		ThrowIfFailed(hr);
+
+		Frame frame;
+		bool acquired = AcquireBuffer(frame.Pixels);
+		if (acquired) {
+			// Copied out so the texture is unmapped right away. Conversion
+			// would need it mapped until a worker is done.
+			std::size_t rowSize = slot.Desc.Width * 4;
+			frame.Pixels.resize(rowSize * slot.Desc.Height);
+			for (UINT row = 0; row < slot.Desc.Height; ++row) {
+				std::memcpy(frame.Pixels.data() + row * rowSize, static_cast<const std::uint8_t*>(mapped.pData) + row * mapped.RowPitch, rowSize);
+			}
+		}
+		context->Unmap(slot.Staging.Get(), 0);
+		slot.InFlight = false;
+
+		if (!acquired) {
+			++dropped_;
+			slot.Screenshot.clear();
+			slot.Video.reset();
+			continue;
+		}
+
+		frame.Width = static_cast<int>(slot.Desc.Width);
+		frame.Height = static_cast<int>(slot.Desc.Height);
+		frame.Bgra = slot.Desc.Format == DXGI_FORMAT_B8G8R8A8_UNORM || slot.Desc.Format == DXGI_FORMAT_B8G8R8A8_UNORM_SRGB;
+		frame.Screenshot = std::move(slot.Screenshot);
+		frame.Video = std::move(slot.Video);
+		slot.Screenshot.clear();
+		if (frame.Video) {
+			std::lock_guard<std::mutex> lock(frame.Video->Mutex);
+			frame.VideoFrame = frame.Video->SubmittedFrames++;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			++encoding_;
+		}
+		encoders_.Submit([this, frame = std::move(frame)]() mutable {
+			Encode(frame);
+			ReleaseBuffer(std::move(frame.Pixels));
+
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (--encoding_ == 0) {
+				idle_.notify_all();
+			}
+		});
+	}
+}
+
+void FrameReadback::Encode(Frame& frame)
+{
+	if (!frame.Screenshot.empty()) {
+		std::vector<std::uint8_t> rgb(static_cast<std::size_t>(frame.Width) * frame.Height * 3);
+		ConvertRgbaToRgb(frame.Pixels.data(), rgb.data(), static_cast<std::size_t>(frame.Width) * frame.Height, frame.Bgra);
+		if (WritePng(frame.Screenshot, rgb.data(), frame.Width, frame.Height)) {
+			++written_;
+		}
+	}
+
+	if (!frame.Video) {
+		return;
+	}
+
+	VideoStream& video = *frame.Video;
+	std::size_t lumaSize = static_cast<std::size_t>(frame.Width) * frame.Height;
+	std::size_t chromaSize = static_cast<std::size_t>((frame.Width + 1) / 2) * ((frame.Height + 1) / 2);
+	std::vector<std::uint8_t> yuv(lumaSize + chromaSize * 2);
+	ConvertRgbaToI420(frame.Pixels.data(), static_cast<std::size_t>(frame.Width) * 4, frame.Width, frame.Height, frame.Bgra,
+		yuv.data(), yuv.data() + lumaSize, yuv.data() + lumaSize + chromaSize);
+
+	std::lock_guard<std::mutex> lock(video.Mutex);
+	if (video.Width == 0) {
+		video.Width = frame.Width;
+		video.Height = frame.Height;
+		video.File << std::format(" W{} H{}\n", video.Width, video.Height);
+	}
+	if (frame.Width != video.Width || frame.Height != video.Height) {
+		// Keeps the frame's place in the order.
+		yuv.clear();
+		++dropped_;
+	}
+	video.Converted.emplace(frame.VideoFrame, std::move(yuv));
+
+	for (auto next = video.Converted.find(video.NextFrame); next != video.Converted.end(); next = video.Converted.find(video.NextFrame)) {
+		if (!next->second.empty()) {
+			video.File << "FRAME\n";
+			video.File.write(reinterpret_cast<const char*>(next->second.data()), next->second.size());
+			++written_;
+		}
+		video.Converted.erase(next);
+		++video.NextFrame;
+	}
+}
+
+bool FrameReadback::AcquireBuffer(std::vector<std::uint8_t>& buffer)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (!freeBuffers_.empty()) {
+		buffer = std::move(freeBuffers_.back());
+		freeBuffers_.pop_back();
+	}
+	else if (buffersInUse_ == maxBuffers_) {
+		return false;
+	}
+	++buffersInUse_;
+	return true;
+}
+
+void FrameReadback::ReleaseBuffer(std::vector<std::uint8_t> buffer)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	freeBuffers_.push_back(std::move(buffer));
+	--buffersInUse_;
+}
@@ -0,0 +1,144 @@
+module;
+// C
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+// Windows
+#include <DirectXMath.h>
+
+export module core.snapshot;
+
+import <array>;
+import <condition_variable>;
+import <mutex>;
+import <vector>;
+
+import diagnostics.latency;
+
+export struct DrawItem
+{
+	DirectX::XMFLOAT4X4 World;
+};
+
+export struct CameraSnapshot
+{
+	DirectX::XMFLOAT4X4 View;
+	float FieldOfView = 90.0f;
+	float NearZ = 0.1f;
+	float FarZ = 1000.0f;
+};
+
+// Everything the renderer needs to draw one simulated frame. Simulation fills
+// it in and it is read-only once published. The draw list keeps its capacity
+// between frames, so a steady scene does not allocate.
+export struct FrameSnapshot
+{
+	std::uint64_t Frame = 0;
+	float DeltaTime = 0.0f;
+	CameraSnapshot Camera;
+	std::vector<DrawItem> DrawList;
+
+	// Input events this frame is the first to respond to.
+	std::vector<InputStamp> Inputs;
+};
+
+// Ring of snapshots handed from simulation to rendering. Snapshots are read
+// in the order they were written and none is skipped, so the rendered frame
+// sequence does not depend on thread timing. The writer blocks while every
+// slot is queued or being read, which bounds how far simulation can run ahead
+// of rendering to Depth() - 1 frames.
+export class SnapshotRing
+{
+public:
+	static constexpr std::size_t MaxDepth = 3;
+
+public:
+	explicit SnapshotRing(std::size_t depth = 2);
+
+	SnapshotRing(const SnapshotRing&) = delete;
+	SnapshotRing& operator=(const SnapshotRing&) = delete;
+
+	// Only valid while nothing is queued.
+	void SetDepth(std::size_t depth);
+	std::size_t Depth() const { return depth_; }
+
+	// Return nullptr once the ring is closed.
+	FrameSnapshot* BeginWrite();
+	void EndWrite();
+	const FrameSnapshot* BeginRead();
+	void EndRead();
+
+	// Wakes up and refuses blocked and future readers and writers.
+	void Close();
+
+private:
+	std::array<FrameSnapshot, MaxDepth> slots_;
+	std::size_t depth_;
+
+	std::mutex mutex_;
+	std::condition_variable condition_;
+	std::uint64_t written_ = 0;
+	std::uint64_t read_ = 0;
+	bool closed_ = false;
+};
+
+module :private;
+
+SnapshotRing::SnapshotRing(std::size_t depth)
+	: depth_(depth)
+{
+	assert(depth_ >= 1 && depth_ <= MaxDepth);
+}
+
+void SnapshotRing::SetDepth(std::size_t depth)
+{
+	std::lock_guard lock(mutex_);
+	assert(depth >= 1 && depth <= MaxDepth);
+	assert(written_ == read_);
+	depth_ = depth;
+	written_ = read_ = 0;
+}
+
+FrameSnapshot* SnapshotRing::BeginWrite()
+{
+	// The slot after the last written one is free once the snapshot written
+	// depth_ frames ago has been read.
+	std::unique_lock lock(mutex_);
+	condition_.wait(lock, [this] { return closed_ || written_ - read_ < depth_; });
+	return closed_ ? nullptr : &slots_[written_ % depth_];
+}
+
+void SnapshotRing::EndWrite()
+{
+	{
+		std::lock_guard lock(mutex_);
+		++written_;
+	}
+	condition_.notify_all();
+}
+
+const FrameSnapshot* SnapshotRing::BeginRead()
+{
+	std::unique_lock lock(mutex_);
+	condition_.wait(lock, [this] { return closed_ || read_ < written_; });
+	return closed_ ? nullptr : &slots_[read_ % depth_];
+}
+
+void SnapshotRing::EndRead()
+{
+	{
+		std::lock_guard lock(mutex_);
+		++read_;
+	}
+	condition_.notify_all();
+}
+
+void SnapshotRing::Close()
+{
+	{
+		std::lock_guard lock(mutex_);
+		closed_ = true;
+	}
+	condition_.notify_all();
+}
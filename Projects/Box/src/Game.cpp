@@ -1,25 +1,57 @@
 module;
 // C
 #include <cassert>
+#include <cmath>
+#include <cstdint>
 
 // Windows
 #include <d3d11.h>
 #include <d3dcompiler.h>
+#include <dxgi1_3.h>
 #include <DirectXMath.h>
 #include <wrl.h>
 
 export module core;
 
+import <algorithm>;
+import <array>;
+import <chrono>;
 import <filesystem>;
 import <format>;
 import <iostream>;
-import <map>;
 import <memory>;
+import <memory_resource>;
 import <span>;
+import <stop_token>;
 import <string>;
+import <thread>;
+import <utility>;
 import <vector>;
 
+import core.memory;
+import core.pacing;
+import core.resolution;
+import core.snapshot;
+import diagnostics.gpu;
+import diagnostics.latency;
+import diagnostics.log;
+import diagnostics.memory;
+import diagnostics.render;
+import diagnostics.replay;
+import pipeline;
+import render.capture;
+import render.context;
+import render.debug;
+import render.graph;
+import render.readback;
+import render.timestamps;
+import resource.registry;
+import resource.shader;
+import resource.targets;
+import resource.streaming;
+import resource.vfs;
 import utility;
+import vertex;
 
 export class Game
 {
@@ -30,15 +62,91 @@ public:
 	virtual bool Startup(HWND window);
 	virtual void Shutdown();
 
+	// Update() simulates one frame into a snapshot and Render() draws the
+	// oldest snapshot that has not been drawn. In pipelined mode Update() runs
+	// on its own thread, between StartSimulation() and StopSimulation(), and
+	// simulation of the next frames overlaps rendering of the current one.
 	void Update();
 	void Render();
 	void Present();
 
+	// Blocks until the swap chain can take another frame and the frame rate
+	// cap allows it. Called before Update() and Render().
+	void WaitForNextFrame();
+
+	void SetFramePacing(const FramePacer::Settings& settings);
+	const FramePacer& Pacer() const { return pacer_; }
+
+	// Renders the scene at a fraction of the window size chosen from the
+	// measured frame time, and stretches it to the back buffer.
+	void SetDynamicResolution(bool enabled, const ResolutionController::Settings& settings = {});
+	bool IsDynamicResolutionEnabled() const { return dynamicResolution_; }
+	float RenderScale() const { return dynamicResolution_ ? resolution_.Scale() : 1.0f; }
+
+	// Passes of the last rendered frame.
+	const RenderGraph& Graph() const { return renderGraph_; }
+
+	// Renders into an offscreen back buffer instead of a window, on the given
+	// driver. The null driver accepts every call and draws nothing, which
+	// measures the CPU side without a GPU. Must be set before Startup(), which
+	// then takes no window.
+	void SetHeadless(bool headless, D3D_DRIVER_TYPE driverType = D3D_DRIVER_TYPE_NULL);
+	bool IsHeadless() const { return headless_; }
+
+	// Recording logs the state returned by ReplayState() when it starts, then
+	// the frame time of every frame and the state after it. Replaying feeds
+	// both back: frame i is simulated with recorded frame time i, and the
+	// state recorded after frame i is applied after frame i again, so the
+	// same frames come out in every build. Recording and replaying fail when
+	// the game is pipelined.
+	bool StartRecording(const std::filesystem::path& path);
+	void StopRecording();
+	bool StartReplay(const std::filesystem::path& path);
+	bool IsReplaying() const { return replay_.IsOpen(); }
+	bool IsReplayFinished() const { return replay_.IsOpen() && replay_.FramesPlayed() == replay_.FrameCount(); }
+	std::uint32_t ReplayFrameCount() const { return replay_.FrameCount(); }
+	std::uint32_t ReplayFramesPlayed() const { return replay_.FramesPlayed(); }
+
+	// Writes what OnRender() submits in the next rendered frame to path, for
+	// replay without the game. See CaptureFile.
+	void CaptureFrame(const std::filesystem::path& path) { capturePath_ = path; }
+
+	// Screenshots and video of the presented frames, UI included. They are
+	// read back a few frames late and written on worker threads.
+	FrameReadback& Readback() { return readback_; }
+
+	// GPU times of the frames and their passes, a few frames late. OnRender()
+	// can time its own work with GpuScope.
+	GpuProfiler& Profiler() { return gpuProfiler_; }
+
+	// Lines drawn over the scene of the next rendered frame, with its depth
+	// test. Shapes can be added from any thread.
+	DebugDraw& Debug() { return debugDraw_; }
+
+	void SetPipelined(bool pipelined, std::size_t snapshotDepth = 2);
+	bool IsPipelined() const { return pipelined_; }
+	void StartSimulation();
+	void StopSimulation();
+
 	void Resize(int width, int height);
 	void Resume();
 	void Pause();
 
 	std::wstring GetAssetPath(std::wstring_view filename) const;
+	const VirtualFileSystem& FileSystem() const { return fileSystem_; }
+	AssetStreamer& Streamer() { return streamer_; }
+
+	// Scratch memory for the render thread, released at the start of the next frame.
+	std::pmr::memory_resource* FrameAllocator() { return &frameArena_; }
+	std::uint64_t HeapAllocationsLastFrame() const { return heapAllocationsLastFrame_; }
+
+	// GPU objects are owned here and referred to by handle. Released handles
+	// stay valid for the GPU until the frame they were released in completes.
+	ResourceRegistry& Resources() { return registry_; }
+	PipelineHandle CreatePipeline(const GraphicsPipeline::Description& desc);
+	const GraphicsPipeline* Pipeline(PipelineHandle handle) const { return pipelines_.Get(handle); }
+	GraphicsPipeline* Pipeline(PipelineHandle handle) { return pipelines_.Get(handle); }
+	void ReleasePipeline(PipelineHandle handle);
 
 	std::wstring_view Title() const { return title_; }
 	int ScreenWidth() const { return screenWidth_; }
@@ -50,41 +158,114 @@ public:
 	ID3D11DeviceContext* ImmediateContext() const& { return immediateContext_.Get(); }
 
 protected:
-	virtual void OnUpdate(float deltaTime) { }
-	virtual void OnRender(ID3D11DeviceContext* immediateContext) { }
+	// In pipelined mode OnUpdate() runs on the simulation thread and must only
+	// communicate with OnRender() through the snapshot.
+	virtual void OnUpdate(float deltaTime, FrameSnapshot& snapshot) { }
+	virtual void OnRender(RenderContext& context, const FrameSnapshot& snapshot) { }
 	virtual void OnResize() { }
 
+	// State that changes at runtime other than through simulation, such as
+	// what the user edits in the UI. Read after every recorded frame and
+	// written back after every replayed one. Its size must be fixed and a
+	// multiple of 4 bytes.
+	virtual std::span<const std::byte> ReplayState() { return {}; }
+	virtual void ApplyReplayState(std::span<const std::byte> state) { }
+
 	// ID3D11DeviceContext* ImmediateContext() const& { return immediateContext_.Get(); }
 	// IDXGISwapChain* SwapChain() const& { return swapChain_.Get(); }
-	// ID3D11RenderTargetView* RenderTargetView() const& { return renderTargetView_.Get(); }
-	// ID3D11DepthStencilView* DepthStencilView() const& { return depthStencilView_.Get(); }
+	// ID3D11RenderTargetView* RenderTargetView() const& { return backBuffer_.RenderTargetView.Get(); }
 
 	void SetBackgroundColor(float r, float g, float b, float a);
 
 private:
 	bool InitDirect3D(HWND window);
+	bool MountAssets();
+	const std::filesystem::path& AssetDirectory() const;
 	DXGI_RATIONAL FindRefreshRate(IDXGIAdapter* adapter) const;
+	void BeginFrame();
+	bool CreateUpscalePipeline();
+	bool CreateDebugDrawPipeline();
+	void BuildRenderGraph(const FrameSnapshot& snapshot);
+	void Upscale(const RenderTarget& sceneColor);
+	void UpdateCompletedFrames();
 
 private:
 	std::wstring title_;
 	int screenWidth_ = 0;
 	int screenHeight_ = 0;
 
-	mutable std::wstring assetDirectory_;
+	mutable std::filesystem::path assetDirectory_;
+	VirtualFileSystem fileSystem_;
+	AssetStreamer streamer_{ fileSystem_ };
 
 	bool windowed_ = true;
 	bool paused_ = false;
+	bool headless_ = false;
+
+	SnapshotRing snapshots_;
+	std::uint64_t simulatedFrames_ = 0;
+	std::uint64_t renderedFrame_ = 0;
+	std::chrono::steady_clock::time_point lastUpdateTime_;
+	bool pipelined_ = false;
+	std::jthread simulationThread_;
+
+	ReplayRecorder recorder_;
+	ReplayPlayer replay_;
+
+	std::filesystem::path capturePath_;
+	CaptureWriter capture_;
+	FrameReadback readback_;
+	GpuProfiler gpuProfiler_;
+	DebugDraw debugDraw_;
+	PipelineHandle debugDrawPipeline_;
+
+	FrameArena frameArena_{ 1024 * 1024 };
+	std::uint64_t frameAllocationCount_ = 0;
+	std::uint64_t heapAllocationsLastFrame_ = 0;
 
 	// graphics 
 	Microsoft::WRL::ComPtr<ID3D11Device> graphicsDevice_;
 	Microsoft::WRL::ComPtr<ID3D11DeviceContext> immediateContext_;
-	Microsoft::WRL::ComPtr<IDXGISwapChain> swapChain_;
+	RenderContext renderContext_;
+	Microsoft::WRL::ComPtr<IDXGISwapChain2> swapChain_;
+	HANDLE frameLatencyWaitableObject_ = nullptr;
+	static constexpr UINT SwapChainFlags = DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT;
+
+	FramePacer pacer_;
+
+	RenderTargetPool renderTargets_;
+
+	// The scene is drawn into the top-left part of transient color and depth
+	// targets at least as large as the window, and then copied or upscaled to
+	// the back buffer. The targets come from the pool, so neither a new render
+	// scale nor a resize within the pool's size bucket needs new textures.
+	RenderGraph renderGraph_;
+	RenderTargetGraphBackend graphBackend_{ renderTargets_ };
+	D3D11_VIEWPORT sceneViewport_;
+
+	ResolutionController resolution_;
+	bool dynamicResolution_ = false;
+	PipelineHandle upscalePipeline_;
+	Microsoft::WRL::ComPtr<ID3D11Buffer> upscaleConstants_;
+	Microsoft::WRL::ComPtr<ID3D11SamplerState> upscaleSampler_;
+
+	ResourceRegistry registry_;
+	ResourcePool<GraphicsPipeline> pipelines_;
+
+	// One event query per frame in flight tells when the GPU finished a frame.
+	// As many frames are let in flight as the pacer's MaxFrameLatency, which
+	// is at most FrameFenceCount.
+	static constexpr std::uint64_t FrameFenceCount = 16;
+	std::array<Microsoft::WRL::ComPtr<ID3D11Query>, FrameFenceCount> frameFences_;
+	std::uint64_t submittedFrames_ = 0;
+	std::uint64_t completedFrames_ = 0;
 	
-	std::map<void*, Microsoft::WRL::ComPtr<ID3D11RenderTargetView>> renderTargetViewCache_;
-	Microsoft::WRL::ComPtr<ID3D11RenderTargetView> currentRenderTargetView_;
+	static constexpr UINT BackBufferCount = 2;
 
-	Microsoft::WRL::ComPtr<ID3D11DepthStencilView> depthStencilView_;
-	Microsoft::WRL::ComPtr<ID3D11Texture2D> depthStencilBuffer_;
+	// With flip-model swap chains in D3D11, buffer 0 always refers to the
+	// current back buffer, so what is fetched at resize serves every frame.
+	// Imported into the render graph each frame.
+	RenderTarget backBuffer_;
 	
 	D3D_DRIVER_TYPE driverType_ = D3D_DRIVER_TYPE_HARDWARE;
 	DXGI_FORMAT backBufferFormat_ = DXGI_FORMAT_R8G8B8A8_UNORM;
@@ -102,7 +283,7 @@ Game::Game(std::wstring_view title, int width, int height, bool windowed)
 
 Game::~Game()
 {
-
+	StopSimulation();
 }
 
 bool Game::Startup(HWND window)
@@ -111,6 +292,18 @@ bool Game::Startup(HWND window)
 		return false;
 	}
 
+	if (!MountAssets()) {
+		return false;
+	}
+
+	if (!CreateUpscalePipeline()) {
+		return false;
+	}
+
+	if (!CreateDebugDrawPipeline()) {
+		return false;
+	}
+
 	return true;
 }
 
@@ -137,15 +330,33 @@ bool Game::InitDirect3D(HWND window)
 	);
 
 	if (FAILED(hr)) {
-		std::cerr << "Failed to create Direct3D device\n";
+		LogError(LogCategory::Render, "Failed to create Direct3D device");
 		return false;
 	}
 
 	if (featureLevel != D3D_FEATURE_LEVEL_11_0) {
-		std::cerr << "Direct3D feature level 11 unsupported\n";
+		LogError(LogCategory::Render, "Direct3D feature level 11 unsupported");
 		return false;
 	}
 
+	renderContext_ = RenderContext(immediateContext_.Get());
+	readback_.Initialize(graphicsDevice_.Get());
+	if (!gpuProfiler_.Initialize(std::make_unique<D3D11GpuQueryBackend>(graphicsDevice_.Get(), immediateContext_.Get()))) {
+		LogWarning(LogCategory::Render, "GPU timestamps unsupported");
+	}
+	debugDraw_.Initialize(graphicsDevice_.Get());
+	renderTargets_.Initialize(graphicsDevice_.Get());
+
+	D3D11_QUERY_DESC fenceDesc{ .Query = D3D11_QUERY_EVENT, .MiscFlags = 0 };
+	for (Microsoft::WRL::ComPtr<ID3D11Query>& fence : frameFences_) {
+		ThrowIfFailed(graphicsDevice_->CreateQuery(&fenceDesc, fence.GetAddressOf()));
+	}
+
+	if (headless_) {
+		Resize(screenWidth_, screenHeight_);
+		return true;
+	}
+
 	Microsoft::WRL::ComPtr<IDXGIDevice> device = nullptr;
 	ThrowIfFailed(graphicsDevice_->QueryInterface(IID_PPV_ARGS(&device)));
 
@@ -154,38 +365,55 @@ bool Game::InitDirect3D(HWND window)
 
 	DXGI_RATIONAL refreshRate = FindRefreshRate(adapter.Get());
 
-	// Fill out a DXGI_SWAP_CHAIN_DESC to describe swap chain
+	// Fill out a DXGI_SWAP_CHAIN_DESC1 to describe swap chain. The frame latency
+	// waitable object lets WaitForNextFrame() block until the swap chain can
+	// take another frame, instead of blocking inside Present().
 
-	DXGI_SWAP_CHAIN_DESC swapChainDesc;
+	DXGI_SWAP_CHAIN_DESC1 swapChainDesc;
 	ZeroMemory(&swapChainDesc, sizeof(swapChainDesc));
-	swapChainDesc.BufferDesc.Width = screenWidth_;
-	swapChainDesc.BufferDesc.Height = screenHeight_;
-	swapChainDesc.BufferDesc.RefreshRate = refreshRate;
-	swapChainDesc.BufferDesc.Format = backBufferFormat_;
-	swapChainDesc.BufferDesc.ScanlineOrdering = DXGI_MODE_SCANLINE_ORDER_UNSPECIFIED;
-	swapChainDesc.BufferDesc.Scaling = DXGI_MODE_SCALING_UNSPECIFIED;
+	swapChainDesc.Width = screenWidth_;
+	swapChainDesc.Height = screenHeight_;
+	swapChainDesc.Format = backBufferFormat_;
 	swapChainDesc.SampleDesc.Count = 1;
 	swapChainDesc.SampleDesc.Quality = 0;
 	swapChainDesc.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
-	swapChainDesc.BufferCount = 2;
-	swapChainDesc.OutputWindow = window;
-	swapChainDesc.Windowed = windowed_;
-	swapChainDesc.Flags = 0;
+	swapChainDesc.BufferCount = BackBufferCount;
+	swapChainDesc.Scaling = DXGI_SCALING_STRETCH;
 	swapChainDesc.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
+	swapChainDesc.AlphaMode = DXGI_ALPHA_MODE_UNSPECIFIED;
+	swapChainDesc.Flags = SwapChainFlags;
+
+	DXGI_SWAP_CHAIN_FULLSCREEN_DESC fullscreenDesc;
+	ZeroMemory(&fullscreenDesc, sizeof(fullscreenDesc));
+	fullscreenDesc.RefreshRate = refreshRate;
+	fullscreenDesc.ScanlineOrdering = DXGI_MODE_SCANLINE_ORDER_UNSPECIFIED;
+	fullscreenDesc.Scaling = DXGI_MODE_SCALING_UNSPECIFIED;
+	fullscreenDesc.Windowed = windowed_;
 
 	// To correctly create the swap chain, we must use the IDXGIFactory that was
 	// used to create the device.
 
-	Microsoft::WRL::ComPtr<IDXGIFactory> factory;
+	Microsoft::WRL::ComPtr<IDXGIFactory2> factory;
 	ThrowIfFailed(adapter->GetParent(IID_PPV_ARGS(&factory)));
 
-	hr = factory->CreateSwapChain(graphicsDevice_.Get(), &swapChainDesc, swapChain_.GetAddressOf());
+	Microsoft::WRL::ComPtr<IDXGISwapChain1> swapChain;
+	hr = factory->CreateSwapChainForHwnd(graphicsDevice_.Get(), window, &swapChainDesc, &fullscreenDesc, nullptr, swapChain.GetAddressOf());
+	if (FAILED(hr))
+	{
+		LogError(LogCategory::Render, "Failed to create swap chain");
+		return false;
+	}
+
+	hr = swapChain.As(&swapChain_);
 	if (FAILED(hr))
 	{
-		std::cerr << "Failed to create swap chain\n";
+		LogError(LogCategory::Render, "Waitable swap chains unsupported");
 		return false;
 	}
 
+	ThrowIfFailed(swapChain_->SetMaximumFrameLatency(pacer_.GetSettings().MaxFrameLatency));
+	frameLatencyWaitableObject_ = swapChain_->GetFrameLatencyWaitableObject();
+
 	// The remaining steps that need to be carried out for
 	// direct3d creation also need to be executed every time
 	// the window is resized. So just call the Resize() method
@@ -229,75 +457,475 @@ DXGI_RATIONAL Game::FindRefreshRate(IDXGIAdapter* adapter) const
 
 void Game::Shutdown()
 {
+	StopSimulation();
+	StopRecording();
+
+	if (frameLatencyWaitableObject_) {
+		CloseHandle(frameLatencyWaitableObject_);
+		frameLatencyWaitableObject_ = nullptr;
+	}
+
 	if (immediateContext_) {
+		readback_.StopVideo();
+		readback_.Flush(immediateContext_.Get());
+		gpuProfiler_.Shutdown();
 		immediateContext_->ClearState();
 	}
 }
 
 void Game::Update()
 {
-	OnUpdate(0.0f);
+	MemoryTagScope memoryTag(MemoryTag::Core);
+
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	float deltaTime = simulatedFrames_ > 0 ? std::chrono::duration<float>(now - lastUpdateTime_).count() : 0.0f;
+	lastUpdateTime_ = now;
+
+	// Replayed frames run on the recorded timebase instead of the clock.
+	if (replay_.IsOpen()) {
+		replay_.NextFrame(deltaTime);
+	}
+
+	FrameSnapshot* snapshot = snapshots_.BeginWrite();
+	if (!snapshot) {
+		return;
+	}
+
+	snapshot->Frame = simulatedFrames_++;
+	snapshot->DeltaTime = deltaTime;
+	snapshot->DrawList.clear();
+	LatencyTracker::Get().CollectInputs(snapshot->Inputs);
+	OnUpdate(deltaTime, *snapshot);
+
+	snapshots_.EndWrite();
+}
+
+void Game::BeginFrame()
+{
+	MemoryTagScope memoryTag(MemoryTag::Core);
+
+	std::uint64_t allocationCount = AllocationCounter::Count();
+	heapAllocationsLastFrame_ = allocationCount - frameAllocationCount_;
+	frameAllocationCount_ = allocationCount;
+
+	frameArena_.Reset();
+
+	// Destroy resources released in frames the GPU is done with.
+	UpdateCompletedFrames();
+	registry_.BeginFrame(submittedFrames_, completedFrames_);
+	pipelines_.Collect(completedFrames_);
+	renderTargets_.Collect(submittedFrames_);
+
+	// Resume asset loads that finished since the last frame. Anything over
+	// budget waits for the next frame instead of stalling this one.
+	streamer_.ProcessCompletions(std::chrono::milliseconds(2));
+
+	MemoryTracker::Get().Update();
 }
 
 void Game::Render()
 {
-	Microsoft::WRL::ComPtr<ID3D11Texture2D> backBuffer;
-	ThrowIfFailed(swapChain_->GetBuffer(0, IID_PPV_ARGS(&backBuffer)));
+	BeginFrame();
+
+	const FrameSnapshot* snapshot = snapshots_.BeginRead();
+	if (!snapshot) {
+		return;
+	}
+
+	MemoryTagScope memoryTag(MemoryTag::Rendering);
+
+	// Ended in Present(), so the frame's time includes the UI.
+	gpuProfiler_.BeginFrame();
 
-	if (auto it = renderTargetViewCache_.find(backBuffer.Get()); it != renderTargetViewCache_.end()) {
-		currentRenderTargetView_ = it->second;
+	renderedFrame_ = snapshot->Frame;
+	LatencyTracker::Get().BeginRender(snapshot->Inputs);
+
+	sceneViewport_ = viewport_;
+	sceneViewport_.Width = std::max(1.0f, std::floor(viewport_.Width * RenderScale()));
+	sceneViewport_.Height = std::max(1.0f, std::floor(viewport_.Height * RenderScale()));
+
+	BuildRenderGraph(*snapshot);
+	if (renderGraph_.Compile()) {
+		graphBackend_.SetFrame(submittedFrames_);
+		renderGraph_.Execute(graphBackend_);
 	}
 	else {
-		ThrowIfFailed(graphicsDevice_->CreateRenderTargetView(backBuffer.Get(), nullptr, currentRenderTargetView_.GetAddressOf()));
-		renderTargetViewCache_.insert({ backBuffer.Get(), currentRenderTargetView_ });
+		LogError(LogCategory::Render, "Failed to compile render graph");
 	}
 
-	immediateContext_->OMSetRenderTargets(1, currentRenderTargetView_.GetAddressOf(), depthStencilView_.Get());
-
-	immediateContext_->ClearRenderTargetView(currentRenderTargetView_.Get(), reinterpret_cast<const float*>(&backgroundColor_));
-	immediateContext_->ClearDepthStencilView(depthStencilView_.Get(), D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1.0f, 0);
+	if (recorder_.IsOpen()) {
+		recorder_.RecordFrame(snapshot->DeltaTime, ReplayState());
+	}
+	if (replay_.IsOpen()) {
+		ApplyReplayState(replay_.State());
+	}
 
-	OnRender(immediateContext_.Get());
+	RenderStatisticsTracker::Get().EndFrame(renderContext_.TakeStatistics());
+	snapshots_.EndRead();
 }
 
 void Game::Present()
 {
-	ThrowIfFailed(swapChain_->Present(0, 0));
+	readback_.Capture(immediateContext_.Get(), backBuffer_.Texture.Get());
+	gpuProfiler_.EndFrame();
+
+	if (swapChain_) {
+		ThrowIfFailed(swapChain_->Present(pacer_.GetSettings().VSync ? 1 : 0, 0));
+	}
+	LatencyTracker::Get().EndPresent(renderedFrame_);
+
+	// Wait for the oldest frames until fewer than the allowed latency are in
+	// flight. The latency can have been lowered since they were submitted.
+	std::uint64_t maxFramesInFlight = std::min<std::uint64_t>(pacer_.GetSettings().MaxFrameLatency, FrameFenceCount);
+	while (submittedFrames_ - completedFrames_ >= maxFramesInFlight) {
+		ID3D11Query* fence = frameFences_[completedFrames_ % FrameFenceCount].Get();
+		while (immediateContext_->GetData(fence, nullptr, 0, 0) == S_FALSE) {
+			std::this_thread::yield();
+		}
+		++completedFrames_;
+	}
+
+	immediateContext_->End(frameFences_[submittedFrames_ % FrameFenceCount].Get());
+	++submittedFrames_;
+}
+
+void Game::WaitForNextFrame()
+{
+	std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+	if (frameLatencyWaitableObject_) {
+		WaitForSingleObjectEx(frameLatencyWaitableObject_, 1000, TRUE);
+	}
+	std::chrono::steady_clock::duration swapChainWait = std::chrono::steady_clock::now() - waitStart;
+
+	PacingClock::Duration pacerWait = pacer_.Wait();
+
+	// The frame cost is the frame interval without the time spent waiting for
+	// the frame rate cap. Waiting for the swap chain counts, since that is
+	// where a GPU-bound frame shows up, except with vsync where it is mostly
+	// waiting for the display.
+	if (dynamicResolution_ && pacer_.LastFrameInterval() > PacingClock::Duration::zero()) {
+		std::chrono::steady_clock::duration cost = pacer_.LastFrameInterval() - pacerWait;
+		if (pacer_.GetSettings().VSync) {
+			cost -= swapChainWait;
+		}
+		resolution_.Update(std::chrono::duration<float, std::milli>(cost).count());
+	}
+}
+
+void Game::SetDynamicResolution(bool enabled, const ResolutionController::Settings& settings)
+{
+	dynamicResolution_ = enabled;
+	resolution_.Configure(settings);
+}
+
+bool Game::CreateUpscalePipeline()
+{
+	MemoryTagScope memoryTag(MemoryTag::Rendering);
+
+	AssetData vertexShaderSource = fileSystem_.Read(AssetId("Shaders/UpscaleVertexShader.hlsl"));
+	AssetData pixelShaderSource = fileSystem_.Read(AssetId("Shaders/UpscalePixelShader.hlsl"));
+
+	GraphicsPipeline::Description desc;
+	desc.VertexShader = ShaderLoader::Default()->LoadVertexShader(vertexShaderSource.Bytes(), "UpscaleVertexShader.hlsl");
+	desc.PixelShader = ShaderLoader::Default()->LoadPixelShader(pixelShaderSource.Bytes(), "UpscalePixelShader.hlsl");
+	if (!desc.VertexShader || !desc.PixelShader) {
+		LogError(LogCategory::Shader, "Failed to load upscale shaders");
+		return false;
+	}
+	upscalePipeline_ = CreatePipeline(desc);
+
+	D3D11_BUFFER_DESC constantsDesc;
+	ZeroMemory(&constantsDesc, sizeof(constantsDesc));
+	constantsDesc.Usage = D3D11_USAGE_DYNAMIC;
+	constantsDesc.ByteWidth = 16;
+	constantsDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	constantsDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	ThrowIfFailed(graphicsDevice_->CreateBuffer(&constantsDesc, nullptr, upscaleConstants_.GetAddressOf()));
+	MemoryTracker::Get().TrackBuffer(upscaleConstants_.Get());
+
+	D3D11_SAMPLER_DESC samplerDesc;
+	ZeroMemory(&samplerDesc, sizeof(samplerDesc));
+	samplerDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+	samplerDesc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
+	samplerDesc.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
+	samplerDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+	samplerDesc.ComparisonFunc = D3D11_COMPARISON_NEVER;
+	samplerDesc.MaxLOD = D3D11_FLOAT32_MAX;
+	ThrowIfFailed(graphicsDevice_->CreateSamplerState(&samplerDesc, upscaleSampler_.GetAddressOf()));
+
+	return true;
+}
+
+bool Game::CreateDebugDrawPipeline()
+{
+	MemoryTagScope memoryTag(MemoryTag::Rendering);
+
+	AssetData vertexShaderSource = fileSystem_.Read(AssetId("Shaders/ColorVertexShader.hlsl"));
+	AssetData pixelShaderSource = fileSystem_.Read(AssetId("Shaders/ColorPixelShader.hlsl"));
+
+	GraphicsPipeline::Description desc;
+	desc.PrimitiveTopology = D3D11_PRIMITIVE_TOPOLOGY_LINELIST;
+	desc.InputLayout = Vertex::PosColor::Layout;
+	desc.VertexShader = ShaderLoader::Default()->LoadVertexShader(vertexShaderSource.Bytes(), "ColorVertexShader.hlsl");
+	desc.PixelShader = ShaderLoader::Default()->LoadPixelShader(pixelShaderSource.Bytes(), "ColorPixelShader.hlsl");
+	if (!desc.VertexShader || !desc.PixelShader) {
+		LogError(LogCategory::Shader, "Failed to load debug draw shaders");
+		return false;
+	}
+	debugDrawPipeline_ = CreatePipeline(desc);
+
+	return true;
+}
+
+void Game::BuildRenderGraph(const FrameSnapshot& snapshot)
+{
+	renderGraph_.Reset(&frameArena_);
+
+	RenderTargetDesc backBufferDesc;
+	backBufferDesc.Width = screenWidth_;
+	backBufferDesc.Height = screenHeight_;
+	backBufferDesc.Format = backBufferFormat_;
+	GraphResource backBuffer = renderGraph_.Import("BackBuffer", RenderTargetGraphBackend::Describe(backBufferDesc), &backBuffer_);
+
+	// Both are bucketed the same way by the pool, so their sizes match as D3D11 requires.
+	RenderTargetDesc colorDesc;
+	colorDesc.Width = screenWidth_;
+	colorDesc.Height = screenHeight_;
+	colorDesc.Format = backBufferFormat_;
+	colorDesc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+
+	RenderTargetDesc depthStencilDesc;
+	depthStencilDesc.Width = screenWidth_;
+	depthStencilDesc.Height = screenHeight_;
+	depthStencilDesc.Format = DXGI_FORMAT_D24_UNORM_S8_UINT;
+	depthStencilDesc.BindFlags = D3D11_BIND_DEPTH_STENCIL;
+
+	PassBuilder scenePass = renderGraph_.AddPass("Scene");
+	GraphResource sceneColor = scenePass.Create("SceneColor", RenderTargetGraphBackend::Describe(colorDesc));
+	GraphResource sceneDepth = scenePass.Create("SceneDepth", RenderTargetGraphBackend::Describe(depthStencilDesc));
+	scenePass.Execute([this, &snapshot, sceneColor, sceneDepth](const PassResources& resources) {
+		GpuScope gpuScope(gpuProfiler_, "Scene");
+		ID3D11RenderTargetView* sceneTarget = RenderTargetGraphBackend::Target(resources.Texture(sceneColor))->RenderTargetView.Get();
+		ID3D11DepthStencilView* depthStencilView = RenderTargetGraphBackend::Target(resources.Texture(sceneDepth))->DepthStencilView.Get();
+
+		renderContext_.SetViewports(1, &sceneViewport_);
+		renderContext_.SetRenderTargets(1, &sceneTarget, depthStencilView);
+
+		renderContext_.ClearRenderTarget(sceneTarget, reinterpret_cast<const float*>(&backgroundColor_));
+		renderContext_.ClearDepthStencil(depthStencilView, D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1.0f, 0);
+
+		// Taken first, as OnRender() may ask for the next capture.
+		std::filesystem::path capturePath = std::exchange(capturePath_, {});
+		bool capturing = !capturePath.empty();
+		if (capturing) {
+			capture_.Begin(static_cast<std::uint32_t>(sceneViewport_.Width), static_cast<std::uint32_t>(sceneViewport_.Height));
+			renderContext_.BeginCapture(capture_);
+		}
+
+		OnRender(renderContext_, snapshot);
+
+		DirectX::XMMATRIX viewProjection = DirectX::XMMatrixMultiply(DirectX::XMLoadFloat4x4(&snapshot.Camera.View),
+			DirectX::XMMatrixPerspectiveFovLH(DirectX::XMConvertToRadians(snapshot.Camera.FieldOfView), AspectRatio(), snapshot.Camera.NearZ, snapshot.Camera.FarZ));
+		debugDraw_.Render(renderContext_, registry_, pipelines_.Get(debugDrawPipeline_), viewProjection);
+
+		if (capturing) {
+			renderContext_.EndCapture();
+			if (capture_.Save(capturePath)) {
+				LogInfo(LogCategory::Render, "Captured {} commands to {}", capture_.CommandCount(), capturePath.string());
+			}
+		}
+	});
+
+	// Leaves the back buffer bound for the UI drawn after Render().
+	PassBuilder resolvePass = renderGraph_.AddPass("Resolve");
+	resolvePass.Read(sceneColor);
+	resolvePass.Write(backBuffer);
+	resolvePass.Execute([this, sceneColor](const PassResources& resources) {
+		GpuScope gpuScope(gpuProfiler_, "Resolve");
+		const RenderTarget* color = RenderTargetGraphBackend::Target(resources.Texture(sceneColor));
+		if (sceneViewport_.Width < viewport_.Width || sceneViewport_.Height < viewport_.Height) {
+			Upscale(*color);
+		}
+		else {
+			renderContext_.SetRenderTargets(1, backBuffer_.RenderTargetView.GetAddressOf(), nullptr);
+			renderContext_.SetViewports(1, &viewport_);
+
+			D3D11_BOX sceneBox{ 0, 0, 0, static_cast<UINT>(screenWidth_), static_cast<UINT>(screenHeight_), 1 };
+			renderContext_.CopySubresourceRegion(backBuffer_.Texture.Get(), 0, 0, 0, 0, color->Texture.Get(), 0, &sceneBox);
+		}
+	});
+}
+
+void Game::Upscale(const RenderTarget& sceneColor)
+{
+	const GraphicsPipeline* pipeline = pipelines_.Get(upscalePipeline_);
+	if (!pipeline) {
+		return;
+	}
+
+	renderContext_.SetRenderTargets(1, backBuffer_.RenderTargetView.GetAddressOf(), nullptr);
+	renderContext_.SetViewports(1, &viewport_);
+
+	float uvScale[4] = { sceneViewport_.Width / sceneColor.Width, sceneViewport_.Height / sceneColor.Height, 0.0f, 0.0f };
+	renderContext_.UpdateBuffer(upscaleConstants_.Get(), uvScale, sizeof(uvScale));
+
+	pipeline->Apply(renderContext_, registry_);
+	renderContext_.SetVSConstantBuffers(0, 1, upscaleConstants_.GetAddressOf());
+	renderContext_.SetPSShaderResources(0, 1, sceneColor.ShaderResourceView.GetAddressOf());
+	renderContext_.SetPSSamplers(0, 1, upscaleSampler_.GetAddressOf());
+	renderContext_.Draw(3, 0);
+
+	// Unbind the scene so it can be a render target again next frame.
+	ID3D11ShaderResourceView* nullResource = nullptr;
+	renderContext_.SetPSShaderResources(0, 1, &nullResource);
+}
+
+void Game::SetFramePacing(const FramePacer::Settings& settings)
+{
+	pacer_.Configure(settings);
+	if (swapChain_) {
+		ThrowIfFailed(swapChain_->SetMaximumFrameLatency(pacer_.GetSettings().MaxFrameLatency));
+	}
+}
+
+void Game::SetHeadless(bool headless, D3D_DRIVER_TYPE driverType)
+{
+	assert(!graphicsDevice_);
+	headless_ = headless;
+	driverType_ = headless ? driverType : D3D_DRIVER_TYPE_HARDWARE;
+}
+
+bool Game::StartRecording(const std::filesystem::path& path)
+{
+	// The frames of a pipelined game depend on thread timing, so they could
+	// not be replayed.
+	if (pipelined_) {
+		LogError(LogCategory::General, "Recordings can not be pipelined");
+		return false;
+	}
+
+	return recorder_.Open(path, ReplayState());
+}
+
+void Game::StopRecording()
+{
+	recorder_.Close();
+}
+
+bool Game::StartReplay(const std::filesystem::path& path)
+{
+	if (pipelined_) {
+		LogError(LogCategory::General, "Replays can not be pipelined");
+		return false;
+	}
+
+	if (!replay_.Open(path, ReplayState().size())) {
+		return false;
+	}
+	ApplyReplayState(replay_.State());
+	return true;
+}
+
+void Game::SetPipelined(bool pipelined, std::size_t snapshotDepth)
+{
+	assert(!simulationThread_.joinable());
+	pipelined_ = pipelined;
+	snapshots_.SetDepth(pipelined ? snapshotDepth : 1);
+}
+
+void Game::StartSimulation()
+{
+	if (!pipelined_ || simulationThread_.joinable()) {
+		return;
+	}
+
+	simulationThread_ = std::jthread([this](std::stop_token stopToken) {
+		while (!stopToken.stop_requested()) {
+			Update();
+		}
+	});
+}
+
+void Game::StopSimulation()
+{
+	if (!simulationThread_.joinable()) {
+		return;
+	}
+
+	simulationThread_.request_stop();
+	snapshots_.Close();
+	simulationThread_.join();
+}
+
+void Game::UpdateCompletedFrames()
+{
+	while (completedFrames_ < submittedFrames_) {
+		ID3D11Query* fence = frameFences_[completedFrames_ % FrameFenceCount].Get();
+		if (immediateContext_->GetData(fence, nullptr, 0, D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK) {
+			break;
+		}
+		++completedFrames_;
+	}
+}
+
+PipelineHandle Game::CreatePipeline(const GraphicsPipeline::Description& desc)
+{
+	return pipelines_.Add(GraphicsPipeline::Create(graphicsDevice_.Get(), registry_, desc));
+}
+
+void Game::ReleasePipeline(PipelineHandle handle)
+{
+	if (GraphicsPipeline* pipeline = pipelines_.Get(handle)) {
+		pipeline->Release(registry_);
+		pipelines_.Release(handle, submittedFrames_);
+	}
 }
 
 void Game::Resize(int width, int height)
 {
 	assert(graphicsDevice_);
 	assert(immediateContext_);
-	assert(swapChain_);
+	assert(swapChain_ || headless_);
+
+	// Moving the window without resizing it ends up here too.
+	if (backBuffer_.RenderTargetView && width == screenWidth_ && height == screenHeight_) {
+		return;
+	}
 
 	immediateContext_->OMSetRenderTargets(0, nullptr, nullptr);
-	currentRenderTargetView_.Reset();
-	renderTargetViewCache_.clear();
-
-	depthStencilView_.Reset();
-	depthStencilBuffer_.Reset();
-
-	// Resize the swap chain
-	ThrowIfFailed(swapChain_->ResizeBuffers(0, width, height, backBufferFormat_, 0));
-
-	// Create the depth/stencil buffer and view
-	D3D11_TEXTURE2D_DESC depthStencilDesc;
-	ZeroMemory(&depthStencilDesc, sizeof(depthStencilDesc));
-	depthStencilDesc.Width = width;
-	depthStencilDesc.Height = height;
-	depthStencilDesc.MipLevels = 1;
-	depthStencilDesc.ArraySize = 1;
-	depthStencilDesc.Format = DXGI_FORMAT_D24_UNORM_S8_UINT;
-	depthStencilDesc.SampleDesc.Count = 1;
-	depthStencilDesc.SampleDesc.Quality = 0;
-	depthStencilDesc.Usage = D3D11_USAGE_DEFAULT;
-	depthStencilDesc.BindFlags = D3D11_BIND_DEPTH_STENCIL;
-	depthStencilDesc.CPUAccessFlags = 0;
-	depthStencilDesc.MiscFlags = 0;
+	backBuffer_ = RenderTarget();
+
+	screenWidth_ = width;
+	screenHeight_ = height;
+
+	D3D11_TEXTURE2D_DESC backBufferDesc;
+	if (swapChain_) {
+		// Resize the swap chain
+		ThrowIfFailed(swapChain_->ResizeBuffers(0, width, height, backBufferFormat_, SwapChainFlags));
 
-	ThrowIfFailed(graphicsDevice_->CreateTexture2D(&depthStencilDesc, nullptr, depthStencilBuffer_.GetAddressOf()));
-	ThrowIfFailed(graphicsDevice_->CreateDepthStencilView(depthStencilBuffer_.Get(), nullptr, depthStencilView_.GetAddressOf()));
+		// Only the current back buffer is accessible, so it is charged for all of them.
+		ThrowIfFailed(swapChain_->GetBuffer(0, IID_PPV_ARGS(&backBuffer_.Texture)));
+		backBuffer_.Texture->GetDesc(&backBufferDesc);
+		MemoryTracker::Get().TrackResource(backBuffer_.Texture.Get(), GpuResourceType::RenderTarget,
+			MemoryTracker::TextureBytes(backBufferDesc) * BackBufferCount);
+	}
+	else {
+		// Headless, the back buffer is a plain render target.
+		ZeroMemory(&backBufferDesc, sizeof(backBufferDesc));
+		backBufferDesc.Width = width;
+		backBufferDesc.Height = height;
+		backBufferDesc.MipLevels = 1;
+		backBufferDesc.ArraySize = 1;
+		backBufferDesc.Format = backBufferFormat_;
+		backBufferDesc.SampleDesc.Count = 1;
+		backBufferDesc.Usage = D3D11_USAGE_DEFAULT;
+		backBufferDesc.BindFlags = D3D11_BIND_RENDER_TARGET;
+		ThrowIfFailed(graphicsDevice_->CreateTexture2D(&backBufferDesc, nullptr, backBuffer_.Texture.GetAddressOf()));
+		MemoryTracker::Get().TrackTexture(backBuffer_.Texture.Get());
+	}
+	ThrowIfFailed(graphicsDevice_->CreateRenderTargetView(backBuffer_.Texture.Get(), nullptr, backBuffer_.RenderTargetView.GetAddressOf()));
+	backBuffer_.Width = backBufferDesc.Width;
+	backBuffer_.Height = backBufferDesc.Height;
 
 	// Set the viewport transform
 	viewport_.TopLeftX = 0;
@@ -308,12 +936,16 @@ void Game::Resize(int width, int height)
 	viewport_.MaxDepth = 1.0f;
 	immediateContext_->RSSetViewports(1, &viewport_);
 
+	resolution_.Reset();
+
 	OnResize();
 }
 
 void Game::Resume()
 {
 	paused_ = false;
+	pacer_.Reset();
+	resolution_.Reset();
 }
 
 void Game::Pause()
@@ -321,7 +953,35 @@ void Game::Pause()
 	paused_ = true;
 }
 
-std::wstring Game::GetAssetPath(std::wstring_view filename) const
+bool Game::MountAssets()
+{
+	MemoryTagScope memoryTag(MemoryTag::Assets);
+
+	// Packed assets live next to the asset directory as "assets.pak".
+	// Loose files are mounted on top in debug builds so edits show up
+	// without repacking, and always when there is no archive.
+	const std::filesystem::path& assetDirectory = AssetDirectory();
+	if (assetDirectory.empty()) {
+		LogError(LogCategory::Resource, "Failed to find asset directory");
+		return false;
+	}
+
+	std::filesystem::path archivePath = assetDirectory.parent_path() / L"assets.pak";
+	bool archiveMounted = std::filesystem::exists(archivePath) && fileSystem_.MountArchive(archivePath);
+
+	bool looseMounted = false;
+#if defined(DEBUG) || defined(_DEBUG)
+	looseMounted = fileSystem_.MountLooseDirectory(assetDirectory);
+#else
+	if (!archiveMounted) {
+		looseMounted = fileSystem_.MountLooseDirectory(assetDirectory);
+	}
+#endif
+
+	return archiveMounted || looseMounted;
+}
+
+const std::filesystem::path& Game::AssetDirectory() const
 {
 	if (assetDirectory_.empty()) {
 		std::filesystem::path path = std::filesystem::current_path();
@@ -332,7 +992,7 @@ std::wstring Game::GetAssetPath(std::wstring_view filename) const
 					break;
 				}
 			}
-			if (assetDirectory_.empty()) {
+			if (assetDirectory_.empty() && path != path.parent_path()) {
 				path = path.parent_path();
 			}
 			else {
@@ -340,8 +1000,12 @@ std::wstring Game::GetAssetPath(std::wstring_view filename) const
 			}
 		}
 	}
-	std::wstring assetPath = std::format(L"{}{}{}", assetDirectory_, std::filesystem::path::preferred_separator, filename);
-	return assetPath;
+	return assetDirectory_;
+}
+
+std::wstring Game::GetAssetPath(std::wstring_view filename) const
+{
+	return (AssetDirectory() / filename).wstring();
 }
 
 void Game::SetBackgroundColor(float r, float g, float b, float a)
@@ -0,0 +1,293 @@
+module;
+// C
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <emmintrin.h>
+
+export module diagnostics.golden;
+
+import <algorithm>;
+import <bit>;
+import <filesystem>;
+import <vector>;
+
+import resource.png;
+
+// How far an image may be from its golden image and still match it.
+export struct ImageTolerance
+{
+	// Largest difference of a colour channel that still counts as equal.
+	int Channel = 2;
+	// Percentage of the compared pixels that may differ by more than that.
+	double DifferentPixels = 0.05;
+	// Lowest mean structural similarity of the luma, 1 for identical images.
+	double Ssim = 0.98;
+};
+
+export struct ImageComparison
+{
+	bool SizeMatches = true;
+	std::uint64_t ComparedPixels = 0;
+	std::uint64_t DifferentPixels = 0;
+	int MaxDifference = 0;
+	double Ssim = 1.0;
+
+	bool Passes(const ImageTolerance& tolerance) const;
+};
+
+// Compares actual with golden per pixel, four at a time with SSE2, and by
+// the mean SSIM of their luma over 8x8 blocks, which catches shifted or
+// blurred structure that stays within the per-pixel tolerance. Alpha is
+// ignored.
+//
+// mask, if not null, is a tolerance per pixel in its red channel: black
+// pixels are not compared, white ones allow tolerance.Channel and grey ones
+// allow differences up to 255 minus their value. It must be of the same size.
+export ImageComparison CompareImages(const PngImage& golden, const PngImage& actual, const PngImage* mask, const ImageTolerance& tolerance);
+
+// Writes where and by how much actual differs from golden: the golden image
+// dimmed where they match, green where they differ within the tolerance and
+// red turning yellow beyond it. Pixels the mask excludes are black.
+export bool WriteDiffHeatmap(const std::filesystem::path& path, const PngImage& golden, const PngImage& actual, const PngImage* mask, const ImageTolerance& tolerance);
+
+module :private;
+
+namespace
+{
+	constexpr int SsimBlock = 8;
+
+	int PixelTolerance(const PngImage* mask, std::size_t pixel, int channel)
+	{
+		return mask ? std::max(channel, 255 - mask->Rgba[pixel * 4]) : channel;
+	}
+
+	int MaxChannelDifference(const std::uint8_t* a, const std::uint8_t* b)
+	{
+		int difference = 0;
+		for (int channel = 0; channel < 3; ++channel) {
+			difference = std::max(difference, std::abs(a[channel] - b[channel]));
+		}
+		return difference;
+	}
+
+	// The largest colour channel difference of four RGBA8 pixels, one per
+	// 32-bit lane.
+	__m128i MaxChannelDifference(__m128i a, __m128i b)
+	{
+		__m128i difference = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+		difference = _mm_and_si128(difference, _mm_set1_epi32(0x00FFFFFF));
+		difference = _mm_max_epu8(difference, _mm_srli_epi32(difference, 8));
+		difference = _mm_max_epu8(difference, _mm_srli_epi32(difference, 16));
+		return _mm_and_si128(difference, _mm_set1_epi32(0xFF));
+	}
+
+	std::uint8_t Luma(const std::uint8_t* pixel)
+	{
+		return static_cast<std::uint8_t>((77 * pixel[0] + 150 * pixel[1] + 29 * pixel[2] + 128) >> 8);
+	}
+
+	// Luma of RGBA8 pixels, sixteen at a time.
+	void ConvertToLuma(const std::uint8_t* rgba, std::uint8_t* luma, std::size_t pixels)
+	{
+		__m128i byteMask = _mm_set1_epi32(0xFF);
+		__m128i red = _mm_set1_epi32(77);
+		__m128i green = _mm_set1_epi32(150);
+		__m128i blue = _mm_set1_epi32(29);
+		__m128i round = _mm_set1_epi32(128);
+
+		std::size_t i = 0;
+		for (; i + 16 <= pixels; i += 16) {
+			// The weighted sum stays below 2^16, so 16-bit products suffice.
+			__m128i sums[4];
+			for (int j = 0; j < 4; ++j) {
+				__m128i pixel = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgba + (i + j * 4) * 4));
+				__m128i sum = _mm_add_epi32(round, _mm_mullo_epi16(_mm_and_si128(pixel, byteMask), red));
+				sum = _mm_add_epi32(sum, _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi32(pixel, 8), byteMask), green));
+				sum = _mm_add_epi32(sum, _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi32(pixel, 16), byteMask), blue));
+				sums[j] = _mm_srli_epi32(sum, 8);
+			}
+			__m128i words = _mm_packs_epi32(sums[0], sums[1]);
+			__m128i moreWords = _mm_packs_epi32(sums[2], sums[3]);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(luma + i), _mm_packus_epi16(words, moreWords));
+		}
+
+		for (; i < pixels; ++i) {
+			luma[i] = Luma(rgba + i * 4);
+		}
+	}
+
+	// SSIM of one block of two luma images.
+	double BlockSsim(const std::uint8_t* x, const std::uint8_t* y, std::size_t stride)
+	{
+		constexpr double C1 = (0.01 * 255) * (0.01 * 255);
+		constexpr double C2 = (0.03 * 255) * (0.03 * 255);
+		constexpr double Count = SsimBlock * SsimBlock;
+
+		// Sums of x, y, x^2, y^2 and xy as 16-bit products summed in pairs.
+		__m128i zero = _mm_setzero_si128();
+		__m128i ones = _mm_set1_epi16(1);
+		__m128i sumX = zero, sumY = zero, sumXX = zero, sumYY = zero, sumXY = zero;
+		for (int row = 0; row < SsimBlock; ++row) {
+			__m128i xs = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(x + row * stride)), zero);
+			__m128i ys = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(y + row * stride)), zero);
+			sumX = _mm_add_epi32(sumX, _mm_madd_epi16(xs, ones));
+			sumY = _mm_add_epi32(sumY, _mm_madd_epi16(ys, ones));
+			sumXX = _mm_add_epi32(sumXX, _mm_madd_epi16(xs, xs));
+			sumYY = _mm_add_epi32(sumYY, _mm_madd_epi16(ys, ys));
+			sumXY = _mm_add_epi32(sumXY, _mm_madd_epi16(xs, ys));
+		}
+
+		auto total = [](__m128i lanes) {
+			lanes = _mm_add_epi32(lanes, _mm_srli_si128(lanes, 8));
+			lanes = _mm_add_epi32(lanes, _mm_srli_si128(lanes, 4));
+			return static_cast<double>(_mm_cvtsi128_si32(lanes));
+		};
+		double meanX = total(sumX) / Count;
+		double meanY = total(sumY) / Count;
+		double varianceX = total(sumXX) / Count - meanX * meanX;
+		double varianceY = total(sumYY) / Count - meanY * meanY;
+		double covariance = total(sumXY) / Count - meanX * meanY;
+		return ((2.0 * meanX * meanY + C1) * (2.0 * covariance + C2)) /
+			((meanX * meanX + meanY * meanY + C1) * (varianceX + varianceY + C2));
+	}
+}
+
+bool ImageComparison::Passes(const ImageTolerance& tolerance) const
+{
+	return SizeMatches &&
+		DifferentPixels <= tolerance.DifferentPixels / 100.0 * ComparedPixels &&
+		Ssim >= tolerance.Ssim;
+}
+
+ImageComparison CompareImages(const PngImage& golden, const PngImage& actual, const PngImage* mask, const ImageTolerance& tolerance)
+{
+	ImageComparison result;
+	if (golden.Width != actual.Width || golden.Height != actual.Height) {
+		result.SizeMatches = false;
+		return result;
+	}
+
+	std::size_t pixels = std::size_t(golden.Width) * golden.Height;
+	const std::uint8_t* a = golden.Rgba.data();
+	const std::uint8_t* b = actual.Rgba.data();
+	const std::uint8_t* m = mask ? mask->Rgba.data() : nullptr;
+
+	// Per pixel: the tolerance is 255 where the mask is black, so nothing
+	// can exceed it, and those pixels are not counted as compared.
+	__m128i channel = _mm_set1_epi32(tolerance.Channel);
+	__m128i excluded = _mm_set1_epi32(255);
+	__m128i maxDifference = _mm_setzero_si128();
+	std::uint64_t excludedPixels = 0;
+	std::size_t i = 0;
+	for (; i + 4 <= pixels; i += 4) {
+		__m128i difference = MaxChannelDifference(
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i * 4)),
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i * 4)));
+		__m128i limit = channel;
+		if (m) {
+			__m128i allowed = _mm_sub_epi32(excluded, _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(m + i * 4)), excluded));
+			// Only the red byte matters; max of non-negative 16-bit lanes.
+			limit = _mm_max_epi16(channel, allowed);
+			__m128i skipped = _mm_cmpeq_epi32(allowed, excluded);
+			excludedPixels += std::popcount(static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(skipped))));
+			difference = _mm_andnot_si128(skipped, difference);
+		}
+		__m128i different = _mm_cmpgt_epi32(difference, limit);
+		result.DifferentPixels += std::popcount(static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(different))));
+		maxDifference = _mm_max_epi16(maxDifference, difference);
+	}
+	alignas(16) std::int32_t lanes[4];
+	_mm_store_si128(reinterpret_cast<__m128i*>(lanes), maxDifference);
+	result.MaxDifference = *std::max_element(lanes, lanes + 4);
+	for (; i < pixels; ++i) {
+		int limit = PixelTolerance(mask, i, tolerance.Channel);
+		if (limit >= 255) {
+			++excludedPixels;
+			continue;
+		}
+		int difference = MaxChannelDifference(a + i * 4, b + i * 4);
+		result.DifferentPixels += difference > limit;
+		result.MaxDifference = std::max(result.MaxDifference, difference);
+	}
+	result.ComparedPixels = pixels - excludedPixels;
+
+	// Luma of both, with the golden's where the mask excludes a pixel, so
+	// excluded pixels do not lower the SSIM. Blocks with no compared pixel at
+	// all do not count, and neither do the columns and rows past the last
+	// whole block.
+	int blocksX = golden.Width / SsimBlock;
+	int blocksY = golden.Height / SsimBlock;
+	if (blocksX == 0 || blocksY == 0) {
+		return result;
+	}
+
+	std::size_t lumaPixels = std::size_t(blocksY) * SsimBlock * golden.Width;
+	std::vector<std::uint8_t> goldenLuma(lumaPixels);
+	std::vector<std::uint8_t> actualLuma(lumaPixels);
+	ConvertToLuma(a, goldenLuma.data(), lumaPixels);
+	ConvertToLuma(b, actualLuma.data(), lumaPixels);
+
+	std::vector<std::uint16_t> comparedInBlock;
+	if (m) {
+		comparedInBlock.assign(std::size_t(blocksX) * blocksY, 0);
+		for (int y = 0; y < blocksY * SsimBlock; ++y) {
+			std::size_t row = std::size_t(y) * golden.Width;
+			std::uint16_t* counts = comparedInBlock.data() + std::size_t(y / SsimBlock) * blocksX;
+			for (int x = 0; x < golden.Width; ++x) {
+				bool compared = m[(row + x) * 4] != 0;
+				actualLuma[row + x] = compared ? actualLuma[row + x] : goldenLuma[row + x];
+				if (x < blocksX * SsimBlock) {
+					counts[x / SsimBlock] += compared;
+				}
+			}
+		}
+	}
+
+	double ssim = 0.0;
+	std::size_t blocks = 0;
+	for (int blockY = 0; blockY < blocksY; ++blockY) {
+		for (int blockX = 0; blockX < blocksX; ++blockX) {
+			if (m && comparedInBlock[std::size_t(blockY) * blocksX + blockX] == 0) {
+				continue;
+			}
+			std::size_t first = std::size_t(blockY) * SsimBlock * golden.Width + std::size_t(blockX) * SsimBlock;
+			ssim += BlockSsim(goldenLuma.data() + first, actualLuma.data() + first, golden.Width);
+			++blocks;
+		}
+	}
+	result.Ssim = blocks > 0 ? ssim / blocks : 1.0;
+	return result;
+}
+
+bool WriteDiffHeatmap(const std::filesystem::path& path, const PngImage& golden, const PngImage& actual, const PngImage* mask, const ImageTolerance& tolerance)
+{
+	if (golden.Width != actual.Width || golden.Height != actual.Height) {
+		return false;
+	}
+
+	std::size_t pixels = std::size_t(golden.Width) * golden.Height;
+	std::vector<std::uint8_t> rgb(pixels * 3);
+	for (std::size_t i = 0; i < pixels; ++i) {
+		std::uint8_t* out = rgb.data() + i * 3;
+		int limit = PixelTolerance(mask, i, tolerance.Channel);
+		int difference = MaxChannelDifference(golden.Rgba.data() + i * 4, actual.Rgba.data() + i * 4);
+		if (limit >= 255) {
+			out[0] = out[1] = out[2] = 0;
+		}
+		else if (difference == 0) {
+			out[0] = out[1] = out[2] = static_cast<std::uint8_t>(Luma(golden.Rgba.data() + i * 4) / 4);
+		}
+		else if (difference <= limit) {
+			out[0] = 0;
+			out[1] = static_cast<std::uint8_t>(std::min(255, 96 + difference * 16));
+			out[2] = 0;
+		}
+		else {
+			out[0] = 255;
+			out[1] = static_cast<std::uint8_t>(std::min(255, (difference - limit) * 4));
+			out[2] = 0;
+		}
+	}
+	return WritePng(path, rgb.data(), golden.Width, golden.Height);
+}
@@ -0,0 +1,529 @@
+module;
+// C
+#include <cfloat>
+#include <cstddef>
+#include <cstdint>
+
+// ImGui
+#include "imgui.h"
+
+export module diagnostics.gpu;
+
+import <algorithm>;
+import <array>;
+import <filesystem>;
+import <format>;
+import <fstream>;
+import <memory>;
+import <ostream>;
+import <span>;
+import <string_view>;
+import <vector>;
+
+import diagnostics.log;
+
+export enum class GpuQueryStatus : std::uint8_t
+{
+	NotReady,
+	Ready,
+	// The GPU clock was unreliable during the frame, e.g. it changed speed.
+	Invalid,
+};
+
+// The timestamp queries behind GpuProfiler. Queries come in frames, one per
+// slot of the profiler's ring, each bracketing up to timestampCount
+// timestamps.
+export class GpuQueryBackend
+{
+public:
+	virtual ~GpuQueryBackend() = default;
+
+	virtual bool Initialize(std::size_t frameCount, std::size_t timestampCount) = 0;
+
+	virtual void BeginFrame(std::size_t frame) = 0;
+	virtual void Timestamp(std::size_t frame, std::size_t index) = 0;
+	virtual void EndFrame(std::size_t frame) = 0;
+
+	// Never waits for the GPU. When Ready, timestamps holds the first
+	// timestamps.size() timestamps of the frame and frequency their ticks per
+	// second.
+	virtual GpuQueryStatus Read(std::size_t frame, std::span<std::uint64_t> timestamps, std::uint64_t& frequency) = 0;
+};
+
+// A GPU for tests of the profiler. Timestamps read the clock moved by
+// Advance(), and a frame's results are ready once latency more frames have
+// ended.
+export class MockGpuQueryBackend : public GpuQueryBackend
+{
+public:
+	explicit MockGpuQueryBackend(std::size_t latency = 2, std::uint64_t frequency = 1000000);
+
+	bool Initialize(std::size_t frameCount, std::size_t timestampCount) override;
+
+	void BeginFrame(std::size_t frame) override;
+	void Timestamp(std::size_t frame, std::size_t index) override;
+	void EndFrame(std::size_t frame) override;
+
+	GpuQueryStatus Read(std::size_t frame, std::span<std::uint64_t> timestamps, std::uint64_t& frequency) override;
+
+	void Advance(std::uint64_t ticks) { now_ += ticks; }
+	// Frames ended from now on are disjoint.
+	void SetDisjoint(bool disjoint) { disjoint_ = disjoint; }
+
+private:
+	struct Frame
+	{
+		std::vector<std::uint64_t> Timestamps;
+		std::uint64_t EndedAt = 0;
+		bool Ended = false;
+		bool Disjoint = false;
+	};
+
+	std::size_t latency_;
+	std::uint64_t frequency_;
+	std::uint64_t now_ = 0;
+	std::uint64_t framesEnded_ = 0;
+	bool disjoint_ = false;
+	std::vector<Frame> frames_;
+};
+
+// Names are not copied and must outlive the profiler.
+export struct GpuScopeTiming
+{
+	std::string_view Name;
+	std::uint32_t Depth = 0;
+	double Milliseconds = 0.0;
+};
+
+export struct GpuFrameTiming
+{
+	std::uint64_t Frame = 0;
+	double Milliseconds = 0.0;
+	std::vector<GpuScopeTiming> Scopes;
+};
+
+// Times frames and scopes within them on the GPU. Every frame writes its
+// timestamps into the next slot of a ring of FrameLatency slots, and its
+// results are read at the start of a later frame, once the GPU is done with
+// them. Nothing ever waits: a frame whose results are still not in when its
+// slot comes round again is dropped.
+//
+// Without a backend, or before Initialize(), every call does nothing.
+export class GpuProfiler
+{
+public:
+	static constexpr std::size_t FrameLatency = 4;
+	static constexpr std::size_t MaxScopes = 32;
+	static constexpr std::size_t FrameHistory = 240;
+	static constexpr std::uint32_t NoScope = UINT32_MAX;
+
+	struct ScopeSummary
+	{
+		std::string_view Name;
+		std::uint32_t Depth = 0;
+		double LastMilliseconds = 0.0;
+		double AverageMilliseconds = 0.0;
+		double MaxMilliseconds = 0.0;
+		std::uint64_t Samples = 0;
+	};
+
+	struct Statistics
+	{
+		std::uint64_t FramesResolved = 0;
+		// Still in flight when their slot was needed again.
+		std::uint64_t FramesDropped = 0;
+		std::uint64_t FramesDisjoint = 0;
+		// Begun after MaxScopes scopes in a frame.
+		std::uint64_t ScopesDropped = 0;
+	};
+
+public:
+	bool Initialize(std::unique_ptr<GpuQueryBackend> backend);
+	void Shutdown();
+	bool IsEnabled() const { return backend_ != nullptr; }
+
+	// Reads the results that are in, then starts timing the next frame.
+	void BeginFrame();
+	void EndFrame();
+
+	// Scopes nest. NoScope when not timed, which EndScope() ignores.
+	std::uint32_t BeginScope(std::string_view name);
+	void EndScope(std::uint32_t scope);
+
+	// The newest frame read back, FrameLatency frames or more behind.
+	const GpuFrameTiming& LastFrame() const;
+	// Oldest first.
+	std::vector<GpuFrameTiming> History() const;
+	// Every scope in the history, in the order they first ran.
+	std::vector<ScopeSummary> Summarize() const;
+	const Statistics& GetStatistics() const { return statistics_; }
+
+	void DrawPanel();
+
+	void WriteJson(std::ostream& stream) const;
+	bool DumpJson(const std::filesystem::path& path) const;
+
+private:
+	static constexpr std::size_t TimestampCount = 2 + 2 * MaxScopes;
+
+	struct Scope
+	{
+		std::string_view Name;
+		std::uint32_t Depth;
+		std::uint32_t Begin;
+		std::uint32_t End;
+	};
+
+	struct Slot
+	{
+		std::uint64_t Frame = 0;
+		std::uint32_t Timestamps = 0;
+		std::vector<Scope> Scopes;
+	};
+
+	void Resolve();
+
+private:
+	std::unique_ptr<GpuQueryBackend> backend_;
+	std::array<Slot, FrameLatency> slots_;
+	std::uint64_t framesBegun_ = 0;
+	std::uint64_t framesResolved_ = 0;
+	bool frameOpen_ = false;
+	std::uint32_t depth_ = 0;
+
+	std::array<GpuFrameTiming, FrameHistory> history_;
+	std::uint64_t historyCount_ = 0;
+	std::array<std::uint64_t, TimestampCount> timestamps_ = {};
+
+	Statistics statistics_;
+};
+
+// Times the GPU work issued during its lifetime.
+export class GpuScope
+{
+public:
+	GpuScope(GpuProfiler& profiler, std::string_view name)
+		: profiler_(profiler), scope_(profiler.BeginScope(name))
+	{
+	}
+
+	~GpuScope() { profiler_.EndScope(scope_); }
+
+	GpuScope(const GpuScope&) = delete;
+	GpuScope& operator=(const GpuScope&) = delete;
+
+private:
+	GpuProfiler& profiler_;
+	std::uint32_t scope_;
+};
+
+module :private;
+
+MockGpuQueryBackend::MockGpuQueryBackend(std::size_t latency, std::uint64_t frequency)
+	: latency_(latency), frequency_(frequency)
+{
+}
+
+bool MockGpuQueryBackend::Initialize(std::size_t frameCount, std::size_t timestampCount)
+{
+	frames_.assign(frameCount, Frame());
+	for (Frame& frame : frames_) {
+		frame.Timestamps.resize(timestampCount);
+	}
+	return true;
+}
+
+void MockGpuQueryBackend::BeginFrame(std::size_t frame)
+{
+	frames_[frame].Ended = false;
+}
+
+void MockGpuQueryBackend::Timestamp(std::size_t frame, std::size_t index)
+{
+	frames_[frame].Timestamps[index] = now_;
+}
+
+void MockGpuQueryBackend::EndFrame(std::size_t frame)
+{
+	frames_[frame].Ended = true;
+	frames_[frame].EndedAt = framesEnded_++;
+	frames_[frame].Disjoint = disjoint_;
+}
+
+GpuQueryStatus MockGpuQueryBackend::Read(std::size_t frame, std::span<std::uint64_t> timestamps, std::uint64_t& frequency)
+{
+	const Frame& queries = frames_[frame];
+	if (!queries.Ended || framesEnded_ - queries.EndedAt <= latency_) {
+		return GpuQueryStatus::NotReady;
+	}
+	if (queries.Disjoint) {
+		return GpuQueryStatus::Invalid;
+	}
+
+	std::copy_n(queries.Timestamps.begin(), timestamps.size(), timestamps.begin());
+	frequency = frequency_;
+	return GpuQueryStatus::Ready;
+}
+
+bool GpuProfiler::Initialize(std::unique_ptr<GpuQueryBackend> backend)
+{
+	Shutdown();
+	if (!backend || !backend->Initialize(FrameLatency, TimestampCount)) {
+		return false;
+	}
+	backend_ = std::move(backend);
+	return true;
+}
+
+void GpuProfiler::Shutdown()
+{
+	backend_.reset();
+	framesBegun_ = 0;
+	framesResolved_ = 0;
+	frameOpen_ = false;
+	depth_ = 0;
+}
+
+void GpuProfiler::BeginFrame()
+{
+	if (!backend_ || frameOpen_) {
+		return;
+	}
+
+	Resolve();
+
+	// The GPU is too far behind to wait for: the oldest frame is given up
+	// and its slot reused.
+	if (framesBegun_ - framesResolved_ == FrameLatency) {
+		++framesResolved_;
+		++statistics_.FramesDropped;
+	}
+
+	std::size_t index = framesBegun_ % FrameLatency;
+	Slot& slot = slots_[index];
+	slot.Frame = framesBegun_;
+	slot.Timestamps = 2;
+	slot.Scopes.clear();
+
+	backend_->BeginFrame(index);
+	backend_->Timestamp(index, 0);
+	frameOpen_ = true;
+	depth_ = 0;
+}
+
+void GpuProfiler::EndFrame()
+{
+	if (!frameOpen_) {
+		return;
+	}
+
+	// Scopes still open end with the frame, so every timestamp read back
+	// has been written.
+	std::size_t index = framesBegun_ % FrameLatency;
+	for (Scope& scope : slots_[index].Scopes) {
+		if (scope.End == 0) {
+			scope.End = scope.Begin + 1;
+			backend_->Timestamp(index, scope.End);
+		}
+	}
+	backend_->Timestamp(index, 1);
+	backend_->EndFrame(index);
+	frameOpen_ = false;
+	++framesBegun_;
+}
+
+std::uint32_t GpuProfiler::BeginScope(std::string_view name)
+{
+	if (!frameOpen_) {
+		return NoScope;
+	}
+
+	std::size_t index = framesBegun_ % FrameLatency;
+	Slot& slot = slots_[index];
+	if (slot.Timestamps + 2 > TimestampCount) {
+		++statistics_.ScopesDropped;
+		return NoScope;
+	}
+
+	backend_->Timestamp(index, slot.Timestamps);
+	slot.Scopes.push_back({ name, depth_++, slot.Timestamps, 0 });
+	// The end is reserved now, so a frame never runs out of them.
+	slot.Timestamps += 2;
+	return static_cast<std::uint32_t>(slot.Scopes.size() - 1);
+}
+
+void GpuProfiler::EndScope(std::uint32_t scope)
+{
+	if (scope == NoScope || !frameOpen_) {
+		return;
+	}
+
+	std::size_t index = framesBegun_ % FrameLatency;
+	Scope& record = slots_[index].Scopes[scope];
+	if (record.End == 0) {
+		record.End = record.Begin + 1;
+		backend_->Timestamp(index, record.End);
+		--depth_;
+	}
+}
+
+void GpuProfiler::Resolve()
+{
+	while (framesResolved_ < framesBegun_) {
+		const Slot& slot = slots_[framesResolved_ % FrameLatency];
+		std::uint64_t frequency = 0;
+		std::span<std::uint64_t> timestamps(timestamps_.data(), slot.Timestamps);
+		GpuQueryStatus status = backend_->Read(framesResolved_ % FrameLatency, timestamps, frequency);
+		if (status == GpuQueryStatus::NotReady) {
+			break;
+		}
+		++framesResolved_;
+
+		if (status == GpuQueryStatus::Invalid || frequency == 0) {
+			++statistics_.FramesDisjoint;
+			continue;
+		}
+
+		auto milliseconds = [&](std::uint32_t begin, std::uint32_t end) {
+			return timestamps[end] >= timestamps[begin] ? (timestamps[end] - timestamps[begin]) * 1000.0 / frequency : 0.0;
+		};
+
+		GpuFrameTiming& frame = history_[historyCount_ % FrameHistory];
+		frame.Frame = slot.Frame;
+		frame.Milliseconds = milliseconds(0, 1);
+		frame.Scopes.clear();
+		for (const Scope& scope : slot.Scopes) {
+			frame.Scopes.push_back({ scope.Name, scope.Depth, milliseconds(scope.Begin, scope.End) });
+		}
+		++historyCount_;
+		++statistics_.FramesResolved;
+	}
+}
+
+const GpuFrameTiming& GpuProfiler::LastFrame() const
+{
+	return history_[(historyCount_ + FrameHistory - 1) % FrameHistory];
+}
+
+std::vector<GpuFrameTiming> GpuProfiler::History() const
+{
+	std::vector<GpuFrameTiming> history;
+	std::uint64_t first = historyCount_ > FrameHistory ? historyCount_ - FrameHistory : 0;
+	for (std::uint64_t frame = first; frame < historyCount_; ++frame) {
+		history.push_back(history_[frame % FrameHistory]);
+	}
+	return history;
+}
+
+std::vector<GpuProfiler::ScopeSummary> GpuProfiler::Summarize() const
+{
+	std::vector<ScopeSummary> summaries;
+	std::uint64_t first = historyCount_ > FrameHistory ? historyCount_ - FrameHistory : 0;
+	for (std::uint64_t frame = first; frame < historyCount_; ++frame) {
+		for (const GpuScopeTiming& scope : history_[frame % FrameHistory].Scopes) {
+			auto found = std::find_if(summaries.begin(), summaries.end(),
+				[&](const ScopeSummary& summary) { return summary.Name == scope.Name && summary.Depth == scope.Depth; });
+			if (found == summaries.end()) {
+				found = summaries.insert(summaries.end(), ScopeSummary{ scope.Name, scope.Depth });
+			}
+			found->LastMilliseconds = scope.Milliseconds;
+			found->AverageMilliseconds += scope.Milliseconds;
+			found->MaxMilliseconds = std::max(found->MaxMilliseconds, scope.Milliseconds);
+			++found->Samples;
+		}
+	}
+
+	for (ScopeSummary& summary : summaries) {
+		summary.AverageMilliseconds /= summary.Samples;
+	}
+	return summaries;
+}
+
+void GpuProfiler::DrawPanel()
+{
+	ImGui::Begin("GPU Profiler");
+
+	if (!IsEnabled()) {
+		ImGui::Text("No GPU timestamps");
+		ImGui::End();
+		return;
+	}
+
+	const GpuFrameTiming& frame = LastFrame();
+	ImGui::Text("Frame %llu: %.3f ms", frame.Frame, frame.Milliseconds);
+	ImGui::Text("Dropped: %llu, disjoint: %llu", statistics_.FramesDropped, statistics_.FramesDisjoint);
+
+	if (ImGui::BeginTable("GpuScopes", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+		ImGui::TableSetupColumn("Scope");
+		ImGui::TableSetupColumn("Last (ms)");
+		ImGui::TableSetupColumn("Average (ms)");
+		ImGui::TableSetupColumn("Max (ms)");
+		ImGui::TableHeadersRow();
+		for (const ScopeSummary& summary : Summarize()) {
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+			ImGui::Text("%*s%.*s", static_cast<int>(summary.Depth * 2), "", static_cast<int>(summary.Name.size()), summary.Name.data());
+			ImGui::TableNextColumn();
+			ImGui::Text("%.3f", summary.LastMilliseconds);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.3f", summary.AverageMilliseconds);
+			ImGui::TableNextColumn();
+			ImGui::Text("%.3f", summary.MaxMilliseconds);
+		}
+		ImGui::EndTable();
+	}
+
+	std::array<float, FrameHistory> values = {};
+	for (std::size_t i = 0; i < FrameHistory; ++i) {
+		values[i] = static_cast<float>(history_[i].Milliseconds);
+	}
+	ImGui::PlotLines("##GpuFrame", values.data(), static_cast<int>(values.size()), static_cast<int>(historyCount_ % FrameHistory),
+		"GPU frame (ms)", 0.0f, FLT_MAX, ImVec2(-1.0f, 60.0f));
+
+	if (ImGui::Button("Dump JSON")) {
+		DumpJson("gpu_profile.json");
+	}
+
+	ImGui::End();
+}
+
+void GpuProfiler::WriteJson(std::ostream& stream) const
+{
+	stream << std::format("{{\n  \"framesResolved\": {},\n  \"framesDropped\": {},\n  \"framesDisjoint\": {},\n  \"scopesDropped\": {},\n",
+		statistics_.FramesResolved, statistics_.FramesDropped, statistics_.FramesDisjoint, statistics_.ScopesDropped);
+
+	std::vector<ScopeSummary> summaries = Summarize();
+	stream << "  \"scopes\": [\n";
+	for (std::size_t i = 0; i < summaries.size(); ++i) {
+		const ScopeSummary& summary = summaries[i];
+		stream << std::format("    {{ \"name\": \"{}\", \"depth\": {}, \"lastMs\": {:.4f}, \"averageMs\": {:.4f}, \"maxMs\": {:.4f}, \"samples\": {} }}{}\n",
+			summary.Name, summary.Depth, summary.LastMilliseconds, summary.AverageMilliseconds, summary.MaxMilliseconds,
+			summary.Samples, i + 1 < summaries.size() ? "," : "");
+	}
+
+	std::vector<GpuFrameTiming> history = History();
+	stream << "  ],\n  \"frames\": [\n";
+	for (std::size_t i = 0; i < history.size(); ++i) {
+		const GpuFrameTiming& frame = history[i];
+		stream << std::format("    {{ \"frame\": {}, \"ms\": {:.4f}, \"scopes\": [", frame.Frame, frame.Milliseconds);
+		for (std::size_t j = 0; j < frame.Scopes.size(); ++j) {
+			const GpuScopeTiming& scope = frame.Scopes[j];
+			stream << std::format("{{ \"name\": \"{}\", \"depth\": {}, \"ms\": {:.4f} }}{}",
+				scope.Name, scope.Depth, scope.Milliseconds, j + 1 < frame.Scopes.size() ? ", " : "");
+		}
+		stream << std::format("] }}{}\n", i + 1 < history.size() ? "," : "");
+	}
+	stream << "  ]\n}\n";
+}
+
+bool GpuProfiler::DumpJson(const std::filesystem::path& path) const
+{
+	std::ofstream file(path, std::ios::trunc);
+	if (!file) {
+		LogError(LogCategory::Render, "Failed to write GPU profile: {}", path.string());
+		return false;
+	}
+
+	WriteJson(file);
+	return true;
+}
@@ -0,0 +1,110 @@
+module;
+// C
+#include <cstddef>
+#include <cstdint>
+
+// Windows
+#include <d3d11.h>
+#include <wrl.h>
+
+export module render.timestamps;
+
+import <span>;
+import <vector>;
+
+import diagnostics.gpu;
+
+// GPU timestamps from D3D11 queries: a disjoint query per frame of the ring
+// around timestamp queries that are all created up front.
+export class D3D11GpuQueryBackend : public GpuQueryBackend
+{
+public:
+	D3D11GpuQueryBackend(ID3D11Device* device, ID3D11DeviceContext* context);
+
+	bool Initialize(std::size_t frameCount, std::size_t timestampCount) override;
+
+	void BeginFrame(std::size_t frame) override;
+	void Timestamp(std::size_t frame, std::size_t index) override;
+	void EndFrame(std::size_t frame) override;
+
+	GpuQueryStatus Read(std::size_t frame, std::span<std::uint64_t> timestamps, std::uint64_t& frequency) override;
+
+private:
+	struct Frame
+	{
+		Microsoft::WRL::ComPtr<ID3D11Query> Disjoint;
+		std::vector<Microsoft::WRL::ComPtr<ID3D11Query>> Timestamps;
+	};
+
+	Microsoft::WRL::ComPtr<ID3D11Device> device_;
+	ID3D11DeviceContext* context_;
+	std::vector<Frame> frames_;
+};
+
+module :private;
+
+D3D11GpuQueryBackend::D3D11GpuQueryBackend(ID3D11Device* device, ID3D11DeviceContext* context)
+	: device_(device), context_(context)
+{
+}
+
+bool D3D11GpuQueryBackend::Initialize(std::size_t frameCount, std::size_t timestampCount)
+{
+	D3D11_QUERY_DESC disjointDesc{ D3D11_QUERY_TIMESTAMP_DISJOINT, 0 };
+	D3D11_QUERY_DESC timestampDesc{ D3D11_QUERY_TIMESTAMP, 0 };
+
+	frames_.resize(frameCount);
+	for (Frame& frame : frames_) {
+		if (FAILED(device_->CreateQuery(&disjointDesc, frame.Disjoint.ReleaseAndGetAddressOf()))) {
+			return false;
+		}
+
+		frame.Timestamps.resize(timestampCount);
+		for (Microsoft::WRL::ComPtr<ID3D11Query>& timestamp : frame.Timestamps) {
+			if (FAILED(device_->CreateQuery(&timestampDesc, timestamp.ReleaseAndGetAddressOf()))) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void D3D11GpuQueryBackend::BeginFrame(std::size_t frame)
+{
+	context_->Begin(frames_[frame].Disjoint.Get());
+}
+
+void D3D11GpuQueryBackend::Timestamp(std::size_t frame, std::size_t index)
+{
+	context_->End(frames_[frame].Timestamps[index].Get());
+}
+
+void D3D11GpuQueryBackend::EndFrame(std::size_t frame)
+{
+	context_->End(frames_[frame].Disjoint.Get());
+}
+
+GpuQueryStatus D3D11GpuQueryBackend::Read(std::size_t frame, std::span<std::uint64_t> timestamps, std::uint64_t& frequency)
+{
+	// DONOTFLUSH, as the queries are polled every frame and the frame's
+	// commands get flushed by Present() anyway.
+	Frame& queries = frames_[frame];
+	D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+	if (context_->GetData(queries.Disjoint.Get(), &disjoint, sizeof(disjoint), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK) {
+		return GpuQueryStatus::NotReady;
+	}
+	if (disjoint.Disjoint) {
+		return GpuQueryStatus::Invalid;
+	}
+
+	for (std::size_t i = 0; i < timestamps.size(); ++i) {
+		UINT64 timestamp;
+		if (context_->GetData(queries.Timestamps[i].Get(), &timestamp, sizeof(timestamp), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK) {
+			return GpuQueryStatus::NotReady;
+		}
+		timestamps[i] = timestamp;
+	}
+
+	frequency = disjoint.Frequency;
+	return GpuQueryStatus::Ready;
+}
@@ -4,10 +4,12 @@ module;
 
 export module pipeline;
 
-import <memory>;
 import <span>;
-import <vector>;
 
+import core.memory;
+import diagnostics.memory;
+import render.context;
+import resource.registry;
 import utility;
 
 export class GraphicsPipeline
@@ -16,54 +18,100 @@ public:
 	struct Description
 	{
 		D3D11_PRIMITIVE_TOPOLOGY PrimitiveTopology = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
-		std::vector<D3D11_INPUT_ELEMENT_DESC> InputLayout;
-		Microsoft::WRL::ComPtr<ID3D11RasterizerState> RasterizerState;
+		// Empty for shaders that generate their vertices from SV_VertexID.
+		std::span<const D3D11_INPUT_ELEMENT_DESC> InputLayout;
+		RasterizerStateHandle RasterizerState;
+		// Null means the default depth test, less with depth writes.
+		DepthStencilStateHandle DepthStencilState;
 		Microsoft::WRL::ComPtr<ID3DBlob> VertexShader;
+		// Null for depth-only passes. Without a pixel shader the rasterizer
+		// only writes depth and no pixel shader invocations are spent.
 		Microsoft::WRL::ComPtr<ID3DBlob> PixelShader;
 	};
 
 public:
-	static std::unique_ptr<GraphicsPipeline> Create(ID3D11Device* device, const Description& desc);
+	// The input layout and shaders are owned by the registry and released by Release().
+	// The rasterizer and depth stencil states are only referenced.
+	static GraphicsPipeline Create(ID3D11Device* device, ResourceRegistry& registry, const Description& desc);
 
 public:
-	void Apply(ID3D11DeviceContext* context);
+	void Apply(RenderContext& context, const ResourceRegistry& registry) const;
+	void Release(ResourceRegistry& registry);
 
-	void SetRasterizerState(Microsoft::WRL::ComPtr<ID3D11RasterizerState> rasterizerState);
+	void SetRasterizerState(RasterizerStateHandle rasterizerState);
+	void SetDepthStencilState(DepthStencilStateHandle depthStencilState);
 
 private:
-	GraphicsPipeline() = default;
-
-private:
-	D3D11_PRIMITIVE_TOPOLOGY primitiveTopology_;
-	Microsoft::WRL::ComPtr<ID3D11InputLayout> inputLayout_;
-	Microsoft::WRL::ComPtr<ID3D11VertexShader> vertexShader_;
-	Microsoft::WRL::ComPtr<ID3D11PixelShader> pixelShader_;
-	Microsoft::WRL::ComPtr<ID3D11RasterizerState> rasterizerState_;
+	D3D11_PRIMITIVE_TOPOLOGY primitiveTopology_ = D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED;
+	InputLayoutHandle inputLayout_;
+	VertexShaderHandle vertexShader_;
+	PixelShaderHandle pixelShader_;
+	RasterizerStateHandle rasterizerState_;
+	DepthStencilStateHandle depthStencilState_;
 };
 
+export using PipelineHandle = Handle<GraphicsPipeline>;
+
 module :private;
 
-std::unique_ptr<GraphicsPipeline> GraphicsPipeline::Create(ID3D11Device* device, const Description& desc)
+GraphicsPipeline GraphicsPipeline::Create(ID3D11Device* device, ResourceRegistry& registry, const Description& desc)
 {
-	std::unique_ptr<GraphicsPipeline> pipeline = std::unique_ptr<GraphicsPipeline>(new GraphicsPipeline());
-	pipeline->primitiveTopology_ = desc.PrimitiveTopology;
-	ThrowIfFailed(device->CreateInputLayout(desc.InputLayout.data(), desc.InputLayout.size(), desc.VertexShader->GetBufferPointer(), desc.VertexShader->GetBufferSize(), &pipeline->inputLayout_));
-	ThrowIfFailed(device->CreateVertexShader(desc.VertexShader->GetBufferPointer(), desc.VertexShader->GetBufferSize(), nullptr, &pipeline->vertexShader_));
-	ThrowIfFailed(device->CreatePixelShader(desc.PixelShader->GetBufferPointer(), desc.PixelShader->GetBufferSize(), nullptr, &pipeline->pixelShader_));
-	pipeline->rasterizerState_ = desc.RasterizerState;
+	MemoryTagScope memoryTag(MemoryTag::Rendering);
+
+	Microsoft::WRL::ComPtr<ID3D11InputLayout> inputLayout;
+	Microsoft::WRL::ComPtr<ID3D11VertexShader> vertexShader;
+	Microsoft::WRL::ComPtr<ID3D11PixelShader> pixelShader;
+	if (!desc.InputLayout.empty()) {
+		ThrowIfFailed(device->CreateInputLayout(desc.InputLayout.data(), desc.InputLayout.size(), desc.VertexShader->GetBufferPointer(), desc.VertexShader->GetBufferSize(), &inputLayout));
+		RenderContext::AttachInputLayout(inputLayout.Get(), desc.InputLayout, desc.VertexShader.Get());
+	}
+	ThrowIfFailed(device->CreateVertexShader(desc.VertexShader->GetBufferPointer(), desc.VertexShader->GetBufferSize(), nullptr, &vertexShader));
+	MemoryTracker::Get().TrackShader(vertexShader.Get(), desc.VertexShader->GetBufferSize());
+	RenderContext::AttachBytecode(vertexShader.Get(), desc.VertexShader.Get());
+	if (desc.PixelShader) {
+		ThrowIfFailed(device->CreatePixelShader(desc.PixelShader->GetBufferPointer(), desc.PixelShader->GetBufferSize(), nullptr, &pixelShader));
+		MemoryTracker::Get().TrackShader(pixelShader.Get(), desc.PixelShader->GetBufferSize());
+		RenderContext::AttachBytecode(pixelShader.Get(), desc.PixelShader.Get());
+	}
+
+	GraphicsPipeline pipeline;
+	pipeline.primitiveTopology_ = desc.PrimitiveTopology;
+	if (inputLayout) {
+		pipeline.inputLayout_ = registry.Add(std::move(inputLayout));
+	}
+	pipeline.vertexShader_ = registry.Add(std::move(vertexShader));
+	if (pixelShader) {
+		pipeline.pixelShader_ = registry.Add(std::move(pixelShader));
+	}
+	pipeline.rasterizerState_ = desc.RasterizerState;
+	pipeline.depthStencilState_ = desc.DepthStencilState;
 	return pipeline;
 }
 
-void GraphicsPipeline::Apply(ID3D11DeviceContext* context)
+void GraphicsPipeline::Apply(RenderContext& context, const ResourceRegistry& registry) const
 {
-	context->IASetPrimitiveTopology(primitiveTopology_);
-	context->IASetInputLayout(inputLayout_.Get());
-	context->VSSetShader(vertexShader_.Get(), nullptr, 0);
-	context->PSSetShader(pixelShader_.Get(), nullptr, 0);
-	context->RSSetState(rasterizerState_.Get());
+	context.SetPrimitiveTopology(primitiveTopology_);
+	context.SetInputLayout(registry.Get(inputLayout_));
+	context.SetVertexShader(registry.Get(vertexShader_));
+	context.SetPixelShader(registry.Get(pixelShader_));
+	context.SetRasterizerState(registry.Get(rasterizerState_));
+	context.SetDepthStencilState(registry.Get(depthStencilState_));
 }
 
-void GraphicsPipeline::SetRasterizerState(Microsoft::WRL::ComPtr<ID3D11RasterizerState> rasterizerState)
+void GraphicsPipeline::Release(ResourceRegistry& registry)
+{
+	registry.Release(inputLayout_);
+	registry.Release(vertexShader_);
+	registry.Release(pixelShader_);
+	*this = GraphicsPipeline();
+}
+
+void GraphicsPipeline::SetRasterizerState(RasterizerStateHandle rasterizerState)
 {
 	rasterizerState_ = rasterizerState;
 }
+
+void GraphicsPipeline::SetDepthStencilState(DepthStencilStateHandle depthStencilState)
+{
+	depthStencilState_ = depthStencilState;
+}
@@ -0,0 +1,301 @@
+module;
+// C
+#include <cfloat>
+#include <cstddef>
+#include <cstdint>
+
+// ImGui
+#include "imgui.h"
+
+export module diagnostics.latency;
+
+import <algorithm>;
+import <array>;
+import <chrono>;
+import <filesystem>;
+import <format>;
+import <fstream>;
+import <mutex>;
+import <span>;
+import <stop_token>;
+import <string_view>;
+import <thread>;
+import <vector>;
+
+import diagnostics.log;
+
+export enum class InputSource : std::uint8_t
+{
+	Keyboard,
+	Mouse,
+	Simulated,
+	Count,
+};
+
+export constexpr std::string_view InputSourceName(InputSource source)
+{
+	constexpr std::string_view names[] = { "Keyboard", "Mouse", "Simulated" };
+	return source < InputSource::Count ? names[static_cast<std::size_t>(source)] : "Unknown";
+}
+
+// An input event on its way to the screen. The timestamps are filled in as
+// the frame that handles the event passes each stage.
+export struct InputStamp
+{
+	using Clock = std::chrono::steady_clock;
+
+	std::uint64_t Id = 0;
+	InputSource Source = InputSource::Keyboard;
+	Clock::time_point Received;
+	Clock::time_point Updated;
+	Clock::time_point Rendered;
+};
+
+// Measures the time from an input event to the Present() of the first frame
+// that could react to it. Events are recorded on the window thread (or by
+// SimulatedInputDriver), picked up by the next simulation step, carried
+// through the frame snapshot, and completed when the frame is presented.
+export class LatencyTracker
+{
+public:
+	using Clock = InputStamp::Clock;
+
+	struct Sample
+	{
+		std::uint64_t Frame;
+		InputSource Source;
+		float UpdateMilliseconds;
+		float RenderMilliseconds;
+		float PresentMilliseconds;
+	};
+
+	struct Summary
+	{
+		std::size_t Count = 0;
+		float Median = 0.0f;
+		float P95 = 0.0f;
+		float P99 = 0.0f;
+		float Max = 0.0f;
+	};
+
+public:
+	static LatencyTracker& Get();
+
+public:
+	// Thread-safe.
+	void RecordInput(InputSource source);
+
+	// Called by the simulation step. Moves pending events into inputs.
+	void CollectInputs(std::vector<InputStamp>& inputs);
+
+	// Called on the render thread for the frame being drawn and then for its Present().
+	void BeginRender(std::span<const InputStamp> inputs);
+	void EndPresent(std::uint64_t frame);
+
+	// Input-to-present latency of the last SampleWindow samples.
+	Summary Summarize() const;
+
+	// Appends one CSV line per sample.
+	bool OpenLog(const std::filesystem::path& path);
+	void CloseLog();
+
+	void DrawPanel();
+
+private:
+	static constexpr std::size_t SampleWindow = 512;
+	static constexpr std::size_t FrameHistory = 240;
+
+	std::mutex mutex_;
+	std::vector<InputStamp> pending_;
+	std::uint64_t nextId_ = 1;
+
+	std::vector<InputStamp> rendering_;
+
+	std::array<Sample, SampleWindow> samples_ = {};
+	std::size_t sampleCount_ = 0;
+	std::size_t nextSample_ = 0;
+
+	// Worst input-to-present latency per presented frame, zero for frames without input.
+	std::array<float, FrameHistory> frameLatencies_ = {};
+	std::size_t nextFrame_ = 0;
+
+	std::ofstream log_;
+};
+
+// Generates input events at a fixed rate, so latency can be measured
+// without anyone at the keyboard.
+export class SimulatedInputDriver
+{
+public:
+	void Start(double eventsPerSecond);
+	void Stop();
+
+	bool IsRunning() const { return thread_.joinable(); }
+
+private:
+	std::jthread thread_;
+};
+
+module :private;
+
+namespace
+{
+	float Milliseconds(InputStamp::Clock::duration duration)
+	{
+		return std::chrono::duration<float, std::milli>(duration).count();
+	}
+}
+
+LatencyTracker& LatencyTracker::Get()
+{
+	static LatencyTracker tracker;
+	return tracker;
+}
+
+void LatencyTracker::RecordInput(InputSource source)
+{
+	Clock::time_point now = Clock::now();
+
+	std::lock_guard lock(mutex_);
+	InputStamp& stamp = pending_.emplace_back();
+	stamp.Id = nextId_++;
+	stamp.Source = source;
+	stamp.Received = now;
+}
+
+void LatencyTracker::CollectInputs(std::vector<InputStamp>& inputs)
+{
+	inputs.clear();
+
+	{
+		std::lock_guard lock(mutex_);
+		inputs.swap(pending_);
+	}
+
+	Clock::time_point now = Clock::now();
+	for (InputStamp& stamp : inputs) {
+		stamp.Updated = now;
+	}
+}
+
+void LatencyTracker::BeginRender(std::span<const InputStamp> inputs)
+{
+	Clock::time_point now = Clock::now();
+
+	rendering_.assign(inputs.begin(), inputs.end());
+	for (InputStamp& stamp : rendering_) {
+		stamp.Rendered = now;
+	}
+}
+
+void LatencyTracker::EndPresent(std::uint64_t frame)
+{
+	Clock::time_point now = Clock::now();
+
+	float frameLatency = 0.0f;
+	for (const InputStamp& stamp : rendering_) {
+		Sample sample{
+			.Frame = frame,
+			.Source = stamp.Source,
+			.UpdateMilliseconds = Milliseconds(stamp.Updated - stamp.Received),
+			.RenderMilliseconds = Milliseconds(stamp.Rendered - stamp.Received),
+			.PresentMilliseconds = Milliseconds(now - stamp.Received),
+		};
+
+		samples_[nextSample_] = sample;
+		nextSample_ = (nextSample_ + 1) % SampleWindow;
+		sampleCount_ = std::min(sampleCount_ + 1, SampleWindow);
+		frameLatency = std::max(frameLatency, sample.PresentMilliseconds);
+
+		if (log_.is_open()) {
+			log_ << std::format("{},{},{},{:.3f},{:.3f},{:.3f}\n", sample.Frame, stamp.Id, InputSourceName(sample.Source),
+				sample.UpdateMilliseconds, sample.RenderMilliseconds, sample.PresentMilliseconds);
+		}
+	}
+	rendering_.clear();
+
+	frameLatencies_[nextFrame_] = frameLatency;
+	nextFrame_ = (nextFrame_ + 1) % FrameHistory;
+}
+
+LatencyTracker::Summary LatencyTracker::Summarize() const
+{
+	std::array<float, SampleWindow> latencies;
+	for (std::size_t i = 0; i < sampleCount_; ++i) {
+		latencies[i] = samples_[i].PresentMilliseconds;
+	}
+
+	Summary summary;
+	summary.Count = sampleCount_;
+	if (sampleCount_ == 0) {
+		return summary;
+	}
+
+	auto first = latencies.begin();
+	auto last = first + sampleCount_;
+	std::sort(first, last);
+
+	auto percentile = [&](float p) { return latencies[static_cast<std::size_t>(p * (sampleCount_ - 1) + 0.5f)]; };
+	summary.Median = percentile(0.5f);
+	summary.P95 = percentile(0.95f);
+	summary.P99 = percentile(0.99f);
+	summary.Max = latencies[sampleCount_ - 1];
+	return summary;
+}
+
+bool LatencyTracker::OpenLog(const std::filesystem::path& path)
+{
+	log_.open(path, std::ios::trunc);
+	if (!log_) {
+		LogError(LogCategory::General, "Failed to open latency log {}", path.string());
+		return false;
+	}
+
+	log_ << "frame,input,source,update_ms,render_ms,present_ms\n";
+	return true;
+}
+
+void LatencyTracker::CloseLog()
+{
+	log_.close();
+}
+
+void LatencyTracker::DrawPanel()
+{
+	ImGui::Begin("Input Latency");
+
+	Summary summary = Summarize();
+	ImGui::Text("Samples: %zu", summary.Count);
+	ImGui::Text("Median: %.2f ms", summary.Median);
+	ImGui::Text("P95: %.2f ms", summary.P95);
+	ImGui::Text("P99: %.2f ms", summary.P99);
+	ImGui::Text("Max: %.2f ms", summary.Max);
+
+	ImGui::PlotHistogram("##FrameLatency", frameLatencies_.data(), static_cast<int>(frameLatencies_.size()),
+		static_cast<int>(nextFrame_), "Input to present per frame (ms)", 0.0f, FLT_MAX, ImVec2(-1.0f, 80.0f));
+
+	ImGui::End();
+}
+
+void SimulatedInputDriver::Start(double eventsPerSecond)
+{
+	Stop();
+
+	auto period = std::chrono::duration_cast<InputStamp::Clock::duration>(std::chrono::duration<double>(1.0 / eventsPerSecond));
+	thread_ = std::jthread([period](std::stop_token stopToken) {
+		InputStamp::Clock::time_point next = InputStamp::Clock::now();
+		while (!stopToken.stop_requested()) {
+			LatencyTracker::Get().RecordInput(InputSource::Simulated);
+			next += period;
+			std::this_thread::sleep_until(next);
+		}
+	});
+}
+
+void SimulatedInputDriver::Stop()
+{
+	if (thread_.joinable()) {
+		thread_.request_stop();
+		thread_.join();
+	}
+}
@@ -0,0 +1,484 @@
+module;
+// C
+#include <cstddef>
+#include <cstdint>
+
+export module diagnostics.log;
+
+import <algorithm>;
+import <array>;
+import <atomic>;
+import <chrono>;
+import <condition_variable>;
+import <filesystem>;
+import <format>;
+import <fstream>;
+import <iostream>;
+import <iterator>;
+import <memory>;
+import <mutex>;
+import <new>;
+import <string>;
+import <string_view>;
+import <thread>;
+import <tuple>;
+import <type_traits>;
+import <unordered_map>;
+import <utility>;
+import <vector>;
+
+export enum class LogSeverity : std::uint8_t
+{
+	Trace,
+	Debug,
+	Info,
+	Warning,
+	Error,
+};
+
+export enum class LogCategory : std::uint8_t
+{
+	General,
+	Render,
+	Shader,
+	Resource,
+	Memory,
+	Count
+};
+
+// Messages below this severity are compiled out: their calls do nothing, and
+// their arguments are not even copied.
+#if defined(DEBUG) || defined(_DEBUG)
+export constexpr LogSeverity CompiledLogSeverity = LogSeverity::Debug;
+#else
+export constexpr LogSeverity CompiledLogSeverity = LogSeverity::Info;
+#endif
+
+// A message waiting in a thread's ring: its format string and its arguments,
+// copied as they were passed. Formatting happens on the logger's thread.
+export struct LogRecord
+{
+	static constexpr std::size_t ArgumentCapacity = 192;
+
+	// Formats the arguments to out and destroys them.
+	using FormatFunction = void (*)(std::string_view format, std::byte* arguments, std::string& out);
+
+	FormatFunction Format = nullptr;
+	std::string_view FormatString;
+	std::chrono::steady_clock::time_point Time;
+	std::uint32_t Thread = 0;
+	std::uint32_t Suppressed = 0;
+	LogSeverity Severity = LogSeverity::Info;
+	LogCategory Category = LogCategory::General;
+	alignas(std::max_align_t) std::byte Arguments[ArgumentCapacity];
+};
+
+// Writes messages from any thread without locks or formatting on that
+// thread. Every thread that logs gets a ring of its own, which only it
+// writes and only the logger's thread reads. A full ring drops the message
+// and counts it rather than waiting.
+//
+// A call site that logs more than RateLimit messages a second on one thread,
+// typically once per frame, is cut off for the rest of that second. Its next
+// message says how many were suppressed.
+//
+// Messages go to stderr and to the file given to OpenFile(), one line each:
+// seconds since start, severity, category and text.
+export class Logger
+{
+public:
+	static constexpr std::size_t RingCapacity = 256;
+	static constexpr std::uint32_t RateLimit = 10;
+
+	struct Statistics
+	{
+		std::uint64_t Written = 0;
+		std::uint64_t Dropped = 0;
+		std::uint64_t Suppressed = 0;
+	};
+
+public:
+	static Logger* Default();
+
+	Logger();
+	~Logger();
+
+	Logger(const Logger&) = delete;
+	Logger& operator=(const Logger&) = delete;
+
+	void SetSeverity(LogSeverity severity);
+	void SetSeverity(LogCategory category, LogSeverity severity);
+	bool IsEnabled(LogSeverity severity, LogCategory category) const
+	{
+		return severity >= severities_[static_cast<std::size_t>(category)].load(std::memory_order_relaxed);
+	}
+
+	bool OpenFile(const std::filesystem::path& path);
+
+	// Waits until every message logged before the call has been written.
+	void Flush();
+
+	Statistics GetStatistics() const;
+
+	// Used by Log(): reserves the calling thread's next record, or returns
+	// null if the ring is full or the call site is over its rate.
+	LogRecord* Begin(LogSeverity severity, LogCategory category, std::string_view format);
+	void Commit(LogRecord* record);
+
+private:
+	struct Ring;
+
+	Ring& ThreadRing();
+	void Run(std::stop_token stopToken);
+	void Drain();
+
+private:
+	std::array<std::atomic<LogSeverity>, static_cast<std::size_t>(LogCategory::Count)> severities_;
+	std::chrono::steady_clock::time_point start_;
+
+	std::mutex ringsMutex_;
+	std::vector<std::shared_ptr<Ring>> rings_;
+	std::atomic<std::uint32_t> nextThread_ = 0;
+
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::condition_variable drained_;
+	std::uint64_t flushRequests_ = 0;
+	std::uint64_t flushesDone_ = 0;
+	std::ofstream file_;
+
+	std::atomic<std::uint64_t> written_ = 0;
+	std::atomic<std::uint64_t> dropped_ = 0;
+	std::atomic<std::uint64_t> suppressed_ = 0;
+
+	// Last, so it stops before the state it uses is gone.
+	std::jthread thread_;
+};
+
+// Strings are stored by value, as the caller's may be gone by the time the
+// message is formatted. Everything else is stored as it is.
+template <typename T>
+using LogArgument = std::conditional_t<
+	std::is_convertible_v<T, std::string_view>,
+	std::string,
+	std::decay_t<T>>;
+
+template <typename... Args>
+void FormatLogArguments(std::string_view format, std::byte* arguments, std::string& out)
+{
+	auto* values = std::launder(reinterpret_cast<std::tuple<Args...>*>(arguments));
+	std::apply([&](Args&... args) {
+		std::vformat_to(std::back_inserter(out), format, std::make_format_args(args...));
+	}, *values);
+	values->~tuple();
+}
+
+export template <LogSeverity Severity, typename... Args>
+void Log(LogCategory category, std::format_string<Args...> format, Args&&... args)
+{
+	if constexpr (Severity >= CompiledLogSeverity) {
+		Logger* logger = Logger::Default();
+		if (!logger->IsEnabled(Severity, category)) {
+			return;
+		}
+		LogRecord* record = logger->Begin(Severity, category, format.get());
+		if (!record) {
+			return;
+		}
+
+		using Stored = std::tuple<LogArgument<Args>...>;
+		if constexpr (sizeof(Stored) <= LogRecord::ArgumentCapacity && alignof(Stored) <= alignof(std::max_align_t)) {
+			new (record->Arguments) Stored(std::forward<Args>(args)...);
+			record->Format = &FormatLogArguments<LogArgument<Args>...>;
+		}
+		else {
+			// Too big to defer, so it is formatted here.
+			new (record->Arguments) std::tuple<std::string>(std::format(format, std::forward<Args>(args)...));
+			record->FormatString = "{}";
+			record->Format = &FormatLogArguments<std::string>;
+		}
+		logger->Commit(record);
+	}
+}
+
+export template <typename... Args>
+void LogTrace(LogCategory category, std::format_string<Args...> format, Args&&... args)
+{
+	Log<LogSeverity::Trace>(category, format, std::forward<Args>(args)...);
+}
+
+export template <typename... Args>
+void LogDebug(LogCategory category, std::format_string<Args...> format, Args&&... args)
+{
+	Log<LogSeverity::Debug>(category, format, std::forward<Args>(args)...);
+}
+
+export template <typename... Args>
+void LogInfo(LogCategory category, std::format_string<Args...> format, Args&&... args)
+{
+	Log<LogSeverity::Info>(category, format, std::forward<Args>(args)...);
+}
+
+export template <typename... Args>
+void LogWarning(LogCategory category, std::format_string<Args...> format, Args&&... args)
+{
+	Log<LogSeverity::Warning>(category, format, std::forward<Args>(args)...);
+}
+
+export template <typename... Args>
+void LogError(LogCategory category, std::format_string<Args...> format, Args&&... args)
+{
+	Log<LogSeverity::Error>(category, format, std::forward<Args>(args)...);
+}
+
+module :private;
+
+namespace
+{
+	const char* SeverityName(LogSeverity severity)
+	{
+		switch (severity) {
+		case LogSeverity::Trace: return "trace";
+		case LogSeverity::Debug: return "debug";
+		case LogSeverity::Info: return "info";
+		case LogSeverity::Warning: return "warning";
+		default: return "error";
+		}
+	}
+
+	const char* CategoryName(LogCategory category)
+	{
+		switch (category) {
+		case LogCategory::General: return "general";
+		case LogCategory::Render: return "render";
+		case LogCategory::Shader: return "shader";
+		case LogCategory::Resource: return "resource";
+		default: return "memory";
+		}
+	}
+
+	struct FormattedRecord
+	{
+		std::chrono::steady_clock::time_point Time;
+		std::string Line;
+	};
+}
+
+// Single producer, single consumer. head is only advanced by the logger's
+// thread, tail only by the owning thread.
+struct Logger::Ring
+{
+	struct RateState
+	{
+		std::chrono::steady_clock::time_point WindowStart;
+		std::uint32_t Count = 0;
+		std::uint32_t Suppressed = 0;
+	};
+
+	std::array<LogRecord, RingCapacity> Records;
+	alignas(64) std::atomic<std::size_t> Head = 0;
+	alignas(64) std::atomic<std::size_t> Tail = 0;
+	std::atomic<bool> Retired = false;
+	std::uint32_t Thread = 0;
+
+	// Only touched by the owning thread.
+	std::unordered_map<const char*, RateState> Rates;
+};
+
+Logger* Logger::Default()
+{
+	static Logger logger;
+	return &logger;
+}
+
+Logger::Logger()
+	: start_(std::chrono::steady_clock::now())
+{
+	SetSeverity(LogSeverity::Info);
+	thread_ = std::jthread([this](std::stop_token stopToken) { Run(stopToken); });
+}
+
+Logger::~Logger()
+{
+	thread_.request_stop();
+	wake_.notify_one();
+	thread_.join();
+	Drain();
+}
+
+void Logger::SetSeverity(LogSeverity severity)
+{
+	for (std::atomic<LogSeverity>& categorySeverity : severities_) {
+		categorySeverity.store(severity, std::memory_order_relaxed);
+	}
+}
+
+void Logger::SetSeverity(LogCategory category, LogSeverity severity)
+{
+	severities_[static_cast<std::size_t>(category)].store(severity, std::memory_order_relaxed);
+}
+
+bool Logger::OpenFile(const std::filesystem::path& path)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	file_.open(path, std::ios::trunc);
+	if (!file_) {
+		std::cerr << "Failed to open log " << path << "\n";
+		return false;
+	}
+	return true;
+}
+
+void Logger::Flush()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	std::uint64_t request = ++flushRequests_;
+	wake_.notify_one();
+	drained_.wait(lock, [&] { return flushesDone_ >= request; });
+}
+
+Logger::Statistics Logger::GetStatistics() const
+{
+	return Statistics{ written_.load(), dropped_.load(), suppressed_.load() };
+}
+
+Logger::Ring& Logger::ThreadRing()
+{
+	// The ring outlives its thread until the logger has drained it.
+	struct Owner
+	{
+		std::shared_ptr<Logger::Ring> Value;
+		~Owner()
+		{
+			if (Value) {
+				Value->Retired.store(true, std::memory_order_release);
+			}
+		}
+	};
+	thread_local Owner owner;
+
+	if (!owner.Value) {
+		owner.Value = std::make_shared<Ring>();
+		owner.Value->Thread = nextThread_++;
+		std::lock_guard<std::mutex> lock(ringsMutex_);
+		rings_.push_back(owner.Value);
+	}
+	return *owner.Value;
+}
+
+LogRecord* Logger::Begin(LogSeverity severity, LogCategory category, std::string_view format)
+{
+	Ring& ring = ThreadRing();
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+	// The format string's address identifies the call site.
+	Ring::RateState& rate = ring.Rates[format.data()];
+	if (now - rate.WindowStart >= std::chrono::seconds(1)) {
+		rate.WindowStart = now;
+		rate.Count = 0;
+	}
+	if (++rate.Count > RateLimit) {
+		++rate.Suppressed;
+		suppressed_.fetch_add(1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	std::size_t tail = ring.Tail.load(std::memory_order_relaxed);
+	if (tail - ring.Head.load(std::memory_order_acquire) == RingCapacity) {
+		dropped_.fetch_add(1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	LogRecord& record = ring.Records[tail % RingCapacity];
+	record.FormatString = format;
+	record.Time = now;
+	record.Thread = ring.Thread;
+	record.Suppressed = std::exchange(rate.Suppressed, 0);
+	record.Severity = severity;
+	record.Category = category;
+	return &record;
+}
+
+void Logger::Commit(LogRecord* record)
+{
+	Ring& ring = ThreadRing();
+	ring.Tail.store(ring.Tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+
+	// Anything less than a warning can wait for the next periodic drain.
+	if (record->Severity >= LogSeverity::Warning) {
+		wake_.notify_one();
+	}
+}
+
+void Logger::Run(std::stop_token stopToken)
+{
+	while (!stopToken.stop_requested()) {
+		std::uint64_t requests;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			wake_.wait_for(lock, std::chrono::milliseconds(10), [&] { return flushRequests_ > flushesDone_ || stopToken.stop_requested(); });
+			requests = flushRequests_;
+		}
+
+		Drain();
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		flushesDone_ = requests;
+		drained_.notify_all();
+	}
+}
+
+void Logger::Drain()
+{
+	std::vector<std::shared_ptr<Ring>> rings;
+	{
+		std::lock_guard<std::mutex> lock(ringsMutex_);
+		rings = rings_;
+	}
+
+	// Rings are drained one after the other, so lines are sorted by time to
+	// interleave threads as they logged.
+	std::vector<FormattedRecord> lines;
+	for (const std::shared_ptr<Ring>& ring : rings) {
+		// Read before the records, so a retired ring is only dropped once
+		// everything its thread committed has been drained.
+		bool retired = ring->Retired.load(std::memory_order_acquire);
+		std::size_t head = ring->Head.load(std::memory_order_relaxed);
+		std::size_t tail = ring->Tail.load(std::memory_order_acquire);
+		for (; head != tail; ++head) {
+			LogRecord& record = ring->Records[head % RingCapacity];
+			double seconds = std::chrono::duration<double>(record.Time - start_).count();
+			std::string line = std::format("{:10.3f} [{}] {} {}: ", seconds, record.Thread, SeverityName(record.Severity), CategoryName(record.Category));
+			record.Format(record.FormatString, record.Arguments, line);
+			if (record.Suppressed > 0) {
+				std::format_to(std::back_inserter(line), " ({} similar messages suppressed)", record.Suppressed);
+			}
+			line += '\n';
+			lines.push_back({ record.Time, std::move(line) });
+			ring->Head.store(head + 1, std::memory_order_release);
+		}
+
+		if (retired) {
+			std::lock_guard<std::mutex> lock(ringsMutex_);
+			std::erase(rings_, ring);
+		}
+	}
+
+	if (lines.empty()) {
+		return;
+	}
+	std::stable_sort(lines.begin(), lines.end(), [](const FormattedRecord& a, const FormattedRecord& b) { return a.Time < b.Time; });
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	for (const FormattedRecord& record : lines) {
+		std::cerr << record.Line;
+		if (file_.is_open()) {
+			file_ << record.Line;
+		}
+	}
+	std::cerr.flush();
+	if (file_.is_open()) {
+		file_.flush();
+	}
+	written_.fetch_add(lines.size(), std::memory_order_relaxed);
+}
@@ -1,3 +1,7 @@
+// C
+#include <cstdlib>
+#include <cstring>
+
 // Windows
 #include <d3d11.h>
 #include <DirectXMath.h>
@@ -6,15 +10,49 @@
 // ImGui
 #include "imgui.h"
 
+import <algorithm>;
+import <array>;
+import <atomic>;
+import <charconv>;
+import <chrono>;
+import <filesystem>;
 import <iostream>;
 import <memory>;
+import <memory_resource>;
+import <mutex>;
+import <span>;
+import <string_view>;
+import <vector>;
 
 import platform.windows;
 import utility;
 import core;
+import core.entities;
+import core.memory;
+import core.pacing;
+import core.snapshot;
+import core.threading;
+import diagnostics.benchmark;
+import diagnostics.gpu;
+import diagnostics.latency;
+import diagnostics.log;
+import diagnostics.memory;
+import diagnostics.microbenchmarks;
+import diagnostics.playback;
+import diagnostics.render;
 import pipeline;
+import render.context;
+import render.debug;
+import render.graph;
+import render.occlusion;
+import render.readback;
+import scene.graph;
+import spatial.bvh;
 import vertex;
+import resource.registry;
 import resource.shader;
+import resource.streaming;
+import resource.vfs;
 
 class Box : public Game
 {
@@ -24,103 +62,436 @@ private:
 		DirectX::XMFLOAT4X4 WorldViewProjection;
 	};
 
+	// One layer of the stacked box.
+	struct BoxLayer
+	{
+		int Index = 0;
+		SceneNode Node = InvalidSceneNode;
+	};
+
 public:
 	using Game::Game;
 
+	void SetDepthPrepass(bool enabled) { depthPrepass_ = enabled; }
+
+	void SetBoxLayers(int layers)
+	{
+		std::lock_guard lock(controlsMutex_);
+		controls_.BoxLayers = layers;
+	}
+
 	bool Startup(HWND window) override
 	{
 		if (!Game::Startup(window)) {
 			return false;
 		}
 
+		MemoryTracker::Get().SetBudget(MemoryTag::Rendering, 16 * 1024 * 1024);
+		MemoryTracker::Get().SetBudget(GpuResourceType::Buffer, 64 * 1024 * 1024);
+		MemoryTracker::Get().SetBudget(GpuResourceType::DepthStencil, 64 * 1024 * 1024);
+
 		CreateBox();
-		InitGraphicsPipeline();
+		LoadGraphicsPipeline();
 		CreateConstantBuffer();
 		CreateRasterizerStates();
+		CreateDepthStencilStates();
+		CreateStatisticsQueries();
 
 		return true;
 	}
 
-	void OnRender(ID3D11DeviceContext* context) override
+protected:
+	std::span<const std::byte> ReplayState() override
 	{
-		if (wireframeMode_) {
-			pipeline_->SetRasterizerState(wireframeRasterizerState_);
-		}
-		else {
-			pipeline_->SetRasterizerState(solidRasterizerState_);
+		std::lock_guard lock(controlsMutex_);
+		replayState_.Panel = controls_;
+		replayState_.Wireframe = wireframeMode_;
+		replayState_.DepthPrepass = depthPrepass_;
+		replayState_.OcclusionCulling = occlusionCulling_;
+		replayState_.Bounds = drawBounds_;
+		return std::as_bytes(std::span(&replayState_, 1));
+	}
+
+	void ApplyReplayState(std::span<const std::byte> state) override
+	{
+		std::memcpy(&replayState_, state.data(), sizeof(replayState_));
+
+		std::lock_guard lock(controlsMutex_);
+		controls_ = replayState_.Panel;
+		wireframeMode_ = replayState_.Wireframe != 0;
+		depthPrepass_ = replayState_.DepthPrepass != 0;
+		occlusionCulling_ = replayState_.OcclusionCulling != 0;
+		drawBounds_ = replayState_.Bounds != 0;
+	}
+
+public:
+	void OnUpdate(float deltaTime, FrameSnapshot& snapshot) override
+	{
+		Controls controls;
+		{
+			std::lock_guard lock(controlsMutex_);
+			controls = controls_;
 		}
-		pipeline_->Apply(context);
 
-		// Update box transform
-		DirectX::XMFLOAT3 boxRotationRadians(
-			DirectX::XMConvertToRadians(boxRotation_.x),
-			DirectX::XMConvertToRadians(boxRotation_.y),
-			DirectX::XMConvertToRadians(boxRotation_.z)
+		// The box is the root of the scene and its layers are children stacked
+		// away from the camera, so only edits to the box touch the layers.
+		NodeTransform box;
+		box.Position = controls.BoxPosition;
+		box.Rotation = DirectX::XMFLOAT3(
+			DirectX::XMConvertToRadians(controls.BoxRotation.x),
+			DirectX::XMConvertToRadians(controls.BoxRotation.y),
+			DirectX::XMConvertToRadians(controls.BoxRotation.z)
 		);
-		DirectX::XMMATRIX W = DirectX::XMMatrixScalingFromVector(DirectX::XMLoadFloat3(&boxScale_)) *
-			DirectX::XMMatrixRotationRollPitchYawFromVector(DirectX::XMLoadFloat3(&boxRotationRadians)) *
-			DirectX::XMMatrixTranslationFromVector(DirectX::XMLoadFloat3(&boxPosition_));
+		box.Scale = controls.BoxScale;
+		if (boxNode_ == InvalidSceneNode) {
+			boxNode_ = scene_.CreateNode(InvalidSceneNode, box);
+		}
+		else if (!(scene_.LocalTransform(boxNode_) == box)) {
+			scene_.SetLocalTransform(boxNode_, box);
+		}
+
+		// Every layer is an entity. Layers are only removed from the top, so
+		// the remaining ones keep their indices.
+		int layerCount = static_cast<int>(entities_.EntityCount());
+		if (layerCount > controls.BoxLayers) {
+			entities_.ForEachChunk<const BoxLayer>([&](std::size_t count, const Entity* entities, const BoxLayer* layers) {
+				for (std::size_t i = 0; i < count; ++i) {
+					if (layers[i].Index >= controls.BoxLayers) {
+						scene_.DestroyNode(layers[i].Node);
+						entityCommands_.Destroy(entities[i]);
+					}
+				}
+			});
+			entities_.Playback(entityCommands_);
+		}
+		for (int layer = layerCount; layer < controls.BoxLayers; ++layer) {
+			NodeTransform local;
+			local.Position.z = 0.5f * layer;
+			entities_.Create(BoxLayer{ layer, scene_.CreateNode(boxNode_, local) });
+		}
+
+		scene_.Update();
+		matricesRecomputed_ = scene_.RecomputedLastUpdate();
+		sceneNodes_ = scene_.NodeCount();
+
+		// Drawn back to front, the worst case for overdraw.
+		snapshot.DrawList.resize(controls.BoxLayers);
+		entities_.ForEach<const BoxLayer>([&](const BoxLayer& layer) {
+			snapshot.DrawList[controls.BoxLayers - 1 - layer.Index].World = scene_.WorldMatrix(layer.Node);
+		});
 
 		// Make view matrix
-		DirectX::XMFLOAT3 cameraRotationRadians(
-			DirectX::XMConvertToRadians(cameraRotation_.x),
-			DirectX::XMConvertToRadians(cameraRotation_.y),
-			DirectX::XMConvertToRadians(cameraRotation_.z)
-		);
-		DirectX::XMMATRIX cameraRotation = DirectX::XMMatrixRotationRollPitchYawFromVector(DirectX::XMLoadFloat3(&cameraRotationRadians));
-		DirectX::XMVECTOR cameraForward = DirectX::XMVector3Transform(DirectX::XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f), cameraRotation);
-		DirectX::XMVECTOR cameraFocus = DirectX::XMVectorAdd(DirectX::XMLoadFloat3(&cameraPosition_), cameraForward);
-		DirectX::XMMATRIX V = DirectX::XMMatrixLookAtLH(DirectX::XMLoadFloat3(&cameraPosition_), cameraFocus, DirectX::XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
-
-		// Make projection matrix
-		DirectX::XMMATRIX P = DirectX::XMMatrixPerspectiveFovLH(DirectX::XMConvertToRadians(fieldOfView_), AspectRatio(), 0.1f, 1000.0f);
-
-		// Update box transform
-		DirectX::XMStoreFloat4x4(&boxTransform_.WorldViewProjection, DirectX::XMMatrixTranspose(W * V * P));
-		
-		// Update transform buffer
-		D3D11_MAPPED_SUBRESOURCE mappedResource;
-		context->Map(transformBuffer_.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
-		memcpy(mappedResource.pData, &boxTransform_, sizeof(boxTransform_));
-		context->Unmap(transformBuffer_.Get(), 0);
-		
+		camera_.SetView(controls.CameraPosition, DirectX::XMFLOAT3(
+			DirectX::XMConvertToRadians(controls.CameraRotation.x),
+			DirectX::XMConvertToRadians(controls.CameraRotation.y),
+			DirectX::XMConvertToRadians(controls.CameraRotation.z)
+		));
+		viewRecomputations_ = camera_.Recomputations();
+
+		snapshot.Camera.View = camera_.View();
+		snapshot.Camera.FieldOfView = controls.FieldOfView;
+	}
+
+	void OnRender(RenderContext& context, const FrameSnapshot& snapshot) override
+	{
+		UpdateBoxTree(snapshot);
+		PickBox(snapshot);
+		if (drawBounds_) {
+			DrawBounds();
+		}
+
+		// Nothing to draw until the shaders have streamed in.
+		if (GraphicsPipeline* pipeline = Pipeline(pipeline_)) {
+			GpuScope gpuScope(Profiler(), "Boxes");
+			BeginStatistics(context.Native());
+			DrawBoxes(context, *pipeline, snapshot);
+			EndStatistics(context.Native());
+		}
+
+		DrawControls();
+		MemoryTracker::Get().DrawPanel();
+		LatencyTracker::Get().DrawPanel();
+		RenderStatisticsTracker::Get().DrawPanel();
+		Profiler().DrawPanel();
+	}
+	
+private:
+	// The projection is made here so that it always matches the current back
+	// buffer. Both are cached until the camera or the back buffer changes.
+	DirectX::XMMATRIX ViewProjection(const CameraSnapshot& camera)
+	{
+		renderCamera_.SetView(camera.View);
+		renderCamera_.SetProjection(DirectX::XMConvertToRadians(camera.FieldOfView), AspectRatio(), camera.NearZ, camera.FarZ);
+		return DirectX::XMLoadFloat4x4(&renderCamera_.ViewProjection());
+	}
+
+	// Keeps one tree proxy per draw item, at the item's current bounds.
+	void UpdateBoxTree(const FrameSnapshot& snapshot)
+	{
+		while (boxProxies_.size() > snapshot.DrawList.size()) {
+			boxTree_.Remove(boxProxies_.back());
+			boxProxies_.pop_back();
+		}
+
+		for (std::size_t i = 0; i < snapshot.DrawList.size(); ++i) {
+			Aabb bounds = Aabb::Transform(boxBounds_.Center, boxBounds_.Extents, DirectX::XMLoadFloat4x4(&snapshot.DrawList[i].World));
+			if (i < boxProxies_.size()) {
+				boxTree_.Move(boxProxies_[i], bounds);
+			}
+			else {
+				boxProxies_.push_back(boxTree_.Insert(bounds, i));
+			}
+		}
+	}
+
+	// The tree's bounds of every box, the picked one highlighted.
+	void DrawBounds()
+	{
+		for (std::size_t i = 0; i < boxProxies_.size(); ++i) {
+			const Aabb& bounds = boxTree_.FatBounds(boxProxies_[i]);
+			DirectX::XMFLOAT3 center((bounds.Min.x + bounds.Max.x) * 0.5f, (bounds.Min.y + bounds.Max.y) * 0.5f, (bounds.Min.z + bounds.Max.z) * 0.5f);
+			DirectX::XMFLOAT3 extents((bounds.Max.x - bounds.Min.x) * 0.5f, (bounds.Max.y - bounds.Min.y) * 0.5f, (bounds.Max.z - bounds.Min.z) * 0.5f);
+			bool picked = static_cast<int>(i) == pickedBox_;
+			Debug().Box(center, extents, picked ? DirectX::XMFLOAT4(1.0f, 1.0f, 0.0f, 1.0f) : DirectX::XMFLOAT4(0.0f, 1.0f, 0.0f, 1.0f));
+		}
+	}
+
+	// Selects the box under the cursor when the left mouse button is clicked
+	// outside the ImGui windows.
+	void PickBox(const FrameSnapshot& snapshot)
+	{
+		ImGuiIO& io = ImGui::GetIO();
+		if (io.WantCaptureMouse || !ImGui::IsMouseClicked(ImGuiMouseButton_Left)) {
+			return;
+		}
+
+		// Unproject the cursor onto the near and far planes.
+		DirectX::XMMATRIX inverseVP = DirectX::XMMatrixInverse(nullptr, ViewProjection(snapshot.Camera));
+		float x = 2.0f * io.MousePos.x / ScreenWidth() - 1.0f;
+		float y = 1.0f - 2.0f * io.MousePos.y / ScreenHeight();
+		DirectX::XMVECTOR nearPoint = DirectX::XMVector3TransformCoord(DirectX::XMVectorSet(x, y, 0.0f, 1.0f), inverseVP);
+		DirectX::XMVECTOR farPoint = DirectX::XMVector3TransformCoord(DirectX::XMVectorSet(x, y, 1.0f, 1.0f), inverseVP);
+
+		BvhRay ray;
+		DirectX::XMStoreFloat3(&ray.Origin, nearPoint);
+		DirectX::XMStoreFloat3(&ray.Direction, DirectX::XMVector3Normalize(DirectX::XMVectorSubtract(farPoint, nearPoint)));
+
+		// The exact test is against the unit box in the box's own space. The
+		// direction is not renormalized there, so distances stay in world units.
+		BvhRayHit hit = boxTree_.RayCast(ray, [&](BvhProxy proxy, const BvhRay& worldRay, float maxDistance) {
+			const DrawItem& item = snapshot.DrawList[boxTree_.UserData(proxy)];
+			DirectX::XMMATRIX inverseWorld = DirectX::XMMatrixInverse(nullptr, DirectX::XMLoadFloat4x4(&item.World));
+
+			BvhRay localRay;
+			DirectX::XMStoreFloat3(&localRay.Origin, DirectX::XMVector3TransformCoord(DirectX::XMLoadFloat3(&worldRay.Origin), inverseWorld));
+			DirectX::XMStoreFloat3(&localRay.Direction, DirectX::XMVector3TransformNormal(DirectX::XMLoadFloat3(&worldRay.Direction), inverseWorld));
+			localRay.MaxDistance = maxDistance;
+
+			return IntersectRay(localRay, Aabb::Transform(boxBounds_.Center, boxBounds_.Extents, DirectX::XMMatrixIdentity()));
+		});
+		pickedBox_ = hit.Proxy != NullProxy ? static_cast<int>(boxTree_.UserData(hit.Proxy)) : -1;
+	}
+
+	void DrawBoxes(RenderContext& context, GraphicsPipeline& pipeline, const FrameSnapshot& snapshot)
+	{
+		const ResourceRegistry& resources = Resources();
+
+		DirectX::XMMATRIX VP = ViewProjection(snapshot.Camera);
+
 		// Bind constant buffer to vertex shader
-		ID3D11Buffer* constantBuffers[] = { transformBuffer_.Get()};
-		context->VSSetConstantBuffers(0, 1, constantBuffers);
+		ID3D11Buffer* constantBuffers[] = { resources.Get(transformBuffer_) };
+		context.SetVSConstantBuffers(0, 1, constantBuffers);
+
+		// Bind vertex/index buffers. The streams are in slot order.
+		ID3D11Buffer* vertexBuffers[] = { resources.Get(positionBuffer_), resources.Get(colorBuffer_) };
+		UINT strides[] = { sizeof(DirectX::XMFLOAT3), sizeof(DirectX::XMFLOAT4) };
+		UINT offsets[] = { 0, 0 };
+		context.SetIndexBuffer(resources.Get(indexBuffer_), DXGI_FORMAT_R32_UINT, 0);
+
+		// Only needed for this frame, so it comes from the frame arena.
+		std::pmr::vector<std::uint32_t> visibleItems(FrameAllocator());
+		visibleItems.reserve(snapshot.DrawList.size());
+		CullBoxes(snapshot, VP, visibleItems);
+
+		// The depth prepass lays down the nearest depth with only the position
+		// stream and no pixel shader. The color pass then tests for equal depth,
+		// so each pixel is shaded once however much the boxes overlap.
+		GraphicsPipeline* depthPipeline = Pipeline(depthPipeline_);
+		bool prepass = depthPrepass_ && depthPipeline && !wireframeMode_;
+		if (prepass) {
+			depthPipeline->Apply(context, resources);
+			context.SetVertexBuffers(Vertex::PosColorStreams::PositionSlot, 1, vertexBuffers, strides, offsets);
+			DrawItems(context, snapshot, visibleItems, VP);
+		}
+
+		if (wireframeMode_) {
+			pipeline.SetRasterizerState(wireframeRasterizerState_);
+		}
+		else {
+			pipeline.SetRasterizerState(solidRasterizerState_);
+		}
+		pipeline.SetDepthStencilState(prepass ? depthEqualState_ : DepthStencilStateHandle());
+		pipeline.Apply(context, resources);
+
+		context.SetVertexBuffers(0, 2, vertexBuffers, strides, offsets);
+		DrawItems(context, snapshot, visibleItems, VP);
+	}
+
+	// Every box is an occluder for the others, and only the boxes that are
+	// not hidden behind them are submitted. Wireframe boxes hide nothing, so
+	// then every box is drawn.
+	void CullBoxes(const FrameSnapshot& snapshot, DirectX::FXMMATRIX VP, std::pmr::vector<std::uint32_t>& visibleItems)
+	{
+		if (!occlusionCulling_ || wireframeMode_) {
+			for (std::uint32_t i = 0; i < snapshot.DrawList.size(); ++i) {
+				visibleItems.push_back(i);
+			}
+			return;
+		}
+
+		OcclusionMesh boxMesh{ boxPositions_, boxIndices_ };
+		occlusion_.BeginFrame(VP, FrameAllocator());
+		for (const DrawItem& item : snapshot.DrawList) {
+			occlusion_.AddOccluder(boxMesh, item.World);
+		}
+		occlusion_.Rasterize();
+		occlusion_.Cull(snapshot.DrawList, boxBounds_, visibleItems);
+	}
+
+	void DrawItems(RenderContext& context, const FrameSnapshot& snapshot, std::span<const std::uint32_t> items, DirectX::FXMMATRIX VP)
+	{
+		ID3D11Buffer* transformBuffer = Resources().Get(transformBuffer_);
 
-		// Bind vertex/index buffers
-		UINT stride = sizeof(Vertex::PosColor);
-		UINT offset = 0;
-		context->IASetVertexBuffers(0, 1, vertexBuffer_.GetAddressOf(), &stride, &offset);
-		context->IASetIndexBuffer(indexBuffer_.Get(), DXGI_FORMAT_R32_UINT, 0);
+		for (std::uint32_t index : items) {
+			const DrawItem& item = snapshot.DrawList[index];
+			Transform transform;
+			DirectX::XMStoreFloat4x4(&transform.WorldViewProjection, DirectX::XMMatrixTranspose(DirectX::XMLoadFloat4x4(&item.World) * VP));
 
-		context->DrawIndexed(36, 0, 0);
+			// Update transform buffer
+			context.UpdateBuffer(transformBuffer, &transform, sizeof(transform));
+
+			context.DrawIndexed(36, 0, 0);
+		}
+	}
+
+	// Counts pixel shader invocations of the box draws. Results are read a few
+	// frames late, when the GPU is done, so the query never stalls the CPU.
+	void BeginStatistics(ID3D11DeviceContext* context)
+	{
+		ID3D11Query* query = statisticsQueries_[statisticsFrame_ % statisticsQueries_.size()].Get();
+		if (statisticsFrame_ >= statisticsQueries_.size()) {
+			D3D11_QUERY_DATA_PIPELINE_STATISTICS statistics;
+			if (context->GetData(query, &statistics, sizeof(statistics), D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK) {
+				pixelShaderInvocations_ = statistics.PSInvocations;
+			}
+		}
+		context->Begin(query);
+	}
+
+	void EndStatistics(ID3D11DeviceContext* context)
+	{
+		context->End(statisticsQueries_[statisticsFrame_ % statisticsQueries_.size()].Get());
+		++statisticsFrame_;
+	}
+
+	void DrawControls()
+	{
+		// The simulation thread reads the controls while they are edited here.
+		std::lock_guard lock(controlsMutex_);
 
-		// UI
 		ImGui::Begin("Controls");
 		ImGui::BeginGroup();
 		ImGui::Text("Box Transform");
 		ImGui::Separator();
-		ImGui::DragFloat3("Box Position", reinterpret_cast<float*>(&boxPosition_), 0.1f);
-		ImGui::DragFloat3("Box Rotation", reinterpret_cast<float*>(&boxRotation_), 0.1f);
-		ImGui::DragFloat3("Box Scale", reinterpret_cast<float*>(&boxScale_), 0.1f);
+		ImGui::DragFloat3("Box Position", reinterpret_cast<float*>(&controls_.BoxPosition), 0.1f);
+		ImGui::DragFloat3("Box Rotation", reinterpret_cast<float*>(&controls_.BoxRotation), 0.1f);
+		ImGui::DragFloat3("Box Scale", reinterpret_cast<float*>(&controls_.BoxScale), 0.1f);
+		ImGui::SliderInt("Box Layers", &controls_.BoxLayers, 1, 32);
+		if (pickedBox_ >= 0) {
+			ImGui::Text("Picked box: %d", pickedBox_);
+		}
+		else {
+			ImGui::Text("Picked box: none (click a box)");
+		}
+		ImGui::Text("Matrices recomputed: %zu of %zu nodes", matricesRecomputed_.load(), sceneNodes_.load());
 		ImGui::Checkbox("Wireframe", &wireframeMode_);
+		ImGui::Checkbox("Depth Prepass", &depthPrepass_);
+		ImGui::Text("Pixel shader invocations: %llu", pixelShaderInvocations_);
+		ImGui::Checkbox("Occlusion Culling", &occlusionCulling_);
+		if (occlusionCulling_) {
+			const OcclusionCuller::Statistics& occlusion = occlusion_.GetStatistics();
+			ImGui::Text("Occluded: %zu of %zu (%zu outside the view)", occlusion.Occluded, occlusion.Tested, occlusion.OutsideFrustum);
+			ImGui::Text("Occluders: %zu (%zu triangles)", occlusion.Occluders, occlusion.OccluderTriangles);
+			ImGui::Text("Culling: %.3f ms raster, %.3f ms test", occlusion.RasterizeMilliseconds, occlusion.TestMilliseconds);
+		}
+		ImGui::Checkbox("Bounds", &drawBounds_);
+		if (drawBounds_) {
+			ImGui::Text("Debug lines: %zu", Debug().LastVertexCount() / 2);
+		}
 		ImGui::EndGroup();
 
 		ImGui::BeginGroup();
 		ImGui::Text("Camera");
 		ImGui::Separator();
-		ImGui::DragFloat3("Camera Position", reinterpret_cast<float*>(&cameraPosition_), 0.1f);
-		ImGui::DragFloat3("Camera Rotation", reinterpret_cast<float*>(&cameraRotation_), 0.1f);
-		ImGui::InputFloat("Field of View", &fieldOfView_, 0.1f);
+		ImGui::DragFloat3("Camera Position", reinterpret_cast<float*>(&controls_.CameraPosition), 0.1f);
+		ImGui::DragFloat3("Camera Rotation", reinterpret_cast<float*>(&controls_.CameraRotation), 0.1f);
+		ImGui::InputFloat("Field of View", &controls_.FieldOfView, 0.1f);
+		ImGui::Text("Camera matrices rebuilt: %zu view, %zu view-projection", viewRecomputations_.load(), renderCamera_.Recomputations());
+		ImGui::EndGroup();
+
+		ImGui::BeginGroup();
+		ImGui::Text("Frame Pacing");
+		ImGui::Separator();
+		ImGui::Text("Frame interval: %.2f ms", std::chrono::duration<float, std::milli>(Pacer().LastFrameInterval()).count());
+		ImGui::Text("Deadline error: %.3f ms", std::chrono::duration<float, std::milli>(Pacer().LastFrameError()).count());
+		if (IsDynamicResolutionEnabled()) {
+			ImGui::Text("Render scale: %.0f%%", RenderScale() * 100.0f);
+		}
+		ImGui::EndGroup();
+
+		ImGui::BeginGroup();
+		ImGui::Text("Memory");
+		ImGui::Separator();
+		ImGui::Text("Heap allocations/frame: %llu", HeapAllocationsLastFrame());
+		ImGui::EndGroup();
+
+		const RenderGraph::Report& graph = Graph().GetReport();
+		ImGui::BeginGroup();
+		ImGui::Text("Render Graph");
+		ImGui::Separator();
+		ImGui::Text("Passes: %zu (%zu culled)", graph.PassCount, graph.CulledPassCount);
+		ImGui::Text("Transient textures: %zu in %zu allocations", graph.TransientCount, graph.PhysicalCount);
+		ImGui::Text("Saved by aliasing: %.1f MiB", graph.SavedBytes() / (1024.0 * 1024.0));
+		ImGui::EndGroup();
+
+		// Replay with --play-capture=frame.gcap.
+		ImGui::BeginGroup();
+		ImGui::Text("Capture");
+		ImGui::Separator();
+		if (ImGui::Button("Capture Frame")) {
+			CaptureFrame("frame.gcap");
+		}
+		if (ImGui::Button("Screenshot")) {
+			Readback().Screenshot("screenshot.png");
+		}
+		ImGui::SameLine();
+		if (!Readback().IsRecordingVideo()) {
+			if (ImGui::Button("Record Video")) {
+				Readback().StartVideo("video.y4m");
+			}
+		}
+		else if (ImGui::Button("Stop Video")) {
+			Readback().StopVideo();
+		}
+		FrameReadback::Statistics readback = Readback().GetStatistics();
+		ImGui::Text("Read back: %llu captured, %llu dropped, %llu written", readback.Captured, readback.Dropped, readback.Written);
 		ImGui::EndGroup();
 		ImGui::End();
 	}
-	
-private:
+
 	void CreateBox()
 	{
-		std::vector<Vertex::PosColor> vertices(8);
+		std::array<Vertex::PosColor, 8> vertices;
 		vertices[0].Position = DirectX::XMFLOAT3(-0.5f, +0.5f, +0.5f);
 		vertices[0].Color = DirectX::XMFLOAT4(1.0f, 0.0f, 0.0f, 1.0f);
 		vertices[1].Position = DirectX::XMFLOAT3(+0.5f, +0.5f, +0.5f);
@@ -138,24 +509,12 @@ private:
 		vertices[7].Position = DirectX::XMFLOAT3(+0.5f, -0.5f, +0.5f);
 		vertices[7].Color = DirectX::XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f);
 
-		{
-			D3D11_BUFFER_DESC desc;
-			desc.Usage = D3D11_USAGE_IMMUTABLE;
-			desc.ByteWidth = sizeof(Vertex::PosColor) * vertices.size();
-			desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-			desc.CPUAccessFlags = 0;
-			desc.MiscFlags = 0;
-			desc.StructureByteStride = 0;
-
-			D3D11_SUBRESOURCE_DATA initialData;
-			initialData.pSysMem = vertices.data();
-			initialData.SysMemPitch = 0;
-			initialData.SysMemSlicePitch = 0;
-
-			ThrowIfFailed(GraphicsDevice()->CreateBuffer(&desc, &initialData, vertexBuffer_.GetAddressOf()));
-		}
+		Vertex::PosColorStreams streams = Vertex::PosColorStreams::Split(vertices);
+		std::copy(streams.Positions.begin(), streams.Positions.end(), boxPositions_.begin());
+		positionBuffer_ = CreateVertexBuffer(streams.Positions.data(), sizeof(DirectX::XMFLOAT3) * streams.Positions.size());
+		colorBuffer_ = CreateVertexBuffer(streams.Colors.data(), sizeof(DirectX::XMFLOAT4) * streams.Colors.size());
 
-		std::vector<UINT> indices(36);
+		std::array<UINT, 36> indices;
 		// top
 		indices[0] = 0; indices[1] = 1; indices[2] = 2;
 		indices[3] = 0; indices[4] = 2; indices[5] = 3;
@@ -194,17 +553,96 @@ private:
 			initialData.SysMemPitch = 0;
 			initialData.SysMemSlicePitch = 0;
 
-			ThrowIfFailed(GraphicsDevice()->CreateBuffer(&desc, &initialData, indexBuffer_.GetAddressOf()));
+			Microsoft::WRL::ComPtr<ID3D11Buffer> indexBuffer;
+			ThrowIfFailed(GraphicsDevice()->CreateBuffer(&desc, &initialData, indexBuffer.GetAddressOf()));
+			MemoryTracker::Get().TrackBuffer(indexBuffer.Get());
+			indexBuffer_ = Resources().Add(std::move(indexBuffer));
 		}
+
+		boxIndices_ = indices;
 	}
 
-	void InitGraphicsPipeline()
+	BufferHandle CreateVertexBuffer(const void* data, std::size_t size)
 	{
+		D3D11_BUFFER_DESC desc;
+		desc.Usage = D3D11_USAGE_IMMUTABLE;
+		desc.ByteWidth = static_cast<UINT>(size);
+		desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+		desc.CPUAccessFlags = 0;
+		desc.MiscFlags = 0;
+		desc.StructureByteStride = 0;
+
+		D3D11_SUBRESOURCE_DATA initialData;
+		initialData.pSysMem = data;
+		initialData.SysMemPitch = 0;
+		initialData.SysMemSlicePitch = 0;
+
+		Microsoft::WRL::ComPtr<ID3D11Buffer> vertexBuffer;
+		ThrowIfFailed(GraphicsDevice()->CreateBuffer(&desc, &initialData, vertexBuffer.GetAddressOf()));
+		MemoryTracker::Get().TrackBuffer(vertexBuffer.Get());
+		return Resources().Add(std::move(vertexBuffer));
+	}
+
+	StreamTask LoadGraphicsPipeline()
+	{
+		static constexpr AssetId shaderIds[] = {
+			AssetId("Shaders/ColorVertexShader.hlsl"),
+			AssetId("Shaders/ColorPixelShader.hlsl"),
+			AssetId("Shaders/DepthVertexShader.hlsl"),
+		};
+
+		std::vector<AssetData> shaderSources = co_await Streamer().LoadAll(shaderIds, StreamPriority::Critical);
+
 		GraphicsPipeline::Description desc;
-		desc.InputLayout = { Vertex::PosColor::Layout.begin(), Vertex::PosColor::Layout.end() };
-		desc.VertexShader = ShaderLoader::Default()->LoadVertexShader(GetAssetPath(L"Shaders/ColorVertexShader.hlsl"));
-		desc.PixelShader = ShaderLoader::Default()->LoadPixelShader(GetAssetPath(L"Shaders/ColorPixelShader.hlsl"));
-		pipeline_ = GraphicsPipeline::Create(GraphicsDevice(), desc);
+		desc.InputLayout = Vertex::PosColorStreams::Layout;
+		desc.VertexShader = ShaderLoader::Default()->LoadVertexShader(shaderSources[0].Bytes(), "ColorVertexShader.hlsl");
+		desc.PixelShader = ShaderLoader::Default()->LoadPixelShader(shaderSources[1].Bytes(), "ColorPixelShader.hlsl");
+		desc.RasterizerState = solidRasterizerState_;
+
+		GraphicsPipeline::Description depthDesc;
+		depthDesc.InputLayout = Vertex::PosColorStreams::PositionLayout;
+		depthDesc.VertexShader = ShaderLoader::Default()->LoadVertexShader(shaderSources[2].Bytes(), "DepthVertexShader.hlsl");
+		depthDesc.RasterizerState = solidRasterizerState_;
+
+		if (!desc.VertexShader || !desc.PixelShader || !depthDesc.VertexShader) {
+			LogError(LogCategory::Shader, "Failed to load box shaders");
+			co_return;
+		}
+
+		// The handles are only set once both pipelines exist, so a failed
+		// load leaves nothing half created to draw with.
+		PipelineHandle pipeline = CreatePipeline(desc);
+		PipelineHandle depthPipeline;
+		try {
+			depthPipeline = CreatePipeline(depthDesc);
+		}
+		catch (...) {
+			ReleasePipeline(pipeline);
+			throw;
+		}
+		pipeline_ = pipeline;
+		depthPipeline_ = depthPipeline;
+	}
+
+	void CreateDepthStencilStates()
+	{
+		// Passes only what the depth prepass left as the nearest surface.
+		D3D11_DEPTH_STENCIL_DESC desc;
+		ZeroMemory(&desc, sizeof(desc));
+		desc.DepthEnable = TRUE;
+		desc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ZERO;
+		desc.DepthFunc = D3D11_COMPARISON_EQUAL;
+		Microsoft::WRL::ComPtr<ID3D11DepthStencilState> depthEqualState;
+		ThrowIfFailed(GraphicsDevice()->CreateDepthStencilState(&desc, depthEqualState.GetAddressOf()));
+		depthEqualState_ = Resources().Add(std::move(depthEqualState));
+	}
+
+	void CreateStatisticsQueries()
+	{
+		D3D11_QUERY_DESC desc{ .Query = D3D11_QUERY_PIPELINE_STATISTICS, .MiscFlags = 0 };
+		for (Microsoft::WRL::ComPtr<ID3D11Query>& query : statisticsQueries_) {
+			ThrowIfFailed(GraphicsDevice()->CreateQuery(&desc, query.GetAddressOf()));
+		}
 	}
 
 	void CreateRasterizerStates()
@@ -213,11 +651,15 @@ private:
 		ZeroMemory(&desc, sizeof(desc));
 		desc.CullMode = D3D11_CULL_BACK;
 		desc.FillMode = D3D11_FILL_SOLID;
-		GraphicsDevice()->CreateRasterizerState(&desc, solidRasterizerState_.GetAddressOf());
+		Microsoft::WRL::ComPtr<ID3D11RasterizerState> solidRasterizerState;
+		GraphicsDevice()->CreateRasterizerState(&desc, solidRasterizerState.GetAddressOf());
+		solidRasterizerState_ = Resources().Add(std::move(solidRasterizerState));
 
 		desc.CullMode = D3D11_CULL_NONE;
 		desc.FillMode = D3D11_FILL_WIREFRAME;
-		GraphicsDevice()->CreateRasterizerState(&desc, wireframeRasterizerState_.GetAddressOf());
+		Microsoft::WRL::ComPtr<ID3D11RasterizerState> wireframeRasterizerState;
+		GraphicsDevice()->CreateRasterizerState(&desc, wireframeRasterizerState.GetAddressOf());
+		wireframeRasterizerState_ = Resources().Add(std::move(wireframeRasterizerState));
 	}
 
 	void CreateConstantBuffer()
@@ -230,31 +672,211 @@ private:
 		desc.MiscFlags = 0;
 		desc.StructureByteStride = 0;
 
-		GraphicsDevice()->CreateBuffer(&desc, nullptr, transformBuffer_.GetAddressOf());
+		Microsoft::WRL::ComPtr<ID3D11Buffer> transformBuffer;
+		GraphicsDevice()->CreateBuffer(&desc, nullptr, transformBuffer.GetAddressOf());
+		MemoryTracker::Get().TrackBuffer(transformBuffer.Get());
+		transformBuffer_ = Resources().Add(std::move(transformBuffer));
 	}
 
 private:
-	std::unique_ptr<GraphicsPipeline> pipeline_;
-	Microsoft::WRL::ComPtr<ID3D11RasterizerState> solidRasterizerState_;
-	Microsoft::WRL::ComPtr<ID3D11RasterizerState> wireframeRasterizerState_;
-	Microsoft::WRL::ComPtr<ID3D11Buffer> vertexBuffer_;
-	Microsoft::WRL::ComPtr<ID3D11Buffer> indexBuffer_;
-	Microsoft::WRL::ComPtr<ID3D11Buffer> transformBuffer_;
-
-	DirectX::XMFLOAT3 boxPosition_;
-	DirectX::XMFLOAT3 boxRotation_;
-	DirectX::XMFLOAT3 boxScale_ = DirectX::XMFLOAT3(1.0f, 1.0f, 1.0f);
-	Transform boxTransform_;
-
-	DirectX::XMFLOAT3 cameraPosition_ = DirectX::XMFLOAT3(0.0f, 0.0f, -5.0f);
-	DirectX::XMFLOAT3 cameraRotation_;
-	float fieldOfView_ = 90.0f;
+	PipelineHandle pipeline_;
+	PipelineHandle depthPipeline_;
+	RasterizerStateHandle solidRasterizerState_;
+	RasterizerStateHandle wireframeRasterizerState_;
+	DepthStencilStateHandle depthEqualState_;
+	BufferHandle positionBuffer_;
+	BufferHandle colorBuffer_;
+	BufferHandle indexBuffer_;
+	BufferHandle transformBuffer_;
+
+	// CPU copy of the box for the occlusion culler.
+	std::array<DirectX::XMFLOAT3, 8> boxPositions_;
+	std::array<UINT, 36> boxIndices_;
+
+	// Object space bounds of the box mesh.
+	OcclusionBounds boxBounds_;
+
+	OcclusionCuller occlusion_;
+	bool occlusionCulling_ = true;
+
+	DynamicBvh boxTree_;
+	std::vector<BvhProxy> boxProxies_;
+	int pickedBox_ = -1;
+	bool drawBounds_ = false;
+
+	// Owned by the simulation thread.
+	SceneGraph scene_;
+	SceneNode boxNode_ = InvalidSceneNode;
+	EntityWorld entities_;
+	CommandBuffer entityCommands_;
+	CameraCache camera_;
+	std::atomic<std::size_t> matricesRecomputed_ = 0;
+	std::atomic<std::size_t> sceneNodes_ = 0;
+	std::atomic<std::size_t> viewRecomputations_ = 0;
+
+	CameraCache renderCamera_;
+
+	struct Controls
+	{
+		DirectX::XMFLOAT3 BoxPosition = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+		DirectX::XMFLOAT3 BoxRotation = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+		DirectX::XMFLOAT3 BoxScale = DirectX::XMFLOAT3(1.0f, 1.0f, 1.0f);
+		int BoxLayers = 1;
+
+		DirectX::XMFLOAT3 CameraPosition = DirectX::XMFLOAT3(0.0f, 0.0f, -5.0f);
+		DirectX::XMFLOAT3 CameraRotation = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+		float FieldOfView = 90.0f;
+	};
+
+	std::mutex controlsMutex_;
+	Controls controls_;
 
 	bool wireframeMode_ = false;
+	bool depthPrepass_ = false;
+
+	// Everything the panel edits, in 32-bit words for the replay log.
+	struct ReplayedState
+	{
+		Controls Panel;
+		std::uint32_t Wireframe;
+		std::uint32_t DepthPrepass;
+		std::uint32_t OcclusionCulling;
+		std::uint32_t Bounds;
+	};
+	static_assert(sizeof(ReplayedState) % 4 == 0);
+
+	ReplayedState replayState_;
+
+	std::array<Microsoft::WRL::ComPtr<ID3D11Query>, 3> statisticsQueries_;
+	std::uint64_t statisticsFrame_ = 0;
+	UINT64 pixelShaderInvocations_ = 0;
 };
 
-int main()
+int main(int argc, char* argv[])
 {
-	Box game(L"Box", 1280, 720, true);
+	// --log=PATH also writes the log to PATH, --verbose logs debug messages.
+	for (int i = 1; i < argc; ++i) {
+		std::string_view argument = argv[i];
+		if (argument.starts_with("--log=") && !Logger::Default()->OpenFile(argument.substr(argument.find('=') + 1))) {
+			return EXIT_FAILURE;
+		}
+		else if (argument == "--verbose") {
+			Logger::Default()->SetSeverity(LogSeverity::Debug);
+		}
+	}
+
+	// --pack=DIRECTORY packs the assets in DIRECTORY into DIRECTORY.pak, which
+	// the game mounts in place of the loose files when it sits next to them.
+	for (int i = 1; i < argc; ++i) {
+		std::string_view argument = argv[i];
+		if (!argument.starts_with("--pack=")) {
+			continue;
+		}
+
+		std::filesystem::path directory = std::filesystem::path(argument.substr(argument.find('=') + 1)).lexically_normal();
+		if (!directory.has_filename()) {
+			directory = directory.parent_path();
+		}
+		std::filesystem::path archivePath = directory;
+		archivePath += ".pak";
+
+		PakWriter writer;
+		if (!writer.AddDirectory(directory) || !writer.Write(archivePath)) {
+			return EXIT_FAILURE;
+		}
+		std::cout << "Packed " << writer.EntryCount() << " assets into " << archivePath.string() << "\n";
+		return EXIT_SUCCESS;
+	}
+
+	// See BenchmarkOptions for the benchmark command line. --objects sets the
+	// number of box layers.
+	BenchmarkOptions benchmark;
+	if (!benchmark.Parse(argc, argv)) {
+		return EXIT_FAILURE;
+	}
+
+	if (benchmark.Threads > 0) {
+		ThreadPool::SetDefaultThreadCount(benchmark.Threads);
+	}
+
+	if (!benchmark.ComparePath.empty()) {
+		std::vector<BenchmarkMetric> metrics;
+		if (!BenchmarkReport::ReadJson(benchmark.ComparePath, metrics)) {
+			return EXIT_FAILURE;
+		}
+		return Benchmark::Report(metrics, benchmark);
+	}
+
+	if (benchmark.Microbenchmarks) {
+		return Benchmark::Report(RunMicrobenchmarks(benchmark.MicrobenchmarkFilter), benchmark);
+	}
+
+	if (!benchmark.PlayCapturePath.empty()) {
+		return RunCapturePlayback(benchmark);
+	}
+
+	if (!benchmark.GoldenPath.empty()) {
+		return RunGoldenTest(benchmark);
+	}
+
+	Box game(L"Box", benchmark.Width, benchmark.Height, true);
+	SimulatedInputDriver inputDriver;
+	FramePacer::Settings pacing;
+
+	// --pipelined simulates on a separate thread, one frame ahead of rendering.
+	// --simulate-input generates input events at 60 Hz for latency measurement.
+	// --latency-log writes every input-to-present sample to input_latency.csv.
+	// --fps-cap=N limits the frame rate, --vsync syncs presents to the display
+	// and --max-frame-latency=N sets how many frames the swap chain may queue.
+	// --dynamic-resolution scales the scene to hold 60 FPS.
+	// --depth-prepass draws depth before color and shades only visible pixels.
+	// --record=PATH logs the session for --replay, see Game::StartRecording().
+	std::string_view recordPath;
+	for (int i = 1; i < argc; ++i) {
+		std::string_view argument = argv[i];
+		if (argument == "--pipelined") {
+			game.SetPipelined(true);
+		}
+		else if (argument == "--simulate-input") {
+			inputDriver.Start(60.0);
+		}
+		else if (argument == "--latency-log") {
+			LatencyTracker::Get().OpenLog("input_latency.csv");
+		}
+		else if (argument == "--vsync") {
+			pacing.VSync = true;
+		}
+		else if (argument.starts_with("--fps-cap=")) {
+			std::string_view value = argument.substr(argument.find('=') + 1);
+			std::from_chars(value.data(), value.data() + value.size(), pacing.TargetFps);
+		}
+		else if (argument == "--dynamic-resolution") {
+			game.SetDynamicResolution(true);
+		}
+		else if (argument == "--depth-prepass") {
+			game.SetDepthPrepass(true);
+		}
+		else if (argument.starts_with("--max-frame-latency=")) {
+			std::string_view value = argument.substr(argument.find('=') + 1);
+			std::from_chars(value.data(), value.data() + value.size(), pacing.MaxFrameLatency);
+		}
+		else if (argument.starts_with("--record=")) {
+			recordPath = argument.substr(argument.find('=') + 1);
+		}
+	}
+	game.SetFramePacing(pacing);
+
+	if (!recordPath.empty() && !game.StartRecording(recordPath)) {
+		return EXIT_FAILURE;
+	}
+
+	if (benchmark.Enabled) {
+		game.SetHeadless(true, benchmark.Driver);
+		if (benchmark.Objects > 0) {
+			game.SetBoxLayers(benchmark.Objects);
+		}
+		return Benchmark::Run(game, benchmark);
+	}
+
 	return Application::Run(&game);
 }
@@ -0,0 +1,530 @@
+module;
+// C
+#include <cstdint>
+
+// Windows
+#include <d3d11.h>
+#include <wrl.h>
+
+// ImGui
+#include "imgui.h"
+
+export module diagnostics.memory;
+
+import <algorithm>;
+import <array>;
+import <atomic>;
+import <filesystem>;
+import <format>;
+import <fstream>;
+import <ostream>;
+import <string>;
+import <string_view>;
+
+import core.memory;
+import diagnostics.log;
+
+export enum class GpuResourceType : std::uint8_t
+{
+	Buffer,
+	ConstantBuffer,
+	Texture,
+	RenderTarget,
+	DepthStencil,
+	Shader,
+	Count,
+};
+
+export constexpr std::string_view GpuResourceTypeName(GpuResourceType type)
+{
+	constexpr std::string_view names[] = { "Buffer", "ConstantBuffer", "Texture", "RenderTarget", "DepthStencil", "Shader" };
+	return type < GpuResourceType::Count ? names[static_cast<std::size_t>(type)] : "Unknown";
+}
+
+// Accounts CPU memory per MemoryTag (from AllocationCounter) and GPU memory
+// per resource type. GPU sizes are computed from the resource descriptors
+// when a resource is tracked, and subtracted automatically when the resource
+// is destroyed.
+export class MemoryTracker
+{
+public:
+	static MemoryTracker& Get();
+
+public:
+	void TrackBuffer(ID3D11Buffer* buffer);
+	void TrackTexture(ID3D11Texture2D* texture);
+	void TrackShader(ID3D11DeviceChild* shader, std::size_t bytecodeSize);
+	void TrackResource(ID3D11DeviceChild* resource, GpuResourceType type, std::uint64_t bytes);
+
+	std::uint64_t GpuBytes(GpuResourceType type) const;
+	std::uint64_t GpuResourceCount(GpuResourceType type) const;
+	// Resources tracked since startup, released or not.
+	std::uint64_t CreatedResources() const { return created_.load(std::memory_order_relaxed); }
+
+	// Zero means no budget.
+	void SetBudget(MemoryTag tag, std::uint64_t bytes);
+	void SetBudget(GpuResourceType type, std::uint64_t bytes);
+
+	// Updates peaks and warns once each time a budget is crossed. Called
+	// once per frame.
+	void Update();
+
+	void DrawPanel();
+
+	void WriteJson(std::ostream& stream) const;
+	bool DumpJson(const std::filesystem::path& path) const;
+
+	static std::uint64_t TextureBytes(const D3D11_TEXTURE2D_DESC& desc);
+
+private:
+	friend class TrackedResource;
+
+	void Untrack(GpuResourceType type, std::uint64_t bytes);
+
+private:
+	static constexpr std::size_t TagCount = static_cast<std::size_t>(MemoryTag::Count);
+	static constexpr std::size_t TypeCount = static_cast<std::size_t>(GpuResourceType::Count);
+
+	struct GpuCounters
+	{
+		std::atomic<std::uint64_t> Bytes;
+		std::atomic<std::uint64_t> Count;
+	};
+
+	std::array<GpuCounters, TypeCount> gpu_;
+	std::atomic<std::uint64_t> created_ = 0;
+
+	std::array<std::uint64_t, TagCount> cpuBudgets_ = {};
+	std::array<std::uint64_t, TagCount> cpuPeaks_ = {};
+	std::array<bool, TagCount> cpuOverBudget_ = {};
+
+	std::array<std::uint64_t, TypeCount> gpuBudgets_ = {};
+	std::array<std::uint64_t, TypeCount> gpuPeaks_ = {};
+	std::array<bool, TypeCount> gpuOverBudget_ = {};
+};
+
+module :private;
+
+namespace
+{
+	// {6C1C5A4E-0B1B-4C53-9A8E-3E5B8D2F4A71}
+	constexpr GUID TrackedResourceGuid = { 0x6c1c5a4e, 0x0b1b, 0x4c53, { 0x9a, 0x8e, 0x3e, 0x5b, 0x8d, 0x2f, 0x4a, 0x71 } };
+
+	// Planar video formats are counted at their average bits per pixel.
+	std::uint32_t BitsPerPixel(DXGI_FORMAT format)
+	{
+		switch (format) {
+		case DXGI_FORMAT_R32G32B32A32_TYPELESS:
+		case DXGI_FORMAT_R32G32B32A32_FLOAT:
+		case DXGI_FORMAT_R32G32B32A32_UINT:
+		case DXGI_FORMAT_R32G32B32A32_SINT:
+			return 128;
+		case DXGI_FORMAT_R32G32B32_TYPELESS:
+		case DXGI_FORMAT_R32G32B32_FLOAT:
+		case DXGI_FORMAT_R32G32B32_UINT:
+		case DXGI_FORMAT_R32G32B32_SINT:
+			return 96;
+		case DXGI_FORMAT_R16G16B16A16_TYPELESS:
+		case DXGI_FORMAT_R16G16B16A16_FLOAT:
+		case DXGI_FORMAT_R16G16B16A16_UNORM:
+		case DXGI_FORMAT_R16G16B16A16_UINT:
+		case DXGI_FORMAT_R16G16B16A16_SNORM:
+		case DXGI_FORMAT_R16G16B16A16_SINT:
+		case DXGI_FORMAT_R32G32_TYPELESS:
+		case DXGI_FORMAT_R32G32_FLOAT:
+		case DXGI_FORMAT_R32G32_UINT:
+		case DXGI_FORMAT_R32G32_SINT:
+		case DXGI_FORMAT_R32G8X24_TYPELESS:
+		case DXGI_FORMAT_D32_FLOAT_S8X24_UINT:
+		case DXGI_FORMAT_R32_FLOAT_X8X24_TYPELESS:
+		case DXGI_FORMAT_X32_TYPELESS_G8X24_UINT:
+		case DXGI_FORMAT_Y416:
+		case DXGI_FORMAT_Y210:
+		case DXGI_FORMAT_Y216:
+			return 64;
+		case DXGI_FORMAT_R10G10B10A2_TYPELESS:
+		case DXGI_FORMAT_R10G10B10A2_UNORM:
+		case DXGI_FORMAT_R10G10B10A2_UINT:
+		case DXGI_FORMAT_R11G11B10_FLOAT:
+		case DXGI_FORMAT_R8G8B8A8_TYPELESS:
+		case DXGI_FORMAT_R8G8B8A8_UNORM:
+		case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+		case DXGI_FORMAT_R8G8B8A8_UINT:
+		case DXGI_FORMAT_R8G8B8A8_SNORM:
+		case DXGI_FORMAT_R8G8B8A8_SINT:
+		case DXGI_FORMAT_R16G16_TYPELESS:
+		case DXGI_FORMAT_R16G16_FLOAT:
+		case DXGI_FORMAT_R16G16_UNORM:
+		case DXGI_FORMAT_R16G16_UINT:
+		case DXGI_FORMAT_R16G16_SNORM:
+		case DXGI_FORMAT_R16G16_SINT:
+		case DXGI_FORMAT_R32_TYPELESS:
+		case DXGI_FORMAT_D32_FLOAT:
+		case DXGI_FORMAT_R32_FLOAT:
+		case DXGI_FORMAT_R32_UINT:
+		case DXGI_FORMAT_R32_SINT:
+		case DXGI_FORMAT_R24G8_TYPELESS:
+		case DXGI_FORMAT_D24_UNORM_S8_UINT:
+		case DXGI_FORMAT_R24_UNORM_X8_TYPELESS:
+		case DXGI_FORMAT_X24_TYPELESS_G8_UINT:
+		case DXGI_FORMAT_R9G9B9E5_SHAREDEXP:
+		case DXGI_FORMAT_R8G8_B8G8_UNORM:
+		case DXGI_FORMAT_G8R8_G8B8_UNORM:
+		case DXGI_FORMAT_B8G8R8A8_UNORM:
+		case DXGI_FORMAT_B8G8R8X8_UNORM:
+		case DXGI_FORMAT_R10G10B10_XR_BIAS_A2_UNORM:
+		case DXGI_FORMAT_B8G8R8A8_TYPELESS:
+		case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+		case DXGI_FORMAT_B8G8R8X8_TYPELESS:
+		case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB:
+		case DXGI_FORMAT_AYUV:
+		case DXGI_FORMAT_Y410:
+		case DXGI_FORMAT_YUY2:
+			return 32;
+		case DXGI_FORMAT_P010:
+		case DXGI_FORMAT_P016:
+			return 24;
+		case DXGI_FORMAT_R8G8_TYPELESS:
+		case DXGI_FORMAT_R8G8_UNORM:
+		case DXGI_FORMAT_R8G8_UINT:
+		case DXGI_FORMAT_R8G8_SNORM:
+		case DXGI_FORMAT_R8G8_SINT:
+		case DXGI_FORMAT_R16_TYPELESS:
+		case DXGI_FORMAT_R16_FLOAT:
+		case DXGI_FORMAT_D16_UNORM:
+		case DXGI_FORMAT_R16_UNORM:
+		case DXGI_FORMAT_R16_UINT:
+		case DXGI_FORMAT_R16_SNORM:
+		case DXGI_FORMAT_R16_SINT:
+		case DXGI_FORMAT_B5G6R5_UNORM:
+		case DXGI_FORMAT_B5G5R5A1_UNORM:
+		case DXGI_FORMAT_A8P8:
+		case DXGI_FORMAT_B4G4R4A4_UNORM:
+			return 16;
+		case DXGI_FORMAT_NV12:
+		case DXGI_FORMAT_420_OPAQUE:
+		case DXGI_FORMAT_NV11:
+			return 12;
+		case DXGI_FORMAT_R8_TYPELESS:
+		case DXGI_FORMAT_R8_UNORM:
+		case DXGI_FORMAT_R8_UINT:
+		case DXGI_FORMAT_R8_SNORM:
+		case DXGI_FORMAT_R8_SINT:
+		case DXGI_FORMAT_A8_UNORM:
+		case DXGI_FORMAT_AI44:
+		case DXGI_FORMAT_IA44:
+		case DXGI_FORMAT_P8:
+			return 8;
+		case DXGI_FORMAT_R1_UNORM:
+			return 1;
+		case DXGI_FORMAT_BC1_TYPELESS:
+		case DXGI_FORMAT_BC1_UNORM:
+		case DXGI_FORMAT_BC1_UNORM_SRGB:
+		case DXGI_FORMAT_BC4_TYPELESS:
+		case DXGI_FORMAT_BC4_UNORM:
+		case DXGI_FORMAT_BC4_SNORM:
+			return 4;
+		case DXGI_FORMAT_BC2_TYPELESS:
+		case DXGI_FORMAT_BC2_UNORM:
+		case DXGI_FORMAT_BC2_UNORM_SRGB:
+		case DXGI_FORMAT_BC3_TYPELESS:
+		case DXGI_FORMAT_BC3_UNORM:
+		case DXGI_FORMAT_BC3_UNORM_SRGB:
+		case DXGI_FORMAT_BC5_TYPELESS:
+		case DXGI_FORMAT_BC5_UNORM:
+		case DXGI_FORMAT_BC5_SNORM:
+		case DXGI_FORMAT_BC6H_TYPELESS:
+		case DXGI_FORMAT_BC6H_UF16:
+		case DXGI_FORMAT_BC6H_SF16:
+		case DXGI_FORMAT_BC7_TYPELESS:
+		case DXGI_FORMAT_BC7_UNORM:
+		case DXGI_FORMAT_BC7_UNORM_SRGB:
+			return 8;
+		default:
+			LogWarning(LogCategory::Memory, "Unknown texture format {}, counted as 32 bits per pixel", static_cast<int>(format));
+			return 32;
+		}
+	}
+
+	bool IsBlockCompressed(DXGI_FORMAT format)
+	{
+		return (format >= DXGI_FORMAT_BC1_TYPELESS && format <= DXGI_FORMAT_BC5_SNORM) ||
+			(format >= DXGI_FORMAT_BC6H_TYPELESS && format <= DXGI_FORMAT_BC7_UNORM_SRGB);
+	}
+
+	std::string FormatBytes(std::uint64_t bytes)
+	{
+		if (bytes >= 1024 * 1024) {
+			return std::format("{:.2f} MiB", bytes / (1024.0 * 1024.0));
+		}
+		return std::format("{:.1f} KiB", bytes / 1024.0);
+	}
+}
+
+// Attached to a D3D11 object as private data. The object releases its
+// private data when it is destroyed, which takes the bytes off the books.
+class TrackedResource : public IUnknown
+{
+public:
+	TrackedResource(GpuResourceType type, std::uint64_t bytes)
+		: type_(type), bytes_(bytes)
+	{
+	}
+
+	HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, void** object) override
+	{
+		if (riid == __uuidof(IUnknown)) {
+			*object = static_cast<IUnknown*>(this);
+			AddRef();
+			return S_OK;
+		}
+		*object = nullptr;
+		return E_NOINTERFACE;
+	}
+
+	ULONG STDMETHODCALLTYPE AddRef() override
+	{
+		return ++references_;
+	}
+
+	ULONG STDMETHODCALLTYPE Release() override
+	{
+		ULONG references = --references_;
+		if (references == 0) {
+			MemoryTracker::Get().Untrack(type_, bytes_);
+			delete this;
+		}
+		return references;
+	}
+
+private:
+	GpuResourceType type_;
+	std::uint64_t bytes_;
+	std::atomic<ULONG> references_ = 1;
+};
+
+MemoryTracker& MemoryTracker::Get()
+{
+	static MemoryTracker tracker;
+	return tracker;
+}
+
+void MemoryTracker::TrackBuffer(ID3D11Buffer* buffer)
+{
+	D3D11_BUFFER_DESC desc;
+	buffer->GetDesc(&desc);
+	GpuResourceType type = (desc.BindFlags & D3D11_BIND_CONSTANT_BUFFER) ? GpuResourceType::ConstantBuffer : GpuResourceType::Buffer;
+	TrackResource(buffer, type, desc.ByteWidth);
+}
+
+void MemoryTracker::TrackTexture(ID3D11Texture2D* texture)
+{
+	D3D11_TEXTURE2D_DESC desc;
+	texture->GetDesc(&desc);
+
+	GpuResourceType type = GpuResourceType::Texture;
+	if (desc.BindFlags & D3D11_BIND_DEPTH_STENCIL) {
+		type = GpuResourceType::DepthStencil;
+	}
+	else if (desc.BindFlags & D3D11_BIND_RENDER_TARGET) {
+		type = GpuResourceType::RenderTarget;
+	}
+	TrackResource(texture, type, TextureBytes(desc));
+}
+
+void MemoryTracker::TrackShader(ID3D11DeviceChild* shader, std::size_t bytecodeSize)
+{
+	TrackResource(shader, GpuResourceType::Shader, bytecodeSize);
+}
+
+void MemoryTracker::TrackResource(ID3D11DeviceChild* resource, GpuResourceType type, std::uint64_t bytes)
+{
+	if (!resource) {
+		return;
+	}
+
+	GpuCounters& counters = gpu_[static_cast<std::size_t>(type)];
+	counters.Bytes.fetch_add(bytes, std::memory_order_relaxed);
+	counters.Count.fetch_add(1, std::memory_order_relaxed);
+	created_.fetch_add(1, std::memory_order_relaxed);
+
+	// The resource holds the only reference from here on.
+	Microsoft::WRL::ComPtr<IUnknown> token;
+	token.Attach(new TrackedResource(type, bytes));
+	resource->SetPrivateDataInterface(TrackedResourceGuid, token.Get());
+}
+
+void MemoryTracker::Untrack(GpuResourceType type, std::uint64_t bytes)
+{
+	GpuCounters& counters = gpu_[static_cast<std::size_t>(type)];
+	counters.Bytes.fetch_sub(bytes, std::memory_order_relaxed);
+	counters.Count.fetch_sub(1, std::memory_order_relaxed);
+}
+
+std::uint64_t MemoryTracker::GpuBytes(GpuResourceType type) const
+{
+	return gpu_[static_cast<std::size_t>(type)].Bytes.load(std::memory_order_relaxed);
+}
+
+std::uint64_t MemoryTracker::GpuResourceCount(GpuResourceType type) const
+{
+	return gpu_[static_cast<std::size_t>(type)].Count.load(std::memory_order_relaxed);
+}
+
+void MemoryTracker::SetBudget(MemoryTag tag, std::uint64_t bytes)
+{
+	cpuBudgets_[static_cast<std::size_t>(tag)] = bytes;
+}
+
+void MemoryTracker::SetBudget(GpuResourceType type, std::uint64_t bytes)
+{
+	gpuBudgets_[static_cast<std::size_t>(type)] = bytes;
+}
+
+void MemoryTracker::Update()
+{
+	for (std::size_t i = 0; i < TagCount; ++i) {
+		MemoryTag tag = static_cast<MemoryTag>(i);
+		std::uint64_t bytes = static_cast<std::uint64_t>(std::max<std::int64_t>(AllocationCounter::LiveBytes(tag), 0));
+		cpuPeaks_[i] = std::max(cpuPeaks_[i], bytes);
+
+		bool overBudget = cpuBudgets_[i] != 0 && bytes > cpuBudgets_[i];
+		if (overBudget && !cpuOverBudget_[i]) {
+			LogWarning(LogCategory::Memory, "Memory budget exceeded: CPU {} uses {} of {}",
+				MemoryTagName(tag), FormatBytes(bytes), FormatBytes(cpuBudgets_[i]));
+		}
+		cpuOverBudget_[i] = overBudget;
+	}
+
+	for (std::size_t i = 0; i < TypeCount; ++i) {
+		GpuResourceType type = static_cast<GpuResourceType>(i);
+		std::uint64_t bytes = GpuBytes(type);
+		gpuPeaks_[i] = std::max(gpuPeaks_[i], bytes);
+
+		bool overBudget = gpuBudgets_[i] != 0 && bytes > gpuBudgets_[i];
+		if (overBudget && !gpuOverBudget_[i]) {
+			LogWarning(LogCategory::Memory, "Memory budget exceeded: GPU {} uses {} of {}",
+				GpuResourceTypeName(type), FormatBytes(bytes), FormatBytes(gpuBudgets_[i]));
+		}
+		gpuOverBudget_[i] = overBudget;
+	}
+}
+
+void MemoryTracker::DrawPanel()
+{
+	auto drawRow = [](std::string_view name, std::uint64_t bytes, std::uint64_t peak, std::uint64_t budget) {
+		ImGui::TableNextRow();
+		ImGui::TableNextColumn();
+		ImGui::TextUnformatted(name.data(), name.data() + name.size());
+		ImGui::TableNextColumn();
+		ImGui::Text("%.1f KiB", bytes / 1024.0);
+		ImGui::TableNextColumn();
+		ImGui::Text("%.1f KiB", peak / 1024.0);
+		ImGui::TableNextColumn();
+		if (budget != 0) {
+			bool overBudget = bytes > budget;
+			if (overBudget) {
+				ImGui::PushStyleColor(ImGuiCol_PlotHistogram, ImVec4(0.9f, 0.2f, 0.2f, 1.0f));
+			}
+			ImGui::ProgressBar(static_cast<float>(bytes) / budget, ImVec2(-1.0f, 0.0f));
+			if (overBudget) {
+				ImGui::PopStyleColor();
+			}
+		}
+		else {
+			ImGui::TextUnformatted("-");
+		}
+	};
+
+	ImGui::Begin("Memory");
+
+	if (ImGui::BeginTable("CPU", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+		ImGui::TableSetupColumn("CPU");
+		ImGui::TableSetupColumn("Live");
+		ImGui::TableSetupColumn("Peak");
+		ImGui::TableSetupColumn("Budget");
+		ImGui::TableHeadersRow();
+		for (std::size_t i = 0; i < TagCount; ++i) {
+			MemoryTag tag = static_cast<MemoryTag>(i);
+			std::uint64_t bytes = static_cast<std::uint64_t>(std::max<std::int64_t>(AllocationCounter::LiveBytes(tag), 0));
+			drawRow(MemoryTagName(tag), bytes, cpuPeaks_[i], cpuBudgets_[i]);
+		}
+		ImGui::EndTable();
+	}
+
+	if (ImGui::BeginTable("GPU", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+		ImGui::TableSetupColumn("GPU");
+		ImGui::TableSetupColumn("Live");
+		ImGui::TableSetupColumn("Peak");
+		ImGui::TableSetupColumn("Budget");
+		ImGui::TableHeadersRow();
+		for (std::size_t i = 0; i < TypeCount; ++i) {
+			GpuResourceType type = static_cast<GpuResourceType>(i);
+			drawRow(GpuResourceTypeName(type), GpuBytes(type), gpuPeaks_[i], gpuBudgets_[i]);
+		}
+		ImGui::EndTable();
+	}
+
+	if (ImGui::Button("Dump JSON")) {
+		DumpJson("memory_report.json");
+	}
+
+	ImGui::End();
+}
+
+void MemoryTracker::WriteJson(std::ostream& stream) const
+{
+	stream << "{\n  \"cpu\": [\n";
+	for (std::size_t i = 0; i < TagCount; ++i) {
+		MemoryTag tag = static_cast<MemoryTag>(i);
+		stream << std::format("    {{ \"tag\": \"{}\", \"liveBytes\": {}, \"peakBytes\": {}, \"allocations\": {}, \"budgetBytes\": {} }}{}\n",
+			MemoryTagName(tag), AllocationCounter::LiveBytes(tag), cpuPeaks_[i], AllocationCounter::Allocations(tag),
+			cpuBudgets_[i], i + 1 < TagCount ? "," : "");
+	}
+	stream << "  ],\n  \"gpu\": [\n";
+	for (std::size_t i = 0; i < TypeCount; ++i) {
+		GpuResourceType type = static_cast<GpuResourceType>(i);
+		stream << std::format("    {{ \"type\": \"{}\", \"liveBytes\": {}, \"peakBytes\": {}, \"resources\": {}, \"budgetBytes\": {} }}{}\n",
+			GpuResourceTypeName(type), GpuBytes(type), gpuPeaks_[i], GpuResourceCount(type),
+			gpuBudgets_[i], i + 1 < TypeCount ? "," : "");
+	}
+	stream << "  ]\n}\n";
+}
+
+bool MemoryTracker::DumpJson(const std::filesystem::path& path) const
+{
+	std::ofstream file(path, std::ios::trunc);
+	if (!file) {
+		LogError(LogCategory::Memory, "Failed to write memory report: {}", path.string());
+		return false;
+	}
+
+	WriteJson(file);
+	return true;
+}
+
+std::uint64_t MemoryTracker::TextureBytes(const D3D11_TEXTURE2D_DESC& desc)
+{
+	std::uint32_t mipLevels = desc.MipLevels;
+	if (mipLevels == 0) {
+		for (std::uint32_t size = std::max(desc.Width, desc.Height); size > 0; size >>= 1) {
+			++mipLevels;
+		}
+	}
+
+	bool blockCompressed = IsBlockCompressed(desc.Format);
+	std::uint64_t bitsPerPixel = BitsPerPixel(desc.Format);
+
+	std::uint64_t bytes = 0;
+	for (std::uint32_t mip = 0; mip < mipLevels; ++mip) {
+		std::uint64_t width = std::max(desc.Width >> mip, 1u);
+		std::uint64_t height = std::max(desc.Height >> mip, 1u);
+		if (blockCompressed) {
+			width = (width + 3) & ~3ull;
+			height = (height + 3) & ~3ull;
+		}
+		bytes += width * height * bitsPerPixel / 8;
+	}
+
+	return bytes * desc.ArraySize * std::max(desc.SampleDesc.Count, 1u);
+}
@@ -0,0 +1,301 @@
+module;
+// C
+#include <cstddef>
+#include <cstdint>
+
+// Windows
+#include <DirectXMath.h>
+
+export module diagnostics.microbenchmarks;
+
+import <algorithm>;
+import <array>;
+import <chrono>;
+import <format>;
+import <functional>;
+import <iostream>;
+import <memory>;
+import <memory_resource>;
+import <random>;
+import <string>;
+import <string_view>;
+import <vector>;
+
+import core.entities;
+import core.memory;
+import core.snapshot;
+import diagnostics.benchmark;
+import render.occlusion;
+import scene.graph;
+import spatial.bvh;
+
+// Runs the microbenchmarks whose name contains filter and returns their cost
+// per operation as "<name>_ns" metrics. Each one is repeated until it has run
+// long enough to time reliably.
+export std::vector<BenchmarkMetric> RunMicrobenchmarks(std::string_view filter);
+
+module :private;
+
+namespace
+{
+	using namespace std::chrono_literals;
+
+	constexpr std::chrono::steady_clock::duration MinimumTime = 200ms;
+
+	struct Microbenchmark
+	{
+		std::string_view Name;
+		// Builds the state and returns the body, which runs the operation the
+		// given number of times.
+		std::function<std::function<void(std::size_t)>()> Setup;
+	};
+
+	// Keeps the compiler from dropping work whose result is otherwise unused.
+	volatile float sink;
+
+	double Measure(const std::function<void(std::size_t)>& body)
+	{
+		std::size_t iterations = 1;
+		while (true) {
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			body(iterations);
+			std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+
+			if (elapsed >= MinimumTime || iterations >= (std::size_t(1) << 32)) {
+				return std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+			}
+
+			// Aim past the minimum time, growing at least 2x and at most 10x.
+			double scale = elapsed.count() > 0 ? 1.5 * MinimumTime / elapsed : 10.0;
+			iterations = static_cast<std::size_t>(iterations * std::clamp(scale, 2.0, 10.0));
+		}
+	}
+
+	const std::array<DirectX::XMFLOAT3, 8> BoxPositions = {
+		DirectX::XMFLOAT3(-0.5f, +0.5f, +0.5f), DirectX::XMFLOAT3(+0.5f, +0.5f, +0.5f),
+		DirectX::XMFLOAT3(+0.5f, +0.5f, -0.5f), DirectX::XMFLOAT3(-0.5f, +0.5f, -0.5f),
+		DirectX::XMFLOAT3(-0.5f, -0.5f, +0.5f), DirectX::XMFLOAT3(+0.5f, -0.5f, +0.5f),
+		DirectX::XMFLOAT3(+0.5f, -0.5f, -0.5f), DirectX::XMFLOAT3(-0.5f, -0.5f, -0.5f),
+	};
+
+	const std::array<std::uint32_t, 36> BoxIndices = {
+		0, 1, 3, 1, 2, 3,
+		3, 2, 7, 2, 6, 7,
+		2, 1, 6, 1, 5, 6,
+		0, 3, 4, 3, 7, 4,
+		1, 0, 5, 0, 4, 5,
+		7, 6, 4, 6, 5, 4,
+	};
+
+	DirectX::XMMATRIX CameraViewProjection()
+	{
+		DirectX::XMMATRIX V = DirectX::XMMatrixLookAtLH(DirectX::XMVectorSet(0.0f, 0.0f, -5.0f, 1.0f), DirectX::XMVectorZero(), DirectX::XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+		DirectX::XMMATRIX P = DirectX::XMMatrixPerspectiveFovLH(DirectX::XM_PIDIV2, 16.0f / 9.0f, 0.1f, 1000.0f);
+		return V * P;
+	}
+
+	std::vector<Microbenchmark> Microbenchmarks()
+	{
+		std::vector<Microbenchmark> benchmarks;
+
+		benchmarks.push_back({ "math/matrix_multiply", [] {
+			auto matrices = std::make_shared<std::vector<DirectX::XMFLOAT4X4>>(1024);
+			for (std::size_t i = 0; i < matrices->size(); ++i) {
+				DirectX::XMStoreFloat4x4(&(*matrices)[i], DirectX::XMMatrixRotationY(0.01f * i) * DirectX::XMMatrixTranslation(0.0f, 0.0f, 1.0f * i));
+			}
+			return [matrices](std::size_t iterations) {
+				DirectX::XMMATRIX result = DirectX::XMMatrixIdentity();
+				for (std::size_t i = 0; i < iterations; ++i) {
+					result = DirectX::XMLoadFloat4x4(&(*matrices)[i % matrices->size()]) * result;
+				}
+				sink = DirectX::XMVectorGetX(result.r[0]);
+			};
+		} });
+
+		auto sceneGraph = [](std::size_t edits) {
+			return [edits] {
+				// 10k nodes with four children each.
+				auto graph = std::make_shared<SceneGraph>();
+				auto nodes = std::make_shared<std::vector<SceneNode>>();
+				for (std::size_t i = 0; i < 10000; ++i) {
+					NodeTransform local;
+					local.Position.x = 0.1f;
+					nodes->push_back(graph->CreateNode(i == 0 ? InvalidSceneNode : (*nodes)[(i - 1) / 4], local));
+				}
+				graph->Update();
+
+				return [graph, nodes, edits](std::size_t iterations) {
+					std::minstd_rand random(1);
+					for (std::size_t i = 0; i < iterations; ++i) {
+						for (std::size_t edit = 0; edit < edits; ++edit) {
+							SceneNode node = edits == 1 ? (*nodes)[0] : (*nodes)[random() % nodes->size()];
+							NodeTransform local = graph->LocalTransform(node);
+							local.Rotation.y += 0.01f;
+							graph->SetLocalTransform(node, local);
+						}
+						graph->Update();
+					}
+				};
+			};
+		};
+		benchmarks.push_back({ "math/scene_graph_sparse_update", sceneGraph(10) });
+		benchmarks.push_back({ "math/scene_graph_full_update", sceneGraph(1) });
+
+		benchmarks.push_back({ "culling/occlusion_rasterize", [] {
+			auto culler = std::make_shared<OcclusionCuller>();
+			return [culler](std::size_t iterations) {
+				for (std::size_t i = 0; i < iterations; ++i) {
+					culler->BeginFrame(CameraViewProjection());
+					for (int layer = 0; layer < 32; ++layer) {
+						DirectX::XMFLOAT4X4 world;
+						DirectX::XMStoreFloat4x4(&world, DirectX::XMMatrixTranslation(0.0f, 0.0f, 0.5f * layer));
+						culler->AddOccluder({ BoxPositions, BoxIndices }, world);
+					}
+					culler->Rasterize();
+				}
+			};
+		} });
+
+		benchmarks.push_back({ "culling/occlusion_test_1024", [] {
+			auto culler = std::make_shared<OcclusionCuller>();
+			culler->BeginFrame(CameraViewProjection());
+			DirectX::XMFLOAT4X4 wall;
+			DirectX::XMStoreFloat4x4(&wall, DirectX::XMMatrixScaling(20.0f, 20.0f, 1.0f));
+			culler->AddOccluder({ BoxPositions, BoxIndices }, wall);
+			culler->Rasterize();
+
+			// A grid of boxes, the middle of it hidden behind the wall.
+			auto items = std::make_shared<std::vector<DrawItem>>(1024);
+			for (std::size_t i = 0; i < items->size(); ++i) {
+				float x = static_cast<float>(i % 32) - 16.0f;
+				float y = static_cast<float>(i / 32) - 16.0f;
+				DirectX::XMStoreFloat4x4(&(*items)[i].World, DirectX::XMMatrixTranslation(x, y, 5.0f));
+			}
+			auto visible = std::make_shared<std::pmr::vector<std::uint32_t>>();
+			return [culler, items, visible](std::size_t iterations) {
+				for (std::size_t i = 0; i < iterations; ++i) {
+					visible->clear();
+					culler->Cull(*items, OcclusionBounds(), *visible);
+				}
+			};
+		} });
+
+		auto boxTree = [] {
+			auto tree = std::make_shared<DynamicBvh>();
+			std::minstd_rand random(1);
+			std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+			for (std::uint64_t i = 0; i < 10000; ++i) {
+				DirectX::XMFLOAT3 center(position(random), position(random), position(random));
+				tree->Insert(Aabb::Transform(center, DirectX::XMFLOAT3(0.5f, 0.5f, 0.5f), DirectX::XMMatrixIdentity()), i);
+			}
+			return tree;
+		};
+
+		benchmarks.push_back({ "culling/bvh_raycast", [boxTree] {
+			auto tree = boxTree();
+			return [tree](std::size_t iterations) {
+				std::minstd_rand random(2);
+				std::uniform_real_distribution<float> direction(-1.0f, 1.0f);
+				float total = 0.0f;
+				for (std::size_t i = 0; i < iterations; ++i) {
+					BvhRay ray{ DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f), DirectX::XMFLOAT3(direction(random), direction(random), direction(random)) };
+					total += tree->RayCast(ray, [&](BvhProxy proxy, const BvhRay& proxyRay, float) { return IntersectRay(proxyRay, tree->FatBounds(proxy)); }).Distance;
+				}
+				sink = total;
+			};
+		} });
+
+		benchmarks.push_back({ "culling/bvh_overlap", [boxTree] {
+			auto tree = boxTree();
+			return [tree](std::size_t iterations) {
+				std::minstd_rand random(3);
+				std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+				std::size_t overlaps = 0;
+				for (std::size_t i = 0; i < iterations; ++i) {
+					DirectX::XMFLOAT3 center(position(random), position(random), position(random));
+					tree->QueryOverlap(Aabb::Transform(center, DirectX::XMFLOAT3(5.0f, 5.0f, 5.0f), DirectX::XMMatrixIdentity()), [&](BvhProxy) {
+						++overlaps;
+						return true;
+					});
+				}
+				sink = static_cast<float>(overlaps);
+			};
+		} });
+
+		benchmarks.push_back({ "allocator/new_delete_64", [] {
+			return [](std::size_t iterations) {
+				for (std::size_t i = 0; i < iterations; ++i) {
+					std::byte* block = new std::byte[64];
+					sink = static_cast<float>(reinterpret_cast<std::uintptr_t>(block) & 1);
+					delete[] block;
+				}
+			};
+		} });
+
+		benchmarks.push_back({ "allocator/frame_arena_64", [] {
+			auto arena = std::make_shared<FrameArena>(64 * 1024);
+			return [arena](std::size_t iterations) {
+				for (std::size_t i = 0; i < iterations; ++i) {
+					if (i % 1024 == 0) {
+						arena->Reset();
+					}
+					sink = static_cast<float>(reinterpret_cast<std::uintptr_t>(arena->allocate(64, 16)) & 1);
+				}
+			};
+		} });
+
+		benchmarks.push_back({ "allocator/fixed_pool_64", [] {
+			auto pool = std::make_shared<FixedPool>(64, 16);
+			return [pool](std::size_t iterations) {
+				for (std::size_t i = 0; i < iterations; ++i) {
+					void* block = pool->Allocate();
+					sink = static_cast<float>(reinterpret_cast<std::uintptr_t>(block) & 1);
+					pool->Deallocate(block);
+				}
+			};
+		} });
+
+		benchmarks.push_back({ "ecs/iterate_100k", [] {
+			struct Position
+			{
+				DirectX::XMFLOAT3 Value;
+			};
+			struct Velocity
+			{
+				DirectX::XMFLOAT3 Value;
+			};
+
+			auto world = std::make_shared<EntityWorld>();
+			for (int i = 0; i < 100000; ++i) {
+				world->Create(Position{ DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f) }, Velocity{ DirectX::XMFLOAT3(1.0f, 0.0f, 0.0f) });
+			}
+			return [world](std::size_t iterations) {
+				for (std::size_t i = 0; i < iterations; ++i) {
+					world->ForEachChunk<Position, const Velocity>([](std::size_t count, const Entity*, Position* positions, const Velocity* velocities) {
+						for (std::size_t j = 0; j < count; ++j) {
+							positions[j].Value.x += velocities[j].Value.x;
+						}
+					});
+				}
+			};
+		} });
+
+		return benchmarks;
+	}
+}
+
+std::vector<BenchmarkMetric> RunMicrobenchmarks(std::string_view filter)
+{
+	std::vector<BenchmarkMetric> metrics;
+	for (const Microbenchmark& benchmark : Microbenchmarks()) {
+		if (benchmark.Name.find(filter) == std::string_view::npos) {
+			continue;
+		}
+
+		std::cout << std::format("{:<40} ", benchmark.Name) << std::flush;
+		double nanoseconds = Measure(benchmark.Setup());
+		std::cout << std::format("{:>12.1f} ns\n", nanoseconds);
+		metrics.push_back({ std::string(benchmark.Name) + "_ns", nanoseconds });
+	}
+	return metrics;
+}
@@ -0,0 +1,385 @@
+module;
+// C
+#include <cfloat>
+#include <cstddef>
+#include <cstdint>
+
+// Windows
+#include <DirectXMath.h>
+
+export module render.occlusion;
+
+import <algorithm>;
+import <chrono>;
+import <memory_resource>;
+import <span>;
+import <vector>;
+
+import core.memory;
+import core.snapshot;
+import core.threading;
+
+// Triangle mesh drawn into the occlusion buffer, in object space.
+export struct OcclusionMesh
+{
+	std::span<const DirectX::XMFLOAT3> Positions;
+	std::span<const std::uint32_t> Indices;
+};
+
+// Object space bounding box of an occludee.
+export struct OcclusionBounds
+{
+	DirectX::XMFLOAT3 Center = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+	DirectX::XMFLOAT3 Extents = DirectX::XMFLOAT3(0.5f, 0.5f, 0.5f);
+};
+
+// Software occlusion culling against a low resolution depth buffer.
+//
+// Each frame the selected occluders are rasterized into a Width x Height
+// depth buffer, four pixels at a time. The buffer is split into horizontal
+// bands that the thread pool rasterizes independently, each band also
+// reducing its rows to the maximum depth per tile. An occludee is hidden when
+// the nearest depth of its screen-space bounds lies behind the farthest
+// occluder depth in every tile the bounds touch.
+//
+// The test is conservative in depth: anything crossing the near plane, or
+// not fully behind the occluders, is reported visible.
+export class OcclusionCuller
+{
+public:
+	static constexpr int Width = 256;
+	static constexpr int Height = 128;
+	static constexpr int TileSize = 8;
+	static constexpr int BandHeight = 16;
+	static constexpr int TilesX = Width / TileSize;
+	static constexpr int TilesY = Height / TileSize;
+
+	struct Statistics
+	{
+		std::size_t Occluders = 0;
+		std::size_t OccluderTriangles = 0;
+		std::size_t Tested = 0;
+		std::size_t Occluded = 0;
+		std::size_t OutsideFrustum = 0;
+		float RasterizeMilliseconds = 0.0f;
+		float TestMilliseconds = 0.0f;
+	};
+
+public:
+	explicit OcclusionCuller(ThreadPool* threadPool = ThreadPool::Default());
+
+	// Starts a frame seen through viewProjection and forgets the occluders.
+	// The occluder triangles of the frame go to frameMemory, if given.
+	void BeginFrame(DirectX::FXMMATRIX viewProjection, std::pmr::memory_resource* frameMemory = nullptr);
+
+	void AddOccluder(const OcclusionMesh& mesh, const DirectX::XMFLOAT4X4& world);
+
+	// Draws the occluders added since BeginFrame() and builds the tile depths.
+	void Rasterize();
+
+	bool IsVisible(const OcclusionBounds& bounds, const DirectX::XMFLOAT4X4& world);
+
+	// Appends the indices of the visible items to visible.
+	void Cull(std::span<const DrawItem> items, const OcclusionBounds& bounds, std::pmr::vector<std::uint32_t>& visible);
+
+	const Statistics& GetStatistics() const { return statistics_; }
+	std::span<const float> DepthBuffer() const { return depth_; }
+
+private:
+	// Screen-space triangle set up for rasterization. Edge i is the one
+	// opposite vertex i; it is non-negative inside the triangle.
+	struct Triangle
+	{
+		float EdgeA[3];
+		float EdgeB[3];
+		float EdgeC[3];
+		float DepthA;
+		float DepthB;
+		float DepthC;
+		int MinX;
+		int MaxX;
+		int MinY;
+		int MaxY;
+	};
+
+	void RasterizeBand(int band);
+
+private:
+	ThreadPool* threadPool_;
+	DirectX::XMFLOAT4X4 viewProjection_;
+
+	std::pmr::vector<Triangle> triangles_;
+	std::vector<DirectX::XMFLOAT4> clipPositions_;
+	std::vector<float> depth_;
+	std::vector<float> tileMaxDepth_;
+
+	Statistics statistics_;
+};
+
+module :private;
+
+namespace
+{
+	// Points closer to the eye than this, in clip space w, are treated as
+	// crossing the near plane.
+	constexpr float MinClipW = 1e-4f;
+
+	// Allows for rounding when an occludee is its own occluder.
+	constexpr float DepthEpsilon = 1e-5f;
+
+	float Milliseconds(std::chrono::steady_clock::duration duration)
+	{
+		return std::chrono::duration<float, std::milli>(duration).count();
+	}
+
+	DirectX::XMFLOAT3 ToScreen(const DirectX::XMFLOAT4& clip)
+	{
+		float inverseW = 1.0f / clip.w;
+		return DirectX::XMFLOAT3(
+			(clip.x * inverseW * 0.5f + 0.5f) * OcclusionCuller::Width,
+			(clip.y * inverseW * -0.5f + 0.5f) * OcclusionCuller::Height,
+			clip.z * inverseW);
+	}
+}
+
+OcclusionCuller::OcclusionCuller(ThreadPool* threadPool)
+	: threadPool_(threadPool), depth_(Width * Height, 1.0f), tileMaxDepth_(TilesX * TilesY, 1.0f)
+{
+	DirectX::XMStoreFloat4x4(&viewProjection_, DirectX::XMMatrixIdentity());
+}
+
+void OcclusionCuller::BeginFrame(DirectX::FXMMATRIX viewProjection, std::pmr::memory_resource* frameMemory)
+{
+	DirectX::XMStoreFloat4x4(&viewProjection_, viewProjection);
+	ResetFrameVector(triangles_, frameMemory);
+	statistics_ = Statistics();
+}
+
+void OcclusionCuller::AddOccluder(const OcclusionMesh& mesh, const DirectX::XMFLOAT4X4& world)
+{
+	DirectX::XMMATRIX worldViewProjection = DirectX::XMLoadFloat4x4(&world) * DirectX::XMLoadFloat4x4(&viewProjection_);
+
+	clipPositions_.resize(mesh.Positions.size());
+	for (std::size_t i = 0; i < mesh.Positions.size(); ++i) {
+		DirectX::XMVECTOR position = DirectX::XMVectorSetW(DirectX::XMLoadFloat3(&mesh.Positions[i]), 1.0f);
+		DirectX::XMStoreFloat4(&clipPositions_[i], DirectX::XMVector4Transform(position, worldViewProjection));
+	}
+
+	for (std::size_t i = 0; i + 2 < mesh.Indices.size(); i += 3) {
+		const DirectX::XMFLOAT4& c0 = clipPositions_[mesh.Indices[i]];
+		const DirectX::XMFLOAT4& c1 = clipPositions_[mesh.Indices[i + 1]];
+		const DirectX::XMFLOAT4& c2 = clipPositions_[mesh.Indices[i + 2]];
+
+		// Occluders are optional, so triangles that would need clipping are
+		// simply left out. That includes vertices in front of the near plane
+		// (z < 0) but not behind the eye, whose part of the triangle the GPU
+		// clips away and which must not hide anything here.
+		if (c0.w < MinClipW || c1.w < MinClipW || c2.w < MinClipW || c0.z < 0.0f || c1.z < 0.0f || c2.z < 0.0f) {
+			continue;
+		}
+
+		DirectX::XMFLOAT3 v[3] = { ToScreen(c0), ToScreen(c1), ToScreen(c2) };
+
+		// Front faces are clockwise on screen, which with y pointing down
+		// gives a positive area.
+		float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[1].y - v[0].y) * (v[2].x - v[0].x);
+		if (area <= 0.0f) {
+			continue;
+		}
+
+		Triangle triangle;
+		triangle.MinX = std::max(static_cast<int>(std::min({ v[0].x, v[1].x, v[2].x })), 0);
+		triangle.MaxX = std::min(static_cast<int>(std::max({ v[0].x, v[1].x, v[2].x })), Width - 1);
+		triangle.MinY = std::max(static_cast<int>(std::min({ v[0].y, v[1].y, v[2].y })), 0);
+		triangle.MaxY = std::min(static_cast<int>(std::max({ v[0].y, v[1].y, v[2].y })), Height - 1);
+		if (triangle.MinX > triangle.MaxX || triangle.MinY > triangle.MaxY) {
+			continue;
+		}
+
+		// Edge functions and the depth plane in the form a * x + b * y + c.
+		float inverseArea = 1.0f / area;
+		triangle.DepthA = triangle.DepthB = triangle.DepthC = 0.0f;
+		for (int edge = 0; edge < 3; ++edge) {
+			const DirectX::XMFLOAT3& a = v[(edge + 1) % 3];
+			const DirectX::XMFLOAT3& b = v[(edge + 2) % 3];
+			triangle.EdgeA[edge] = a.y - b.y;
+			triangle.EdgeB[edge] = b.x - a.x;
+			triangle.EdgeC[edge] = -(triangle.EdgeA[edge] * a.x + triangle.EdgeB[edge] * a.y);
+
+			float depth = v[edge].z * inverseArea;
+			triangle.DepthA += triangle.EdgeA[edge] * depth;
+			triangle.DepthB += triangle.EdgeB[edge] * depth;
+			triangle.DepthC += triangle.EdgeC[edge] * depth;
+		}
+
+		triangles_.push_back(triangle);
+	}
+
+	++statistics_.Occluders;
+}
+
+void OcclusionCuller::Rasterize()
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	statistics_.OccluderTriangles = triangles_.size();
+	threadPool_->ParallelFor(Height / BandHeight, [this](std::size_t band) { RasterizeBand(static_cast<int>(band)); });
+
+	statistics_.RasterizeMilliseconds = Milliseconds(std::chrono::steady_clock::now() - start);
+}
+
+void OcclusionCuller::RasterizeBand(int band)
+{
+	using namespace DirectX;
+
+	int bandMinY = band * BandHeight;
+	int bandMaxY = bandMinY + BandHeight - 1;
+	std::fill(depth_.begin() + bandMinY * Width, depth_.begin() + (bandMaxY + 1) * Width, 1.0f);
+
+	const XMVECTOR pixelOffsets = XMVectorSet(0.5f, 1.5f, 2.5f, 3.5f);
+	const XMVECTOR zero = XMVectorZero();
+
+	for (const Triangle& triangle : triangles_) {
+		int minY = std::max(triangle.MinY, bandMinY);
+		int maxY = std::min(triangle.MaxY, bandMaxY);
+		if (minY > maxY) {
+			continue;
+		}
+
+		XMVECTOR edgeA0 = XMVectorReplicate(triangle.EdgeA[0]);
+		XMVECTOR edgeA1 = XMVectorReplicate(triangle.EdgeA[1]);
+		XMVECTOR edgeA2 = XMVectorReplicate(triangle.EdgeA[2]);
+		XMVECTOR depthA = XMVectorReplicate(triangle.DepthA);
+		int minX = triangle.MinX & ~3;
+
+		for (int y = minY; y <= maxY; ++y) {
+			float centerY = y + 0.5f;
+			XMVECTOR row0 = XMVectorReplicate(triangle.EdgeB[0] * centerY + triangle.EdgeC[0]);
+			XMVECTOR row1 = XMVectorReplicate(triangle.EdgeB[1] * centerY + triangle.EdgeC[1]);
+			XMVECTOR row2 = XMVectorReplicate(triangle.EdgeB[2] * centerY + triangle.EdgeC[2]);
+			XMVECTOR rowDepth = XMVectorReplicate(triangle.DepthB * centerY + triangle.DepthC);
+			float* depthRow = &depth_[y * Width];
+
+			for (int x = minX; x <= triangle.MaxX; x += 4) {
+				XMVECTOR centerX = XMVectorAdd(XMVectorReplicate(static_cast<float>(x)), pixelOffsets);
+
+				XMVECTOR inside = XMVectorGreaterOrEqual(XMVectorMultiplyAdd(edgeA0, centerX, row0), zero);
+				inside = XMVectorAndInt(inside, XMVectorGreaterOrEqual(XMVectorMultiplyAdd(edgeA1, centerX, row1), zero));
+				inside = XMVectorAndInt(inside, XMVectorGreaterOrEqual(XMVectorMultiplyAdd(edgeA2, centerX, row2), zero));
+
+				XMVECTOR depth = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(depthRow + x));
+				XMVECTOR triangleDepth = XMVectorMultiplyAdd(depthA, centerX, rowDepth);
+				depth = XMVectorSelect(depth, XMVectorMin(depth, triangleDepth), inside);
+				XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(depthRow + x), depth);
+			}
+		}
+	}
+
+	// Farthest depth per tile.
+	for (int tileY = bandMinY / TileSize; tileY <= bandMaxY / TileSize; ++tileY) {
+		for (int tileX = 0; tileX < TilesX; ++tileX) {
+			XMVECTOR maxDepth = zero;
+			for (int y = tileY * TileSize; y < (tileY + 1) * TileSize; ++y) {
+				const float* depthRow = &depth_[y * Width + tileX * TileSize];
+				for (int x = 0; x < TileSize; x += 4) {
+					maxDepth = XMVectorMax(maxDepth, XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(depthRow + x)));
+				}
+			}
+			maxDepth = XMVectorMax(maxDepth, XMVectorSwizzle<2, 3, 0, 1>(maxDepth));
+			maxDepth = XMVectorMax(maxDepth, XMVectorSwizzle<1, 0, 3, 2>(maxDepth));
+			tileMaxDepth_[tileY * TilesX + tileX] = XMVectorGetX(maxDepth);
+		}
+	}
+}
+
+bool OcclusionCuller::IsVisible(const OcclusionBounds& bounds, const DirectX::XMFLOAT4X4& world)
+{
+	using namespace DirectX;
+
+	++statistics_.Tested;
+
+	XMMATRIX worldViewProjection = XMLoadFloat4x4(&world) * XMLoadFloat4x4(&viewProjection_);
+	XMVECTOR center = XMLoadFloat3(&bounds.Center);
+	XMVECTOR extents = XMLoadFloat3(&bounds.Extents);
+
+	float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+	float minDepth = FLT_MAX;
+	int cornersBehind = 0;
+	for (int corner = 0; corner < 8; ++corner) {
+		XMVECTOR sign = XMVectorSet(corner & 1 ? 1.0f : -1.0f, corner & 2 ? 1.0f : -1.0f, corner & 4 ? 1.0f : -1.0f, 0.0f);
+		XMVECTOR position = XMVectorSetW(XMVectorMultiplyAdd(sign, extents, center), 1.0f);
+
+		XMFLOAT4 clip;
+		XMStoreFloat4(&clip, XMVector4Transform(position, worldViewProjection));
+		if (clip.w < MinClipW) {
+			++cornersBehind;
+			continue;
+		}
+
+		XMFLOAT3 screen = ToScreen(clip);
+		minX = std::min(minX, screen.x);
+		maxX = std::max(maxX, screen.x);
+		minY = std::min(minY, screen.y);
+		maxY = std::max(maxY, screen.y);
+		minDepth = std::min(minDepth, screen.z);
+	}
+
+	// Straddling the near plane leaves the screen bounds unknown.
+	if (cornersBehind > 0) {
+		if (cornersBehind < 8) {
+			return true;
+		}
+		++statistics_.OutsideFrustum;
+		return false;
+	}
+
+	if (maxX < 0.0f || maxY < 0.0f || minX >= Width || minY >= Height || minDepth > 1.0f) {
+		++statistics_.OutsideFrustum;
+		return false;
+	}
+
+	int pixelMinX = std::max(static_cast<int>(minX), 0);
+	int pixelMaxX = std::min(static_cast<int>(maxX), Width - 1);
+	int pixelMinY = std::max(static_cast<int>(minY), 0);
+	int pixelMaxY = std::min(static_cast<int>(maxY), Height - 1);
+	float occludeeDepth = minDepth - DepthEpsilon;
+
+	// Tiles entirely in front of the occludee settle it at once. Others, such
+	// as tiles on an occluder silhouette, are checked pixel by pixel.
+	for (int tileY = pixelMinY / TileSize; tileY <= pixelMaxY / TileSize; ++tileY) {
+		for (int tileX = pixelMinX / TileSize; tileX <= pixelMaxX / TileSize; ++tileX) {
+			if (occludeeDepth > tileMaxDepth_[tileY * TilesX + tileX]) {
+				continue;
+			}
+
+			int x0 = std::max(pixelMinX, tileX * TileSize);
+			int x1 = std::min(pixelMaxX, tileX * TileSize + TileSize - 1);
+			int y0 = std::max(pixelMinY, tileY * TileSize);
+			int y1 = std::min(pixelMaxY, tileY * TileSize + TileSize - 1);
+			for (int y = y0; y <= y1; ++y) {
+				const float* depthRow = &depth_[y * Width];
+				for (int x = x0; x <= x1; ++x) {
+					if (occludeeDepth <= depthRow[x]) {
+						return true;
+					}
+				}
+			}
+		}
+	}
+
+	++statistics_.Occluded;
+	return false;
+}
+
+void OcclusionCuller::Cull(std::span<const DrawItem> items, const OcclusionBounds& bounds, std::pmr::vector<std::uint32_t>& visible)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	for (std::size_t i = 0; i < items.size(); ++i) {
+		if (IsVisible(bounds, items[i].World)) {
+			visible.push_back(static_cast<std::uint32_t>(i));
+		}
+	}
+
+	statistics_.TestMilliseconds += Milliseconds(std::chrono::steady_clock::now() - start);
+}
@@ -0,0 +1,643 @@
+module;
+// C
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <tmmintrin.h>
+
+export module resource.png;
+
+import <algorithm>;
+import <array>;
+import <filesystem>;
+import <fstream>;
+import <span>;
+import <vector>;
+
+import diagnostics.log;
+
+// An 8-bit RGBA image.
+export struct PngImage
+{
+	int Width = 0;
+	int Height = 0;
+	std::vector<std::uint8_t> Rgba;
+};
+
+// Converts RGBA8 pixels to packed RGB8. bgra swaps red and blue on the way.
+export void ConvertRgbaToRgb(const std::uint8_t* rgba, std::uint8_t* rgb, std::size_t pixels, bool bgra);
+
+// Writes an RGB8 image as a PNG with stored, uncompressed deflate blocks, so
+// no compression library is needed and writing costs little more than I/O.
+export bool WritePng(const std::filesystem::path& path, const std::uint8_t* rgb, int width, int height);
+
+// Reads a non-interlaced 8-bit grey, grey and alpha, RGB or RGBA PNG as RGBA.
+// Any deflate stream is accepted, so images recompressed by other tools
+// still load; stored blocks as WritePng() writes them are copied as they are.
+export bool ReadPng(const std::filesystem::path& path, PngImage& image);
+
+module :private;
+
+namespace
+{
+	std::array<std::uint32_t, 256> MakeCrcTable()
+	{
+		std::array<std::uint32_t, 256> table;
+		for (std::uint32_t i = 0; i < 256; ++i) {
+			std::uint32_t crc = i;
+			for (int bit = 0; bit < 8; ++bit) {
+				crc = crc & 1 ? 0xEDB88320u ^ (crc >> 1) : crc >> 1;
+			}
+			table[i] = crc;
+		}
+		return table;
+	}
+
+	std::uint32_t Crc32(std::uint32_t crc, const std::uint8_t* data, std::size_t size)
+	{
+		static const std::array<std::uint32_t, 256> table = MakeCrcTable();
+		crc = ~crc;
+		for (std::size_t i = 0; i < size; ++i) {
+			crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+		}
+		return ~crc;
+	}
+
+	void AppendBigEndian(std::vector<std::uint8_t>& bytes, std::uint32_t value)
+	{
+		bytes.push_back(static_cast<std::uint8_t>(value >> 24));
+		bytes.push_back(static_cast<std::uint8_t>(value >> 16));
+		bytes.push_back(static_cast<std::uint8_t>(value >> 8));
+		bytes.push_back(static_cast<std::uint8_t>(value));
+	}
+
+	std::uint32_t ReadBigEndian(const std::uint8_t* bytes)
+	{
+		return (std::uint32_t(bytes[0]) << 24) | (std::uint32_t(bytes[1]) << 16) | (std::uint32_t(bytes[2]) << 8) | bytes[3];
+	}
+
+	void WriteChunk(std::ofstream& file, const char type[4], const std::vector<std::uint8_t>& data)
+	{
+		std::vector<std::uint8_t> length;
+		AppendBigEndian(length, static_cast<std::uint32_t>(data.size()));
+		std::uint32_t crc = Crc32(Crc32(0, reinterpret_cast<const std::uint8_t*>(type), 4), data.data(), data.size());
+		std::vector<std::uint8_t> checksum;
+		AppendBigEndian(checksum, crc);
+
+		file.write(reinterpret_cast<const char*>(length.data()), length.size());
+		file.write(type, 4);
+		file.write(reinterpret_cast<const char*>(data.data()), data.size());
+		file.write(reinterpret_cast<const char*>(checksum.data()), checksum.size());
+	}
+
+	// Canonical Huffman code as deflate describes it: the number of codes of
+	// every length and the symbols ordered by code.
+	struct HuffmanCode
+	{
+		std::array<std::uint16_t, 16> Counts{};
+		std::array<std::uint16_t, 288> Symbols{};
+	};
+
+	// Fails on over-subscribed codes. Incomplete ones are allowed, as for a
+	// distance code with a single symbol.
+	bool BuildHuffmanCode(HuffmanCode& code, const std::uint8_t* lengths, int count)
+	{
+		code.Counts.fill(0);
+		for (int symbol = 0; symbol < count; ++symbol) {
+			++code.Counts[lengths[symbol]];
+		}
+
+		int left = 1;
+		for (int length = 1; length < 16; ++length) {
+			left = left * 2 - code.Counts[length];
+			if (left < 0) {
+				return false;
+			}
+		}
+
+		std::array<std::uint16_t, 16> offsets{};
+		for (int length = 1; length < 15; ++length) {
+			offsets[length + 1] = offsets[length] + code.Counts[length];
+		}
+		for (int symbol = 0; symbol < count; ++symbol) {
+			if (lengths[symbol] != 0) {
+				code.Symbols[offsets[lengths[symbol]]++] = static_cast<std::uint16_t>(symbol);
+			}
+		}
+		return true;
+	}
+
+	class Inflater
+	{
+	public:
+		Inflater(std::span<const std::uint8_t> input, std::vector<std::uint8_t>& output, std::size_t maxOutput)
+			: input_(input), output_(output), maxOutput_(maxOutput)
+		{
+		}
+
+		// Inflates a raw deflate stream, stopping after its final block.
+		bool Run();
+
+	private:
+		// -1 past the end of the input.
+		int Bits(int count);
+		int Decode(const HuffmanCode& code);
+		bool Stored();
+		bool Codes(const HuffmanCode& lengths, const HuffmanCode& distances);
+		bool Dynamic();
+
+		std::span<const std::uint8_t> input_;
+		std::size_t position_ = 0;
+		std::uint32_t bitBuffer_ = 0;
+		int bitCount_ = 0;
+
+		std::vector<std::uint8_t>& output_;
+		std::size_t maxOutput_;
+	};
+
+	int Inflater::Bits(int count)
+	{
+		while (bitCount_ < count) {
+			if (position_ == input_.size()) {
+				return -1;
+			}
+			bitBuffer_ |= std::uint32_t(input_[position_++]) << bitCount_;
+			bitCount_ += 8;
+		}
+		int value = static_cast<int>(bitBuffer_ & ((1u << count) - 1));
+		bitBuffer_ >>= count;
+		bitCount_ -= count;
+		return value;
+	}
+
+	int Inflater::Decode(const HuffmanCode& code)
+	{
+		// Codes are packed starting with their most significant bit, so they
+		// are read one bit at a time.
+		int value = 0;
+		int first = 0;
+		int index = 0;
+		for (int length = 1; length < 16; ++length) {
+			int bit = Bits(1);
+			if (bit < 0) {
+				return -1;
+			}
+			value |= bit;
+			int count = code.Counts[length];
+			if (value - first < count) {
+				return code.Symbols[index + value - first];
+			}
+			index += count;
+			first = (first + count) << 1;
+			value <<= 1;
+		}
+		return -1;
+	}
+
+	bool Inflater::Stored()
+	{
+		bitBuffer_ = 0;
+		bitCount_ = 0;
+		if (position_ + 4 > input_.size()) {
+			return false;
+		}
+
+		std::size_t length = input_[position_] | (input_[position_ + 1] << 8);
+		std::size_t complement = input_[position_ + 2] | (input_[position_ + 3] << 8);
+		position_ += 4;
+		if (length != (~complement & 0xFFFF) || position_ + length > input_.size() || output_.size() + length > maxOutput_) {
+			return false;
+		}
+
+		output_.insert(output_.end(), input_.begin() + position_, input_.begin() + position_ + length);
+		position_ += length;
+		return true;
+	}
+
+	bool Inflater::Codes(const HuffmanCode& lengths, const HuffmanCode& distances)
+	{
+		static constexpr std::array<std::uint16_t, 29> LengthBase = {
+			3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+		static constexpr std::array<std::uint8_t, 29> LengthExtra = {
+			0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+		static constexpr std::array<std::uint16_t, 30> DistanceBase = {
+			1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+		static constexpr std::array<std::uint8_t, 30> DistanceExtra = {
+			0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+		for (;;) {
+			int symbol = Decode(lengths);
+			if (symbol < 0) {
+				return false;
+			}
+			if (symbol < 256) {
+				if (output_.size() == maxOutput_) {
+					return false;
+				}
+				output_.push_back(static_cast<std::uint8_t>(symbol));
+				continue;
+			}
+			if (symbol == 256) {
+				return true;
+			}
+
+			symbol -= 257;
+			if (symbol >= static_cast<int>(LengthBase.size())) {
+				return false;
+			}
+			int lengthExtra = Bits(LengthExtra[symbol]);
+			int distanceSymbol = Decode(distances);
+			if (lengthExtra < 0 || distanceSymbol < 0 || distanceSymbol >= static_cast<int>(DistanceBase.size())) {
+				return false;
+			}
+			int distanceExtra = Bits(DistanceExtra[distanceSymbol]);
+			if (distanceExtra < 0) {
+				return false;
+			}
+
+			std::size_t length = LengthBase[symbol] + lengthExtra;
+			std::size_t distance = DistanceBase[distanceSymbol] + distanceExtra;
+			if (distance > output_.size() || output_.size() + length > maxOutput_) {
+				return false;
+			}
+			// The source may overlap what is being copied, byte by byte.
+			std::size_t source = output_.size() - distance;
+			for (std::size_t i = 0; i < length; ++i) {
+				output_.push_back(output_[source + i]);
+			}
+		}
+	}
+
+	bool Inflater::Dynamic()
+	{
+		static constexpr std::array<std::uint8_t, 19> Order = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+		int lengthCount = Bits(5);
+		int distanceCount = Bits(5);
+		int codeCount = Bits(4);
+		if (lengthCount < 0 || distanceCount < 0 || codeCount < 0) {
+			return false;
+		}
+		lengthCount += 257;
+		distanceCount += 1;
+		codeCount += 4;
+		if (lengthCount > 286 || distanceCount > 30) {
+			return false;
+		}
+
+		std::array<std::uint8_t, 320> lengths{};
+		for (int i = 0; i < codeCount; ++i) {
+			int length = Bits(3);
+			if (length < 0) {
+				return false;
+			}
+			lengths[Order[i]] = static_cast<std::uint8_t>(length);
+		}
+
+		HuffmanCode lengthCode;
+		if (!BuildHuffmanCode(lengthCode, lengths.data(), 19)) {
+			return false;
+		}
+
+		// Both codes' lengths come as one run-length coded sequence.
+		lengths.fill(0);
+		for (int i = 0; i < lengthCount + distanceCount; ) {
+			int symbol = Decode(lengthCode);
+			if (symbol < 0) {
+				return false;
+			}
+			if (symbol < 16) {
+				lengths[i++] = static_cast<std::uint8_t>(symbol);
+				continue;
+			}
+
+			// 16 repeats the previous length, 17 and 18 repeat zeroes.
+			if (symbol == 16 && i == 0) {
+				return false;
+			}
+			std::uint8_t repeated = symbol == 16 ? lengths[i - 1] : 0;
+			int extra = Bits(symbol == 16 ? 2 : symbol == 17 ? 3 : 7);
+			int repeat = (symbol == 18 ? 11 : 3) + extra;
+			if (extra < 0 || i + repeat > lengthCount + distanceCount) {
+				return false;
+			}
+			while (repeat-- > 0) {
+				lengths[i++] = repeated;
+			}
+		}
+
+		HuffmanCode literals;
+		HuffmanCode distances;
+		if (lengths[256] == 0 ||
+			!BuildHuffmanCode(literals, lengths.data(), lengthCount) ||
+			!BuildHuffmanCode(distances, lengths.data() + lengthCount, distanceCount)) {
+			return false;
+		}
+		return Codes(literals, distances);
+	}
+
+	bool Inflater::Run()
+	{
+		static const auto fixed = [] {
+			std::array<std::uint8_t, 320> lengths{};
+			std::fill(lengths.begin(), lengths.begin() + 144, 8);
+			std::fill(lengths.begin() + 144, lengths.begin() + 256, 9);
+			std::fill(lengths.begin() + 256, lengths.begin() + 280, 7);
+			std::fill(lengths.begin() + 280, lengths.begin() + 288, 8);
+			std::fill(lengths.begin() + 288, lengths.end(), 5);
+
+			std::array<HuffmanCode, 2> codes;
+			BuildHuffmanCode(codes[0], lengths.data(), 288);
+			BuildHuffmanCode(codes[1], lengths.data() + 288, 30);
+			return codes;
+		}();
+
+		for (;;) {
+			int last = Bits(1);
+			int type = Bits(2);
+			bool valid = false;
+			if (type == 0) {
+				valid = Stored();
+			}
+			else if (type == 1) {
+				valid = Codes(fixed[0], fixed[1]);
+			}
+			else if (type == 2) {
+				valid = Dynamic();
+			}
+
+			if (last < 0 || !valid) {
+				return false;
+			}
+			if (last == 1) {
+				return true;
+			}
+		}
+	}
+
+	// The reverse of ConvertRgbaToRgb() with opaque alpha, sixteen pixels at
+	// a time.
+	void ConvertRgbToRgba(const std::uint8_t* rgb, std::uint8_t* rgba, std::size_t pixels)
+	{
+		__m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+		__m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000));
+
+		std::size_t i = 0;
+		for (; i + 16 <= pixels; i += 16) {
+			const __m128i* source = reinterpret_cast<const __m128i*>(rgb + i * 3);
+			__m128i a = _mm_loadu_si128(source + 0);
+			__m128i b = _mm_loadu_si128(source + 1);
+			__m128i c = _mm_loadu_si128(source + 2);
+
+			__m128i* target = reinterpret_cast<__m128i*>(rgba + i * 4);
+			_mm_storeu_si128(target + 0, _mm_or_si128(_mm_shuffle_epi8(a, shuffle), alpha));
+			_mm_storeu_si128(target + 1, _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(b, a, 12), shuffle), alpha));
+			_mm_storeu_si128(target + 2, _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(c, b, 8), shuffle), alpha));
+			_mm_storeu_si128(target + 3, _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(c, 4), shuffle), alpha));
+		}
+
+		for (; i < pixels; ++i) {
+			rgba[i * 4 + 0] = rgb[i * 3 + 0];
+			rgba[i * 4 + 1] = rgb[i * 3 + 1];
+			rgba[i * 4 + 2] = rgb[i * 3 + 2];
+			rgba[i * 4 + 3] = 255;
+		}
+	}
+
+	int PaethPredictor(int left, int above, int aboveLeft)
+	{
+		int estimate = left + above - aboveLeft;
+		int toLeft = std::abs(estimate - left);
+		int toAbove = std::abs(estimate - above);
+		int toAboveLeft = std::abs(estimate - aboveLeft);
+		if (toLeft <= toAbove && toLeft <= toAboveLeft) {
+			return left;
+		}
+		return toAbove <= toAboveLeft ? above : aboveLeft;
+	}
+
+	// Reverses the filter of one row in place. previous is null for the
+	// first row.
+	bool Unfilter(int filter, std::uint8_t* row, const std::uint8_t* previous, std::size_t size, std::size_t pixelSize)
+	{
+		if (filter == 0) {
+			return true;
+		}
+		if (filter > 4) {
+			return false;
+		}
+
+		for (std::size_t i = 0; i < size; ++i) {
+			int left = i >= pixelSize ? row[i - pixelSize] : 0;
+			int above = previous ? previous[i] : 0;
+			int aboveLeft = previous && i >= pixelSize ? previous[i - pixelSize] : 0;
+			switch (filter) {
+			case 1: row[i] = static_cast<std::uint8_t>(row[i] + left); break;
+			case 2: row[i] = static_cast<std::uint8_t>(row[i] + above); break;
+			case 3: row[i] = static_cast<std::uint8_t>(row[i] + (left + above) / 2); break;
+			default: row[i] = static_cast<std::uint8_t>(row[i] + PaethPredictor(left, above, aboveLeft)); break;
+			}
+		}
+		return true;
+	}
+}
+
+void ConvertRgbaToRgb(const std::uint8_t* rgba, std::uint8_t* rgb, std::size_t pixels, bool bgra)
+{
+	// Sixteen pixels at a time: each load of four pixels drops its alpha
+	// bytes, and the three 12-byte results are stitched into 48 bytes.
+	__m128i shuffle = bgra
+		? _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1)
+		: _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+	std::size_t i = 0;
+	for (; i + 16 <= pixels; i += 16) {
+		const __m128i* source = reinterpret_cast<const __m128i*>(rgba + i * 4);
+		__m128i a = _mm_shuffle_epi8(_mm_loadu_si128(source + 0), shuffle);
+		__m128i b = _mm_shuffle_epi8(_mm_loadu_si128(source + 1), shuffle);
+		__m128i c = _mm_shuffle_epi8(_mm_loadu_si128(source + 2), shuffle);
+		__m128i d = _mm_shuffle_epi8(_mm_loadu_si128(source + 3), shuffle);
+
+		__m128i* target = reinterpret_cast<__m128i*>(rgb + i * 3);
+		_mm_storeu_si128(target + 0, _mm_or_si128(a, _mm_slli_si128(b, 12)));
+		_mm_storeu_si128(target + 1, _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+		_mm_storeu_si128(target + 2, _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+	}
+
+	for (; i < pixels; ++i) {
+		rgb[i * 3 + 0] = rgba[i * 4 + (bgra ? 2 : 0)];
+		rgb[i * 3 + 1] = rgba[i * 4 + 1];
+		rgb[i * 3 + 2] = rgba[i * 4 + (bgra ? 0 : 2)];
+	}
+}
+
+bool WritePng(const std::filesystem::path& path, const std::uint8_t* rgb, int width, int height)
+{
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file) {
+		LogError(LogCategory::Resource, "Failed to open image {}", path.string());
+		return false;
+	}
+
+	static const std::uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+	// 8-bit RGB, no interlacing.
+	std::vector<std::uint8_t> header;
+	AppendBigEndian(header, static_cast<std::uint32_t>(width));
+	AppendBigEndian(header, static_cast<std::uint32_t>(height));
+	header.insert(header.end(), { 8, 2, 0, 0, 0 });
+	WriteChunk(file, "IHDR", header);
+
+	// Every row is prefixed with filter type 0. The zlib stream is a header,
+	// stored blocks of at most 65535 bytes and the Adler-32 of the rows.
+	std::size_t rowSize = static_cast<std::size_t>(width) * 3;
+	std::size_t rawSize = (rowSize + 1) * height;
+	std::vector<std::uint8_t> data;
+	data.reserve(rawSize + rawSize / 65535 * 5 + 16);
+	data.push_back(0x78);
+	data.push_back(0x01);
+
+	std::uint32_t adlerA = 1;
+	std::uint32_t adlerB = 0;
+	std::size_t blockRemaining = 0;
+	std::size_t rawRemaining = rawSize;
+	auto emit = [&](const std::uint8_t* bytes, std::size_t size) {
+		while (size > 0) {
+			if (blockRemaining == 0) {
+				blockRemaining = std::min<std::size_t>(rawRemaining, 65535);
+				rawRemaining -= blockRemaining;
+				std::uint16_t length = static_cast<std::uint16_t>(blockRemaining);
+				data.push_back(rawRemaining == 0 ? 1 : 0);
+				data.push_back(static_cast<std::uint8_t>(length));
+				data.push_back(static_cast<std::uint8_t>(length >> 8));
+				data.push_back(static_cast<std::uint8_t>(~length));
+				data.push_back(static_cast<std::uint8_t>(~length >> 8));
+			}
+			std::size_t count = std::min(size, blockRemaining);
+			data.insert(data.end(), bytes, bytes + count);
+			// 5552 bytes is the most that can be summed before the modulo
+			// without overflowing.
+			for (std::size_t start = 0; start < count; start += 5552) {
+				std::size_t end = std::min(count, start + 5552);
+				for (std::size_t i = start; i < end; ++i) {
+					adlerA += bytes[i];
+					adlerB += adlerA;
+				}
+				adlerA %= 65521;
+				adlerB %= 65521;
+			}
+			bytes += count;
+			size -= count;
+			blockRemaining -= count;
+		}
+	};
+
+	const std::uint8_t filter = 0;
+	for (int row = 0; row < height; ++row) {
+		emit(&filter, 1);
+		emit(rgb + row * rowSize, rowSize);
+	}
+	AppendBigEndian(data, (adlerB << 16) | adlerA);
+	WriteChunk(file, "IDAT", data);
+	WriteChunk(file, "IEND", {});
+	return file.good();
+}
+
+bool ReadPng(const std::filesystem::path& path, PngImage& image)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file) {
+		LogError(LogCategory::Resource, "Failed to open image {}", path.string());
+		return false;
+	}
+	std::vector<std::uint8_t> bytes(static_cast<std::size_t>(file.tellg()));
+	file.seekg(0);
+	file.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+	std::span<const std::uint8_t> data(bytes);
+
+	static const std::uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	if (data.size() < sizeof(signature) || std::memcmp(data.data(), signature, sizeof(signature)) != 0) {
+		LogError(LogCategory::Resource, "Image {} is not a PNG", path.string());
+		return false;
+	}
+
+	// The header's fields and the concatenated IDAT chunks. Checksums are
+	// not verified: a corrupt image fails to inflate or compare anyway.
+	std::uint32_t width = 0;
+	std::uint32_t height = 0;
+	int channels = 0;
+	std::vector<std::uint8_t> compressed;
+	for (std::size_t position = sizeof(signature); position + 12 <= data.size(); ) {
+		std::uint32_t length = ReadBigEndian(data.data() + position);
+		const std::uint8_t* type = data.data() + position + 4;
+		const std::uint8_t* payload = type + 4;
+		if (length > data.size() - position - 12) {
+			break;
+		}
+
+		if (std::memcmp(type, "IHDR", 4) == 0 && length >= 13) {
+			width = ReadBigEndian(payload);
+			height = ReadBigEndian(payload + 4);
+			int bitDepth = payload[8];
+			int colorType = payload[9];
+			int interlace = payload[12];
+			channels = colorType == 0 ? 1 : colorType == 2 ? 3 : colorType == 4 ? 2 : colorType == 6 ? 4 : 0;
+			if (bitDepth != 8 || interlace != 0) {
+				channels = 0;
+			}
+		}
+		else if (std::memcmp(type, "IDAT", 4) == 0) {
+			compressed.insert(compressed.end(), payload, payload + length);
+		}
+		else if (std::memcmp(type, "IEND", 4) == 0) {
+			break;
+		}
+		position += 12 + length;
+	}
+
+	if (channels == 0 || width == 0 || height == 0 || width > 16384 || height > 16384) {
+		LogError(LogCategory::Resource, "Image {} is not an 8-bit grey, RGB or RGBA PNG", path.string());
+		return false;
+	}
+
+	// Skip the zlib header; the Adler-32 at the end is not checked either.
+	std::size_t rowSize = std::size_t(width) * channels;
+	std::size_t rawSize = (rowSize + 1) * height;
+	std::vector<std::uint8_t> raw;
+	raw.reserve(rawSize);
+	if (compressed.size() < 2 || (compressed[0] & 0x0F) != 8 ||
+		!Inflater(std::span<const std::uint8_t>(compressed).subspan(2), raw, rawSize).Run() || raw.size() != rawSize) {
+		LogError(LogCategory::Resource, "Image {} is corrupt", path.string());
+		return false;
+	}
+
+	image.Width = static_cast<int>(width);
+	image.Height = static_cast<int>(height);
+	image.Rgba.resize(std::size_t(width) * height * 4);
+	for (std::uint32_t y = 0; y < height; ++y) {
+		std::uint8_t* row = raw.data() + y * (rowSize + 1) + 1;
+		const std::uint8_t* previous = y > 0 ? row - (rowSize + 1) : nullptr;
+		if (!Unfilter(row[-1], row, previous, rowSize, channels)) {
+			LogError(LogCategory::Resource, "Image {} is corrupt", path.string());
+			return false;
+		}
+
+		std::uint8_t* pixel = image.Rgba.data() + std::size_t(y) * width * 4;
+		if (channels == 4) {
+			std::memcpy(pixel, row, rowSize);
+		}
+		else if (channels == 3) {
+			ConvertRgbToRgba(row, pixel, width);
+		}
+		else {
+			for (std::uint32_t x = 0; x < width; ++x, pixel += 4) {
+				const std::uint8_t* source = row + x * channels;
+				pixel[0] = pixel[1] = pixel[2] = source[0];
+				pixel[3] = channels == 2 ? source[1] : 255;
+			}
+		}
+	}
+	return true;
+}
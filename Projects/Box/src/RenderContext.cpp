@@ -0,0 +1,866 @@
+module;
+// C
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Windows
+#include <d3d11.h>
+#include <wrl.h>
+
+export module render.context;
+
+import <algorithm>;
+import <span>;
+import <unordered_map>;
+import <utility>;
+import <vector>;
+
+import diagnostics.log;
+import render.capture;
+import utility;
+
+// What a frame submitted through RenderContext. Calls made on Native() are
+// not counted.
+export struct RenderStatistics
+{
+	std::uint64_t DrawCalls = 0;
+	std::uint64_t Instances = 0;
+	std::uint64_t Primitives = 0;
+	// Every Set call, whether or not it changes what is bound.
+	std::uint64_t StateChanges = 0;
+	std::uint64_t ConstantBufferBytes = 0;
+	std::uint64_t BufferBytes = 0;
+	std::uint64_t Maps = 0;
+	std::uint64_t Unmaps = 0;
+	// Filled in by RenderStatisticsTracker, from the resources tracked by
+	// MemoryTracker.
+	std::uint64_t ResourcesCreated = 0;
+};
+
+// The calls Game::Render() and the demos make on the immediate context while
+// rendering a frame. They go straight to D3D11, are counted in Statistics(),
+// and most are also written to a capture between BeginCapture() and
+// EndCapture(). Anything else is made on Native() and is neither counted nor
+// captured.
+export class RenderContext
+{
+public:
+	RenderContext() = default;
+	explicit RenderContext(ID3D11DeviceContext* context);
+
+	ID3D11DeviceContext* Native() const { return context_; }
+
+	void SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology);
+	void SetInputLayout(ID3D11InputLayout* inputLayout);
+	void SetVertexShader(ID3D11VertexShader* shader);
+	void SetPixelShader(ID3D11PixelShader* shader);
+	void SetRasterizerState(ID3D11RasterizerState* state);
+	void SetDepthStencilState(ID3D11DepthStencilState* state, UINT stencilRef = 0);
+	void SetVSConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers);
+	void SetPSConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers);
+	void SetVertexBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* strides, const UINT* offsets);
+	void SetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset);
+
+	// Counted but not captured: replays draw into a target of their own and
+	// captures hold no textures.
+	void SetViewports(UINT count, const D3D11_VIEWPORT* viewports);
+	void SetRenderTargets(UINT count, ID3D11RenderTargetView* const* renderTargets, ID3D11DepthStencilView* depthStencil);
+	void SetPSShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views);
+	void SetPSSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers);
+	void ClearRenderTarget(ID3D11RenderTargetView* renderTarget, const float color[4]);
+	void ClearDepthStencil(ID3D11DepthStencilView* depthStencil, UINT flags, float depth, UINT8 stencil);
+	void CopySubresourceRegion(ID3D11Resource* destination, UINT destinationSubresource, UINT x, UINT y, UINT z,
+		ID3D11Resource* source, UINT sourceSubresource, const D3D11_BOX* sourceBox);
+
+	// Replaces the whole contents of a dynamic buffer.
+	void UpdateBuffer(ID3D11Buffer* buffer, const void* data, std::size_t size);
+	// Writes part of a dynamic buffer. With discard the rest of the buffer is
+	// lost. Without, it is kept and may still be in use by the GPU, so only
+	// parts not written since the last discard may be written.
+	void WriteBuffer(ID3D11Buffer* buffer, std::size_t offset, const void* data, std::size_t size, bool discard);
+
+	void Draw(UINT vertexCount, UINT startVertex);
+	void DrawIndexed(UINT indexCount, UINT startIndex, INT baseVertex);
+
+	// Counts since the last TakeStatistics(), which starts over.
+	const RenderStatistics& Statistics() const { return statistics_; }
+	RenderStatistics TakeStatistics() { return std::exchange(statistics_, {}); }
+
+	// Objects are written to the capture when they are first used, buffers
+	// with their contents at that point.
+	void BeginCapture(CaptureWriter& capture);
+	void EndCapture();
+	bool IsCapturing() const { return capture_ != nullptr; }
+
+	// D3D11 keeps no bytecode with shaders and input layouts. Attaching it
+	// lets captures recreate them.
+	static void AttachBytecode(ID3D11DeviceChild* shader, ID3DBlob* bytecode);
+	static void AttachInputLayout(ID3D11InputLayout* inputLayout, std::span<const D3D11_INPUT_ELEMENT_DESC> elements, ID3DBlob* vertexShader);
+
+private:
+	CaptureObject Capture(ID3D11DeviceChild* object, CaptureObjectKind kind);
+	void CaptureObjectCommand(CaptureCommand command, ID3D11DeviceChild* object, CaptureObjectKind kind);
+	void CaptureConstantBuffers(CaptureShaderStage stage, UINT startSlot, UINT count, ID3D11Buffer* const* buffers);
+
+private:
+	ID3D11DeviceContext* context_ = nullptr;
+
+	RenderStatistics statistics_;
+	D3D11_PRIMITIVE_TOPOLOGY topology_ = D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED;
+
+	CaptureWriter* capture_ = nullptr;
+	std::unordered_map<ID3D11DeviceChild*, CaptureObject> capturedObjects_;
+	std::vector<std::byte> payload_;
+};
+
+// Replays captures on a D3D11 device of its own, into a render target of
+// the captured size. EndFrame() waits for the GPU.
+export class D3D11CaptureTarget : public CaptureTarget
+{
+public:
+	explicit D3D11CaptureTarget(D3D_DRIVER_TYPE driverType);
+
+	bool Load(const CaptureFile& capture) override;
+	void BeginFrame() override;
+	void Execute(CaptureCommand command, std::span<const std::byte> payload) override;
+	void EndFrame() override;
+
+	// Copies the render target to rgba, RGBA8 and width * 4 bytes per row.
+	// Waits for the GPU.
+	bool ReadPixels(std::vector<std::uint8_t>& rgba);
+
+private:
+	template <typename T>
+	T* Get(std::span<const std::byte> payload, std::size_t offset = 0) const;
+
+private:
+	D3D_DRIVER_TYPE driverType_;
+	Microsoft::WRL::ComPtr<ID3D11Device> device_;
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext> context_;
+	Microsoft::WRL::ComPtr<ID3D11RenderTargetView> renderTarget_;
+	Microsoft::WRL::ComPtr<ID3D11DepthStencilView> depthStencil_;
+	Microsoft::WRL::ComPtr<ID3D11Query> frameDone_;
+	D3D11_VIEWPORT viewport_{};
+
+	// Indexed by object id - 1. Null where the object could not be made.
+	std::vector<Microsoft::WRL::ComPtr<ID3D11DeviceChild>> objects_;
+	std::vector<bool> dynamic_;
+};
+
+template <typename T>
+T* D3D11CaptureTarget::Get(std::span<const std::byte> payload, std::size_t offset) const
+{
+	CaptureObject id = ReadCapture<CaptureObject>(payload, offset);
+	if (id == NullCaptureObject || id > objects_.size()) {
+		return nullptr;
+	}
+	return static_cast<T*>(objects_[id - 1].Get());
+}
+
+module :private;
+
+namespace
+{
+	// {6D628BEF-B797-4F1E-A6F4-0A3317876A50}
+	constexpr GUID CaptureBytecodeGuid = { 0x6d628bef, 0xb797, 0x4f1e, { 0xa6, 0xf4, 0x0a, 0x33, 0x17, 0x87, 0x6a, 0x50 } };
+
+	template <typename T>
+	void AppendPod(std::vector<std::byte>& bytes, const T& value)
+	{
+		const std::byte* begin = reinterpret_cast<const std::byte*>(&value);
+		bytes.insert(bytes.end(), begin, begin + sizeof(T));
+	}
+
+	std::vector<std::byte> PrivateBytecode(ID3D11DeviceChild* object)
+	{
+		UINT size = 0;
+		if (object->GetPrivateData(CaptureBytecodeGuid, &size, nullptr) != S_OK || size == 0) {
+			return {};
+		}
+		std::vector<std::byte> bytecode(size);
+		object->GetPrivateData(CaptureBytecodeGuid, &size, bytecode.data());
+		return bytecode;
+	}
+
+	// Copies a buffer's contents through a staging buffer. Only done for the
+	// first use of a buffer in a capture, so the stall does not matter.
+	std::vector<std::byte> ReadBuffer(ID3D11DeviceContext* context, ID3D11Buffer* buffer, const D3D11_BUFFER_DESC& desc)
+	{
+		Microsoft::WRL::ComPtr<ID3D11Device> device;
+		context->GetDevice(device.GetAddressOf());
+
+		D3D11_BUFFER_DESC stagingDesc;
+		ZeroMemory(&stagingDesc, sizeof(stagingDesc));
+		stagingDesc.ByteWidth = desc.ByteWidth;
+		stagingDesc.Usage = D3D11_USAGE_STAGING;
+		stagingDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+
+		Microsoft::WRL::ComPtr<ID3D11Buffer> staging;
+		ThrowIfFailed(device->CreateBuffer(&stagingDesc, nullptr, staging.GetAddressOf()));
+		context->CopyResource(staging.Get(), buffer);
+
+		std::vector<std::byte> contents(desc.ByteWidth);
+		D3D11_MAPPED_SUBRESOURCE mappedResource;
+		ThrowIfFailed(context->Map(staging.Get(), 0, D3D11_MAP_READ, 0, &mappedResource));
+		std::memcpy(contents.data(), mappedResource.pData, contents.size());
+		context->Unmap(staging.Get(), 0);
+		return contents;
+	}
+
+	std::uint64_t PrimitiveCount(D3D11_PRIMITIVE_TOPOLOGY topology, UINT vertexCount)
+	{
+		switch (topology) {
+		case D3D11_PRIMITIVE_TOPOLOGY_POINTLIST:
+			return vertexCount;
+		case D3D11_PRIMITIVE_TOPOLOGY_LINELIST:
+			return vertexCount / 2;
+		case D3D11_PRIMITIVE_TOPOLOGY_LINESTRIP:
+			return vertexCount > 1 ? vertexCount - 1 : 0;
+		case D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST:
+			return vertexCount / 3;
+		case D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP:
+			return vertexCount > 2 ? vertexCount - 2 : 0;
+		default:
+			return 0;
+		}
+	}
+}
+
+RenderContext::RenderContext(ID3D11DeviceContext* context)
+	: context_(context)
+{
+}
+
+void RenderContext::SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology)
+{
+	context_->IASetPrimitiveTopology(topology);
+	topology_ = topology;
+	++statistics_.StateChanges;
+	if (capture_) {
+		capture_->BeginCommand(CaptureCommand::SetPrimitiveTopology);
+		capture_->Write(static_cast<std::uint32_t>(topology));
+		capture_->EndCommand();
+	}
+}
+
+void RenderContext::SetInputLayout(ID3D11InputLayout* inputLayout)
+{
+	context_->IASetInputLayout(inputLayout);
+	++statistics_.StateChanges;
+	CaptureObjectCommand(CaptureCommand::SetInputLayout, inputLayout, CaptureObjectKind::InputLayout);
+}
+
+void RenderContext::SetVertexShader(ID3D11VertexShader* shader)
+{
+	context_->VSSetShader(shader, nullptr, 0);
+	++statistics_.StateChanges;
+	CaptureObjectCommand(CaptureCommand::SetVertexShader, shader, CaptureObjectKind::VertexShader);
+}
+
+void RenderContext::SetPixelShader(ID3D11PixelShader* shader)
+{
+	context_->PSSetShader(shader, nullptr, 0);
+	++statistics_.StateChanges;
+	CaptureObjectCommand(CaptureCommand::SetPixelShader, shader, CaptureObjectKind::PixelShader);
+}
+
+void RenderContext::SetRasterizerState(ID3D11RasterizerState* state)
+{
+	context_->RSSetState(state);
+	++statistics_.StateChanges;
+	CaptureObjectCommand(CaptureCommand::SetRasterizerState, state, CaptureObjectKind::RasterizerState);
+}
+
+void RenderContext::SetDepthStencilState(ID3D11DepthStencilState* state, UINT stencilRef)
+{
+	context_->OMSetDepthStencilState(state, stencilRef);
+	++statistics_.StateChanges;
+	if (capture_) {
+		CaptureObject object = Capture(state, CaptureObjectKind::DepthStencilState);
+		capture_->BeginCommand(CaptureCommand::SetDepthStencilState);
+		capture_->Write(object);
+		capture_->Write(static_cast<std::uint32_t>(stencilRef));
+		capture_->EndCommand();
+	}
+}
+
+void RenderContext::SetVSConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers)
+{
+	context_->VSSetConstantBuffers(startSlot, count, buffers);
+	++statistics_.StateChanges;
+	CaptureConstantBuffers(CaptureShaderStage::Vertex, startSlot, count, buffers);
+}
+
+void RenderContext::SetPSConstantBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers)
+{
+	context_->PSSetConstantBuffers(startSlot, count, buffers);
+	++statistics_.StateChanges;
+	CaptureConstantBuffers(CaptureShaderStage::Pixel, startSlot, count, buffers);
+}
+
+void RenderContext::SetVertexBuffers(UINT startSlot, UINT count, ID3D11Buffer* const* buffers, const UINT* strides, const UINT* offsets)
+{
+	context_->IASetVertexBuffers(startSlot, count, buffers, strides, offsets);
+	++statistics_.StateChanges;
+	if (capture_) {
+		payload_.clear();
+		for (UINT i = 0; i < count; ++i) {
+			AppendPod(payload_, CaptureVertexBuffer{ Capture(buffers[i], CaptureObjectKind::Buffer), strides[i], offsets[i] });
+		}
+		capture_->BeginCommand(CaptureCommand::SetVertexBuffers);
+		capture_->Write(static_cast<std::uint32_t>(startSlot));
+		capture_->Write(static_cast<std::uint32_t>(count));
+		capture_->Write(payload_.data(), payload_.size());
+		capture_->EndCommand();
+	}
+}
+
+void RenderContext::SetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset)
+{
+	context_->IASetIndexBuffer(buffer, format, offset);
+	++statistics_.StateChanges;
+	if (capture_) {
+		CaptureObject object = Capture(buffer, CaptureObjectKind::Buffer);
+		capture_->BeginCommand(CaptureCommand::SetIndexBuffer);
+		capture_->Write(object);
+		capture_->Write(static_cast<std::uint32_t>(format));
+		capture_->Write(static_cast<std::uint32_t>(offset));
+		capture_->EndCommand();
+	}
+}
+
+void RenderContext::SetViewports(UINT count, const D3D11_VIEWPORT* viewports)
+{
+	context_->RSSetViewports(count, viewports);
+	++statistics_.StateChanges;
+}
+
+void RenderContext::SetRenderTargets(UINT count, ID3D11RenderTargetView* const* renderTargets, ID3D11DepthStencilView* depthStencil)
+{
+	context_->OMSetRenderTargets(count, renderTargets, depthStencil);
+	++statistics_.StateChanges;
+}
+
+void RenderContext::SetPSShaderResources(UINT startSlot, UINT count, ID3D11ShaderResourceView* const* views)
+{
+	context_->PSSetShaderResources(startSlot, count, views);
+	++statistics_.StateChanges;
+}
+
+void RenderContext::SetPSSamplers(UINT startSlot, UINT count, ID3D11SamplerState* const* samplers)
+{
+	context_->PSSetSamplers(startSlot, count, samplers);
+	++statistics_.StateChanges;
+}
+
+void RenderContext::ClearRenderTarget(ID3D11RenderTargetView* renderTarget, const float color[4])
+{
+	context_->ClearRenderTargetView(renderTarget, color);
+}
+
+void RenderContext::ClearDepthStencil(ID3D11DepthStencilView* depthStencil, UINT flags, float depth, UINT8 stencil)
+{
+	context_->ClearDepthStencilView(depthStencil, flags, depth, stencil);
+}
+
+void RenderContext::CopySubresourceRegion(ID3D11Resource* destination, UINT destinationSubresource, UINT x, UINT y, UINT z,
+	ID3D11Resource* source, UINT sourceSubresource, const D3D11_BOX* sourceBox)
+{
+	context_->CopySubresourceRegion(destination, destinationSubresource, x, y, z, source, sourceSubresource, sourceBox);
+}
+
+void RenderContext::UpdateBuffer(ID3D11Buffer* buffer, const void* data, std::size_t size)
+{
+	// Captured first, so a buffer's first capture holds its previous contents.
+	if (capture_) {
+		CaptureObject object = Capture(buffer, CaptureObjectKind::Buffer);
+		capture_->BeginCommand(CaptureCommand::UpdateBuffer);
+		capture_->Write(object);
+		capture_->Write(data, size);
+		capture_->EndCommand();
+	}
+
+	D3D11_MAPPED_SUBRESOURCE mappedResource;
+	ThrowIfFailed(context_->Map(buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource));
+	std::memcpy(mappedResource.pData, data, size);
+	context_->Unmap(buffer, 0);
+
+	D3D11_BUFFER_DESC desc;
+	buffer->GetDesc(&desc);
+	if (desc.BindFlags & D3D11_BIND_CONSTANT_BUFFER) {
+		statistics_.ConstantBufferBytes += size;
+	}
+	else {
+		statistics_.BufferBytes += size;
+	}
+	++statistics_.Maps;
+	++statistics_.Unmaps;
+}
+
+void RenderContext::WriteBuffer(ID3D11Buffer* buffer, std::size_t offset, const void* data, std::size_t size, bool discard)
+{
+	if (capture_) {
+		CaptureObject object = Capture(buffer, CaptureObjectKind::Buffer);
+		capture_->BeginCommand(CaptureCommand::WriteBuffer);
+		capture_->Write(object);
+		capture_->Write(static_cast<std::uint32_t>(offset));
+		capture_->Write(static_cast<std::uint32_t>(discard));
+		capture_->Write(data, size);
+		capture_->EndCommand();
+	}
+
+	D3D11_MAPPED_SUBRESOURCE mappedResource;
+	ThrowIfFailed(context_->Map(buffer, 0, discard ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE, 0, &mappedResource));
+	std::memcpy(static_cast<std::byte*>(mappedResource.pData) + offset, data, size);
+	context_->Unmap(buffer, 0);
+
+	statistics_.BufferBytes += size;
+	++statistics_.Maps;
+	++statistics_.Unmaps;
+}
+
+void RenderContext::Draw(UINT vertexCount, UINT startVertex)
+{
+	context_->Draw(vertexCount, startVertex);
+	++statistics_.DrawCalls;
+	++statistics_.Instances;
+	statistics_.Primitives += PrimitiveCount(topology_, vertexCount);
+	if (capture_) {
+		capture_->BeginCommand(CaptureCommand::Draw);
+		capture_->Write(static_cast<std::uint32_t>(vertexCount));
+		capture_->Write(static_cast<std::uint32_t>(startVertex));
+		capture_->EndCommand();
+	}
+}
+
+void RenderContext::DrawIndexed(UINT indexCount, UINT startIndex, INT baseVertex)
+{
+	context_->DrawIndexed(indexCount, startIndex, baseVertex);
+	++statistics_.DrawCalls;
+	++statistics_.Instances;
+	statistics_.Primitives += PrimitiveCount(topology_, indexCount);
+	if (capture_) {
+		capture_->BeginCommand(CaptureCommand::DrawIndexed);
+		capture_->Write(static_cast<std::uint32_t>(indexCount));
+		capture_->Write(static_cast<std::uint32_t>(startIndex));
+		capture_->Write(static_cast<std::int32_t>(baseVertex));
+		capture_->EndCommand();
+	}
+}
+
+void RenderContext::BeginCapture(CaptureWriter& capture)
+{
+	capture_ = &capture;
+	capturedObjects_.clear();
+}
+
+void RenderContext::EndCapture()
+{
+	capture_ = nullptr;
+	capturedObjects_.clear();
+}
+
+void RenderContext::AttachBytecode(ID3D11DeviceChild* shader, ID3DBlob* bytecode)
+{
+	shader->SetPrivateData(CaptureBytecodeGuid, static_cast<UINT>(bytecode->GetBufferSize()), bytecode->GetBufferPointer());
+}
+
+void RenderContext::AttachInputLayout(ID3D11InputLayout* inputLayout, std::span<const D3D11_INPUT_ELEMENT_DESC> elements, ID3DBlob* vertexShader)
+{
+	// Stored as the capture payload it becomes.
+	std::vector<std::byte> payload;
+	AppendPod(payload, static_cast<std::uint32_t>(elements.size()));
+	for (const D3D11_INPUT_ELEMENT_DESC& element : elements) {
+		CaptureInputElement captured{};
+		std::size_t nameLength = std::min(std::strlen(element.SemanticName), captured.SemanticName.size() - 1);
+		std::memcpy(captured.SemanticName.data(), element.SemanticName, nameLength);
+		captured.SemanticIndex = element.SemanticIndex;
+		captured.Format = element.Format;
+		captured.InputSlot = element.InputSlot;
+		captured.AlignedByteOffset = element.AlignedByteOffset;
+		captured.InputSlotClass = element.InputSlotClass;
+		captured.InstanceDataStepRate = element.InstanceDataStepRate;
+		AppendPod(payload, captured);
+	}
+	const std::byte* bytecode = static_cast<const std::byte*>(vertexShader->GetBufferPointer());
+	payload.insert(payload.end(), bytecode, bytecode + vertexShader->GetBufferSize());
+
+	inputLayout->SetPrivateData(CaptureBytecodeGuid, static_cast<UINT>(payload.size()), payload.data());
+}
+
+CaptureObject RenderContext::Capture(ID3D11DeviceChild* object, CaptureObjectKind kind)
+{
+	if (!object) {
+		return NullCaptureObject;
+	}
+	if (auto found = capturedObjects_.find(object); found != capturedObjects_.end()) {
+		return found->second;
+	}
+
+	std::vector<std::byte> payload;
+	switch (kind) {
+	case CaptureObjectKind::Buffer: {
+		ID3D11Buffer* buffer = static_cast<ID3D11Buffer*>(object);
+		D3D11_BUFFER_DESC desc;
+		buffer->GetDesc(&desc);
+		static_assert(sizeof(CaptureBufferDesc) == sizeof(D3D11_BUFFER_DESC));
+		AppendPod(payload, desc);
+		std::vector<std::byte> contents = ReadBuffer(context_, buffer, desc);
+		payload.insert(payload.end(), contents.begin(), contents.end());
+		break;
+	}
+	case CaptureObjectKind::VertexShader:
+	case CaptureObjectKind::PixelShader:
+	case CaptureObjectKind::InputLayout:
+		payload = PrivateBytecode(object);
+		if (payload.empty()) {
+			LogWarning(LogCategory::Render, "Captured a shader or input layout without bytecode");
+		}
+		break;
+	case CaptureObjectKind::RasterizerState: {
+		D3D11_RASTERIZER_DESC desc;
+		static_cast<ID3D11RasterizerState*>(object)->GetDesc(&desc);
+		AppendPod(payload, desc);
+		break;
+	}
+	case CaptureObjectKind::DepthStencilState: {
+		D3D11_DEPTH_STENCIL_DESC desc;
+		static_cast<ID3D11DepthStencilState*>(object)->GetDesc(&desc);
+		AppendPod(payload, desc);
+		break;
+	}
+	}
+
+	CaptureObject id = capture_->AddObject(kind, payload);
+	capturedObjects_.emplace(object, id);
+	return id;
+}
+
+void RenderContext::CaptureObjectCommand(CaptureCommand command, ID3D11DeviceChild* object, CaptureObjectKind kind)
+{
+	if (!capture_) {
+		return;
+	}
+
+	CaptureObject id = Capture(object, kind);
+	capture_->BeginCommand(command);
+	capture_->Write(id);
+	capture_->EndCommand();
+}
+
+void RenderContext::CaptureConstantBuffers(CaptureShaderStage stage, UINT startSlot, UINT count, ID3D11Buffer* const* buffers)
+{
+	if (!capture_) {
+		return;
+	}
+
+	payload_.clear();
+	for (UINT i = 0; i < count; ++i) {
+		AppendPod(payload_, Capture(buffers[i], CaptureObjectKind::Buffer));
+	}
+	capture_->BeginCommand(CaptureCommand::SetConstantBuffers);
+	capture_->Write(stage);
+	capture_->Write(static_cast<std::uint32_t>(startSlot));
+	capture_->Write(static_cast<std::uint32_t>(count));
+	capture_->Write(payload_.data(), payload_.size());
+	capture_->EndCommand();
+}
+
+D3D11CaptureTarget::D3D11CaptureTarget(D3D_DRIVER_TYPE driverType)
+	: driverType_(driverType)
+{
+}
+
+bool D3D11CaptureTarget::Load(const CaptureFile& capture)
+{
+	if (!device_) {
+		D3D_FEATURE_LEVEL featureLevel;
+		if (FAILED(D3D11CreateDevice(nullptr, driverType_, NULL, 0, nullptr, 0, D3D11_SDK_VERSION, device_.GetAddressOf(), &featureLevel, context_.GetAddressOf()))) {
+			LogError(LogCategory::Render, "Failed to create Direct3D device");
+			return false;
+		}
+
+		D3D11_QUERY_DESC queryDesc{ D3D11_QUERY_EVENT, 0 };
+		ThrowIfFailed(device_->CreateQuery(&queryDesc, frameDone_.GetAddressOf()));
+	}
+
+	// The render target and depth buffer the scene pass had.
+	D3D11_TEXTURE2D_DESC textureDesc;
+	ZeroMemory(&textureDesc, sizeof(textureDesc));
+	textureDesc.Width = std::max(capture.Width(), 1u);
+	textureDesc.Height = std::max(capture.Height(), 1u);
+	textureDesc.MipLevels = 1;
+	textureDesc.ArraySize = 1;
+	textureDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	textureDesc.SampleDesc.Count = 1;
+	textureDesc.Usage = D3D11_USAGE_DEFAULT;
+	textureDesc.BindFlags = D3D11_BIND_RENDER_TARGET;
+
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> color;
+	ThrowIfFailed(device_->CreateTexture2D(&textureDesc, nullptr, color.GetAddressOf()));
+	ThrowIfFailed(device_->CreateRenderTargetView(color.Get(), nullptr, renderTarget_.ReleaseAndGetAddressOf()));
+
+	textureDesc.Format = DXGI_FORMAT_D24_UNORM_S8_UINT;
+	textureDesc.BindFlags = D3D11_BIND_DEPTH_STENCIL;
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> depth;
+	ThrowIfFailed(device_->CreateTexture2D(&textureDesc, nullptr, depth.GetAddressOf()));
+	ThrowIfFailed(device_->CreateDepthStencilView(depth.Get(), nullptr, depthStencil_.ReleaseAndGetAddressOf()));
+
+	viewport_ = D3D11_VIEWPORT{ 0.0f, 0.0f, static_cast<float>(textureDesc.Width), static_cast<float>(textureDesc.Height), 0.0f, 1.0f };
+
+	objects_.clear();
+	dynamic_.clear();
+	for (const CaptureRecord& record : capture.Objects()) {
+		Microsoft::WRL::ComPtr<ID3D11DeviceChild> object;
+		bool dynamic = false;
+
+		switch (static_cast<CaptureObjectKind>(record.Type)) {
+		case CaptureObjectKind::Buffer: {
+			D3D11_BUFFER_DESC desc = ReadCapture<D3D11_BUFFER_DESC>(record.Payload);
+			std::span<const std::byte> contents = record.Payload.subspan(std::min(sizeof(desc), record.Payload.size()));
+			D3D11_SUBRESOURCE_DATA data{ contents.data(), 0, 0 };
+
+			Microsoft::WRL::ComPtr<ID3D11Buffer> buffer;
+			if (SUCCEEDED(device_->CreateBuffer(&desc, contents.size() == desc.ByteWidth ? &data : nullptr, buffer.GetAddressOf()))) {
+				object = buffer;
+			}
+			dynamic = desc.Usage == D3D11_USAGE_DYNAMIC;
+			break;
+		}
+		case CaptureObjectKind::VertexShader: {
+			Microsoft::WRL::ComPtr<ID3D11VertexShader> shader;
+			if (!record.Payload.empty() && SUCCEEDED(device_->CreateVertexShader(record.Payload.data(), record.Payload.size(), nullptr, shader.GetAddressOf()))) {
+				object = shader;
+			}
+			break;
+		}
+		case CaptureObjectKind::PixelShader: {
+			Microsoft::WRL::ComPtr<ID3D11PixelShader> shader;
+			if (!record.Payload.empty() && SUCCEEDED(device_->CreatePixelShader(record.Payload.data(), record.Payload.size(), nullptr, shader.GetAddressOf()))) {
+				object = shader;
+			}
+			break;
+		}
+		case CaptureObjectKind::InputLayout: {
+			std::uint32_t count = ReadCapture<std::uint32_t>(record.Payload);
+			std::vector<CaptureInputElement> elements(count);
+			std::vector<D3D11_INPUT_ELEMENT_DESC> descs(count);
+			for (std::uint32_t i = 0; i < count; ++i) {
+				elements[i] = ReadCapture<CaptureInputElement>(record.Payload, sizeof(std::uint32_t) + i * sizeof(CaptureInputElement));
+				descs[i] = D3D11_INPUT_ELEMENT_DESC{
+					elements[i].SemanticName.data(), elements[i].SemanticIndex, static_cast<DXGI_FORMAT>(elements[i].Format),
+					elements[i].InputSlot, elements[i].AlignedByteOffset,
+					static_cast<D3D11_INPUT_CLASSIFICATION>(elements[i].InputSlotClass), elements[i].InstanceDataStepRate
+				};
+			}
+
+			std::size_t bytecodeOffset = sizeof(std::uint32_t) + count * sizeof(CaptureInputElement);
+			Microsoft::WRL::ComPtr<ID3D11InputLayout> inputLayout;
+			if (bytecodeOffset < record.Payload.size() &&
+				SUCCEEDED(device_->CreateInputLayout(descs.data(), count, record.Payload.data() + bytecodeOffset, record.Payload.size() - bytecodeOffset, inputLayout.GetAddressOf()))) {
+				object = inputLayout;
+			}
+			break;
+		}
+		case CaptureObjectKind::RasterizerState: {
+			D3D11_RASTERIZER_DESC desc = ReadCapture<D3D11_RASTERIZER_DESC>(record.Payload);
+			Microsoft::WRL::ComPtr<ID3D11RasterizerState> state;
+			if (SUCCEEDED(device_->CreateRasterizerState(&desc, state.GetAddressOf()))) {
+				object = state;
+			}
+			break;
+		}
+		case CaptureObjectKind::DepthStencilState: {
+			D3D11_DEPTH_STENCIL_DESC desc = ReadCapture<D3D11_DEPTH_STENCIL_DESC>(record.Payload);
+			Microsoft::WRL::ComPtr<ID3D11DepthStencilState> state;
+			if (SUCCEEDED(device_->CreateDepthStencilState(&desc, state.GetAddressOf()))) {
+				object = state;
+			}
+			break;
+		}
+		}
+
+		if (!object) {
+			LogError(LogCategory::Render, "Failed to recreate captured object {}", objects_.size() + 1);
+		}
+		objects_.push_back(std::move(object));
+		dynamic_.push_back(dynamic);
+	}
+	return true;
+}
+
+void D3D11CaptureTarget::BeginFrame()
+{
+	// The scene pass' state when OnRender() is called.
+	context_->ClearState();
+	context_->RSSetViewports(1, &viewport_);
+	context_->OMSetRenderTargets(1, renderTarget_.GetAddressOf(), depthStencil_.Get());
+
+	const float clearColor[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+	context_->ClearRenderTargetView(renderTarget_.Get(), clearColor);
+	context_->ClearDepthStencilView(depthStencil_.Get(), D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1.0f, 0);
+}
+
+void D3D11CaptureTarget::Execute(CaptureCommand command, std::span<const std::byte> payload)
+{
+	switch (command) {
+	case CaptureCommand::SetPrimitiveTopology:
+		context_->IASetPrimitiveTopology(static_cast<D3D11_PRIMITIVE_TOPOLOGY>(ReadCapture<std::uint32_t>(payload)));
+		break;
+	case CaptureCommand::SetInputLayout:
+		context_->IASetInputLayout(Get<ID3D11InputLayout>(payload));
+		break;
+	case CaptureCommand::SetVertexShader:
+		context_->VSSetShader(Get<ID3D11VertexShader>(payload), nullptr, 0);
+		break;
+	case CaptureCommand::SetPixelShader:
+		context_->PSSetShader(Get<ID3D11PixelShader>(payload), nullptr, 0);
+		break;
+	case CaptureCommand::SetRasterizerState:
+		context_->RSSetState(Get<ID3D11RasterizerState>(payload));
+		break;
+	case CaptureCommand::SetDepthStencilState:
+		context_->OMSetDepthStencilState(Get<ID3D11DepthStencilState>(payload), ReadCapture<std::uint32_t>(payload, 4));
+		break;
+	case CaptureCommand::SetConstantBuffers: {
+		CaptureShaderStage stage = ReadCapture<CaptureShaderStage>(payload);
+		UINT startSlot = ReadCapture<std::uint32_t>(payload, 4);
+		UINT count = std::min<UINT>(ReadCapture<std::uint32_t>(payload, 8), D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT);
+		ID3D11Buffer* buffers[D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT];
+		for (UINT i = 0; i < count; ++i) {
+			buffers[i] = Get<ID3D11Buffer>(payload, 12 + i * sizeof(CaptureObject));
+		}
+		if (stage == CaptureShaderStage::Vertex) {
+			context_->VSSetConstantBuffers(startSlot, count, buffers);
+		}
+		else {
+			context_->PSSetConstantBuffers(startSlot, count, buffers);
+		}
+		break;
+	}
+	case CaptureCommand::SetVertexBuffers: {
+		UINT startSlot = ReadCapture<std::uint32_t>(payload);
+		UINT count = std::min<UINT>(ReadCapture<std::uint32_t>(payload, 4), D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT);
+		ID3D11Buffer* buffers[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+		UINT strides[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+		UINT offsets[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+		for (UINT i = 0; i < count; ++i) {
+			std::size_t offset = 8 + i * sizeof(CaptureVertexBuffer);
+			CaptureVertexBuffer binding = ReadCapture<CaptureVertexBuffer>(payload, offset);
+			buffers[i] = Get<ID3D11Buffer>(payload, offset);
+			strides[i] = binding.Stride;
+			offsets[i] = binding.Offset;
+		}
+		context_->IASetVertexBuffers(startSlot, count, buffers, strides, offsets);
+		break;
+	}
+	case CaptureCommand::SetIndexBuffer:
+		context_->IASetIndexBuffer(Get<ID3D11Buffer>(payload), static_cast<DXGI_FORMAT>(ReadCapture<std::uint32_t>(payload, 4)), ReadCapture<std::uint32_t>(payload, 8));
+		break;
+	case CaptureCommand::UpdateBuffer: {
+		ID3D11Buffer* buffer = Get<ID3D11Buffer>(payload);
+		if (!buffer) {
+			break;
+		}
+		D3D11_BUFFER_DESC desc;
+		buffer->GetDesc(&desc);
+		// A damaged capture's contents are cut off at the end of the buffer,
+		// and short ones only update what they hold.
+		std::span<const std::byte> contents = payload.subspan(sizeof(CaptureObject));
+		contents = contents.first(std::min<std::size_t>(contents.size(), desc.ByteWidth));
+		CaptureObject id = ReadCapture<CaptureObject>(payload);
+		if (dynamic_[id - 1]) {
+			D3D11_MAPPED_SUBRESOURCE mappedResource;
+			ThrowIfFailed(context_->Map(buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource));
+			std::memcpy(mappedResource.pData, contents.data(), contents.size());
+			context_->Unmap(buffer, 0);
+		}
+		else if (contents.size() == desc.ByteWidth) {
+			context_->UpdateSubresource(buffer, 0, nullptr, contents.data(), 0, 0);
+		}
+		else if (!(desc.BindFlags & D3D11_BIND_CONSTANT_BUFFER)) {
+			// Constant buffers can only be updated whole.
+			D3D11_BOX box{ 0, 0, 0, static_cast<UINT>(contents.size()), 1, 1 };
+			context_->UpdateSubresource(buffer, 0, &box, contents.data(), 0, 0);
+		}
+		break;
+	}
+	case CaptureCommand::WriteBuffer: {
+		ID3D11Buffer* buffer = Get<ID3D11Buffer>(payload);
+		if (!buffer || payload.size() < 12) {
+			break;
+		}
+		D3D11_BUFFER_DESC desc;
+		buffer->GetDesc(&desc);
+		std::uint32_t offset = ReadCapture<std::uint32_t>(payload, 4);
+		if (offset > desc.ByteWidth) {
+			break;
+		}
+		bool discard = ReadCapture<std::uint32_t>(payload, 8) != 0;
+		// Whatever a damaged capture writes past the end is cut off.
+		std::span<const std::byte> contents = payload.subspan(12);
+		contents = contents.first(std::min<std::size_t>(contents.size(), desc.ByteWidth - offset));
+		CaptureObject id = ReadCapture<CaptureObject>(payload);
+		if (dynamic_[id - 1]) {
+			D3D11_MAPPED_SUBRESOURCE mappedResource;
+			ThrowIfFailed(context_->Map(buffer, 0, discard ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE, 0, &mappedResource));
+			std::memcpy(static_cast<std::byte*>(mappedResource.pData) + offset, contents.data(), contents.size());
+			context_->Unmap(buffer, 0);
+		}
+		else {
+			D3D11_BOX box{ offset, 0, 0, offset + static_cast<UINT>(contents.size()), 1, 1 };
+			context_->UpdateSubresource(buffer, 0, &box, contents.data(), 0, 0);
+		}
+		break;
+	}
+	case CaptureCommand::Draw:
+		context_->Draw(ReadCapture<std::uint32_t>(payload), ReadCapture<std::uint32_t>(payload, 4));
+		break;
+	case CaptureCommand::DrawIndexed:
+		context_->DrawIndexed(ReadCapture<std::uint32_t>(payload), ReadCapture<std::uint32_t>(payload, 4), ReadCapture<std::int32_t>(payload, 8));
+		break;
+	default:
+		break;
+	}
+}
+
+void D3D11CaptureTarget::EndFrame()
+{
+	context_->End(frameDone_.Get());
+	while (context_->GetData(frameDone_.Get(), nullptr, 0, 0) == S_FALSE) {
+	}
+}
+
+bool D3D11CaptureTarget::ReadPixels(std::vector<std::uint8_t>& rgba)
+{
+	if (!renderTarget_) {
+		return false;
+	}
+
+	Microsoft::WRL::ComPtr<ID3D11Resource> color;
+	renderTarget_->GetResource(color.GetAddressOf());
+	D3D11_TEXTURE2D_DESC desc;
+	static_cast<ID3D11Texture2D*>(color.Get())->GetDesc(&desc);
+
+	desc.Usage = D3D11_USAGE_STAGING;
+	desc.BindFlags = 0;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> staging;
+	ThrowIfFailed(device_->CreateTexture2D(&desc, nullptr, staging.GetAddressOf()));
+	context_->CopyResource(staging.Get(), color.Get());
+
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	if (FAILED(context_->Map(staging.Get(), 0, D3D11_MAP_READ, 0, &mapped))) {
+		LogError(LogCategory::Render, "Failed to read back the replayed frame");
+		return false;
+	}
+
+	std::size_t rowSize = std::size_t(desc.Width) * 4;
+	rgba.resize(rowSize * desc.Height);
+	for (UINT row = 0; row < desc.Height; ++row) {
+		std::memcpy(rgba.data() + row * rowSize, static_cast<const std::uint8_t*>(mapped.pData) + row * mapped.RowPitch, rowSize);
+	}
+	context_->Unmap(staging.Get(), 0);
+	return true;
+}
@@ -0,0 +1,520 @@
+module;
+// C
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+export module render.graph;
+
+import <algorithm>;
+import <functional>;
+import <memory>;
+import <memory_resource>;
+import <span>;
+import <string>;
+import <string_view>;
+import <vector>;
+
+import core.memory;
+
+export struct GraphTextureDesc
+{
+	std::uint32_t Width = 0;
+	std::uint32_t Height = 0;
+	// Backend specific, e.g. a DXGI_FORMAT and D3D11_BIND_FLAG bits.
+	std::uint32_t Format = 0;
+	std::uint32_t BindFlags = 0;
+	std::uint32_t SampleCount = 1;
+	std::uint32_t BytesPerPixel = 4;
+
+	bool operator==(const GraphTextureDesc&) const = default;
+
+	std::uint64_t Bytes() const { return static_cast<std::uint64_t>(Width) * Height * SampleCount * BytesPerPixel; }
+};
+
+export using GraphResource = std::uint32_t;
+
+// Physical texture as handed out by the backend.
+export using GraphTexture = const void*;
+
+// Creates the physical textures behind transient graph resources.
+export class RenderGraphBackend
+{
+public:
+	virtual ~RenderGraphBackend() = default;
+
+	virtual GraphTexture AcquireTexture(const GraphTextureDesc& desc) = 0;
+	virtual void ReleaseTexture(GraphTexture texture) = 0;
+};
+
+export class RenderGraph;
+export class PassResources;
+
+// Declares what a pass reads and writes. Obtained from RenderGraph::AddPass().
+export class PassBuilder
+{
+public:
+	// A transient texture that only lives while passes use it.
+	GraphResource Create(std::string_view name, const GraphTextureDesc& desc);
+	GraphResource Read(GraphResource resource);
+	GraphResource Write(GraphResource resource);
+
+	// Keeps the pass even if nothing reads what it writes.
+	void HasSideEffects();
+
+	void Execute(std::function<void(const PassResources&)> execute);
+
+private:
+	friend class RenderGraph;
+
+	PassBuilder(RenderGraph& graph, std::uint32_t pass) : graph_(graph), pass_(pass) { }
+
+	RenderGraph& graph_;
+	std::uint32_t pass_;
+};
+
+export class PassResources
+{
+public:
+	GraphTexture Texture(GraphResource resource) const;
+	const GraphTextureDesc& Desc(GraphResource resource) const;
+
+private:
+	friend class RenderGraph;
+
+	explicit PassResources(const RenderGraph& graph) : graph_(graph) { }
+
+	const RenderGraph& graph_;
+};
+
+// Frame graph of render passes. Each frame the passes are declared with
+// their inputs and outputs, then Compile() works out what to run:
+//
+// - Passes whose outputs nobody reads are culled, unless they write an
+//   imported resource or have side effects.
+// - Passes run in declaration order. A pass can only refer to resources
+//   declared before it, so this order always satisfies the dependencies.
+// - Each transient texture lives from the first to the last surviving pass
+//   that uses it. Transients with identical descriptions whose lifetimes do
+//   not overlap share one physical texture.
+//
+// The graph does not know about D3D11; textures come from a backend, so the
+// whole pipeline also runs with CpuRenderGraphBackend.
+export class RenderGraph
+{
+public:
+	struct Report
+	{
+		std::size_t PassCount = 0;
+		std::size_t CulledPassCount = 0;
+		std::size_t TransientCount = 0;
+		std::size_t PhysicalCount = 0;
+		// Memory the transients would need without aliasing, and with it.
+		std::uint64_t TransientBytes = 0;
+		std::uint64_t AllocatedBytes = 0;
+
+		std::uint64_t SavedBytes() const { return TransientBytes - AllocatedBytes; }
+	};
+
+public:
+	// Drops all passes and resources but keeps the storage. What Compile()
+	// works out for the frame is allocated from frameMemory, if given, which
+	// must then last until Execute() returns.
+	void Reset(std::pmr::memory_resource* frameMemory = nullptr);
+
+	// A texture owned outside the graph, e.g. the back buffer. Passes that
+	// write it are never culled.
+	GraphResource Import(std::string_view name, const GraphTextureDesc& desc, GraphTexture texture);
+
+	PassBuilder AddPass(std::string_view name);
+
+	bool Compile();
+	void Execute(RenderGraphBackend& backend);
+
+	const Report& GetReport() const { return report_; }
+	bool IsCulled(std::string_view passName) const;
+
+private:
+	friend class PassBuilder;
+	friend class PassResources;
+
+	static constexpr std::uint32_t None = UINT32_MAX;
+
+	struct Resource
+	{
+		std::string Name;
+		GraphTextureDesc Desc;
+		GraphTexture Imported = nullptr;
+		std::uint32_t Creator = None;
+
+		// Compile results
+		std::uint32_t ReadCount = 0;
+		std::uint32_t FirstUse = None;
+		std::uint32_t LastUse = 0;
+		std::uint32_t Physical = None;
+	};
+
+	struct Pass
+	{
+		std::string Name;
+		std::vector<GraphResource> Reads;
+		std::vector<GraphResource> Writes;
+		std::function<void(const PassResources&)> Execute;
+		bool SideEffects = false;
+
+		// Compile results
+		std::uint32_t WriteCount = 0;
+		bool Culled = false;
+	};
+
+	struct Physical
+	{
+		GraphTextureDesc Desc;
+		std::uint32_t FirstUse;
+		std::uint32_t LastUse;
+		GraphTexture Texture = nullptr;
+	};
+
+	bool IsImported(GraphResource resource) const { return resources_[resource].Imported != nullptr; }
+
+	void CullPasses();
+	void ComputeLifetimes();
+	void AliasTransients();
+
+private:
+	std::vector<Resource> resources_;
+	std::vector<Pass> passes_;
+	std::size_t resourceCount_ = 0;
+	std::size_t passCount_ = 0;
+
+	std::pmr::vector<Physical> physicals_;
+	std::pmr::vector<GraphResource> scratch_;
+	Report report_;
+	bool compiled_ = false;
+};
+
+// Backend that keeps textures in system memory, for running graphs without a
+// GPU. Passes can read and write the pixels through Pixels().
+export class CpuRenderGraphBackend : public RenderGraphBackend
+{
+public:
+	struct Texture
+	{
+		GraphTextureDesc Desc;
+		std::vector<std::byte> Pixels;
+	};
+
+public:
+	GraphTexture AcquireTexture(const GraphTextureDesc& desc) override;
+	void ReleaseTexture(GraphTexture texture) override;
+
+	static std::span<std::byte> Pixels(GraphTexture texture);
+
+	std::uint64_t LiveBytes() const { return liveBytes_; }
+	std::uint64_t PeakBytes() const { return peakBytes_; }
+	std::size_t Acquisitions() const { return acquisitions_; }
+
+private:
+	std::vector<std::unique_ptr<Texture>> textures_;
+	std::uint64_t liveBytes_ = 0;
+	std::uint64_t peakBytes_ = 0;
+	std::size_t acquisitions_ = 0;
+};
+
+module :private;
+
+GraphResource PassBuilder::Create(std::string_view name, const GraphTextureDesc& desc)
+{
+	GraphResource resource = graph_.Import(name, desc, nullptr);
+	graph_.resources_[resource].Creator = pass_;
+	graph_.passes_[pass_].Writes.push_back(resource);
+	return resource;
+}
+
+GraphResource PassBuilder::Read(GraphResource resource)
+{
+	assert(resource < graph_.resourceCount_);
+	graph_.passes_[pass_].Reads.push_back(resource);
+	return resource;
+}
+
+GraphResource PassBuilder::Write(GraphResource resource)
+{
+	assert(resource < graph_.resourceCount_);
+	graph_.passes_[pass_].Writes.push_back(resource);
+	return resource;
+}
+
+void PassBuilder::HasSideEffects()
+{
+	graph_.passes_[pass_].SideEffects = true;
+}
+
+void PassBuilder::Execute(std::function<void(const PassResources&)> execute)
+{
+	graph_.passes_[pass_].Execute = std::move(execute);
+}
+
+GraphTexture PassResources::Texture(GraphResource resource) const
+{
+	const RenderGraph::Resource& entry = graph_.resources_[resource];
+	if (entry.Imported) {
+		return entry.Imported;
+	}
+	return entry.Physical != RenderGraph::None ? graph_.physicals_[entry.Physical].Texture : nullptr;
+}
+
+const GraphTextureDesc& PassResources::Desc(GraphResource resource) const
+{
+	return graph_.resources_[resource].Desc;
+}
+
+void RenderGraph::Reset(std::pmr::memory_resource* frameMemory)
+{
+	// Entries are reused, so their strings and vectors keep their capacity.
+	for (std::size_t i = 0; i < passCount_; ++i) {
+		passes_[i].Reads.clear();
+		passes_[i].Writes.clear();
+		passes_[i].Execute = nullptr;
+	}
+	resourceCount_ = 0;
+	passCount_ = 0;
+	ResetFrameVector(physicals_, frameMemory);
+	ResetFrameVector(scratch_, frameMemory);
+	compiled_ = false;
+}
+
+GraphResource RenderGraph::Import(std::string_view name, const GraphTextureDesc& desc, GraphTexture texture)
+{
+	if (resourceCount_ == resources_.size()) {
+		resources_.emplace_back();
+	}
+
+	Resource& resource = resources_[resourceCount_];
+	resource.Name.assign(name);
+	resource.Desc = desc;
+	resource.Imported = texture;
+	resource.Creator = None;
+	return static_cast<GraphResource>(resourceCount_++);
+}
+
+PassBuilder RenderGraph::AddPass(std::string_view name)
+{
+	if (passCount_ == passes_.size()) {
+		passes_.emplace_back();
+	}
+
+	Pass& pass = passes_[passCount_];
+	pass.Name.assign(name);
+	pass.SideEffects = false;
+	return PassBuilder(*this, static_cast<std::uint32_t>(passCount_++));
+}
+
+bool RenderGraph::Compile()
+{
+	// Every transient must be created before it is used.
+	for (std::uint32_t i = 0; i < passCount_; ++i) {
+		for (GraphResource resource : passes_[i].Reads) {
+			if (!IsImported(resource) && (resources_[resource].Creator == None || resources_[resource].Creator >= i)) {
+				return false;
+			}
+		}
+	}
+
+	report_ = Report();
+	physicals_.clear();
+
+	CullPasses();
+	ComputeLifetimes();
+	AliasTransients();
+
+	report_.PassCount = passCount_;
+	compiled_ = true;
+	return true;
+}
+
+void RenderGraph::CullPasses()
+{
+	for (std::size_t i = 0; i < resourceCount_; ++i) {
+		resources_[i].ReadCount = 0;
+	}
+
+	for (std::size_t i = 0; i < passCount_; ++i) {
+		Pass& pass = passes_[i];
+		pass.Culled = false;
+		pass.WriteCount = static_cast<std::uint32_t>(pass.Writes.size());
+		for (GraphResource resource : pass.Reads) {
+			++resources_[resource].ReadCount;
+		}
+		// Writing something that outlives the graph counts as being read.
+		for (GraphResource resource : pass.Writes) {
+			if (IsImported(resource)) {
+				pass.SideEffects = true;
+			}
+		}
+	}
+
+	// Walk back from the transients nobody reads, releasing the passes that
+	// only produce unread resources.
+	scratch_.clear();
+	for (std::size_t i = 0; i < resourceCount_; ++i) {
+		if (!IsImported(static_cast<GraphResource>(i)) && resources_[i].ReadCount == 0) {
+			scratch_.push_back(static_cast<GraphResource>(i));
+		}
+	}
+
+	while (!scratch_.empty()) {
+		GraphResource unread = scratch_.back();
+		scratch_.pop_back();
+
+		for (std::size_t i = 0; i < passCount_; ++i) {
+			Pass& pass = passes_[i];
+			if (pass.Culled || std::find(pass.Writes.begin(), pass.Writes.end(), unread) == pass.Writes.end()) {
+				continue;
+			}
+
+			if (--pass.WriteCount == 0 && !pass.SideEffects) {
+				pass.Culled = true;
+				++report_.CulledPassCount;
+				for (GraphResource resource : pass.Reads) {
+					if (--resources_[resource].ReadCount == 0 && !IsImported(resource)) {
+						scratch_.push_back(resource);
+					}
+				}
+			}
+		}
+	}
+}
+
+void RenderGraph::ComputeLifetimes()
+{
+	for (std::size_t i = 0; i < resourceCount_; ++i) {
+		resources_[i].FirstUse = None;
+		resources_[i].LastUse = 0;
+		resources_[i].Physical = None;
+	}
+
+	for (std::uint32_t i = 0; i < passCount_; ++i) {
+		const Pass& pass = passes_[i];
+		if (pass.Culled) {
+			continue;
+		}
+
+		auto use = [this, i](GraphResource resource) {
+			Resource& entry = resources_[resource];
+			entry.FirstUse = std::min(entry.FirstUse, i);
+			entry.LastUse = std::max(entry.LastUse, i);
+		};
+		std::for_each(pass.Reads.begin(), pass.Reads.end(), use);
+		std::for_each(pass.Writes.begin(), pass.Writes.end(), use);
+	}
+}
+
+void RenderGraph::AliasTransients()
+{
+	scratch_.clear();
+	for (std::size_t i = 0; i < resourceCount_; ++i) {
+		if (!IsImported(static_cast<GraphResource>(i)) && resources_[i].FirstUse != None) {
+			scratch_.push_back(static_cast<GraphResource>(i));
+		}
+	}
+
+	// Interval scheduling: in order of first use, each transient takes the
+	// first compatible physical texture that is free by then.
+	std::sort(scratch_.begin(), scratch_.end(), [this](GraphResource a, GraphResource b) {
+		return resources_[a].FirstUse < resources_[b].FirstUse;
+	});
+
+	for (GraphResource resource : scratch_) {
+		Resource& entry = resources_[resource];
+		auto free = std::find_if(physicals_.begin(), physicals_.end(), [&entry](const Physical& physical) {
+			return physical.Desc == entry.Desc && physical.LastUse < entry.FirstUse;
+		});
+
+		if (free != physicals_.end()) {
+			free->LastUse = entry.LastUse;
+			entry.Physical = static_cast<std::uint32_t>(free - physicals_.begin());
+		}
+		else {
+			entry.Physical = static_cast<std::uint32_t>(physicals_.size());
+			physicals_.push_back({ entry.Desc, entry.FirstUse, entry.LastUse });
+			report_.AllocatedBytes += entry.Desc.Bytes();
+		}
+
+		report_.TransientBytes += entry.Desc.Bytes();
+		++report_.TransientCount;
+	}
+
+	report_.PhysicalCount = physicals_.size();
+}
+
+void RenderGraph::Execute(RenderGraphBackend& backend)
+{
+	assert(compiled_);
+
+	PassResources resources(*this);
+	for (std::uint32_t i = 0; i < passCount_; ++i) {
+		Pass& pass = passes_[i];
+		if (pass.Culled) {
+			continue;
+		}
+
+		for (Physical& physical : physicals_) {
+			if (physical.FirstUse == i) {
+				physical.Texture = backend.AcquireTexture(physical.Desc);
+			}
+		}
+
+		if (pass.Execute) {
+			pass.Execute(resources);
+		}
+
+		for (Physical& physical : physicals_) {
+			if (physical.LastUse == i) {
+				backend.ReleaseTexture(physical.Texture);
+				physical.Texture = nullptr;
+			}
+		}
+	}
+}
+
+bool RenderGraph::IsCulled(std::string_view passName) const
+{
+	for (std::size_t i = 0; i < passCount_; ++i) {
+		if (passes_[i].Name == passName) {
+			return passes_[i].Culled;
+		}
+	}
+	return false;
+}
+
+GraphTexture CpuRenderGraphBackend::AcquireTexture(const GraphTextureDesc& desc)
+{
+	auto texture = std::make_unique<Texture>();
+	texture->Desc = desc;
+	texture->Pixels.resize(desc.Bytes());
+
+	liveBytes_ += desc.Bytes();
+	peakBytes_ = std::max(peakBytes_, liveBytes_);
+	++acquisitions_;
+
+	textures_.push_back(std::move(texture));
+	return textures_.back().get();
+}
+
+void CpuRenderGraphBackend::ReleaseTexture(GraphTexture texture)
+{
+	auto found = std::find_if(textures_.begin(), textures_.end(),
+		[texture](const std::unique_ptr<Texture>& entry) { return entry.get() == texture; });
+	if (found == textures_.end()) {
+		return;
+	}
+
+	liveBytes_ -= (*found)->Desc.Bytes();
+	textures_.erase(found);
+}
+
+std::span<std::byte> CpuRenderGraphBackend::Pixels(GraphTexture texture)
+{
+	return const_cast<Texture*>(static_cast<const Texture*>(texture))->Pixels;
+}
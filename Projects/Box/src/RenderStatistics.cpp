@@ -0,0 +1,109 @@
+module;
+// C
+#include <cfloat>
+#include <cstddef>
+#include <cstdint>
+
+// ImGui
+#include "imgui.h"
+
+export module diagnostics.render;
+
+import <array>;
+import <vector>;
+
+import diagnostics.memory;
+import render.context;
+
+// The render statistics of the last FrameHistory rendered frames. The game
+// hands over the counts of its RenderContext after every frame, and they
+// can be polled from the render thread.
+export class RenderStatisticsTracker
+{
+public:
+	static constexpr std::size_t FrameHistory = 240;
+
+public:
+	static RenderStatisticsTracker& Get();
+
+public:
+	// Called on the render thread once a frame is rendered. Fills in the
+	// resources created since the previous frame.
+	void EndFrame(const RenderStatistics& statistics);
+
+	// All zero before the first frame.
+	const RenderStatistics& LastFrame() const;
+	// Oldest first.
+	std::vector<RenderStatistics> History() const;
+	std::uint64_t FrameCount() const { return frameCount_; }
+
+	void DrawPanel();
+
+private:
+	std::array<RenderStatistics, FrameHistory> frames_ = {};
+	std::uint64_t frameCount_ = 0;
+	std::uint64_t createdResources_ = 0;
+};
+
+module :private;
+
+RenderStatisticsTracker& RenderStatisticsTracker::Get()
+{
+	static RenderStatisticsTracker tracker;
+	return tracker;
+}
+
+void RenderStatisticsTracker::EndFrame(const RenderStatistics& statistics)
+{
+	std::uint64_t createdResources = MemoryTracker::Get().CreatedResources();
+
+	RenderStatistics& frame = frames_[frameCount_ % FrameHistory];
+	frame = statistics;
+	frame.ResourcesCreated = createdResources - createdResources_;
+	createdResources_ = createdResources;
+	++frameCount_;
+}
+
+const RenderStatistics& RenderStatisticsTracker::LastFrame() const
+{
+	return frames_[(frameCount_ + FrameHistory - 1) % FrameHistory];
+}
+
+std::vector<RenderStatistics> RenderStatisticsTracker::History() const
+{
+	std::vector<RenderStatistics> history;
+	std::uint64_t first = frameCount_ > FrameHistory ? frameCount_ - FrameHistory : 0;
+	for (std::uint64_t frame = first; frame < frameCount_; ++frame) {
+		history.push_back(frames_[frame % FrameHistory]);
+	}
+	return history;
+}
+
+void RenderStatisticsTracker::DrawPanel()
+{
+	ImGui::Begin("Render Statistics");
+
+	const RenderStatistics& frame = LastFrame();
+	ImGui::Text("Draw calls: %llu", frame.DrawCalls);
+	ImGui::Text("Instances: %llu", frame.Instances);
+	ImGui::Text("Primitives: %llu", frame.Primitives);
+	ImGui::Text("State changes: %llu", frame.StateChanges);
+	ImGui::Text("Constant buffer uploads: %llu bytes", frame.ConstantBufferBytes);
+	ImGui::Text("Buffer uploads: %llu bytes", frame.BufferBytes);
+	ImGui::Text("Map/Unmap: %llu/%llu", frame.Maps, frame.Unmaps);
+	ImGui::Text("Resources created: %llu", frame.ResourcesCreated);
+
+	// Plotted from the oldest frame in the ring.
+	int offset = static_cast<int>(frameCount_ % FrameHistory);
+	std::array<float, FrameHistory> values;
+	for (std::size_t i = 0; i < FrameHistory; ++i) {
+		values[i] = static_cast<float>(frames_[i].DrawCalls);
+	}
+	ImGui::PlotLines("##DrawCalls", values.data(), static_cast<int>(values.size()), offset, "Draw calls per frame", 0.0f, FLT_MAX, ImVec2(-1.0f, 60.0f));
+	for (std::size_t i = 0; i < FrameHistory; ++i) {
+		values[i] = static_cast<float>(frames_[i].Primitives);
+	}
+	ImGui::PlotLines("##Primitives", values.data(), static_cast<int>(values.size()), offset, "Primitives per frame", 0.0f, FLT_MAX, ImVec2(-1.0f, 60.0f));
+
+	ImGui::End();
+}
@@ -0,0 +1,246 @@
+module;
+// C
+#include <cassert>
+#include <cstdint>
+
+// Windows
+#include <d3d11.h>
+#include <wrl.h>
+
+export module resource.targets;
+
+import <algorithm>;
+import <memory>;
+import <vector>;
+
+import core.memory;
+import diagnostics.memory;
+import render.graph;
+import utility;
+
+export struct RenderTargetDesc
+{
+	UINT Width = 0;
+	UINT Height = 0;
+	DXGI_FORMAT Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	// D3D11_BIND_RENDER_TARGET, D3D11_BIND_DEPTH_STENCIL and/or D3D11_BIND_SHADER_RESOURCE.
+	UINT BindFlags = D3D11_BIND_RENDER_TARGET;
+	UINT SampleCount = 1;
+
+	bool operator==(const RenderTargetDesc&) const = default;
+};
+
+// A pooled texture with the views its bind flags allow. The texture can be
+// larger than requested; only the requested area is meant to be used.
+export struct RenderTarget
+{
+	RenderTargetDesc Desc;
+	UINT Width = 0;
+	UINT Height = 0;
+
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> Texture;
+	Microsoft::WRL::ComPtr<ID3D11RenderTargetView> RenderTargetView;
+	Microsoft::WRL::ComPtr<ID3D11DepthStencilView> DepthStencilView;
+	Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> ShaderResourceView;
+};
+
+// Hands out render targets and depth buffers and keeps released ones for
+// reuse. Sizes are rounded up to buckets, so a window being dragged to a
+// slightly different size gets the same textures back instead of new ones.
+// Targets unused for MaxIdleFrames are destroyed.
+export class RenderTargetPool
+{
+public:
+	static constexpr UINT SizeBucket = 256;
+	static constexpr std::uint64_t MaxIdleFrames = 120;
+
+public:
+	void Initialize(ID3D11Device* device);
+
+	// The returned pointer stays valid until the target is released and evicted.
+	const RenderTarget* Acquire(const RenderTargetDesc& desc, std::uint64_t frame);
+	void Release(const RenderTarget* target, std::uint64_t frame);
+
+	// Destroys targets that have been idle too long.
+	void Collect(std::uint64_t frame);
+	void Clear();
+
+	std::size_t Size() const { return entries_.size(); }
+	std::size_t Allocations() const { return allocations_; }
+
+private:
+	struct Entry
+	{
+		RenderTarget Target;
+		bool InUse = false;
+		std::uint64_t LastUsedFrame = 0;
+	};
+
+	static UINT Bucket(UINT size);
+	std::unique_ptr<Entry> CreateEntry(const RenderTargetDesc& desc);
+
+private:
+	Microsoft::WRL::ComPtr<ID3D11Device> device_;
+	std::vector<std::unique_ptr<Entry>> entries_;
+	std::size_t allocations_ = 0;
+};
+
+// Lets a render graph take its transient textures from a RenderTargetPool.
+// Graph textures are const RenderTarget pointers.
+export class RenderTargetGraphBackend : public RenderGraphBackend
+{
+public:
+	explicit RenderTargetGraphBackend(RenderTargetPool& pool) : pool_(pool) { }
+
+	// Frame used to age the targets released by the graph.
+	void SetFrame(std::uint64_t frame) { frame_ = frame; }
+
+	GraphTexture AcquireTexture(const GraphTextureDesc& desc) override;
+	void ReleaseTexture(GraphTexture texture) override;
+
+	static GraphTextureDesc Describe(const RenderTargetDesc& desc);
+	static const RenderTarget* Target(GraphTexture texture) { return static_cast<const RenderTarget*>(texture); }
+
+private:
+	RenderTargetPool& pool_;
+	std::uint64_t frame_ = 0;
+};
+
+module :private;
+
+void RenderTargetPool::Initialize(ID3D11Device* device)
+{
+	device_ = device;
+}
+
+const RenderTarget* RenderTargetPool::Acquire(const RenderTargetDesc& desc, std::uint64_t frame)
+{
+	assert(device_);
+
+	RenderTargetDesc key = desc;
+	key.Width = Bucket(desc.Width);
+	key.Height = Bucket(desc.Height);
+
+	auto found = std::find_if(entries_.begin(), entries_.end(),
+		[&key](const std::unique_ptr<Entry>& entry) { return !entry->InUse && entry->Target.Desc == key; });
+
+	Entry* entry;
+	if (found != entries_.end()) {
+		entry = found->get();
+	}
+	else {
+		entries_.push_back(CreateEntry(key));
+		entry = entries_.back().get();
+	}
+
+	entry->InUse = true;
+	entry->LastUsedFrame = frame;
+	return &entry->Target;
+}
+
+void RenderTargetPool::Release(const RenderTarget* target, std::uint64_t frame)
+{
+	if (!target) {
+		return;
+	}
+
+	auto found = std::find_if(entries_.begin(), entries_.end(),
+		[target](const std::unique_ptr<Entry>& entry) { return &entry->Target == target; });
+	assert(found != entries_.end() && (*found)->InUse);
+
+	(*found)->InUse = false;
+	(*found)->LastUsedFrame = frame;
+}
+
+void RenderTargetPool::Collect(std::uint64_t frame)
+{
+	std::erase_if(entries_, [frame](const std::unique_ptr<Entry>& entry) {
+		return !entry->InUse && frame - entry->LastUsedFrame > MaxIdleFrames;
+	});
+}
+
+void RenderTargetPool::Clear()
+{
+	entries_.clear();
+}
+
+UINT RenderTargetPool::Bucket(UINT size)
+{
+	return std::max<UINT>((size + SizeBucket - 1) / SizeBucket, 1) * SizeBucket;
+}
+
+std::unique_ptr<RenderTargetPool::Entry> RenderTargetPool::CreateEntry(const RenderTargetDesc& desc)
+{
+	MemoryTagScope memoryTag(MemoryTag::Rendering);
+
+	D3D11_TEXTURE2D_DESC textureDesc;
+	ZeroMemory(&textureDesc, sizeof(textureDesc));
+	textureDesc.Width = desc.Width;
+	textureDesc.Height = desc.Height;
+	textureDesc.MipLevels = 1;
+	textureDesc.ArraySize = 1;
+	textureDesc.Format = desc.Format;
+	textureDesc.SampleDesc.Count = desc.SampleCount;
+	textureDesc.SampleDesc.Quality = 0;
+	textureDesc.Usage = D3D11_USAGE_DEFAULT;
+	textureDesc.BindFlags = desc.BindFlags;
+
+	auto entry = std::make_unique<Entry>();
+	RenderTarget& target = entry->Target;
+	target.Desc = desc;
+	target.Width = desc.Width;
+	target.Height = desc.Height;
+
+	ThrowIfFailed(device_->CreateTexture2D(&textureDesc, nullptr, target.Texture.GetAddressOf()));
+	MemoryTracker::Get().TrackTexture(target.Texture.Get());
+
+	if (desc.BindFlags & D3D11_BIND_RENDER_TARGET) {
+		ThrowIfFailed(device_->CreateRenderTargetView(target.Texture.Get(), nullptr, target.RenderTargetView.GetAddressOf()));
+	}
+	if (desc.BindFlags & D3D11_BIND_DEPTH_STENCIL) {
+		ThrowIfFailed(device_->CreateDepthStencilView(target.Texture.Get(), nullptr, target.DepthStencilView.GetAddressOf()));
+	}
+	if (desc.BindFlags & D3D11_BIND_SHADER_RESOURCE) {
+		ThrowIfFailed(device_->CreateShaderResourceView(target.Texture.Get(), nullptr, target.ShaderResourceView.GetAddressOf()));
+	}
+
+	++allocations_;
+	return entry;
+}
+
+GraphTexture RenderTargetGraphBackend::AcquireTexture(const GraphTextureDesc& desc)
+{
+	RenderTargetDesc targetDesc;
+	targetDesc.Width = desc.Width;
+	targetDesc.Height = desc.Height;
+	targetDesc.Format = static_cast<DXGI_FORMAT>(desc.Format);
+	targetDesc.BindFlags = desc.BindFlags;
+	targetDesc.SampleCount = desc.SampleCount;
+	return pool_.Acquire(targetDesc, frame_);
+}
+
+void RenderTargetGraphBackend::ReleaseTexture(GraphTexture texture)
+{
+	pool_.Release(Target(texture), frame_);
+}
+
+GraphTextureDesc RenderTargetGraphBackend::Describe(const RenderTargetDesc& desc)
+{
+	D3D11_TEXTURE2D_DESC pixelDesc;
+	ZeroMemory(&pixelDesc, sizeof(pixelDesc));
+	pixelDesc.Width = 1;
+	pixelDesc.Height = 1;
+	pixelDesc.MipLevels = 1;
+	pixelDesc.ArraySize = 1;
+	pixelDesc.Format = desc.Format;
+	pixelDesc.SampleDesc.Count = 1;
+
+	GraphTextureDesc graphDesc;
+	graphDesc.Width = desc.Width;
+	graphDesc.Height = desc.Height;
+	graphDesc.Format = static_cast<std::uint32_t>(desc.Format);
+	graphDesc.BindFlags = desc.BindFlags;
+	graphDesc.SampleCount = desc.SampleCount;
+	graphDesc.BytesPerPixel = static_cast<std::uint32_t>(MemoryTracker::TextureBytes(pixelDesc));
+	return graphDesc;
+}
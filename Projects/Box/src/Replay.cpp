@@ -0,0 +1,229 @@
+module;
+// C
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+export module diagnostics.replay;
+
+import <array>;
+import <filesystem>;
+import <fstream>;
+import <iostream>;
+import <iterator>;
+import <span>;
+import <vector>;
+
+// Log of a session: a fixed size block of state at the start, then the frame
+// time of every frame and the state after it. The state is stored as 32-bit
+// words, and each frame only stores a bitmask and the words that changed
+// since the previous frame, so a frame where nothing changed costs the frame
+// time and the mask.
+//
+//   header  "GRPL", version, state size, frame count   (4 x uint32)
+//   state   the initial state
+//   frame   float frame time, ceil(words / 8) mask bytes, changed words
+export class ReplayRecorder
+{
+public:
+	~ReplayRecorder() { Close(); }
+
+	// The state's size must be a multiple of 4.
+	bool Open(const std::filesystem::path& path, std::span<const std::byte> initialState);
+	void Close();
+	bool IsOpen() const { return file_.is_open(); }
+
+	void RecordFrame(float deltaTime, std::span<const std::byte> state);
+
+	std::uint32_t FrameCount() const { return frameCount_; }
+
+private:
+	std::ofstream file_;
+	std::vector<std::byte> previous_;
+	std::vector<std::byte> frame_;
+	std::uint32_t frameCount_ = 0;
+};
+
+export class ReplayPlayer
+{
+public:
+	// Fails if the log does not hold state of stateSize bytes.
+	bool Open(const std::filesystem::path& path, std::size_t stateSize);
+	void Close();
+	bool IsOpen() const { return !data_.empty(); }
+
+	// Decodes the next frame into deltaTime and State(). Returns false after
+	// the last frame.
+	bool NextFrame(float& deltaTime);
+
+	// The initial state after Open(), and the state after the last decoded
+	// frame from then on.
+	std::span<const std::byte> State() const { return state_; }
+
+	std::uint32_t FrameCount() const { return frameCount_; }
+	std::uint32_t FramesPlayed() const { return framesPlayed_; }
+
+private:
+	std::vector<std::byte> data_;
+	std::size_t position_ = 0;
+	std::vector<std::byte> state_;
+	std::uint32_t frameCount_ = 0;
+	std::uint32_t framesPlayed_ = 0;
+};
+
+module :private;
+
+namespace
+{
+	constexpr std::array<char, 4> Magic = { 'G', 'R', 'P', 'L' };
+	constexpr std::uint32_t Version = 1;
+
+	struct Header
+	{
+		std::array<char, 4> Magic;
+		std::uint32_t Version;
+		std::uint32_t StateSize;
+		std::uint32_t FrameCount;
+	};
+
+	constexpr std::size_t WordSize = sizeof(std::uint32_t);
+
+	std::size_t MaskBytes(std::size_t stateSize)
+	{
+		return (stateSize / WordSize + 7) / 8;
+	}
+}
+
+bool ReplayRecorder::Open(const std::filesystem::path& path, std::span<const std::byte> initialState)
+{
+	assert(initialState.size() % WordSize == 0);
+	Close();
+
+	file_.open(path, std::ios::binary | std::ios::trunc);
+	if (!file_) {
+		std::cerr << "Failed to open replay log " << path << "\n";
+		return false;
+	}
+
+	// The frame count is filled in by Close().
+	Header header{ Magic, Version, static_cast<std::uint32_t>(initialState.size()), 0 };
+	file_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file_.write(reinterpret_cast<const char*>(initialState.data()), initialState.size());
+
+	previous_.assign(initialState.begin(), initialState.end());
+	frame_.reserve(sizeof(float) + MaskBytes(initialState.size()) + initialState.size());
+	frameCount_ = 0;
+	return true;
+}
+
+void ReplayRecorder::Close()
+{
+	if (!file_.is_open()) {
+		return;
+	}
+
+	file_.seekp(offsetof(Header, FrameCount));
+	file_.write(reinterpret_cast<const char*>(&frameCount_), sizeof(frameCount_));
+	file_.close();
+}
+
+void ReplayRecorder::RecordFrame(float deltaTime, std::span<const std::byte> state)
+{
+	if (!file_.is_open()) {
+		return;
+	}
+	assert(state.size() == previous_.size());
+
+	std::size_t maskBytes = MaskBytes(state.size());
+	frame_.resize(sizeof(float) + maskBytes);
+	std::memcpy(frame_.data(), &deltaTime, sizeof(float));
+	std::byte* mask = frame_.data() + sizeof(float);
+	std::memset(mask, 0, maskBytes);
+
+	for (std::size_t word = 0; word * WordSize < state.size(); ++word) {
+		const std::byte* current = state.data() + word * WordSize;
+		std::byte* previous = previous_.data() + word * WordSize;
+		if (std::memcmp(current, previous, WordSize) != 0) {
+			// frame_ may move, so the mask is indexed afresh.
+			frame_[sizeof(float) + word / 8] |= std::byte(1 << (word % 8));
+			frame_.insert(frame_.end(), current, current + WordSize);
+			std::memcpy(previous, current, WordSize);
+		}
+	}
+
+	file_.write(reinterpret_cast<const char*>(frame_.data()), frame_.size());
+	++frameCount_;
+}
+
+bool ReplayPlayer::Open(const std::filesystem::path& path, std::size_t stateSize)
+{
+	Close();
+
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		std::cerr << "Failed to open replay log " << path << "\n";
+		return false;
+	}
+
+	std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	Header header;
+	if (bytes.size() < sizeof(header) + stateSize) {
+		std::cerr << "Replay log " << path << " is truncated\n";
+		return false;
+	}
+
+	std::memcpy(&header, bytes.data(), sizeof(header));
+	if (header.Magic != Magic || header.Version != Version) {
+		std::cerr << "Replay log " << path << " has an unknown format\n";
+		return false;
+	}
+	if (header.StateSize != stateSize) {
+		std::cerr << "Replay log " << path << " was recorded by a different build of the demo\n";
+		return false;
+	}
+
+	data_.resize(bytes.size());
+	std::memcpy(data_.data(), bytes.data(), bytes.size());
+	state_.assign(data_.begin() + sizeof(header), data_.begin() + sizeof(header) + stateSize);
+	position_ = sizeof(header) + stateSize;
+	frameCount_ = header.FrameCount;
+	framesPlayed_ = 0;
+	return true;
+}
+
+void ReplayPlayer::Close()
+{
+	data_.clear();
+	state_.clear();
+	position_ = 0;
+	frameCount_ = 0;
+	framesPlayed_ = 0;
+}
+
+bool ReplayPlayer::NextFrame(float& deltaTime)
+{
+	std::size_t maskBytes = MaskBytes(state_.size());
+	if (framesPlayed_ == frameCount_ || position_ + sizeof(float) + maskBytes > data_.size()) {
+		return false;
+	}
+
+	std::memcpy(&deltaTime, data_.data() + position_, sizeof(float));
+	const std::byte* mask = data_.data() + position_ + sizeof(float);
+	std::size_t position = position_ + sizeof(float) + maskBytes;
+
+	for (std::size_t word = 0; word * WordSize < state_.size(); ++word) {
+		if ((mask[word / 8] & std::byte(1 << (word % 8))) == std::byte(0)) {
+			continue;
+		}
+		if (position + WordSize > data_.size()) {
+			return false;
+		}
+		std::memcpy(state_.data() + word * WordSize, data_.data() + position, WordSize);
+		position += WordSize;
+	}
+
+	position_ = position;
+	++framesPlayed_;
+	return true;
+}
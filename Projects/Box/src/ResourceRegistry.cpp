@@ -0,0 +1,197 @@
+module;
+// C
+#include <cassert>
+#include <cstdint>
+
+// Windows
+#include <d3d11.h>
+#include <wrl.h>
+
+export module resource.registry;
+
+import <tuple>;
+import <utility>;
+import <vector>;
+
+// 32-bit reference to an object in a ResourcePool: 20 bits of slot index and
+// 12 bits of generation. The generation changes when the object is released,
+// so stale handles are detected instead of silently aliasing a new object.
+// A default-constructed handle is null.
+export template <typename T>
+class Handle
+{
+public:
+	static constexpr std::uint32_t IndexBits = 20;
+	static constexpr std::uint32_t GenerationBits = 12;
+	static constexpr std::uint32_t MaxIndex = (1u << IndexBits) - 1;
+	static constexpr std::uint32_t MaxGeneration = (1u << GenerationBits) - 1;
+
+	constexpr Handle() = default;
+	constexpr Handle(std::uint32_t index, std::uint32_t generation)
+		: value_((generation << IndexBits) | index)
+	{
+	}
+
+	constexpr std::uint32_t Index() const { return value_ & MaxIndex; }
+	constexpr std::uint32_t Generation() const { return value_ >> IndexBits; }
+	constexpr std::uint32_t Value() const { return value_; }
+
+	constexpr explicit operator bool() const { return value_ != 0; }
+	constexpr bool operator==(const Handle&) const = default;
+
+private:
+	std::uint32_t value_ = 0;
+};
+
+// Dense slot array addressed by Handle<Tag>. Released objects are destroyed
+// once the frame they were released in has completed on the GPU, and only
+// then is their slot reused. Pointers returned by Get() are invalidated by Add().
+export template <typename T, typename Tag = T>
+class ResourcePool
+{
+public:
+	using HandleType = Handle<Tag>;
+
+public:
+	HandleType Add(T object)
+	{
+		std::uint32_t index;
+		if (!freeSlots_.empty()) {
+			index = freeSlots_.back();
+			freeSlots_.pop_back();
+		}
+		else {
+			index = static_cast<std::uint32_t>(objects_.size());
+			assert(index <= HandleType::MaxIndex);
+			objects_.emplace_back();
+			generations_.push_back(1);
+		}
+
+		objects_[index] = std::move(object);
+		return HandleType(index, generations_[index]);
+	}
+
+	T* Get(HandleType handle)
+	{
+		return const_cast<T*>(std::as_const(*this).Get(handle));
+	}
+
+	const T* Get(HandleType handle) const
+	{
+		if (!handle) {
+			return nullptr;
+		}
+		bool alive = IsAlive(handle);
+		assert(alive && "Use of a released resource handle");
+		return alive ? &objects_[handle.Index()] : nullptr;
+	}
+
+	bool IsAlive(HandleType handle) const
+	{
+		return handle && handle.Index() < generations_.size() && generations_[handle.Index()] == handle.Generation();
+	}
+
+	// The object stays intact until Collect() sees that frame completed.
+	void Release(HandleType handle, std::uint64_t frame)
+	{
+		if (!IsAlive(handle)) {
+			return;
+		}
+
+		std::uint32_t index = handle.Index();
+		std::uint16_t& generation = generations_[index];
+		generation = generation == HandleType::MaxGeneration ? 1 : static_cast<std::uint16_t>(generation + 1);
+		pendingReleases_.push_back({ index, frame });
+	}
+
+	// Destroys objects released in frames before completedFrames.
+	void Collect(std::uint64_t completedFrames)
+	{
+		std::size_t collected = 0;
+		for (; collected < pendingReleases_.size() && pendingReleases_[collected].Frame < completedFrames; ++collected) {
+			std::uint32_t index = pendingReleases_[collected].Index;
+			objects_[index] = T{};
+			freeSlots_.push_back(index);
+		}
+		pendingReleases_.erase(pendingReleases_.begin(), pendingReleases_.begin() + collected);
+	}
+
+private:
+	struct PendingRelease
+	{
+		std::uint32_t Index;
+		std::uint64_t Frame;
+	};
+
+	std::vector<T> objects_;
+	std::vector<std::uint16_t> generations_;
+	std::vector<std::uint32_t> freeSlots_;
+	std::vector<PendingRelease> pendingReleases_;
+};
+
+export using BufferHandle = Handle<ID3D11Buffer>;
+export using VertexShaderHandle = Handle<ID3D11VertexShader>;
+export using PixelShaderHandle = Handle<ID3D11PixelShader>;
+export using InputLayoutHandle = Handle<ID3D11InputLayout>;
+export using RasterizerStateHandle = Handle<ID3D11RasterizerState>;
+export using DepthStencilStateHandle = Handle<ID3D11DepthStencilState>;
+
+// Owns the D3D11 objects used by render code, which refers to them through
+// handles. Resolving a handle yields a raw pointer, so per-frame code does no
+// reference counting.
+export class ResourceRegistry
+{
+public:
+	template <typename T>
+	Handle<T> Add(Microsoft::WRL::ComPtr<T> object)
+	{
+		return Pool<T>().Add(std::move(object));
+	}
+
+	template <typename T>
+	T* Get(Handle<T> handle) const
+	{
+		const Microsoft::WRL::ComPtr<T>* object = Pool<T>().Get(handle);
+		return object ? object->Get() : nullptr;
+	}
+
+	template <typename T>
+	void Release(Handle<T> handle)
+	{
+		Pool<T>().Release(handle, currentFrame_);
+	}
+
+	// currentFrame is the frame being recorded, completedFrames the number of
+	// frames the GPU has finished.
+	void BeginFrame(std::uint64_t currentFrame, std::uint64_t completedFrames)
+	{
+		currentFrame_ = currentFrame;
+		std::apply([completedFrames](auto&... pools) { (pools.Collect(completedFrames), ...); }, pools_);
+	}
+
+	std::uint64_t CurrentFrame() const { return currentFrame_; }
+
+private:
+	template <typename T>
+	using ComPool = ResourcePool<Microsoft::WRL::ComPtr<T>, T>;
+
+	template <typename T>
+	ComPool<T>& Pool() { return std::get<ComPool<T>>(pools_); }
+
+	template <typename T>
+	const ComPool<T>& Pool() const { return std::get<ComPool<T>>(pools_); }
+
+private:
+	std::tuple<
+		ComPool<ID3D11Buffer>,
+		ComPool<ID3D11VertexShader>,
+		ComPool<ID3D11PixelShader>,
+		ComPool<ID3D11InputLayout>,
+		ComPool<ID3D11RasterizerState>,
+		ComPool<ID3D11DepthStencilState>
+	> pools_;
+
+	std::uint64_t currentFrame_ = 0;
+};
+
+module :private;
@@ -0,0 +1,380 @@
+module;
+// C
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Windows
+#include <DirectXMath.h>
+
+export module scene.graph;
+
+import <algorithm>;
+import <atomic>;
+import <vector>;
+
+import core.threading;
+
+export using SceneNode = std::uint32_t;
+export constexpr SceneNode InvalidSceneNode = UINT32_MAX;
+
+export struct NodeTransform
+{
+	DirectX::XMFLOAT3 Position = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+	// Pitch, yaw and roll in radians.
+	DirectX::XMFLOAT3 Rotation = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+	DirectX::XMFLOAT3 Scale = DirectX::XMFLOAT3(1.0f, 1.0f, 1.0f);
+
+	bool operator==(const NodeTransform& other) const
+	{
+		return std::memcmp(this, &other, sizeof(NodeTransform)) == 0;
+	}
+};
+
+// Transform hierarchy stored as flat arrays sorted by depth: every node comes
+// after its parent, so one pass over the arrays updates the whole tree, and
+// all nodes of a level can be updated in parallel.
+//
+// Nodes are referred to by stable handles. Setting a local transform only
+// marks the node; Update() recomputes the world matrices of the marked nodes
+// and their descendants and leaves everything else untouched. Creating or
+// destroying nodes re-sorts the arrays on the next Update().
+export class SceneGraph
+{
+public:
+	// Levels smaller than this are updated on the calling thread.
+	static constexpr std::size_t ParallelThreshold = 4096;
+	static constexpr std::size_t BatchSize = 1024;
+
+public:
+	explicit SceneGraph(ThreadPool* threadPool = ThreadPool::Default());
+
+	SceneNode CreateNode(SceneNode parent = InvalidSceneNode, const NodeTransform& local = {});
+
+	// Destroys the node and its descendants.
+	void DestroyNode(SceneNode node);
+
+	void SetLocalTransform(SceneNode node, const NodeTransform& local);
+	const NodeTransform& LocalTransform(SceneNode node) const { return records_[node].Local; }
+
+	// Valid after Update().
+	const DirectX::XMFLOAT4X4& WorldMatrix(SceneNode node) const { return worlds_[records_[node].Slot]; }
+
+	void Update();
+
+	std::size_t NodeCount() const { return nodeCount_; }
+	std::size_t Depth() const { return levelStarts_.empty() ? 0 : levelStarts_.size() - 1; }
+
+	// World matrices recomputed by the last Update().
+	std::size_t RecomputedLastUpdate() const { return recomputed_; }
+
+private:
+	struct Record
+	{
+		NodeTransform Local;
+		SceneNode Parent = InvalidSceneNode;
+		std::uint32_t Depth = 0;
+		// Position in the sorted arrays.
+		std::uint32_t Slot = 0;
+		bool Alive = false;
+		bool Dirty = false;
+	};
+
+	static constexpr std::uint32_t NoParent = UINT32_MAX;
+
+	void Rebuild();
+	std::size_t UpdateRange(std::size_t begin, std::size_t end);
+
+private:
+	ThreadPool* threadPool_;
+
+	// Indexed by handle.
+	std::vector<Record> records_;
+	std::vector<SceneNode> freeHandles_;
+	std::vector<SceneNode> dirtyNodes_;
+	std::size_t nodeCount_ = 0;
+	bool layoutChanged_ = false;
+
+	// Indexed by slot, sorted by depth.
+	std::vector<std::uint32_t> parents_;
+	std::vector<SceneNode> handles_;
+	std::vector<DirectX::XMFLOAT4X4> locals_;
+	std::vector<DirectX::XMFLOAT4X4> worlds_;
+	std::vector<std::uint8_t> dirty_;
+	std::vector<std::size_t> levelStarts_;
+
+	std::size_t recomputed_ = 0;
+};
+
+// View and projection matrices that are only rebuilt when their inputs change.
+export class CameraCache
+{
+public:
+	// rotation is pitch, yaw and roll in radians. The camera looks along +z.
+	void SetView(const DirectX::XMFLOAT3& position, const DirectX::XMFLOAT3& rotation);
+	void SetView(const DirectX::XMFLOAT4X4& view);
+	void SetProjection(float fieldOfView, float aspectRatio, float nearZ, float farZ);
+
+	const DirectX::XMFLOAT4X4& View();
+	const DirectX::XMFLOAT4X4& ViewProjection();
+
+	// Matrices rebuilt so far.
+	std::size_t Recomputations() const { return recomputations_; }
+
+private:
+	DirectX::XMFLOAT3 position_ = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+	DirectX::XMFLOAT3 rotation_ = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+	float projection_[4] = {};
+
+	DirectX::XMFLOAT4X4 view_;
+	DirectX::XMFLOAT4X4 viewProjection_;
+	bool viewDirty_ = true;
+	bool projectionDirty_ = true;
+	bool viewProjectionDirty_ = true;
+	std::size_t recomputations_ = 0;
+};
+
+module :private;
+
+namespace
+{
+	DirectX::XMMATRIX LocalMatrix(const NodeTransform& transform)
+	{
+		return DirectX::XMMatrixScalingFromVector(DirectX::XMLoadFloat3(&transform.Scale)) *
+			DirectX::XMMatrixRotationRollPitchYawFromVector(DirectX::XMLoadFloat3(&transform.Rotation)) *
+			DirectX::XMMatrixTranslationFromVector(DirectX::XMLoadFloat3(&transform.Position));
+	}
+}
+
+SceneGraph::SceneGraph(ThreadPool* threadPool)
+	: threadPool_(threadPool)
+{
+}
+
+SceneNode SceneGraph::CreateNode(SceneNode parent, const NodeTransform& local)
+{
+	assert(parent == InvalidSceneNode || (parent < records_.size() && records_[parent].Alive));
+
+	SceneNode node;
+	if (!freeHandles_.empty()) {
+		node = freeHandles_.back();
+		freeHandles_.pop_back();
+	}
+	else {
+		node = static_cast<SceneNode>(records_.size());
+		records_.emplace_back();
+	}
+
+	Record& record = records_[node];
+	record.Local = local;
+	record.Parent = parent;
+	record.Depth = parent != InvalidSceneNode ? records_[parent].Depth + 1 : 0;
+	record.Alive = true;
+	record.Dirty = false;
+
+	++nodeCount_;
+	layoutChanged_ = true;
+	return node;
+}
+
+void SceneGraph::DestroyNode(SceneNode node)
+{
+	assert(node < records_.size() && records_[node].Alive);
+
+	records_[node].Alive = false;
+	freeHandles_.push_back(node);
+	--nodeCount_;
+	layoutChanged_ = true;
+
+	// Nodes only know their parent, so sweep until no node is left under a
+	// destroyed one. Each sweep takes one more level of the subtree.
+	bool destroyed = true;
+	while (destroyed) {
+		destroyed = false;
+		for (SceneNode child = 0; child < records_.size(); ++child) {
+			Record& record = records_[child];
+			if (record.Alive && record.Parent != InvalidSceneNode && !records_[record.Parent].Alive) {
+				record.Alive = false;
+				freeHandles_.push_back(child);
+				--nodeCount_;
+				destroyed = true;
+			}
+		}
+	}
+}
+
+void SceneGraph::SetLocalTransform(SceneNode node, const NodeTransform& local)
+{
+	Record& record = records_[node];
+	assert(record.Alive);
+
+	record.Local = local;
+	if (!record.Dirty) {
+		record.Dirty = true;
+		dirtyNodes_.push_back(node);
+	}
+}
+
+void SceneGraph::Update()
+{
+	if (layoutChanged_) {
+		Rebuild();
+	}
+
+	for (SceneNode node : dirtyNodes_) {
+		Record& record = records_[node];
+		record.Dirty = false;
+		if (!record.Alive) {
+			continue;
+		}
+		DirectX::XMStoreFloat4x4(&locals_[record.Slot], LocalMatrix(record.Local));
+		dirty_[record.Slot] = 1;
+	}
+	dirtyNodes_.clear();
+
+	// Each level only reads the level above it, which is already done.
+	std::atomic<std::size_t> recomputed = 0;
+	for (std::size_t level = 0; level + 1 < levelStarts_.size(); ++level) {
+		std::size_t begin = levelStarts_[level];
+		std::size_t end = levelStarts_[level + 1];
+
+		if (end - begin < ParallelThreshold) {
+			recomputed += UpdateRange(begin, end);
+			continue;
+		}
+
+		threadPool_->ParallelFor((end - begin + BatchSize - 1) / BatchSize, [&](std::size_t batch) {
+			std::size_t batchBegin = begin + batch * BatchSize;
+			recomputed += UpdateRange(batchBegin, std::min(batchBegin + BatchSize, end));
+		});
+	}
+	recomputed_ = recomputed;
+
+	std::fill(dirty_.begin(), dirty_.end(), std::uint8_t(0));
+}
+
+std::size_t SceneGraph::UpdateRange(std::size_t begin, std::size_t end)
+{
+	std::size_t recomputed = 0;
+	for (std::size_t slot = begin; slot < end; ++slot) {
+		std::uint32_t parent = parents_[slot];
+		if (parent != NoParent && dirty_[parent]) {
+			dirty_[slot] = 1;
+		}
+		if (!dirty_[slot]) {
+			continue;
+		}
+
+		DirectX::XMMATRIX world = DirectX::XMLoadFloat4x4(&locals_[slot]);
+		if (parent != NoParent) {
+			world *= DirectX::XMLoadFloat4x4(&worlds_[parent]);
+		}
+		DirectX::XMStoreFloat4x4(&worlds_[slot], world);
+		++recomputed;
+	}
+	return recomputed;
+}
+
+void SceneGraph::Rebuild()
+{
+	handles_.clear();
+	std::uint32_t maxDepth = 0;
+	for (SceneNode node = 0; node < records_.size(); ++node) {
+		if (records_[node].Alive) {
+			handles_.push_back(node);
+			maxDepth = std::max(maxDepth, records_[node].Depth);
+		}
+	}
+
+	// Counting sort by depth. Within a level nodes keep handle order.
+	levelStarts_.assign(handles_.empty() ? 0 : maxDepth + 2, 0);
+	for (SceneNode node : handles_) {
+		++levelStarts_[records_[node].Depth + 1];
+	}
+	for (std::size_t level = 1; level < levelStarts_.size(); ++level) {
+		levelStarts_[level] += levelStarts_[level - 1];
+	}
+
+	std::vector<std::size_t> next(levelStarts_.begin(), levelStarts_.end());
+	std::vector<SceneNode> sorted(handles_.size());
+	for (SceneNode node : handles_) {
+		std::size_t slot = next[records_[node].Depth]++;
+		sorted[slot] = node;
+		records_[node].Slot = static_cast<std::uint32_t>(slot);
+	}
+	handles_.swap(sorted);
+
+	parents_.resize(handles_.size());
+	locals_.resize(handles_.size());
+	worlds_.resize(handles_.size());
+	dirty_.assign(handles_.size(), 1);
+	for (std::size_t slot = 0; slot < handles_.size(); ++slot) {
+		const Record& record = records_[handles_[slot]];
+		parents_[slot] = record.Parent != InvalidSceneNode ? records_[record.Parent].Slot : NoParent;
+		DirectX::XMStoreFloat4x4(&locals_[slot], LocalMatrix(record.Local));
+	}
+
+	layoutChanged_ = false;
+}
+
+void CameraCache::SetView(const DirectX::XMFLOAT3& position, const DirectX::XMFLOAT3& rotation)
+{
+	if (std::memcmp(&position, &position_, sizeof(position)) == 0 && std::memcmp(&rotation, &rotation_, sizeof(rotation)) == 0 && !viewDirty_) {
+		return;
+	}
+
+	position_ = position;
+	rotation_ = rotation;
+
+	DirectX::XMMATRIX cameraRotation = DirectX::XMMatrixRotationRollPitchYawFromVector(DirectX::XMLoadFloat3(&rotation));
+	DirectX::XMVECTOR cameraForward = DirectX::XMVector3Transform(DirectX::XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f), cameraRotation);
+	DirectX::XMVECTOR cameraFocus = DirectX::XMVectorAdd(DirectX::XMLoadFloat3(&position), cameraForward);
+	DirectX::XMStoreFloat4x4(&view_, DirectX::XMMatrixLookAtLH(DirectX::XMLoadFloat3(&position), cameraFocus, DirectX::XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f)));
+
+	++recomputations_;
+	viewDirty_ = false;
+	viewProjectionDirty_ = true;
+}
+
+void CameraCache::SetView(const DirectX::XMFLOAT4X4& view)
+{
+	if (std::memcmp(&view, &view_, sizeof(view)) == 0 && !viewDirty_) {
+		return;
+	}
+
+	view_ = view;
+	viewDirty_ = false;
+	viewProjectionDirty_ = true;
+}
+
+void CameraCache::SetProjection(float fieldOfView, float aspectRatio, float nearZ, float farZ)
+{
+	float projection[4] = { fieldOfView, aspectRatio, nearZ, farZ };
+	if (std::memcmp(projection, projection_, sizeof(projection)) == 0 && !projectionDirty_) {
+		return;
+	}
+
+	std::memcpy(projection_, projection, sizeof(projection));
+	projectionDirty_ = false;
+	viewProjectionDirty_ = true;
+}
+
+const DirectX::XMFLOAT4X4& CameraCache::View()
+{
+	assert(!viewDirty_);
+	return view_;
+}
+
+const DirectX::XMFLOAT4X4& CameraCache::ViewProjection()
+{
+	assert(!viewDirty_ && !projectionDirty_);
+
+	if (viewProjectionDirty_) {
+		DirectX::XMMATRIX P = DirectX::XMMatrixPerspectiveFovLH(projection_[0], projection_[1], projection_[2], projection_[3]);
+		DirectX::XMStoreFloat4x4(&viewProjection_, DirectX::XMLoadFloat4x4(&view_) * P);
+		++recomputations_;
+		viewProjectionDirty_ = false;
+	}
+	return viewProjection_;
+}
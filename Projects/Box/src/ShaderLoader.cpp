@@ -5,10 +5,10 @@ module;
 
 export module resource.shader;
 
-import <iostream>;
 import <span>;
 import <string>;
 
+import diagnostics.log;
 import utility;
 
 export class ShaderLoader
@@ -22,10 +22,20 @@ public:
 	Microsoft::WRL::ComPtr<ID3DBlob> LoadPixelShader(std::wstring_view filename,
 		std::span<const D3D_SHADER_MACRO> macros = {});
 
+	// Compiles source that is already in memory, e.g. read from the virtual file system.
+	// sourceName is only used in compiler messages.
+	Microsoft::WRL::ComPtr<ID3DBlob> LoadVertexShader(std::span<const std::byte> source,
+		std::string_view sourceName, std::span<const D3D_SHADER_MACRO> macros = {});
+	Microsoft::WRL::ComPtr<ID3DBlob> LoadPixelShader(std::span<const std::byte> source,
+		std::string_view sourceName, std::span<const D3D_SHADER_MACRO> macros = {});
+
 private:
 	Microsoft::WRL::ComPtr<ID3DBlob> LoadShader(std::wstring_view filename,
 		std::string_view entrypoint, std::string_view target,
 		std::span<const D3D_SHADER_MACRO> macros);
+	Microsoft::WRL::ComPtr<ID3DBlob> LoadShader(std::span<const std::byte> source,
+		std::string_view sourceName, std::string_view entrypoint, std::string_view target,
+		std::span<const D3D_SHADER_MACRO> macros);
 };
 
 module :private;
@@ -48,6 +58,18 @@ Microsoft::WRL::ComPtr<ID3DBlob> ShaderLoader::LoadPixelShader(std::wstring_view
 	return LoadShader(filename, "main", "ps_5_0", macros);
 }
 
+Microsoft::WRL::ComPtr<ID3DBlob> ShaderLoader::LoadVertexShader(std::span<const std::byte> source,
+	std::string_view sourceName, std::span<const D3D_SHADER_MACRO> macros)
+{
+	return LoadShader(source, sourceName, "main", "vs_5_0", macros);
+}
+
+Microsoft::WRL::ComPtr<ID3DBlob> ShaderLoader::LoadPixelShader(std::span<const std::byte> source,
+	std::string_view sourceName, std::span<const D3D_SHADER_MACRO> macros)
+{
+	return LoadShader(source, sourceName, "main", "ps_5_0", macros);
+}
+
 Microsoft::WRL::ComPtr<ID3DBlob> ShaderLoader::LoadShader(std::wstring_view filename,
 	std::string_view entrypoint, std::string_view target,
 	std::span<const D3D_SHADER_MACRO> macros)
@@ -73,13 +95,50 @@ Microsoft::WRL::ComPtr<ID3DBlob> ShaderLoader::LoadShader(std::wstring_view file
 
 	if (FAILED(hr)) {
 		if ((hr & D3D11_ERROR_FILE_NOT_FOUND) != 0) {
-			std::cerr << "File not found.\n";
+			LogError(LogCategory::Shader, "File not found.");
 		}
 
 		if (errorMessage) {
-			std::cerr << "Shader compile error: " << static_cast<char*>(errorMessage->GetBufferPointer()) << "\n";
+			LogError(LogCategory::Shader, "Shader compile error: {}", static_cast<char*>(errorMessage->GetBufferPointer()));
 		}
 	}
 
 	return compiledShader;
 }
+
+Microsoft::WRL::ComPtr<ID3DBlob> ShaderLoader::LoadShader(std::span<const std::byte> source,
+	std::string_view sourceName, std::string_view entrypoint, std::string_view target,
+	std::span<const D3D_SHADER_MACRO> macros)
+{
+	if (source.empty()) {
+		LogError(LogCategory::Shader, "Shader source is empty: {}", sourceName);
+		return nullptr;
+	}
+
+	UINT compileFlags = 0;
+#if defined(DEBUG) || defined(_DEBUG)
+	compileFlags = D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION;
+#endif
+
+	Microsoft::WRL::ComPtr<ID3DBlob> compiledShader;
+	Microsoft::WRL::ComPtr<ID3DBlob> errorMessage;
+
+	std::string name(sourceName);
+	HRESULT hr = D3DCompile(
+		source.data(), source.size(),
+		name.c_str(),
+		macros.empty() ? nullptr : macros.data(),
+		D3D_COMPILE_STANDARD_FILE_INCLUDE,
+		entrypoint.data(),
+		target.data(),
+		compileFlags, 0,
+		compiledShader.GetAddressOf(),
+		errorMessage.GetAddressOf()
+	);
+
+	if (FAILED(hr) && errorMessage) {
+		LogError(LogCategory::Shader, "Shader compile error: {}", static_cast<char*>(errorMessage->GetBufferPointer()));
+	}
+
+	return compiledShader;
+}
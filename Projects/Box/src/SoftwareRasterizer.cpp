@@ -0,0 +1,649 @@
+module;
+// C
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+export module render.software;
+
+import <algorithm>;
+import <array>;
+import <span>;
+import <vector>;
+
+import render.capture;
+
+// Replays captures on the CPU and rasterizes them, so frames can be rendered
+// and compared where there is no GPU. Shaders can not be run, so the target
+// implements the demos' own: the vertex shader transforms POSITION by the
+// matrix in vertex constant buffer 0 (ColorVertexShader.hlsl) or passes it
+// through when no buffer is bound there, and the pixel shader outputs the
+// interpolated COLOR. Without a pixel shader only depth is written.
+//
+// Triangles and lines are clipped in clip space and rasterized with the
+// top-left fill rule at pixel centres, with perspective-correct colour,
+// depth testing and culling as the bound states describe. Results match
+// Direct3D up to rounding at edges, not bit for bit.
+export class SoftwareCaptureTarget : public CaptureTarget
+{
+public:
+	bool Load(const CaptureFile& capture) override;
+	void BeginFrame() override;
+	void Execute(CaptureCommand command, std::span<const std::byte> payload) override;
+
+	int Width() const { return width_; }
+	int Height() const { return height_; }
+	// RGBA8, Width() * 4 bytes per row.
+	const std::vector<std::uint8_t>& Pixels() const { return color_; }
+
+private:
+	struct Attribute
+	{
+		std::uint32_t Slot = 0;
+		std::uint32_t Offset = 0;
+		std::uint32_t Format = 0;
+		bool Present = false;
+	};
+
+	struct Object
+	{
+		CaptureObjectKind Kind;
+		std::vector<std::byte> Contents;
+		Attribute Position;
+		Attribute Color;
+	};
+
+	struct Vertex
+	{
+		std::array<float, 4> Clip;
+		std::array<float, 4> Color;
+	};
+
+	Object* Find(CaptureObject id, CaptureObjectKind kind);
+	bool FetchVertex(std::uint32_t index, Vertex& vertex);
+	void DrawPrimitives(std::span<const Vertex> vertices);
+	void DrawTriangle(const Vertex& a, const Vertex& b, const Vertex& c);
+	void FillTriangle(const Vertex& a, const Vertex& b, const Vertex& c);
+	void DrawLine(const Vertex& a, const Vertex& b);
+	void WritePixel(int x, int y, float depth, const std::array<float, 4>& color);
+
+	std::vector<Object> objects_;
+	int width_ = 0;
+	int height_ = 0;
+	std::vector<std::uint8_t> color_;
+	std::vector<float> depth_;
+
+	std::uint32_t topology_ = 0;
+	CaptureObject inputLayout_ = NullCaptureObject;
+	CaptureObject pixelShader_ = NullCaptureObject;
+	CaptureObject rasterizerState_ = NullCaptureObject;
+	CaptureObject depthStencilState_ = NullCaptureObject;
+	CaptureObject transform_ = NullCaptureObject;
+	std::array<CaptureVertexBuffer, 16> vertexBuffers_{};
+	CaptureVertexBuffer indexBuffer_{};
+
+	// The bound states, resolved per draw.
+	std::uint32_t fillMode_ = 0;
+	std::uint32_t cullMode_ = 0;
+	bool frontCounterClockwise_ = false;
+	bool depthEnable_ = false;
+	bool depthWrite_ = false;
+	std::uint32_t depthFunc_ = 0;
+	std::vector<Vertex> vertices_;
+};
+
+module :private;
+
+namespace
+{
+	// The D3D11 values the rasterizer needs.
+	constexpr std::uint32_t LineList = 2;
+	constexpr std::uint32_t LineStrip = 3;
+	constexpr std::uint32_t TriangleList = 4;
+	constexpr std::uint32_t TriangleStrip = 5;
+	constexpr std::uint32_t IndexFormat16 = 57;
+
+	constexpr std::uint32_t FormatR32G32B32A32Float = 2;
+	constexpr std::uint32_t FormatR32G32B32Float = 6;
+	constexpr std::uint32_t FormatR32G32Float = 16;
+	constexpr std::uint32_t FormatR8G8B8A8Unorm = 28;
+
+	constexpr std::uint32_t FillWireframe = 2;
+	constexpr std::uint32_t CullNone = 1;
+	constexpr std::uint32_t CullFront = 2;
+	constexpr std::uint32_t CullBack = 3;
+
+	constexpr std::uint32_t ComparisonNever = 1;
+	constexpr std::uint32_t ComparisonLess = 2;
+	constexpr std::uint32_t ComparisonEqual = 3;
+	constexpr std::uint32_t ComparisonLessEqual = 4;
+	constexpr std::uint32_t ComparisonGreater = 5;
+	constexpr std::uint32_t ComparisonNotEqual = 6;
+	constexpr std::uint32_t ComparisonGreaterEqual = 7;
+
+	// Offsets of the fields read from D3D11_RASTERIZER_DESC and
+	// D3D11_DEPTH_STENCIL_DESC.
+	constexpr std::size_t FillModeOffset = 0;
+	constexpr std::size_t CullModeOffset = 4;
+	constexpr std::size_t FrontCounterClockwiseOffset = 8;
+	constexpr std::size_t DepthEnableOffset = 0;
+	constexpr std::size_t DepthWriteMaskOffset = 4;
+	constexpr std::size_t DepthFuncOffset = 8;
+
+	using Vector4 = std::array<float, 4>;
+
+	bool PassesDepth(std::uint32_t func, float depth, float stored)
+	{
+		switch (func) {
+		case ComparisonNever: return false;
+		case ComparisonLess: return depth < stored;
+		case ComparisonEqual: return depth == stored;
+		case ComparisonLessEqual: return depth <= stored;
+		case ComparisonGreater: return depth > stored;
+		case ComparisonNotEqual: return depth != stored;
+		case ComparisonGreaterEqual: return depth >= stored;
+		default: return true;
+		}
+	}
+
+	// Distance of a clip space position inside one of the six frustum
+	// planes: -w <= x, y <= w and 0 <= z <= w.
+	float PlaneDistance(const Vector4& clip, int plane)
+	{
+		switch (plane) {
+		case 0: return clip[3] + clip[0];
+		case 1: return clip[3] - clip[0];
+		case 2: return clip[3] + clip[1];
+		case 3: return clip[3] - clip[1];
+		case 4: return clip[2];
+		default: return clip[3] - clip[2];
+		}
+	}
+
+	std::uint8_t ToUnorm(float value)
+	{
+		return static_cast<std::uint8_t>(std::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+	}
+}
+
+bool SoftwareCaptureTarget::Load(const CaptureFile& capture)
+{
+	width_ = static_cast<int>(std::max(capture.Width(), 1u));
+	height_ = static_cast<int>(std::max(capture.Height(), 1u));
+	color_.assign(std::size_t(width_) * height_ * 4, 0);
+	depth_.assign(std::size_t(width_) * height_, 1.0f);
+
+	objects_.clear();
+	objects_.reserve(capture.Objects().size());
+	for (const CaptureRecord& record : capture.Objects()) {
+		Object object{ static_cast<CaptureObjectKind>(record.Type) };
+		if (object.Kind == CaptureObjectKind::Buffer) {
+			std::span<const std::byte> contents = record.Payload.subspan(std::min(sizeof(CaptureBufferDesc), record.Payload.size()));
+			object.Contents.assign(contents.begin(), contents.end());
+			object.Contents.resize(ReadCapture<CaptureBufferDesc>(record.Payload).ByteWidth);
+		}
+		else if (object.Kind == CaptureObjectKind::InputLayout) {
+			std::uint32_t count = ReadCapture<std::uint32_t>(record.Payload);
+			for (std::uint32_t i = 0; i < count; ++i) {
+				CaptureInputElement element = ReadCapture<CaptureInputElement>(record.Payload, 4 + i * sizeof(CaptureInputElement));
+				Attribute attribute{ element.InputSlot, element.AlignedByteOffset, element.Format, true };
+				if (element.SemanticIndex != 0) {
+					continue;
+				}
+				if (std::strncmp(element.SemanticName.data(), "POSITION", element.SemanticName.size()) == 0) {
+					object.Position = attribute;
+				}
+				else if (std::strncmp(element.SemanticName.data(), "COLOR", element.SemanticName.size()) == 0) {
+					object.Color = attribute;
+				}
+			}
+		}
+		else {
+			// States are read when they are bound.
+			object.Contents.assign(record.Payload.begin(), record.Payload.end());
+		}
+		objects_.push_back(std::move(object));
+	}
+	return true;
+}
+
+void SoftwareCaptureTarget::BeginFrame()
+{
+	// The same cleared target and default state D3D11CaptureTarget starts with.
+	std::fill(color_.begin(), color_.end(), std::uint8_t(0));
+	for (std::size_t i = 3; i < color_.size(); i += 4) {
+		color_[i] = 255;
+	}
+	std::fill(depth_.begin(), depth_.end(), 1.0f);
+
+	topology_ = 0;
+	inputLayout_ = NullCaptureObject;
+	pixelShader_ = NullCaptureObject;
+	rasterizerState_ = NullCaptureObject;
+	depthStencilState_ = NullCaptureObject;
+	transform_ = NullCaptureObject;
+	vertexBuffers_.fill(CaptureVertexBuffer{});
+	indexBuffer_ = CaptureVertexBuffer{};
+}
+
+SoftwareCaptureTarget::Object* SoftwareCaptureTarget::Find(CaptureObject id, CaptureObjectKind kind)
+{
+	if (id == NullCaptureObject || id > objects_.size() || objects_[id - 1].Kind != kind) {
+		return nullptr;
+	}
+	return &objects_[id - 1];
+}
+
+void SoftwareCaptureTarget::Execute(CaptureCommand command, std::span<const std::byte> payload)
+{
+	switch (command) {
+	case CaptureCommand::SetPrimitiveTopology:
+		topology_ = ReadCapture<std::uint32_t>(payload);
+		return;
+	case CaptureCommand::SetInputLayout:
+		inputLayout_ = ReadCapture<CaptureObject>(payload);
+		return;
+	case CaptureCommand::SetPixelShader:
+		pixelShader_ = ReadCapture<CaptureObject>(payload);
+		return;
+	case CaptureCommand::SetRasterizerState:
+		rasterizerState_ = ReadCapture<CaptureObject>(payload);
+		return;
+	case CaptureCommand::SetDepthStencilState:
+		depthStencilState_ = ReadCapture<CaptureObject>(payload);
+		return;
+	case CaptureCommand::SetConstantBuffers: {
+		CaptureShaderStage stage = ReadCapture<CaptureShaderStage>(payload);
+		std::uint32_t startSlot = ReadCapture<std::uint32_t>(payload, 4);
+		std::uint32_t count = ReadCapture<std::uint32_t>(payload, 8);
+		if (stage == CaptureShaderStage::Vertex && startSlot == 0 && count > 0) {
+			transform_ = ReadCapture<CaptureObject>(payload, 12);
+		}
+		return;
+	}
+	case CaptureCommand::SetVertexBuffers: {
+		std::uint32_t startSlot = ReadCapture<std::uint32_t>(payload);
+		std::uint32_t count = ReadCapture<std::uint32_t>(payload, 4);
+		for (std::uint32_t i = 0; i < count && startSlot + i < vertexBuffers_.size(); ++i) {
+			vertexBuffers_[startSlot + i] = ReadCapture<CaptureVertexBuffer>(payload, 8 + i * sizeof(CaptureVertexBuffer));
+		}
+		return;
+	}
+	case CaptureCommand::SetIndexBuffer:
+		indexBuffer_.Buffer = ReadCapture<CaptureObject>(payload);
+		indexBuffer_.Stride = ReadCapture<std::uint32_t>(payload, 4) == IndexFormat16 ? 2 : 4;
+		indexBuffer_.Offset = ReadCapture<std::uint32_t>(payload, 8);
+		return;
+	case CaptureCommand::UpdateBuffer:
+		if (Object* buffer = Find(ReadCapture<CaptureObject>(payload), CaptureObjectKind::Buffer)) {
+			std::span<const std::byte> contents = payload.subspan(sizeof(CaptureObject));
+			std::memcpy(buffer->Contents.data(), contents.data(), std::min(contents.size(), buffer->Contents.size()));
+		}
+		return;
+	case CaptureCommand::WriteBuffer: {
+		Object* buffer = Find(ReadCapture<CaptureObject>(payload), CaptureObjectKind::Buffer);
+		std::uint32_t offset = ReadCapture<std::uint32_t>(payload, 4);
+		if (buffer && payload.size() >= 12 && offset <= buffer->Contents.size()) {
+			std::span<const std::byte> contents = payload.subspan(12);
+			std::memcpy(buffer->Contents.data() + offset, contents.data(), std::min(contents.size(), buffer->Contents.size() - offset));
+		}
+		return;
+	}
+	case CaptureCommand::Draw:
+	case CaptureCommand::DrawIndexed:
+		break;
+	default:
+		return;
+	}
+
+	// Null states are the Direct3D defaults.
+	const Object* rasterizer = Find(rasterizerState_, CaptureObjectKind::RasterizerState);
+	fillMode_ = rasterizer ? ReadCapture<std::uint32_t>(rasterizer->Contents, FillModeOffset) : 3;
+	cullMode_ = rasterizer ? ReadCapture<std::uint32_t>(rasterizer->Contents, CullModeOffset) : CullBack;
+	frontCounterClockwise_ = rasterizer && ReadCapture<std::uint32_t>(rasterizer->Contents, FrontCounterClockwiseOffset) != 0;
+
+	const Object* depthStencil = Find(depthStencilState_, CaptureObjectKind::DepthStencilState);
+	depthEnable_ = !depthStencil || ReadCapture<std::uint32_t>(depthStencil->Contents, DepthEnableOffset) != 0;
+	depthWrite_ = !depthStencil || ReadCapture<std::uint32_t>(depthStencil->Contents, DepthWriteMaskOffset) != 0;
+	depthFunc_ = depthStencil ? ReadCapture<std::uint32_t>(depthStencil->Contents, DepthFuncOffset) : ComparisonLess;
+
+	vertices_.clear();
+	Vertex vertex;
+	if (command == CaptureCommand::Draw) {
+		std::uint32_t vertexCount = ReadCapture<std::uint32_t>(payload);
+		std::uint32_t startVertex = ReadCapture<std::uint32_t>(payload, 4);
+		for (std::uint32_t i = 0; i < vertexCount; ++i) {
+			if (!FetchVertex(startVertex + i, vertex)) {
+				return;
+			}
+			vertices_.push_back(vertex);
+		}
+	}
+	else {
+		std::uint32_t indexCount = ReadCapture<std::uint32_t>(payload);
+		std::uint32_t startIndex = ReadCapture<std::uint32_t>(payload, 4);
+		std::int32_t baseVertex = ReadCapture<std::int32_t>(payload, 8);
+
+		const Object* indices = Find(indexBuffer_.Buffer, CaptureObjectKind::Buffer);
+		std::size_t first = indexBuffer_.Offset + std::size_t(startIndex) * indexBuffer_.Stride;
+		if (!indices || first + std::size_t(indexCount) * indexBuffer_.Stride > indices->Contents.size()) {
+			return;
+		}
+		for (std::uint32_t i = 0; i < indexCount; ++i) {
+			std::uint32_t index = 0;
+			std::memcpy(&index, indices->Contents.data() + first + i * indexBuffer_.Stride, indexBuffer_.Stride);
+			if (!FetchVertex(static_cast<std::uint32_t>(std::int64_t(index) + baseVertex), vertex)) {
+				return;
+			}
+			vertices_.push_back(vertex);
+		}
+	}
+	DrawPrimitives(vertices_);
+}
+
+bool SoftwareCaptureTarget::FetchVertex(std::uint32_t index, Vertex& vertex)
+{
+	const Object* layout = Find(inputLayout_, CaptureObjectKind::InputLayout);
+	if (!layout || !layout->Position.Present) {
+		return false;
+	}
+
+	// Reads an attribute as up to four floats, or fails if its buffer is
+	// too small. Missing components keep their defaults.
+	auto read = [&](const Attribute& attribute, Vector4& value) {
+		const CaptureVertexBuffer& binding = vertexBuffers_[attribute.Slot % vertexBuffers_.size()];
+		const Object* buffer = Find(binding.Buffer, CaptureObjectKind::Buffer);
+		std::size_t offset = binding.Offset + std::size_t(index) * binding.Stride + attribute.Offset;
+		std::size_t size = attribute.Format == FormatR8G8B8A8Unorm ? 4 : attribute.Format == FormatR32G32B32A32Float ? 16 : attribute.Format == FormatR32G32B32Float ? 12 : 8;
+		if (!buffer || offset + size > buffer->Contents.size()) {
+			return false;
+		}
+
+		const std::byte* data = buffer->Contents.data() + offset;
+		if (attribute.Format == FormatR8G8B8A8Unorm) {
+			for (int i = 0; i < 4; ++i) {
+				value[i] = std::to_integer<int>(data[i]) / 255.0f;
+			}
+		}
+		else {
+			std::memcpy(value.data(), data, size);
+		}
+		return attribute.Format == FormatR8G8B8A8Unorm || attribute.Format == FormatR32G32B32A32Float ||
+			attribute.Format == FormatR32G32B32Float || attribute.Format == FormatR32G32Float;
+	};
+
+	Vector4 position = { 0.0f, 0.0f, 0.0f, 1.0f };
+	vertex.Color = { 1.0f, 1.0f, 1.0f, 1.0f };
+	if (!read(layout->Position, position) || (layout->Color.Present && !read(layout->Color, vertex.Color))) {
+		return false;
+	}
+	position[3] = 1.0f;
+
+	// The shader's mul(position, worldViewProjection) reads the transposed
+	// matrix that was uploaded row by row.
+	const Object* transform = Find(transform_, CaptureObjectKind::Buffer);
+	if (transform && transform->Contents.size() >= 16 * sizeof(float)) {
+		float matrix[16];
+		std::memcpy(matrix, transform->Contents.data(), sizeof(matrix));
+		for (int row = 0; row < 4; ++row) {
+			vertex.Clip[row] = matrix[row * 4] * position[0] + matrix[row * 4 + 1] * position[1] + matrix[row * 4 + 2] * position[2] + matrix[row * 4 + 3];
+		}
+	}
+	else {
+		vertex.Clip = position;
+	}
+	return true;
+}
+
+void SoftwareCaptureTarget::DrawPrimitives(std::span<const Vertex> vertices)
+{
+	switch (topology_) {
+	case TriangleList:
+		for (std::size_t i = 0; i + 2 < vertices.size(); i += 3) {
+			DrawTriangle(vertices[i], vertices[i + 1], vertices[i + 2]);
+		}
+		break;
+	case TriangleStrip:
+		// Every other triangle of a strip is flipped to keep the winding.
+		for (std::size_t i = 0; i + 2 < vertices.size(); ++i) {
+			if (i % 2 == 0) {
+				DrawTriangle(vertices[i], vertices[i + 1], vertices[i + 2]);
+			}
+			else {
+				DrawTriangle(vertices[i + 1], vertices[i], vertices[i + 2]);
+			}
+		}
+		break;
+	case LineList:
+		for (std::size_t i = 0; i + 1 < vertices.size(); i += 2) {
+			DrawLine(vertices[i], vertices[i + 1]);
+		}
+		break;
+	case LineStrip:
+		for (std::size_t i = 0; i + 1 < vertices.size(); ++i) {
+			DrawLine(vertices[i], vertices[i + 1]);
+		}
+		break;
+	default:
+		// Points are not rasterized.
+		break;
+	}
+}
+
+void SoftwareCaptureTarget::DrawTriangle(const Vertex& a, const Vertex& b, const Vertex& c)
+{
+	if (fillMode_ == FillWireframe) {
+		// Each edge on its own, so clipping adds no edges of its own.
+		DrawLine(a, b);
+		DrawLine(b, c);
+		DrawLine(c, a);
+		return;
+	}
+
+	// Sutherland-Hodgman against each frustum plane, then a fan.
+	std::array<Vertex, 9> polygon = { a, b, c };
+	std::array<Vertex, 9> clipped;
+	std::size_t count = 3;
+	for (int plane = 0; plane < 6 && count >= 3; ++plane) {
+		std::size_t clippedCount = 0;
+		for (std::size_t i = 0; i < count; ++i) {
+			const Vertex& current = polygon[i];
+			const Vertex& next = polygon[(i + 1) % count];
+			float currentDistance = PlaneDistance(current.Clip, plane);
+			float nextDistance = PlaneDistance(next.Clip, plane);
+			if (currentDistance >= 0.0f) {
+				clipped[clippedCount++] = current;
+			}
+			if ((currentDistance >= 0.0f) != (nextDistance >= 0.0f)) {
+				float t = currentDistance / (currentDistance - nextDistance);
+				Vertex& crossing = clipped[clippedCount++];
+				for (int j = 0; j < 4; ++j) {
+					crossing.Clip[j] = current.Clip[j] + (next.Clip[j] - current.Clip[j]) * t;
+					crossing.Color[j] = current.Color[j] + (next.Color[j] - current.Color[j]) * t;
+				}
+			}
+		}
+		polygon = clipped;
+		count = clippedCount;
+	}
+
+	for (std::size_t i = 1; i + 1 < count; ++i) {
+		FillTriangle(polygon[0], polygon[i], polygon[i + 1]);
+	}
+}
+
+void SoftwareCaptureTarget::FillTriangle(const Vertex& a, const Vertex& b, const Vertex& c)
+{
+	// Screen positions, depth and 1/w, and the colours divided by w for
+	// perspective-correct interpolation.
+	struct Screen
+	{
+		float X, Y, Z, InvW;
+		Vector4 Color;
+	};
+	auto project = [&](const Vertex& vertex) {
+		float invW = 1.0f / vertex.Clip[3];
+		Screen screen{
+			(vertex.Clip[0] * invW * 0.5f + 0.5f) * width_,
+			(0.5f - vertex.Clip[1] * invW * 0.5f) * height_,
+			vertex.Clip[2] * invW,
+			invW };
+		for (int i = 0; i < 4; ++i) {
+			screen.Color[i] = vertex.Color[i] * invW;
+		}
+		return screen;
+	};
+	std::array<Screen, 3> v = { project(a), project(b), project(c) };
+
+	// Positive area is clockwise on screen.
+	float area = (v[1].X - v[0].X) * (v[2].Y - v[0].Y) - (v[1].Y - v[0].Y) * (v[2].X - v[0].X);
+	if (area == 0.0f) {
+		return;
+	}
+	bool front = frontCounterClockwise_ ? area < 0.0f : area > 0.0f;
+	if ((cullMode_ == CullBack && !front) || (cullMode_ == CullFront && front)) {
+		return;
+	}
+	if (area < 0.0f) {
+		std::swap(v[1], v[2]);
+		area = -area;
+	}
+
+	// Edge i is opposite vertex i. Pixels exactly on an edge belong to it if
+	// it is a top or a left edge.
+	struct Edge
+	{
+		float A, B, C;
+		bool TopLeft;
+	};
+	std::array<Edge, 3> edges;
+	for (int i = 0; i < 3; ++i) {
+		const Screen& from = v[(i + 1) % 3];
+		const Screen& to = v[(i + 2) % 3];
+		float dx = to.X - from.X;
+		float dy = to.Y - from.Y;
+		edges[i] = { -dy, dx, dy * from.X - dx * from.Y, dy < 0.0f || (dy == 0.0f && dx > 0.0f) };
+	}
+
+	int minX = std::max(0, static_cast<int>(std::floor(std::min({ v[0].X, v[1].X, v[2].X }))));
+	int maxX = std::min(width_ - 1, static_cast<int>(std::ceil(std::max({ v[0].X, v[1].X, v[2].X }))));
+	int minY = std::max(0, static_cast<int>(std::floor(std::min({ v[0].Y, v[1].Y, v[2].Y }))));
+	int maxY = std::min(height_ - 1, static_cast<int>(std::ceil(std::max({ v[0].Y, v[1].Y, v[2].Y }))));
+	float invArea = 1.0f / area;
+
+	for (int y = minY; y <= maxY; ++y) {
+		float py = y + 0.5f;
+		for (int x = minX; x <= maxX; ++x) {
+			float px = x + 0.5f;
+			std::array<float, 3> weights;
+			bool inside = true;
+			for (int i = 0; i < 3 && inside; ++i) {
+				float e = edges[i].A * px + edges[i].B * py + edges[i].C;
+				inside = e > 0.0f || (e == 0.0f && edges[i].TopLeft);
+				weights[i] = e * invArea;
+			}
+			if (!inside) {
+				continue;
+			}
+
+			float depth = weights[0] * v[0].Z + weights[1] * v[1].Z + weights[2] * v[2].Z;
+			float invW = weights[0] * v[0].InvW + weights[1] * v[1].InvW + weights[2] * v[2].InvW;
+			Vector4 color;
+			for (int i = 0; i < 4; ++i) {
+				color[i] = (weights[0] * v[0].Color[i] + weights[1] * v[1].Color[i] + weights[2] * v[2].Color[i]) / invW;
+			}
+			WritePixel(x, y, depth, color);
+		}
+	}
+}
+
+void SoftwareCaptureTarget::DrawLine(const Vertex& a, const Vertex& b)
+{
+	// Parametric clipping of the segment against the frustum.
+	float enter = 0.0f;
+	float leave = 1.0f;
+	for (int plane = 0; plane < 6; ++plane) {
+		float from = PlaneDistance(a.Clip, plane);
+		float to = PlaneDistance(b.Clip, plane);
+		if (from < 0.0f && to < 0.0f) {
+			return;
+		}
+		if (from < 0.0f) {
+			enter = std::max(enter, from / (from - to));
+		}
+		else if (to < 0.0f) {
+			leave = std::min(leave, from / (from - to));
+		}
+	}
+	if (enter > leave) {
+		return;
+	}
+
+	auto interpolate = [&](float t) {
+		Vertex vertex;
+		for (int i = 0; i < 4; ++i) {
+			vertex.Clip[i] = a.Clip[i] + (b.Clip[i] - a.Clip[i]) * t;
+			vertex.Color[i] = a.Color[i] + (b.Color[i] - a.Color[i]) * t;
+		}
+		return vertex;
+	};
+	Vertex start = interpolate(enter);
+	Vertex end = interpolate(leave);
+
+	float startInvW = 1.0f / start.Clip[3];
+	float endInvW = 1.0f / end.Clip[3];
+	float x0 = (start.Clip[0] * startInvW * 0.5f + 0.5f) * width_;
+	float y0 = (0.5f - start.Clip[1] * startInvW * 0.5f) * height_;
+	float x1 = (end.Clip[0] * endInvW * 0.5f + 0.5f) * width_;
+	float y1 = (0.5f - end.Clip[1] * endInvW * 0.5f) * height_;
+
+	// One pixel per step along the major axis, sampled at pixel centres.
+	float dx = x1 - x0;
+	float dy = y1 - y0;
+	bool xMajor = std::abs(dx) >= std::abs(dy);
+	float length = xMajor ? dx : dy;
+	float origin = xMajor ? x0 : y0;
+	if (length == 0.0f) {
+		return;
+	}
+	int first = static_cast<int>(std::floor(std::min(origin, origin + length) + 0.5f));
+	int last = static_cast<int>(std::floor(std::max(origin, origin + length) + 0.5f)) - 1;
+
+	for (int step = first; step <= last; ++step) {
+		float t = std::clamp((step + 0.5f - origin) / length, 0.0f, 1.0f);
+		int x = xMajor ? step : static_cast<int>(std::floor(x0 + dx * t));
+		int y = xMajor ? static_cast<int>(std::floor(y0 + dy * t)) : step;
+		if (x < 0 || x >= width_ || y < 0 || y >= height_) {
+			continue;
+		}
+
+		float invW = startInvW + (endInvW - startInvW) * t;
+		float depth = start.Clip[2] * startInvW + (end.Clip[2] * endInvW - start.Clip[2] * startInvW) * t;
+		Vector4 color;
+		for (int i = 0; i < 4; ++i) {
+			color[i] = (start.Color[i] * startInvW + (end.Color[i] * endInvW - start.Color[i] * startInvW) * t) / invW;
+		}
+		WritePixel(x, y, depth, color);
+	}
+}
+
+void SoftwareCaptureTarget::WritePixel(int x, int y, float depth, const std::array<float, 4>& color)
+{
+	std::size_t index = std::size_t(y) * width_ + x;
+	if (depthEnable_) {
+		if (!PassesDepth(depthFunc_, depth, depth_[index])) {
+			return;
+		}
+		if (depthWrite_) {
+			depth_[index] = depth;
+		}
+	}
+
+	if (pixelShader_ != NullCaptureObject) {
+		std::uint8_t* pixel = color_.data() + index * 4;
+		for (int i = 0; i < 4; ++i) {
+			pixel[i] = ToUnorm(color[i]);
+		}
+	}
+}
@@ -3,14 +3,16 @@ module;
 
 export module utility;
 
-import <format>;
-import <iostream>;
 import <vector>;
 
+import diagnostics.log;
+
 export inline void ThrowIfFailed(HRESULT hr)
 {
 	if (FAILED(hr)) {
-		std::cerr << std::format("hr=0x{:X}", hr) << "\n";
+		LogError(LogCategory::General, "hr=0x{:X}", hr);
+		// The exception usually ends the program, so the message is written first.
+		Logger::Default()->Flush();
 		throw std::exception();
 	}
 }
@@ -5,6 +5,8 @@ module;
 export module vertex;
 
 import <array>;
+import <span>;
+import <vector>;
 
 export namespace Vertex
 {
@@ -18,6 +20,38 @@ export namespace Vertex
 			{ "COLOR", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 }
 		} };
 	};
+
+	// PosColor split into one stream per attribute. Depth-only passes bind
+	// just the position stream and fetch 12 bytes per vertex instead of 28.
+	struct PosColorStreams
+	{
+		static constexpr UINT PositionSlot = 0;
+		static constexpr UINT ColorSlot = 1;
+
+		std::vector<DirectX::XMFLOAT3> Positions;
+		std::vector<DirectX::XMFLOAT4> Colors;
+
+		static PosColorStreams Split(std::span<const PosColor> vertices)
+		{
+			PosColorStreams streams;
+			streams.Positions.reserve(vertices.size());
+			streams.Colors.reserve(vertices.size());
+			for (const PosColor& vertex : vertices) {
+				streams.Positions.push_back(vertex.Position);
+				streams.Colors.push_back(vertex.Color);
+			}
+			return streams;
+		}
+
+		static constexpr const std::array<const D3D11_INPUT_ELEMENT_DESC, 1> PositionLayout = { {
+			{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, PositionSlot, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 }
+		} };
+
+		static constexpr const std::array<const D3D11_INPUT_ELEMENT_DESC, 2> Layout = { {
+			{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, PositionSlot, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+			{ "COLOR", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, ColorSlot, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 }
+		} };
+	};
 }
 
 module :private;
@@ -0,0 +1,697 @@
+module;
+// C
+#include <cstdint>
+#include <cstring>
+
+// Windows
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+
+// Compression
+#include <lz4.h>
+#include <zstd.h>
+
+export module resource.vfs;
+
+import <algorithm>;
+import <filesystem>;
+import <format>;
+import <fstream>;
+import <iostream>;
+import <memory>;
+import <optional>;
+import <span>;
+import <string>;
+import <string_view>;
+import <unordered_map>;
+import <utility>;
+import <vector>;
+
+import core.threading;
+import diagnostics.log;
+
+export struct AssetId
+{
+	std::uint64_t Value = 0;
+
+	constexpr AssetId() = default;
+	constexpr explicit AssetId(std::string_view path) : Value(Hash(path)) { }
+
+	// FNV-1a over the normalized path. Lookups are case-insensitive and treat
+	// '\\' and '/' alike, matching how Windows resolves the loose files.
+	static constexpr std::uint64_t Hash(std::string_view path)
+	{
+		std::uint64_t hash = 14695981039346656037ull;
+		for (char c : path) {
+			if (c == '\\') {
+				c = '/';
+			}
+			else if (c >= 'A' && c <= 'Z') {
+				c = static_cast<char>(c - 'A' + 'a');
+			}
+			hash ^= static_cast<unsigned char>(c);
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	static AssetId FromRelativePath(const std::filesystem::path& path)
+	{
+		std::u8string name = path.generic_u8string();
+		return AssetId(std::string_view(reinterpret_cast<const char*>(name.data()), name.size()));
+	}
+
+	constexpr bool operator==(const AssetId&) const = default;
+};
+
+export enum class Compression : std::uint32_t
+{
+	None,
+	LZ4,
+	Zstd,
+};
+
+// Bytes of an asset. Uncompressed pak entries are views straight into the
+// mapped archive, everything else owns its storage.
+export class AssetData
+{
+public:
+	AssetData() = default;
+	AssetData(AssetData&&) = default;
+	AssetData& operator=(AssetData&&) = default;
+
+	AssetData(const AssetData&) = delete;
+	AssetData& operator=(const AssetData&) = delete;
+
+	std::span<const std::byte> Bytes() const { return view_; }
+	std::size_t Size() const { return view_.size(); }
+	explicit operator bool() const { return !view_.empty(); }
+
+private:
+	friend class VirtualFileSystem;
+
+	std::vector<std::byte> storage_;
+	std::span<const std::byte> view_;
+};
+
+export class VirtualFileSystem
+{
+public:
+	VirtualFileSystem();
+	~VirtualFileSystem();
+
+	VirtualFileSystem(const VirtualFileSystem&) = delete;
+	VirtualFileSystem& operator=(const VirtualFileSystem&) = delete;
+
+	// Archives mounted later shadow entries of earlier ones. Entries of one
+	// archive or directory whose ids collide are reported, and the later one
+	// wins.
+	bool MountArchive(const std::filesystem::path& path);
+
+	// Files found here override archive entries. Intended for development, so
+	// edited assets are picked up without rebuilding the pak.
+	bool MountLooseDirectory(const std::filesystem::path& directory);
+
+	void UnmountAll();
+
+	bool Exists(AssetId id) const;
+	AssetData Read(AssetId id) const;
+
+	// Reads and decompresses the assets on the default thread pool.
+	void ReadBatch(std::span<const AssetId> ids, std::span<AssetData> results) const;
+
+	// Path of the loose override for the asset, or nullptr when it is only
+	// available from an archive.
+	const std::filesystem::path* LoosePath(AssetId id) const;
+
+private:
+	class MappedFile;
+	struct Archive;
+
+	// Open-addressed hash table from asset id to an index. Ids are already
+	// hashes, so a probe is a mask and usually a single comparison.
+	class AssetIndex
+	{
+	public:
+		// Returns the value the id replaced, if any.
+		std::optional<std::uint32_t> Insert(AssetId id, std::uint32_t value);
+		std::optional<std::uint32_t> Find(AssetId id) const;
+		void Clear();
+
+	private:
+		void Rehash(std::size_t capacity);
+
+	private:
+		static constexpr std::uint32_t EmptySlot = UINT32_MAX;
+
+		struct Slot
+		{
+			std::uint64_t Key = 0;
+			std::uint32_t Value = EmptySlot;
+		};
+
+		std::vector<Slot> slots_;
+		std::size_t size_ = 0;
+	};
+
+	bool ReadArchiveEntry(std::uint32_t location, AssetData& data) const;
+	static bool ReadLooseFile(const std::filesystem::path& path, AssetData& data);
+
+private:
+	std::vector<std::unique_ptr<Archive>> archives_;
+	std::vector<std::filesystem::path> looseFiles_;
+
+	AssetIndex looseIndex_;
+	AssetIndex archiveIndex_;
+};
+
+// Builds pak archives. Used by asset tooling, not at runtime; Box packs its
+// asset directory with --pack. Write() fails if two entries have the same id.
+export class PakWriter
+{
+public:
+	void Add(AssetId id, std::span<const std::byte> data, Compression method = Compression::LZ4);
+	// Fails if two paths in the directory hash to the same id.
+	bool AddDirectory(const std::filesystem::path& directory, Compression method = Compression::LZ4);
+
+	std::size_t EntryCount() const { return entries_.size(); }
+	bool Write(const std::filesystem::path& path) const;
+
+private:
+	struct PendingEntry
+	{
+		AssetId Id;
+		Compression Method;
+		std::uint32_t Size;
+		std::vector<std::byte> Stored;
+	};
+
+	std::vector<PendingEntry> entries_;
+};
+
+module :private;
+
+namespace
+{
+	// "PAK1"
+	constexpr std::uint32_t PakMagic = 0x314B4150;
+	constexpr std::uint32_t PakVersion = 1;
+	constexpr std::uint64_t PakAlignment = 16;
+
+	struct PakHeader
+	{
+		std::uint32_t Magic;
+		std::uint32_t Version;
+		std::uint32_t EntryCount;
+		std::uint32_t Reserved;
+		std::uint64_t TableOffset;
+	};
+
+	struct PakEntry
+	{
+		std::uint64_t Id;
+		std::uint64_t Offset;
+		std::uint32_t StoredSize;
+		std::uint32_t Size;
+		Compression Method;
+		std::uint32_t Reserved;
+	};
+
+	static_assert(sizeof(PakHeader) == 24);
+	static_assert(sizeof(PakEntry) == 32);
+
+	// Archive locations are packed as [archive:8][entry:24].
+	constexpr std::uint32_t PackLocation(std::size_t archive, std::size_t entry)
+	{
+		return static_cast<std::uint32_t>((archive << 24) | entry);
+	}
+
+	constexpr std::uint32_t MaxArchives = 255;
+	constexpr std::uint32_t MaxEntriesPerArchive = 1u << 24;
+
+	// Compressed entries are decompressed into a buffer of their full size,
+	// so a damaged table must not be able to ask for more than any asset.
+	constexpr std::uint32_t MaxEntrySize = 1u << 28;
+	// LZ4 cannot expand its input more than 255 times.
+	constexpr std::uint64_t MaxLZ4Ratio = 255;
+
+	// Whether an entry lies before the table and its sizes fit how it is
+	// stored. PakWriter only compresses entries that get smaller.
+	bool IsValidEntry(const PakEntry& entry, std::uint64_t tableOffset)
+	{
+		if (entry.Offset > tableOffset || entry.StoredSize > tableOffset - entry.Offset) {
+			return false;
+		}
+		switch (entry.Method) {
+		case Compression::None:
+			return entry.Size == entry.StoredSize;
+		case Compression::LZ4:
+			return entry.Size > entry.StoredSize && entry.Size <= MaxEntrySize && entry.Size <= entry.StoredSize * MaxLZ4Ratio;
+		case Compression::Zstd:
+			return entry.Size > entry.StoredSize && entry.Size <= MaxEntrySize;
+		}
+		return false;
+	}
+}
+
+class VirtualFileSystem::MappedFile
+{
+public:
+	~MappedFile()
+	{
+		if (view_) {
+			UnmapViewOfFile(view_);
+		}
+		if (mapping_) {
+			CloseHandle(mapping_);
+		}
+		if (file_ != INVALID_HANDLE_VALUE) {
+			CloseHandle(file_);
+		}
+	}
+
+	bool Open(const std::filesystem::path& path)
+	{
+		file_ = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+		if (file_ == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file_, &fileSize) || fileSize.QuadPart == 0) {
+			return false;
+		}
+
+		mapping_ = CreateFileMappingW(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!mapping_) {
+			return false;
+		}
+
+		view_ = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+		if (!view_) {
+			return false;
+		}
+
+		bytes_ = { static_cast<const std::byte*>(view_), static_cast<std::size_t>(fileSize.QuadPart) };
+		return true;
+	}
+
+	std::span<const std::byte> Bytes() const { return bytes_; }
+
+private:
+	HANDLE file_ = INVALID_HANDLE_VALUE;
+	HANDLE mapping_ = nullptr;
+	void* view_ = nullptr;
+	std::span<const std::byte> bytes_;
+};
+
+struct VirtualFileSystem::Archive
+{
+	MappedFile File;
+	std::span<const PakEntry> Entries;
+};
+
+VirtualFileSystem::VirtualFileSystem() = default;
+
+VirtualFileSystem::~VirtualFileSystem() = default;
+
+bool VirtualFileSystem::MountArchive(const std::filesystem::path& path)
+{
+	if (archives_.size() >= MaxArchives) {
+		LogError(LogCategory::Resource, "Too many archives mounted");
+		return false;
+	}
+
+	auto archive = std::make_unique<Archive>();
+	if (!archive->File.Open(path)) {
+		LogError(LogCategory::Resource, "Failed to map archive: {}", path.string());
+		return false;
+	}
+
+	std::span<const std::byte> bytes = archive->File.Bytes();
+	if (bytes.size() < sizeof(PakHeader)) {
+		LogError(LogCategory::Resource, "Invalid archive: {}", path.string());
+		return false;
+	}
+
+	PakHeader header;
+	std::memcpy(&header, bytes.data(), sizeof(header));
+	if (header.Magic != PakMagic || header.Version != PakVersion || header.EntryCount > MaxEntriesPerArchive ||
+		header.TableOffset % alignof(PakEntry) != 0 ||
+		header.TableOffset + std::uint64_t(header.EntryCount) * sizeof(PakEntry) > bytes.size()) {
+		LogError(LogCategory::Resource, "Invalid archive: {}", path.string());
+		return false;
+	}
+
+	archive->Entries = {
+		reinterpret_cast<const PakEntry*>(bytes.data() + header.TableOffset),
+		header.EntryCount
+	};
+
+	for (const PakEntry& entry : archive->Entries) {
+		if (!IsValidEntry(entry, header.TableOffset)) {
+			LogError(LogCategory::Resource, "Corrupted archive entry {:016x} in {}: {} bytes stored as {}", entry.Id, path.string(), entry.Size, entry.StoredSize);
+			return false;
+		}
+	}
+
+	// Ids replacing entries of earlier archives shadow them. Within one
+	// archive they can only come from paths whose hashes collide.
+	std::size_t archiveIndex = archives_.size();
+	for (std::size_t i = 0; i < archive->Entries.size(); ++i) {
+		AssetId id;
+		id.Value = archive->Entries[i].Id;
+		std::optional<std::uint32_t> replaced = archiveIndex_.Insert(id, PackLocation(archiveIndex, i));
+		if (replaced && (*replaced >> 24) == archiveIndex) {
+			LogError(LogCategory::Resource, "Asset id {:016x} appears twice in {}", id.Value, path.string());
+		}
+	}
+	archives_.push_back(std::move(archive));
+
+	return true;
+}
+
+bool VirtualFileSystem::MountLooseDirectory(const std::filesystem::path& directory)
+{
+	std::error_code error;
+	std::filesystem::recursive_directory_iterator it(directory, error);
+	if (error) {
+		LogError(LogCategory::Resource, "Failed to mount directory: {}", directory.string());
+		return false;
+	}
+
+	// Files of earlier directories are overridden, files of this one collide.
+	std::size_t firstFile = looseFiles_.size();
+	for (const auto& entry : it) {
+		if (!entry.is_regular_file()) {
+			continue;
+		}
+		AssetId id = AssetId::FromRelativePath(entry.path().lexically_relative(directory));
+		std::optional<std::uint32_t> replaced = looseIndex_.Insert(id, static_cast<std::uint32_t>(looseFiles_.size()));
+		if (replaced && *replaced >= firstFile) {
+			LogError(LogCategory::Resource, "Asset ids of {} and {} collide", looseFiles_[*replaced].string(), entry.path().string());
+		}
+		looseFiles_.push_back(entry.path());
+	}
+
+	return true;
+}
+
+void VirtualFileSystem::UnmountAll()
+{
+	looseIndex_.Clear();
+	archiveIndex_.Clear();
+	looseFiles_.clear();
+	archives_.clear();
+}
+
+bool VirtualFileSystem::Exists(AssetId id) const
+{
+	return looseIndex_.Find(id).has_value() || archiveIndex_.Find(id).has_value();
+}
+
+AssetData VirtualFileSystem::Read(AssetId id) const
+{
+	AssetData data;
+	if (auto loose = looseIndex_.Find(id)) {
+		ReadLooseFile(looseFiles_[*loose], data);
+	}
+	else if (auto location = archiveIndex_.Find(id)) {
+		ReadArchiveEntry(*location, data);
+	}
+	return data;
+}
+
+void VirtualFileSystem::ReadBatch(std::span<const AssetId> ids, std::span<AssetData> results) const
+{
+	ThreadPool::Default()->ParallelFor(std::min(ids.size(), results.size()), [&](std::size_t i) {
+		results[i] = Read(ids[i]);
+	});
+}
+
+const std::filesystem::path* VirtualFileSystem::LoosePath(AssetId id) const
+{
+	if (auto loose = looseIndex_.Find(id)) {
+		return &looseFiles_[*loose];
+	}
+	return nullptr;
+}
+
+bool VirtualFileSystem::ReadArchiveEntry(std::uint32_t location, AssetData& data) const
+{
+	const Archive& archive = *archives_[location >> 24];
+	const PakEntry& entry = archive.Entries[location & (MaxEntriesPerArchive - 1)];
+	std::span<const std::byte> stored = archive.File.Bytes().subspan(entry.Offset, entry.StoredSize);
+
+	switch (entry.Method) {
+	case Compression::None:
+		data.view_ = stored;
+		return true;
+	case Compression::LZ4:
+	{
+		data.storage_.resize(entry.Size);
+		int size = LZ4_decompress_safe(
+			reinterpret_cast<const char*>(stored.data()),
+			reinterpret_cast<char*>(data.storage_.data()),
+			static_cast<int>(stored.size()),
+			static_cast<int>(data.storage_.size()));
+		if (size < 0 || static_cast<std::uint32_t>(size) != entry.Size) {
+			break;
+		}
+		data.view_ = data.storage_;
+		return true;
+	}
+	case Compression::Zstd:
+	{
+		data.storage_.resize(entry.Size);
+		std::size_t size = ZSTD_decompress(data.storage_.data(), data.storage_.size(), stored.data(), stored.size());
+		if (ZSTD_isError(size) || size != entry.Size) {
+			break;
+		}
+		data.view_ = data.storage_;
+		return true;
+	}
+	}
+
+	LogError(LogCategory::Resource, "Failed to decompress archive entry");
+	data.storage_.clear();
+	data.view_ = {};
+	return false;
+}
+
+bool VirtualFileSystem::ReadLooseFile(const std::filesystem::path& path, AssetData& data)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file) {
+		LogError(LogCategory::Resource, "Failed to open file: {}", path.string());
+		return false;
+	}
+
+	std::streamsize size = file.tellg();
+	file.seekg(0, std::ios::beg);
+
+	data.storage_.resize(static_cast<std::size_t>(size));
+	if (!file.read(reinterpret_cast<char*>(data.storage_.data()), size)) {
+		LogError(LogCategory::Resource, "Failed to read file: {}", path.string());
+		data.storage_.clear();
+		return false;
+	}
+
+	data.view_ = data.storage_;
+	return true;
+}
+
+std::optional<std::uint32_t> VirtualFileSystem::AssetIndex::Insert(AssetId id, std::uint32_t value)
+{
+	if ((size_ + 1) * 2 > slots_.size()) {
+		Rehash(slots_.empty() ? 64 : slots_.size() * 2);
+	}
+
+	std::size_t mask = slots_.size() - 1;
+	for (std::size_t i = (id.Value ^ (id.Value >> 32)) & mask; ; i = (i + 1) & mask) {
+		Slot& slot = slots_[i];
+		if (slot.Value == EmptySlot) {
+			slot.Key = id.Value;
+			slot.Value = value;
+			++size_;
+			return std::nullopt;
+		}
+		if (slot.Key == id.Value) {
+			return std::exchange(slot.Value, value);
+		}
+	}
+}
+
+std::optional<std::uint32_t> VirtualFileSystem::AssetIndex::Find(AssetId id) const
+{
+	if (slots_.empty()) {
+		return std::nullopt;
+	}
+
+	std::size_t mask = slots_.size() - 1;
+	for (std::size_t i = (id.Value ^ (id.Value >> 32)) & mask; ; i = (i + 1) & mask) {
+		const Slot& slot = slots_[i];
+		if (slot.Value == EmptySlot) {
+			return std::nullopt;
+		}
+		if (slot.Key == id.Value) {
+			return slot.Value;
+		}
+	}
+}
+
+void VirtualFileSystem::AssetIndex::Clear()
+{
+	slots_.clear();
+	size_ = 0;
+}
+
+void VirtualFileSystem::AssetIndex::Rehash(std::size_t capacity)
+{
+	std::vector<Slot> previous = std::move(slots_);
+	slots_.assign(capacity, Slot{});
+	size_ = 0;
+	for (const Slot& slot : previous) {
+		if (slot.Value != EmptySlot) {
+			AssetId id;
+			id.Value = slot.Key;
+			Insert(id, slot.Value);
+		}
+	}
+}
+
+void PakWriter::Add(AssetId id, std::span<const std::byte> data, Compression method)
+{
+	PendingEntry entry{ .Id = id, .Method = method, .Size = static_cast<std::uint32_t>(data.size()) };
+
+	switch (method) {
+	case Compression::LZ4:
+	{
+		entry.Stored.resize(LZ4_compressBound(static_cast<int>(data.size())));
+		int size = LZ4_compress_default(
+			reinterpret_cast<const char*>(data.data()),
+			reinterpret_cast<char*>(entry.Stored.data()),
+			static_cast<int>(data.size()),
+			static_cast<int>(entry.Stored.size()));
+		entry.Stored.resize(size > 0 ? size : 0);
+		break;
+	}
+	case Compression::Zstd:
+	{
+		entry.Stored.resize(ZSTD_compressBound(data.size()));
+		std::size_t size = ZSTD_compress(entry.Stored.data(), entry.Stored.size(), data.data(), data.size(), 19);
+		entry.Stored.resize(ZSTD_isError(size) ? 0 : size);
+		break;
+	}
+	case Compression::None:
+		break;
+	}
+
+	// Keep small or incompressible data as is, so it can be read without a copy.
+	if (method == Compression::None || entry.Stored.empty() || entry.Stored.size() >= data.size()) {
+		entry.Method = Compression::None;
+		entry.Stored.assign(data.begin(), data.end());
+	}
+
+	entries_.push_back(std::move(entry));
+}
+
+bool PakWriter::AddDirectory(const std::filesystem::path& directory, Compression method)
+{
+	std::error_code error;
+	std::filesystem::recursive_directory_iterator it(directory, error);
+	if (error) {
+		std::cerr << "Failed to open directory: " << directory.string() << "\n";
+		return false;
+	}
+
+	std::unordered_map<std::uint64_t, std::filesystem::path> paths;
+	for (const auto& entry : it) {
+		if (!entry.is_regular_file()) {
+			continue;
+		}
+
+		AssetId id = AssetId::FromRelativePath(entry.path().lexically_relative(directory));
+		auto [existing, inserted] = paths.try_emplace(id.Value, entry.path());
+		if (!inserted) {
+			std::cerr << "Asset ids of " << existing->second.string() << " and " << entry.path().string() << " collide\n";
+			return false;
+		}
+
+		std::ifstream file(entry.path(), std::ios::binary);
+		std::vector<char> contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		if (!file && !file.eof()) {
+			std::cerr << "Failed to read file: " << entry.path().string() << "\n";
+			return false;
+		}
+
+		Add(id, std::as_bytes(std::span(contents)), method);
+	}
+
+	return true;
+}
+
+bool PakWriter::Write(const std::filesystem::path& path) const
+{
+	std::vector<std::uint64_t> ids;
+	ids.reserve(entries_.size());
+	for (const PendingEntry& entry : entries_) {
+		ids.push_back(entry.Id.Value);
+	}
+	std::sort(ids.begin(), ids.end());
+	if (auto duplicate = std::adjacent_find(ids.begin(), ids.end()); duplicate != ids.end()) {
+		std::cerr << std::format("Asset id {:016x} added twice to {}\n", *duplicate, path.string());
+		return false;
+	}
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file) {
+		std::cerr << "Failed to create archive: " << path.string() << "\n";
+		return false;
+	}
+
+	static constexpr char padding[PakAlignment] = {};
+	auto align = [&file](std::uint64_t offset) {
+		std::uint64_t aligned = (offset + PakAlignment - 1) & ~(PakAlignment - 1);
+		file.write(padding, static_cast<std::streamsize>(aligned - offset));
+		return aligned;
+	};
+
+	std::vector<PakEntry> table;
+	table.reserve(entries_.size());
+
+	// The header is patched once the table offset is known.
+	PakHeader header{ .Magic = PakMagic, .Version = PakVersion };
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	std::uint64_t offset = sizeof(PakHeader);
+	for (const PendingEntry& entry : entries_) {
+		offset = align(offset);
+		table.push_back(PakEntry{
+			.Id = entry.Id.Value,
+			.Offset = offset,
+			.StoredSize = static_cast<std::uint32_t>(entry.Stored.size()),
+			.Size = entry.Size,
+			.Method = entry.Method,
+			.Reserved = 0
+		});
+		file.write(reinterpret_cast<const char*>(entry.Stored.data()), static_cast<std::streamsize>(entry.Stored.size()));
+		offset += entry.Stored.size();
+	}
+
+	header.EntryCount = static_cast<std::uint32_t>(table.size());
+	header.TableOffset = align(offset);
+	file.write(reinterpret_cast<const char*>(table.data()), static_cast<std::streamsize>(table.size() * sizeof(PakEntry)));
+
+	file.seekp(0);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	if (!file) {
+		std::cerr << "Failed to write archive: " << path.string() << "\n";
+		return false;
+	}
+
+	return true;
+}
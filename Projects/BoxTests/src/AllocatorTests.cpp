@@ -0,0 +1,194 @@
+module;
+// C
+#include <cstddef>
+#include <cstdint>
+
+export module tests.memory;
+
+import <memory_resource>;
+import <span>;
+import <vector>;
+
+import core.memory;
+import render.graph;
+import test;
+
+export std::span<const TestCase> AllocatorTests();
+
+module :private;
+
+namespace
+{
+	// Hands out the same two textures to every pass, without allocating.
+	class StaticGraphBackend : public RenderGraphBackend
+	{
+	public:
+		GraphTexture AcquireTexture(const GraphTextureDesc& desc) override { return &textures_[next_++ % 2]; }
+		void ReleaseTexture(GraphTexture texture) override { }
+
+	private:
+		int textures_[2] = {};
+		std::size_t next_ = 0;
+	};
+
+	// What Game does for a frame: a graph and the culled draw list on the
+	// frame arena.
+	void SimulateFrame(FrameArena& arena, RenderGraph& graph, RenderGraphBackend& backend, std::size_t itemCount, int& executed)
+	{
+		arena.Reset();
+
+		std::pmr::vector<std::uint32_t> visibleItems(&arena);
+		visibleItems.reserve(itemCount);
+		for (std::uint32_t i = 0; i < itemCount; i += 2) {
+			visibleItems.push_back(i);
+		}
+
+		static int backBuffer;
+		GraphTextureDesc desc{ .Width = 1280, .Height = 720 };
+		graph.Reset(&arena);
+		GraphResource target = graph.Import("BackBuffer", desc, &backBuffer);
+
+		PassBuilder scene = graph.AddPass("Scene");
+		GraphResource color = scene.Create("SceneColor", desc);
+		scene.Create("Unused", desc);
+		scene.Execute([&executed](const PassResources&) { ++executed; });
+
+		PassBuilder resolve = graph.AddPass("Resolve");
+		resolve.Read(color);
+		resolve.Write(target);
+		resolve.Execute([&executed](const PassResources&) { ++executed; });
+
+		if (graph.Compile()) {
+			graph.Execute(backend);
+		}
+	}
+
+	void ArenaResetReusesMemory(TestContext& test)
+	{
+		FrameArena arena(1024);
+		void* first = arena.allocate(100, 16);
+		test.CheckEqual(arena.Used(), std::size_t(100));
+		arena.Reset();
+		test.CheckEqual(arena.Used(), std::size_t(0));
+		test.Check(arena.allocate(100, 16) == first);
+	}
+
+	void ArenaGrowsAfterOverflow(TestContext& test)
+	{
+		FrameArena arena(256);
+		test.Check(arena.allocate(200, 16) != nullptr);
+		test.Check(arena.allocate(200, 16) != nullptr);
+		test.CheckEqual(arena.Capacity(), std::size_t(256));
+
+		// The next frame fits both.
+		arena.Reset();
+		test.Check(arena.Capacity() >= 400);
+		std::uint64_t allocations = AllocationCounter::Count();
+		test.Check(arena.allocate(200, 16) != nullptr);
+		test.Check(arena.allocate(200, 16) != nullptr);
+		test.CheckEqual(AllocationCounter::Count(), allocations);
+	}
+
+	void ArenaAlignsAllocations(TestContext& test)
+	{
+		FrameArena arena(1024);
+		test.Check(arena.allocate(1, 1) != nullptr);
+		void* aligned = arena.allocate(16, 64);
+		test.CheckEqual(reinterpret_cast<std::uintptr_t>(aligned) % 64, std::uintptr_t(0));
+	}
+
+	void FixedPoolReusesBlocks(TestContext& test)
+	{
+		FixedPool pool(48, 8, 4);
+		void* a = pool.Allocate();
+		void* b = pool.Allocate();
+		test.Check(a != b);
+		pool.Deallocate(a);
+		test.Check(pool.Allocate() == a);
+
+		// Blocks are only taken from the heap a chunk at a time.
+		std::uint64_t allocations = AllocationCounter::Count();
+		test.Check(pool.Allocate() != nullptr);
+		test.Check(pool.Allocate() != nullptr);
+		test.CheckEqual(AllocationCounter::Count(), allocations);
+	}
+
+	void ObjectPoolDestroysObjects(TestContext& test)
+	{
+		struct Counted
+		{
+			int* Live;
+			explicit Counted(int* live) : Live(live) { ++*Live; }
+			~Counted() { --*Live; }
+		};
+
+		int live = 0;
+		ObjectPool<Counted> pool;
+		{
+			auto a = pool.Create(&live);
+			auto b = pool.Create(&live);
+			test.CheckEqual(live, 2);
+		}
+		test.CheckEqual(live, 0);
+	}
+
+	void ResetFrameVectorKeepsHeapCapacity(TestContext& test)
+	{
+		std::pmr::vector<int> values;
+		values.resize(100);
+		ResetFrameVector(values, nullptr);
+		test.Check(values.empty());
+		test.Check(values.capacity() >= 100);
+
+		FrameArena arena(4096);
+		ResetFrameVector(values, &arena);
+		test.Check(values.get_allocator().resource() == &arena);
+		values.resize(10);
+		test.Check(arena.Used() >= 10 * sizeof(int));
+
+		// Back on the heap, leaving the arena's storage behind.
+		ResetFrameVector(values, nullptr);
+		test.Check(values.get_allocator().resource() == std::pmr::get_default_resource());
+		test.CheckEqual(values.capacity(), std::size_t(0));
+	}
+
+	// Counts calls to the global operator new through the hooks in
+	// AllocationHooks.cpp. Once the arena has grown to fit a frame, frames
+	// must not touch the heap.
+	void SteadyStateFrameDoesNotAllocate(TestContext& test)
+	{
+		FrameArena arena(64);
+		RenderGraph graph;
+		StaticGraphBackend backend;
+		int executed = 0;
+		std::uint64_t allocations = AllocationCounter::Count();
+		for (int frame = 0; frame < 3; ++frame) {
+			SimulateFrame(arena, graph, backend, 1000, executed);
+		}
+		// The first frames grow the arena, which shows the hooks count.
+		test.Check(AllocationCounter::Count() > allocations);
+		test.Check(graph.IsCulled("Scene") == false);
+
+		allocations = AllocationCounter::Count();
+		for (int frame = 0; frame < 10; ++frame) {
+			SimulateFrame(arena, graph, backend, 1000, executed);
+		}
+		test.CheckEqual(AllocationCounter::Count() - allocations, std::uint64_t(0));
+		test.CheckEqual(executed, 26);
+	}
+
+	constexpr TestCase tests[] = {
+		{ "FrameArena/ResetReusesMemory", ArenaResetReusesMemory },
+		{ "FrameArena/GrowsAfterOverflow", ArenaGrowsAfterOverflow },
+		{ "FrameArena/AlignsAllocations", ArenaAlignsAllocations },
+		{ "FixedPool/ReusesBlocks", FixedPoolReusesBlocks },
+		{ "ObjectPool/DestroysObjects", ObjectPoolDestroysObjects },
+		{ "ResetFrameVector/KeepsHeapCapacity", ResetFrameVectorKeepsHeapCapacity },
+		{ "FrameArena/SteadyStateFrameDoesNotAllocate", SteadyStateFrameDoesNotAllocate },
+	};
+}
+
+std::span<const TestCase> AllocatorTests()
+{
+	return tests;
+}
@@ -0,0 +1,204 @@
+module;
+// C
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+export module tests.capture;
+
+import <array>;
+import <filesystem>;
+import <span>;
+import <string>;
+import <string_view>;
+import <vector>;
+
+import render.capture;
+import render.software;
+import test;
+
+export std::span<const TestCase> CaptureTests();
+
+module :private;
+
+namespace
+{
+	struct PosColor
+	{
+		float Position[3];
+		float Color[4];
+	};
+
+	template <typename T>
+	void Append(std::vector<std::byte>& bytes, const T& value)
+	{
+		const std::byte* data = reinterpret_cast<const std::byte*>(&value);
+		bytes.insert(bytes.end(), data, data + sizeof(T));
+	}
+
+	// A capture of the given objects and no commands, saved and loaded the
+	// way --play-capture does.
+	class TestCapture
+	{
+	public:
+		explicit TestCapture(std::string_view name)
+			: path_(std::filesystem::temp_directory_path() / (std::string(name) + ".gcap"))
+		{
+			writer_.Begin(8, 8);
+		}
+
+		~TestCapture()
+		{
+			std::error_code error;
+			std::filesystem::remove(path_, error);
+		}
+
+		CaptureObject Add(CaptureObjectKind kind, std::span<const std::byte> payload) { return writer_.AddObject(kind, payload); }
+
+		CaptureObject AddBuffer(std::uint32_t byteWidth)
+		{
+			std::vector<std::byte> payload;
+			Append(payload, CaptureBufferDesc{ byteWidth, 2, 1, 0x10000, 0, 0 });
+			payload.resize(payload.size() + byteWidth);
+			return Add(CaptureObjectKind::Buffer, payload);
+		}
+
+		bool Load(CaptureFile& capture) { return writer_.Save(path_) && capture.Load(path_); }
+
+	private:
+		std::filesystem::path path_;
+		CaptureWriter writer_;
+	};
+
+	std::vector<std::byte> UpdateBufferPayload(CaptureObject buffer, std::span<const std::byte> contents)
+	{
+		std::vector<std::byte> payload;
+		Append(payload, buffer);
+		payload.insert(payload.end(), contents.begin(), contents.end());
+		return payload;
+	}
+
+	std::vector<std::byte> WriteBufferPayload(CaptureObject buffer, std::uint32_t offset, std::span<const std::byte> contents)
+	{
+		std::vector<std::byte> payload;
+		Append(payload, buffer);
+		Append(payload, offset);
+		Append(payload, std::uint32_t(0));
+		payload.insert(payload.end(), contents.begin(), contents.end());
+		return payload;
+	}
+
+	void CpuTargetClampsBufferWrites(TestContext& test)
+	{
+		TestCapture writer("CpuTargetClampsBufferWrites");
+		CaptureObject buffer = writer.AddBuffer(16);
+		CaptureFile capture;
+		CpuCaptureTarget target;
+		test.Check(writer.Load(capture) && target.Load(capture));
+
+		std::array<std::byte, 16> contents{};
+		target.Execute(CaptureCommand::WriteBuffer, WriteBufferPayload(buffer, 0, contents));
+		test.CheckEqual(target.GetStatistics().BytesUpdated, std::uint64_t(16));
+
+		// Past the end only what fits is written, and nothing past it.
+		target.Execute(CaptureCommand::WriteBuffer, WriteBufferPayload(buffer, 8, contents));
+		test.CheckEqual(target.GetStatistics().BytesUpdated, std::uint64_t(24));
+		target.Execute(CaptureCommand::WriteBuffer, WriteBufferPayload(buffer, 16, contents));
+		target.Execute(CaptureCommand::WriteBuffer, WriteBufferPayload(buffer, 17, contents));
+		test.CheckEqual(target.GetStatistics().BytesUpdated, std::uint64_t(24));
+
+		// Too short for the offset and discard flag.
+		std::vector<std::byte> truncated = WriteBufferPayload(buffer, 0, {});
+		truncated.resize(8);
+		target.Execute(CaptureCommand::WriteBuffer, truncated);
+		test.CheckEqual(target.GetStatistics().BytesUpdated, std::uint64_t(24));
+	}
+
+	void CpuTargetClampsBufferUpdates(TestContext& test)
+	{
+		TestCapture writer("CpuTargetClampsBufferUpdates");
+		CaptureObject buffer = writer.AddBuffer(16);
+		CaptureFile capture;
+		CpuCaptureTarget target;
+		test.Check(writer.Load(capture) && target.Load(capture));
+
+		// Longer than the buffer, shorter than the buffer, and too short for
+		// the object.
+		std::array<std::byte, 32> contents{};
+		target.Execute(CaptureCommand::UpdateBuffer, UpdateBufferPayload(buffer, contents));
+		test.CheckEqual(target.GetStatistics().BytesUpdated, std::uint64_t(16));
+		target.Execute(CaptureCommand::UpdateBuffer, UpdateBufferPayload(buffer, std::span(contents).first(8)));
+		test.CheckEqual(target.GetStatistics().BytesUpdated, std::uint64_t(24));
+		std::vector<std::byte> truncated = UpdateBufferPayload(buffer, {});
+		truncated.resize(2);
+		target.Execute(CaptureCommand::UpdateBuffer, truncated);
+		test.CheckEqual(target.GetStatistics().BytesUpdated, std::uint64_t(24));
+	}
+
+	void SoftwareTargetClampsBufferWrites(TestContext& test)
+	{
+		// Positions are passed through as clip space without a constant
+		// buffer, so the triangle covers the middle of the target.
+		TestCapture writer("SoftwareTargetClampsBufferWrites");
+		CaptureObject buffer = writer.AddBuffer(3 * sizeof(PosColor));
+		std::vector<std::byte> layout;
+		Append(layout, std::uint32_t(2));
+		CaptureInputElement position{};
+		std::memcpy(position.SemanticName.data(), "POSITION", 8);
+		position.Format = 6;
+		Append(layout, position);
+		CaptureInputElement color{};
+		std::memcpy(color.SemanticName.data(), "COLOR", 5);
+		color.Format = 2;
+		color.AlignedByteOffset = 12;
+		Append(layout, color);
+		CaptureObject inputLayout = writer.Add(CaptureObjectKind::InputLayout, layout);
+		CaptureObject pixelShader = writer.Add(CaptureObjectKind::PixelShader, {});
+
+		CaptureFile capture;
+		SoftwareCaptureTarget target;
+		test.Check(writer.Load(capture) && target.Load(capture));
+		target.BeginFrame();
+		auto execute = [&target](CaptureCommand command, auto... values) {
+			std::vector<std::byte> payload;
+			(Append(payload, values), ...);
+			target.Execute(command, payload);
+		};
+		execute(CaptureCommand::SetPrimitiveTopology, std::uint32_t(4));
+		execute(CaptureCommand::SetInputLayout, inputLayout);
+		execute(CaptureCommand::SetPixelShader, pixelShader);
+		execute(CaptureCommand::SetRasterizerState, NullCaptureObject);
+		execute(CaptureCommand::SetVertexBuffers, std::uint32_t(0), std::uint32_t(1), CaptureVertexBuffer{ buffer, sizeof(PosColor), 0 });
+
+		// One vertex more than the buffer holds, which is cut off.
+		const PosColor vertices[] = {
+			{ { -1.0f, -1.0f, 0.5f }, { 1.0f, 0.0f, 0.0f, 1.0f } },
+			{ { 0.0f, 1.0f, 0.5f }, { 1.0f, 0.0f, 0.0f, 1.0f } },
+			{ { 1.0f, -1.0f, 0.5f }, { 1.0f, 0.0f, 0.0f, 1.0f } },
+			{ { 0.0f, 0.0f, 0.5f }, { 0.0f, 1.0f, 0.0f, 1.0f } },
+		};
+		target.Execute(CaptureCommand::UpdateBuffer, UpdateBufferPayload(buffer, std::as_bytes(std::span(vertices))));
+		target.Execute(CaptureCommand::WriteBuffer, WriteBufferPayload(buffer, 0, std::as_bytes(std::span(vertices))));
+		target.Execute(CaptureCommand::WriteBuffer, WriteBufferPayload(buffer, 3 * sizeof(PosColor) + 1, std::as_bytes(std::span(vertices))));
+		std::vector<std::byte> truncated = WriteBufferPayload(buffer, 0, {});
+		truncated.resize(6);
+		target.Execute(CaptureCommand::WriteBuffer, truncated);
+		execute(CaptureCommand::Draw, std::uint32_t(3), std::uint32_t(0));
+
+		const std::vector<std::uint8_t>& pixels = target.Pixels();
+		std::size_t center = (std::size_t(4) * target.Width() + 4) * 4;
+		test.CheckEqual(int(pixels[center]), 255);
+		test.CheckEqual(int(pixels[center + 1]), 0);
+	}
+
+	constexpr TestCase tests[] = {
+		{ "Capture/CpuTargetClampsBufferWrites", CpuTargetClampsBufferWrites },
+		{ "Capture/CpuTargetClampsBufferUpdates", CpuTargetClampsBufferUpdates },
+		{ "Capture/SoftwareTargetClampsBufferWrites", SoftwareTargetClampsBufferWrites },
+	};
+}
+
+std::span<const TestCase> CaptureTests()
+{
+	return tests;
+}
@@ -0,0 +1,220 @@
+module;
+// C
+#include <cstddef>
+#include <cstdint>
+
+export module tests.gpu;
+
+import <memory>;
+import <span>;
+import <string_view>;
+import <vector>;
+
+import diagnostics.gpu;
+import test;
+
+export std::span<const TestCase> GpuProfilerTests();
+
+module :private;
+
+namespace
+{
+	// The mock's default frequency: a tick is a microsecond.
+	constexpr double TickMilliseconds = 0.001;
+
+	// Starts a profiler on a mock GPU whose results come in latency frames
+	// after they ended. The profiler owns the mock.
+	MockGpuQueryBackend& Start(GpuProfiler& profiler, std::size_t latency)
+	{
+		auto backend = std::make_unique<MockGpuQueryBackend>(latency);
+		MockGpuQueryBackend& mock = *backend;
+		profiler.Initialize(std::move(backend));
+		return mock;
+	}
+
+	void RunFrame(GpuProfiler& profiler, MockGpuQueryBackend& mock, std::uint64_t ticks)
+	{
+		profiler.BeginFrame();
+		mock.Advance(ticks);
+		profiler.EndFrame();
+	}
+
+	void ReadsFramesOnceReady(TestContext& test)
+	{
+		GpuProfiler profiler;
+		MockGpuQueryBackend& mock = Start(profiler, 2);
+		test.Check(profiler.IsEnabled());
+
+		// Frame 0 is ready once two more frames have ended, so the profiler
+		// reads it at the start of frame 3.
+		for (std::uint64_t frame = 0; frame < 3; ++frame) {
+			RunFrame(profiler, mock, (frame + 1) * 100);
+			test.CheckEqual(profiler.GetStatistics().FramesResolved, std::uint64_t(0));
+		}
+
+		profiler.BeginFrame();
+		test.CheckEqual(profiler.GetStatistics().FramesResolved, std::uint64_t(1));
+		test.CheckEqual(profiler.LastFrame().Frame, std::uint64_t(0));
+		test.CheckNear(profiler.LastFrame().Milliseconds, 100 * TickMilliseconds, 1e-9);
+		mock.Advance(400);
+		profiler.EndFrame();
+
+		// One frame in, one frame out from then on.
+		for (std::uint64_t frame = 4; frame < 10; ++frame) {
+			RunFrame(profiler, mock, (frame + 1) * 100);
+			test.CheckEqual(profiler.LastFrame().Frame, frame - 3);
+			test.CheckNear(profiler.LastFrame().Milliseconds, (frame - 2) * 100 * TickMilliseconds, 1e-9);
+		}
+		test.CheckEqual(profiler.History().size(), std::size_t(7));
+		test.CheckEqual(profiler.GetStatistics().FramesDropped, std::uint64_t(0));
+	}
+
+	void DropsFramesWhenRingIsFull(TestContext& test)
+	{
+		// Results that come in just before their slot is needed again are
+		// all read.
+		GpuProfiler keepingUp;
+		MockGpuQueryBackend& fast = Start(keepingUp, GpuProfiler::FrameLatency - 1);
+		for (int frame = 0; frame < 30; ++frame) {
+			RunFrame(keepingUp, fast, 100);
+		}
+		test.CheckEqual(keepingUp.GetStatistics().FramesDropped, std::uint64_t(0));
+		test.CheckEqual(keepingUp.GetStatistics().FramesResolved, std::uint64_t(30 - GpuProfiler::FrameLatency));
+
+		// A GPU further behind than the ring never gets read. Every frame
+		// past the first FrameLatency gives up the oldest one instead of
+		// waiting for it.
+		GpuProfiler fallingBehind;
+		MockGpuQueryBackend& slow = Start(fallingBehind, GpuProfiler::FrameLatency + 6);
+		for (int frame = 0; frame < 30; ++frame) {
+			RunFrame(fallingBehind, slow, 100);
+		}
+		test.CheckEqual(fallingBehind.GetStatistics().FramesDropped, std::uint64_t(30 - GpuProfiler::FrameLatency));
+		test.CheckEqual(fallingBehind.GetStatistics().FramesResolved, std::uint64_t(0));
+		test.Check(fallingBehind.History().empty());
+	}
+
+	void SkipsDisjointFrames(TestContext& test)
+	{
+		GpuProfiler profiler;
+		MockGpuQueryBackend& mock = Start(profiler, 0);
+		for (std::uint64_t frame = 0; frame < 10; ++frame) {
+			mock.SetDisjoint(frame == 5 || frame == 6);
+			RunFrame(profiler, mock, 100);
+		}
+		profiler.BeginFrame();
+
+		const GpuProfiler::Statistics& statistics = profiler.GetStatistics();
+		test.CheckEqual(statistics.FramesDisjoint, std::uint64_t(2));
+		test.CheckEqual(statistics.FramesResolved, std::uint64_t(8));
+		std::vector<std::uint64_t> frames;
+		for (const GpuFrameTiming& timing : profiler.History()) {
+			frames.push_back(timing.Frame);
+		}
+		test.Check(frames == std::vector<std::uint64_t>{ 0, 1, 2, 3, 4, 7, 8, 9 });
+		test.CheckEqual(profiler.LastFrame().Frame, std::uint64_t(9));
+	}
+
+	void TimesNestedScopes(TestContext& test)
+	{
+		GpuProfiler profiler;
+		MockGpuQueryBackend& mock = Start(profiler, 0);
+		for (int frame = 0; frame < 3; ++frame) {
+			profiler.BeginFrame();
+			{
+				GpuScope scene(profiler, "Scene");
+				mock.Advance(1000);
+				{
+					GpuScope boxes(profiler, "Boxes");
+					mock.Advance(500);
+				}
+				mock.Advance(250);
+			}
+			{
+				GpuScope resolve(profiler, "Resolve");
+				mock.Advance(200);
+			}
+			profiler.EndFrame();
+		}
+		profiler.BeginFrame();
+
+		const GpuFrameTiming& last = profiler.LastFrame();
+		test.CheckNear(last.Milliseconds, 1950 * TickMilliseconds, 1e-9);
+		test.CheckEqual(last.Scopes.size(), std::size_t(3));
+		if (last.Scopes.size() == 3) {
+			test.CheckEqual(last.Scopes[0].Name, std::string_view("Scene"));
+			test.CheckEqual(last.Scopes[0].Depth, std::uint32_t(0));
+			test.CheckNear(last.Scopes[0].Milliseconds, 1750 * TickMilliseconds, 1e-9);
+			test.CheckEqual(last.Scopes[1].Name, std::string_view("Boxes"));
+			test.CheckEqual(last.Scopes[1].Depth, std::uint32_t(1));
+			test.CheckNear(last.Scopes[1].Milliseconds, 500 * TickMilliseconds, 1e-9);
+			test.CheckEqual(last.Scopes[2].Name, std::string_view("Resolve"));
+			test.CheckEqual(last.Scopes[2].Depth, std::uint32_t(0));
+			test.CheckNear(last.Scopes[2].Milliseconds, 200 * TickMilliseconds, 1e-9);
+		}
+
+		std::vector<GpuProfiler::ScopeSummary> summary = profiler.Summarize();
+		test.CheckEqual(summary.size(), std::size_t(3));
+		if (summary.size() == 3) {
+			test.CheckEqual(summary[1].Name, std::string_view("Boxes"));
+			test.CheckEqual(summary[1].Samples, std::uint64_t(3));
+			test.CheckNear(summary[1].AverageMilliseconds, 500 * TickMilliseconds, 1e-9);
+		}
+
+		// A scope still open at the end of the frame ends with it.
+		profiler.BeginScope("Open");
+		mock.Advance(300);
+		profiler.EndFrame();
+		profiler.BeginFrame();
+		test.CheckEqual(profiler.LastFrame().Scopes.size(), std::size_t(1));
+		if (!profiler.LastFrame().Scopes.empty()) {
+			test.CheckNear(profiler.LastFrame().Scopes[0].Milliseconds, 300 * TickMilliseconds, 1e-9);
+		}
+	}
+
+	void DropsScopesPastMaximum(TestContext& test)
+	{
+		GpuProfiler profiler;
+		MockGpuQueryBackend& mock = Start(profiler, 0);
+		profiler.BeginFrame();
+		std::size_t untimed = 0;
+		for (std::size_t i = 0; i < GpuProfiler::MaxScopes + 5; ++i) {
+			std::uint32_t scope = profiler.BeginScope("Draw");
+			untimed += scope == GpuProfiler::NoScope;
+			mock.Advance(10);
+			profiler.EndScope(scope);
+		}
+		profiler.EndFrame();
+		profiler.BeginFrame();
+
+		test.CheckEqual(untimed, std::size_t(5));
+		test.CheckEqual(profiler.GetStatistics().ScopesDropped, std::uint64_t(5));
+		test.CheckEqual(profiler.LastFrame().Scopes.size(), GpuProfiler::MaxScopes);
+		test.CheckNear(profiler.LastFrame().Milliseconds, (GpuProfiler::MaxScopes + 5) * 10 * TickMilliseconds, 1e-9);
+	}
+
+	void DoesNothingWithoutBackend(TestContext& test)
+	{
+		GpuProfiler profiler;
+		test.Check(!profiler.IsEnabled());
+		profiler.BeginFrame();
+		test.CheckEqual(profiler.BeginScope("Scene"), GpuProfiler::NoScope);
+		profiler.EndFrame();
+		test.Check(profiler.History().empty());
+		test.CheckEqual(profiler.GetStatistics().FramesResolved, std::uint64_t(0));
+	}
+
+	constexpr TestCase tests[] = {
+		{ "GpuProfiler/ReadsFramesOnceReady", ReadsFramesOnceReady },
+		{ "GpuProfiler/DropsFramesWhenRingIsFull", DropsFramesWhenRingIsFull },
+		{ "GpuProfiler/SkipsDisjointFrames", SkipsDisjointFrames },
+		{ "GpuProfiler/TimesNestedScopes", TimesNestedScopes },
+		{ "GpuProfiler/DropsScopesPastMaximum", DropsScopesPastMaximum },
+		{ "GpuProfiler/DoesNothingWithoutBackend", DoesNothingWithoutBackend },
+	};
+}
+
+std::span<const TestCase> GpuProfilerTests()
+{
+	return tests;
+}
@@ -0,0 +1,95 @@
+module;
+// C
+#include <cstddef>
+#include <cstdint>
+
+export module tests.latency;
+
+import <chrono>;
+import <span>;
+import <thread>;
+import <vector>;
+
+import diagnostics.latency;
+import test;
+
+export std::span<const TestCase> LatencyTests();
+
+module :private;
+
+namespace
+{
+	using namespace std::chrono_literals;
+
+	// The frame loop of a headless run: the simulation picks up the inputs,
+	// then the frame is rendered and presented. Returns the events handled.
+	std::size_t RunFrame(std::uint64_t frame, std::chrono::milliseconds stageTime)
+	{
+		LatencyTracker& tracker = LatencyTracker::Get();
+		std::vector<InputStamp> inputs;
+		tracker.CollectInputs(inputs);
+		std::this_thread::sleep_for(stageTime);
+		tracker.BeginRender(inputs);
+		std::this_thread::sleep_for(stageTime);
+		tracker.EndPresent(frame);
+		return inputs.size();
+	}
+
+	void SummarizesSimulatedInput(TestContext& test)
+	{
+		// Drain what earlier tests left behind.
+		RunFrame(0, 0ms);
+		std::size_t before = LatencyTracker::Get().Summarize().Count;
+
+		SimulatedInputDriver driver;
+		driver.Start(500.0);
+		test.Check(driver.IsRunning());
+
+		std::size_t handled = 0;
+		for (std::uint64_t frame = 1; frame <= 20; ++frame) {
+			handled += RunFrame(frame, 2ms);
+		}
+		driver.Stop();
+		test.Check(!driver.IsRunning());
+		handled += RunFrame(21, 2ms);
+
+		// Nothing arrives once the driver has stopped.
+		test.CheckEqual(RunFrame(22, 0ms), std::size_t(0));
+
+		LatencyTracker::Summary summary = LatencyTracker::Get().Summarize();
+		test.Check(handled > 0);
+		test.CheckEqual(summary.Count, before + handled);
+
+		// Every event waits at least for a render and a present stage, and
+		// at most for a whole frame more.
+		test.Check(summary.Median >= 4.0f);
+		test.Check(summary.Median <= summary.P95);
+		test.Check(summary.P95 <= summary.P99);
+		test.Check(summary.P99 <= summary.Max);
+		test.Check(summary.Max < 100.0f);
+	}
+
+	void FramesWithoutInputAddNoSamples(TestContext& test)
+	{
+		RunFrame(0, 0ms);
+		std::size_t before = LatencyTracker::Get().Summarize().Count;
+		for (std::uint64_t frame = 1; frame <= 5; ++frame) {
+			RunFrame(frame, 0ms);
+		}
+		test.CheckEqual(LatencyTracker::Get().Summarize().Count, before);
+
+		LatencyTracker::Get().RecordInput(InputSource::Keyboard);
+		test.CheckEqual(RunFrame(6, 1ms), std::size_t(1));
+		test.CheckEqual(LatencyTracker::Get().Summarize().Count, before + 1);
+	}
+
+	constexpr TestCase tests[] = {
+		{ "LatencyTracker/SummarizesSimulatedInput", SummarizesSimulatedInput },
+		{ "LatencyTracker/FramesWithoutInputAddNoSamples", FramesWithoutInputAddNoSamples },
+	};
+}
+
+std::span<const TestCase> LatencyTests()
+{
+	return tests;
+}
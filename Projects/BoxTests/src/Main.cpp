@@ -0,0 +1,33 @@
+// C
+#include <cstdlib>
+
+import <span>;
+import <string_view>;
+
+import test;
+import tests.capture;
+import tests.gpu;
+import tests.graph;
+import tests.latency;
+import tests.memory;
+import tests.pacing;
+import tests.resolution;
+
+// Unit tests of the parts of Box that need neither a window nor a GPU. The
+// only argument is a filter: tests whose name does not contain it are
+// skipped.
+int main(int argc, char* argv[])
+{
+	const std::span<const TestCase> groups[] = {
+		AllocatorTests(),
+		LatencyTests(),
+		RenderGraphTests(),
+		PacingTests(),
+		ResolutionTests(),
+		GpuProfilerTests(),
+		CaptureTests(),
+	};
+
+	std::string_view filter = argc > 1 ? argv[1] : "";
+	return RunTests(groups, filter);
+}
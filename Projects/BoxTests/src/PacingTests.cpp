@@ -0,0 +1,191 @@
+module;
+// C
+#include <cstddef>
+#include <cstdint>
+
+export module tests.pacing;
+
+import <algorithm>;
+import <chrono>;
+import <span>;
+import <utility>;
+import <vector>;
+
+import core.pacing;
+import test;
+
+export std::span<const TestCase> PacingTests();
+
+module :private;
+
+namespace
+{
+	using namespace std::chrono_literals;
+
+	// Time only moves when the pacer sleeps or spins, or when a test runs
+	// frame work. Sleeps overshoot by the next of a repeating list of
+	// oversleeps, the way a scheduler wakes threads late.
+	class FakePacingClock : public PacingClock
+	{
+	public:
+		static constexpr Duration SpinStep = 1us;
+
+	public:
+		explicit FakePacingClock(std::vector<Duration> oversleeps = { Duration::zero() })
+			: oversleeps_(std::move(oversleeps))
+		{
+		}
+
+		TimePoint Now() override { return now_; }
+
+		void Sleep(Duration duration) override
+		{
+			now_ += duration + oversleeps_[sleeps_++ % oversleeps_.size()];
+		}
+
+		void Spin() override
+		{
+			now_ += SpinStep;
+			++spins_;
+		}
+
+		void Advance(Duration duration) { now_ += duration; }
+
+		std::size_t Sleeps() const { return sleeps_; }
+		std::size_t Spins() const { return spins_; }
+
+	private:
+		// Not the epoch, which FramePacer takes for no frame yet.
+		TimePoint now_ = TimePoint(1s);
+		std::vector<Duration> oversleeps_;
+		std::size_t sleeps_ = 0;
+		std::size_t spins_ = 0;
+	};
+
+	FramePacer::Settings Fps(double targetFps)
+	{
+		FramePacer::Settings settings;
+		settings.TargetFps = targetFps;
+		return settings;
+	}
+
+	// Frame work of 2 to 8 ms, varying from frame to frame.
+	PacingClock::Duration FrameWork(int frame)
+	{
+		return 2ms + PacingClock::Duration(frame * 1'234'567 % 6'000'000);
+	}
+
+	void AbsorbsSleepJitter(TestContext& test)
+	{
+		// Wake-ups up to a millisecond late, within the spin threshold.
+		FakePacingClock clock({ 0us, 900us, 250us, 1ms, 600us });
+		FramePacer pacer(clock);
+		pacer.Configure(Fps(60.0));
+		PacingClock::Duration period = std::chrono::duration_cast<PacingClock::Duration>(std::chrono::duration<double>(1.0 / 60.0));
+
+		pacer.Wait();
+		PacingClock::TimePoint first = clock.Now();
+		for (int frame = 1; frame <= 300; ++frame) {
+			clock.Advance(FrameWork(frame));
+			pacer.Wait();
+			test.Check(pacer.LastFrameError() >= PacingClock::Duration::zero());
+			test.Check(pacer.LastFrameError() < FakePacingClock::SpinStep);
+			test.Check(pacer.LastFrameInterval() > period - FakePacingClock::SpinStep);
+			test.Check(pacer.LastFrameInterval() < period + FakePacingClock::SpinStep);
+		}
+
+		// The spin covers the oversleeps, so frames land on their deadlines.
+		test.Check(clock.Now() - first - 300 * period < FakePacingClock::SpinStep);
+		test.Check(clock.Sleeps() > 0);
+		test.Check(clock.Spins() > 0);
+	}
+
+	void LateWakeUpsDoNotAccumulate(TestContext& test)
+	{
+		// Beyond the spin threshold, so frames start late.
+		FakePacingClock clock({ 3ms, 0us, 2500us });
+		FramePacer pacer(clock);
+		pacer.Configure(Fps(60.0));
+		PacingClock::Duration period = std::chrono::duration_cast<PacingClock::Duration>(std::chrono::duration<double>(1.0 / 60.0));
+
+		pacer.Wait();
+		PacingClock::TimePoint first = clock.Now();
+		PacingClock::Duration worstError = PacingClock::Duration::zero();
+		for (int frame = 1; frame <= 300; ++frame) {
+			clock.Advance(FrameWork(frame));
+			pacer.Wait();
+			worstError = std::max(worstError, pacer.LastFrameError());
+		}
+
+		// One frame is late by at most the oversleep past the threshold, but
+		// the deadlines stay on the schedule.
+		test.Check(worstError > 1ms);
+		test.Check(worstError <= 3ms - pacer.GetSettings().SpinThreshold + FakePacingClock::SpinStep);
+		PacingClock::Duration drift = clock.Now() - first - 300 * period;
+		test.Check(drift >= PacingClock::Duration::zero());
+		test.Check(drift <= worstError);
+	}
+
+	void RestartsScheduleAfterHitch(TestContext& test)
+	{
+		FakePacingClock clock;
+		FramePacer pacer(clock);
+		pacer.Configure(Fps(100.0));
+
+		pacer.Wait();
+		clock.Advance(2ms);
+		pacer.Wait();
+		test.CheckEqual(pacer.LastFrameInterval(), PacingClock::Duration(10ms));
+
+		// Three frames late. The next frame starts at once and the ones after
+		// it are paced again, instead of rushing out frames to catch up.
+		clock.Advance(35ms);
+		test.CheckEqual(pacer.Wait(), PacingClock::Duration::zero());
+		for (int frame = 0; frame < 5; ++frame) {
+			clock.Advance(2ms);
+			pacer.Wait();
+			test.CheckEqual(pacer.LastFrameInterval(), PacingClock::Duration(10ms));
+			test.CheckEqual(pacer.LastFrameError(), PacingClock::Duration::zero());
+		}
+	}
+
+	void UncappedDoesNotWait(TestContext& test)
+	{
+		FakePacingClock clock;
+		FramePacer pacer(clock);
+		pacer.Configure(Fps(0.0));
+
+		for (int frame = 0; frame < 10; ++frame) {
+			clock.Advance(FrameWork(frame));
+			test.CheckEqual(pacer.Wait(), PacingClock::Duration::zero());
+		}
+		test.CheckEqual(clock.Sleeps(), std::size_t(0));
+		test.CheckEqual(clock.Spins(), std::size_t(0));
+		test.CheckEqual(pacer.LastFrameInterval(), FrameWork(9));
+	}
+
+	void ClampsFrameLatency(TestContext& test)
+	{
+		FramePacer pacer;
+		FramePacer::Settings settings;
+		settings.MaxFrameLatency = 0;
+		pacer.Configure(settings);
+		test.CheckEqual(pacer.GetSettings().MaxFrameLatency, std::uint32_t(1));
+		settings.MaxFrameLatency = 100;
+		pacer.Configure(settings);
+		test.CheckEqual(pacer.GetSettings().MaxFrameLatency, std::uint32_t(16));
+	}
+
+	constexpr TestCase tests[] = {
+		{ "FramePacer/AbsorbsSleepJitter", AbsorbsSleepJitter },
+		{ "FramePacer/LateWakeUpsDoNotAccumulate", LateWakeUpsDoNotAccumulate },
+		{ "FramePacer/RestartsScheduleAfterHitch", RestartsScheduleAfterHitch },
+		{ "FramePacer/UncappedDoesNotWait", UncappedDoesNotWait },
+		{ "FramePacer/ClampsFrameLatency", ClampsFrameLatency },
+	};
+}
+
+std::span<const TestCase> PacingTests()
+{
+	return tests;
+}
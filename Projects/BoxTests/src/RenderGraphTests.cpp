@@ -0,0 +1,227 @@
+module;
+// C
+#include <cstddef>
+#include <cstdint>
+
+export module tests.graph;
+
+import <algorithm>;
+import <span>;
+import <string>;
+import <vector>;
+
+import render.graph;
+import test;
+
+export std::span<const TestCase> RenderGraphTests();
+
+module :private;
+
+namespace
+{
+	constexpr GraphTextureDesc ColorDesc{ .Width = 8, .Height = 4 };
+	constexpr GraphTextureDesc DepthDesc{ .Width = 8, .Height = 4, .Format = 1 };
+
+	void CullsPassesWithUnreadOutputs(TestContext& test)
+	{
+		CpuRenderGraphBackend backend;
+		CpuRenderGraphBackend output;
+		GraphTexture backBuffer = output.AcquireTexture(ColorDesc);
+
+		RenderGraph graph;
+		std::vector<std::string> executed;
+		auto record = [&executed](const char* name) {
+			return [&executed, name](const PassResources&) { executed.push_back(name); };
+		};
+
+		GraphResource target = graph.Import("BackBuffer", ColorDesc, backBuffer);
+
+		// Only read by Blur, which nobody reads, so both go.
+		PassBuilder shadows = graph.AddPass("Shadows");
+		GraphResource shadowMap = shadows.Create("ShadowMap", DepthDesc);
+		shadows.Execute(record("Shadows"));
+
+		PassBuilder blur = graph.AddPass("Blur");
+		blur.Read(shadowMap);
+		blur.Create("Blurred", DepthDesc);
+		blur.Execute(record("Blur"));
+
+		PassBuilder readback = graph.AddPass("Readback");
+		readback.Create("Staging", ColorDesc);
+		readback.HasSideEffects();
+		readback.Execute(record("Readback"));
+
+		PassBuilder scene = graph.AddPass("Scene");
+		scene.Write(target);
+		scene.Execute(record("Scene"));
+
+		test.Check(graph.Compile());
+		graph.Execute(backend);
+
+		test.Check(graph.IsCulled("Shadows"));
+		test.Check(graph.IsCulled("Blur"));
+		test.Check(!graph.IsCulled("Readback"));
+		test.Check(!graph.IsCulled("Scene"));
+		test.CheckEqual(graph.GetReport().PassCount, std::size_t(4));
+		test.CheckEqual(graph.GetReport().CulledPassCount, std::size_t(2));
+		test.Check(executed == std::vector<std::string>{ "Readback", "Scene" });
+
+		// Culled transients get no texture.
+		test.CheckEqual(graph.GetReport().TransientCount, std::size_t(1));
+		test.CheckEqual(backend.Acquisitions(), std::size_t(1));
+	}
+
+	void TexturesLiveFromFirstToLastUse(TestContext& test)
+	{
+		CpuRenderGraphBackend backend;
+		CpuRenderGraphBackend output;
+		GraphTexture backBuffer = output.AcquireTexture(ColorDesc);
+
+		RenderGraph graph;
+		GraphResource target = graph.Import("BackBuffer", ColorDesc, backBuffer);
+		std::vector<std::uint64_t> liveBytes;
+
+		PassBuilder depth = graph.AddPass("Depth");
+		GraphResource depthBuffer = depth.Create("Depth", DepthDesc);
+		depth.Execute([&](const PassResources&) { liveBytes.push_back(backend.LiveBytes()); });
+
+		PassBuilder scene = graph.AddPass("Scene");
+		scene.Read(depthBuffer);
+		GraphResource color = scene.Create("SceneColor", ColorDesc);
+		scene.Execute([&](const PassResources&) { liveBytes.push_back(backend.LiveBytes()); });
+
+		PassBuilder resolve = graph.AddPass("Resolve");
+		resolve.Read(color);
+		resolve.Write(target);
+		resolve.Execute([&](const PassResources& resources) {
+			liveBytes.push_back(backend.LiveBytes());
+			test.Check(resources.Texture(depthBuffer) == nullptr);
+			test.Check(resources.Texture(target) == backBuffer);
+		});
+
+		test.Check(graph.Compile());
+		graph.Execute(backend);
+
+		// The depth buffer is released after Scene, its last use.
+		std::uint64_t bytes = ColorDesc.Bytes();
+		test.Check(liveBytes == std::vector<std::uint64_t>{ bytes, 2 * bytes, bytes });
+		test.CheckEqual(backend.PeakBytes(), 2 * bytes);
+		test.CheckEqual(backend.LiveBytes(), std::uint64_t(0));
+	}
+
+	void AliasesDisjointTransients(TestContext& test)
+	{
+		CpuRenderGraphBackend backend;
+		CpuRenderGraphBackend output;
+		GraphTexture backBuffer = output.AcquireTexture(ColorDesc);
+
+		RenderGraph graph;
+		GraphResource target = graph.Import("BackBuffer", ColorDesc, backBuffer);
+		GraphTexture textures[4] = {};
+
+		// A and C do not overlap and share a texture. B overlaps both, and D
+		// has another description, so both get their own.
+		PassBuilder first = graph.AddPass("First");
+		GraphResource a = first.Create("A", ColorDesc);
+		first.Execute([&](const PassResources& resources) { textures[0] = resources.Texture(a); });
+
+		PassBuilder second = graph.AddPass("Second");
+		second.Read(a);
+		GraphResource b = second.Create("B", ColorDesc);
+		GraphResource d = second.Create("D", DepthDesc);
+
+		PassBuilder third = graph.AddPass("Third");
+		third.Read(b);
+		third.Read(d);
+		GraphResource c = third.Create("C", ColorDesc);
+		third.Execute([&](const PassResources& resources) {
+			textures[1] = resources.Texture(b);
+			textures[2] = resources.Texture(c);
+			textures[3] = resources.Texture(d);
+		});
+
+		PassBuilder fourth = graph.AddPass("Fourth");
+		fourth.Read(c);
+		fourth.Write(target);
+
+		test.Check(graph.Compile());
+		graph.Execute(backend);
+
+		test.Check(textures[0] != nullptr);
+		test.Check(textures[1] != nullptr && textures[1] != textures[0]);
+		test.Check(textures[2] == textures[0]);
+		test.Check(textures[3] != textures[0] && textures[3] != textures[1]);
+
+		const RenderGraph::Report& report = graph.GetReport();
+		test.CheckEqual(report.TransientCount, std::size_t(4));
+		test.CheckEqual(report.PhysicalCount, std::size_t(3));
+		test.CheckEqual(report.SavedBytes(), ColorDesc.Bytes());
+		test.CheckEqual(backend.Acquisitions(), std::size_t(3));
+		test.CheckEqual(backend.PeakBytes(), report.AllocatedBytes);
+	}
+
+	void PassesShareTexturePixels(TestContext& test)
+	{
+		CpuRenderGraphBackend backend;
+		CpuRenderGraphBackend output;
+		GraphTexture backBuffer = output.AcquireTexture(ColorDesc);
+
+		RenderGraph graph;
+		GraphResource target = graph.Import("BackBuffer", ColorDesc, backBuffer);
+
+		PassBuilder fill = graph.AddPass("Fill");
+		GraphResource color = fill.Create("Color", ColorDesc);
+		fill.Execute([color](const PassResources& resources) {
+			std::span<std::byte> pixels = CpuRenderGraphBackend::Pixels(resources.Texture(color));
+			std::fill(pixels.begin(), pixels.end(), std::byte{ 0x5a });
+		});
+
+		PassBuilder copy = graph.AddPass("Copy");
+		copy.Read(color);
+		copy.Write(target);
+		copy.Execute([color, target](const PassResources& resources) {
+			std::span<std::byte> source = CpuRenderGraphBackend::Pixels(resources.Texture(color));
+			std::span<std::byte> destination = CpuRenderGraphBackend::Pixels(resources.Texture(target));
+			std::copy(source.begin(), source.end(), destination.begin());
+		});
+
+		test.Check(graph.Compile());
+		graph.Execute(backend);
+
+		std::span<std::byte> pixels = CpuRenderGraphBackend::Pixels(backBuffer);
+		test.CheckEqual(pixels.size(), std::size_t(ColorDesc.Bytes()));
+		test.Check(std::all_of(pixels.begin(), pixels.end(), [](std::byte pixel) { return pixel == std::byte{ 0x5a }; }));
+	}
+
+	void RejectsReadsBeforeCreation(TestContext& test)
+	{
+		RenderGraph graph;
+		PassBuilder early = graph.AddPass("Early");
+		PassBuilder late = graph.AddPass("Late");
+		GraphResource color = late.Create("Color", ColorDesc);
+		late.HasSideEffects();
+		early.Read(color);
+		test.Check(!graph.Compile());
+
+		// Reset starts a valid frame over.
+		graph.Reset();
+		PassBuilder only = graph.AddPass("Only");
+		only.Create("Color", ColorDesc);
+		only.HasSideEffects();
+		test.Check(graph.Compile());
+		test.CheckEqual(graph.GetReport().PassCount, std::size_t(1));
+	}
+
+	constexpr TestCase tests[] = {
+		{ "RenderGraph/CullsPassesWithUnreadOutputs", CullsPassesWithUnreadOutputs },
+		{ "RenderGraph/TexturesLiveFromFirstToLastUse", TexturesLiveFromFirstToLastUse },
+		{ "RenderGraph/AliasesDisjointTransients", AliasesDisjointTransients },
+		{ "RenderGraph/PassesShareTexturePixels", PassesShareTexturePixels },
+		{ "RenderGraph/RejectsReadsBeforeCreation", RejectsReadsBeforeCreation },
+	};
+}
+
+std::span<const TestCase> RenderGraphTests()
+{
+	return tests;
+}
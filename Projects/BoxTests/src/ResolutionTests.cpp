@@ -0,0 +1,142 @@
+module;
+// C
+#include <cmath>
+#include <cstddef>
+
+export module tests.resolution;
+
+import <algorithm>;
+import <span>;
+
+import core.resolution;
+import test;
+
+export std::span<const TestCase> ResolutionTests();
+
+module :private;
+
+namespace
+{
+	// A GPU-bound frame: its time grows with the pixels drawn.
+	float PixelBoundFrame(float fullScaleMilliseconds, float scale)
+	{
+		return fullScaleMilliseconds * scale * scale;
+	}
+
+	void IgnoresErrorsInDeadBand(TestContext& test)
+	{
+		ResolutionController controller;
+		const float trace[] = { 16.5f, 15.6f, 16.3f, 16.7f, 15.4f, 16.1f, 16.6f, 15.9f };
+		for (int i = 0; i < 200; ++i) {
+			controller.Update(trace[i % std::size(trace)]);
+			test.CheckEqual(controller.Scale(), 1.0f);
+		}
+	}
+
+	void ChangesInMinScaleSteps(TestContext& test)
+	{
+		ResolutionController controller;
+		const ResolutionController::Settings& settings = controller.GetSettings();
+
+		// Slowly rising load, then falling again.
+		float previous = controller.Scale();
+		std::size_t changes = 0;
+		for (int i = 0; i < 400; ++i) {
+			float milliseconds = 16.0f + 8.0f * std::sin(i * 0.02f);
+			float scale = controller.Update(milliseconds);
+			if (scale != previous) {
+				bool atLimit = scale == settings.MinScale || scale == settings.MaxScale;
+				test.Check(std::abs(scale - previous) >= settings.MinScaleStep || atLimit);
+				++changes;
+			}
+			previous = scale;
+		}
+		test.Check(changes > 0);
+	}
+
+	void ConvergesOnBudget(TestContext& test)
+	{
+		// 24 ms at full scale needs about 82% of the pixels for 16 ms.
+		ResolutionController controller;
+		float scale = controller.Scale();
+		float milliseconds = 0.0f;
+		for (int i = 0; i < 600; ++i) {
+			milliseconds = PixelBoundFrame(24.0f, scale);
+			scale = controller.Update(milliseconds);
+		}
+		test.Check(scale > 0.7f && scale < 0.9f);
+		test.CheckNear(milliseconds, 16.0, 16.0 * 0.15);
+	}
+
+	void IntegralClampAvoidsWindup(TestContext& test)
+	{
+		// Far over budget for a long time pins the scale to the minimum.
+		ResolutionController controller;
+		for (int i = 0; i < 300; ++i) {
+			controller.Update(40.0f);
+		}
+		test.CheckEqual(controller.Scale(), controller.GetSettings().MinScale);
+
+		// Once there is headroom the scale rises as soon as the smoothed
+		// frame time has caught up, without unwinding 300 frames of error.
+		int frames = 0;
+		while (controller.Scale() == controller.GetSettings().MinScale && frames < 100) {
+			controller.Update(8.0f);
+			++frames;
+		}
+		test.Check(frames <= 15);
+	}
+
+	void RecoversAfterSpike(TestContext& test)
+	{
+		ResolutionController controller;
+		for (int i = 0; i < 100; ++i) {
+			controller.Update(12.0f);
+		}
+		test.CheckEqual(controller.Scale(), 1.0f);
+
+		// A single hitch may lower the scale a little, but not to the minimum,
+		// and the scale is back to full once frames are fast again.
+		float lowest = controller.Update(60.0f);
+		int frames = 0;
+		while (controller.Scale() < 1.0f && frames < 100) {
+			lowest = std::min(lowest, controller.Update(12.0f));
+			++frames;
+		}
+		test.Check(lowest > controller.GetSettings().MinScale);
+		test.Check(frames <= 30);
+	}
+
+	void ClampsSettings(TestContext& test)
+	{
+		ResolutionController::Settings settings;
+		settings.MinScale = 0.0f;
+		settings.MaxScale = 2.0f;
+		ResolutionController controller(settings);
+		test.CheckEqual(controller.GetSettings().MinScale, 0.1f);
+		test.CheckEqual(controller.GetSettings().MaxScale, 1.0f);
+
+		for (int i = 0; i < 1000; ++i) {
+			controller.Update(1000.0f);
+		}
+		test.CheckEqual(controller.Scale(), 0.1f);
+
+		controller.Reset();
+		test.CheckEqual(controller.Scale(), 1.0f);
+		test.CheckEqual(controller.SmoothedFrameMilliseconds(), 0.0f);
+	}
+
+	constexpr TestCase tests[] = {
+		{ "ResolutionController/IgnoresErrorsInDeadBand", IgnoresErrorsInDeadBand },
+		{ "ResolutionController/ChangesInMinScaleSteps", ChangesInMinScaleSteps },
+		{ "ResolutionController/ConvergesOnBudget", ConvergesOnBudget },
+		{ "ResolutionController/IntegralClampAvoidsWindup", IntegralClampAvoidsWindup },
+		{ "ResolutionController/RecoversAfterSpike", RecoversAfterSpike },
+		{ "ResolutionController/ClampsSettings", ClampsSettings },
+	};
+}
+
+std::span<const TestCase> ResolutionTests()
+{
+	return tests;
+}
@@ -0,0 +1,104 @@
+module;
+// C
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+
+export module test;
+
+import <format>;
+import <iostream>;
+import <source_location>;
+import <span>;
+import <string>;
+import <string_view>;
+
+// Checks of one test case. A failed check prints where it is and the test
+// goes on, so a run shows every failure and not just the first.
+export class TestContext
+{
+public:
+	explicit TestContext(std::string_view name) : name_(name) { }
+
+	bool Check(bool condition, std::source_location location = std::source_location::current());
+
+	template <typename T, typename U>
+	bool CheckEqual(const T& actual, const U& expected, std::source_location location = std::source_location::current())
+	{
+		if (actual == expected) {
+			return true;
+		}
+		Fail(std::format("{} != {}", actual, expected), location);
+		return false;
+	}
+
+	bool CheckNear(double actual, double expected, double tolerance, std::source_location location = std::source_location::current());
+
+	std::size_t Failures() const { return failures_; }
+
+private:
+	void Fail(std::string_view message, const std::source_location& location);
+
+private:
+	std::string_view name_;
+	std::size_t failures_ = 0;
+};
+
+export struct TestCase
+{
+	std::string_view Name;
+	void (*Run)(TestContext& test);
+};
+
+// Runs the tests whose name contains filter and prints the failed checks
+// and a summary. Returns the process exit code.
+export int RunTests(std::span<const std::span<const TestCase>> groups, std::string_view filter);
+
+module :private;
+
+bool TestContext::Check(bool condition, std::source_location location)
+{
+	if (!condition) {
+		Fail("check failed", location);
+	}
+	return condition;
+}
+
+bool TestContext::CheckNear(double actual, double expected, double tolerance, std::source_location location)
+{
+	if (std::abs(actual - expected) <= tolerance) {
+		return true;
+	}
+	Fail(std::format("{} is not within {} of {}", actual, tolerance, expected), location);
+	return false;
+}
+
+void TestContext::Fail(std::string_view message, const std::source_location& location)
+{
+	++failures_;
+	std::cerr << std::format("{}({}): {}: {}\n", location.file_name(), location.line(), name_, message);
+}
+
+int RunTests(std::span<const std::span<const TestCase>> groups, std::string_view filter)
+{
+	std::size_t run = 0;
+	std::size_t failed = 0;
+	for (std::span<const TestCase> group : groups) {
+		for (const TestCase& test : group) {
+			if (test.Name.find(filter) == std::string_view::npos) {
+				continue;
+			}
+
+			TestContext context(test.Name);
+			test.Run(context);
+			++run;
+			if (context.Failures() > 0) {
+				++failed;
+				std::cout << std::format("FAILED {}\n", test.Name);
+			}
+		}
+	}
+
+	std::cout << std::format("{} of {} tests passed\n", run - failed, run);
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -5,6 +5,7 @@ import <memory>;
 
 import platform.windows;
 import core;
+import core.entities;
 import utility;
 import pipeline;
 import vertex;
@@ -12,6 +13,14 @@ import resource.shader;
 
 class Triangle : public Game
 {
+private:
+	struct Mesh
+	{
+		Microsoft::WRL::ComPtr<ID3D11Buffer> VertexBuffer;
+		UINT Stride = 0;
+		UINT VertexCount = 0;
+	};
+
 public:
 	Triangle(std::wstring_view title, int width, int height, bool windowed)
 		: Game(title, width, height, windowed)
@@ -54,26 +63,30 @@ public:
 		initData.SysMemPitch = 0;
 		initData.SysMemSlicePitch = 0;
 
-		GraphicsDevice()->CreateBuffer(&vertexBufferDesc, &initData, vertexBuffer_.GetAddressOf());
+		Mesh mesh;
+		mesh.Stride = sizeof(Vertex::PosColor);
+		mesh.VertexCount = static_cast<UINT>(triangle.size());
+		GraphicsDevice()->CreateBuffer(&vertexBufferDesc, &initData, mesh.VertexBuffer.GetAddressOf());
+		entities_.Create(std::move(mesh));
 
 		return true;
 	}
 
 	void OnRender(ID3D11DeviceContext* immediateContext) override
 	{
-		UINT stride = sizeof(Vertex::PosColor);
-		UINT offset = 0;
-		immediateContext->IASetVertexBuffers(0, 1, vertexBuffer_.GetAddressOf(), &stride, &offset);
-
 		pipeline_->Apply(immediateContext);
 
-		immediateContext->Draw(3, 0);
+		entities_.ForEach<const Mesh>([immediateContext](const Mesh& mesh)
+		{
+			UINT offset = 0;
+			immediateContext->IASetVertexBuffers(0, 1, mesh.VertexBuffer.GetAddressOf(), &mesh.Stride, &offset);
+			immediateContext->Draw(mesh.VertexCount, 0);
+		});
 	}
 
 private:
 	std::unique_ptr<GraphicsPipeline> pipeline_;
-	Microsoft::WRL::ComPtr<ID3D11Buffer> vertexBuffer_;
-	std::vector<Vertex::PosColor> vertices_;
+	EntityWorld entities_;
 };
 
 int main()
@@ -0,0 +1,149 @@
+module;
+// C
+#include <cstddef>
+
+export module core.threading;
+
+import <algorithm>;
+import <atomic>;
+import <condition_variable>;
+import <functional>;
+import <mutex>;
+import <stop_token>;
+import <thread>;
+import <vector>;
+
+export class ThreadPool
+{
+public:
+	static ThreadPool* Default();
+
+public:
+	explicit ThreadPool(unsigned int threadCount);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	void Submit(std::function<void()> task);
+
+	// Runs body(0..count-1) on the workers and the calling thread, and returns
+	// once every index has been processed. Must not be called from a worker.
+	void ParallelFor(std::size_t count, const std::function<void(std::size_t)>& body);
+
+	unsigned int ThreadCount() const { return static_cast<unsigned int>(workers_.size()); }
+
+private:
+	void WorkerLoop(std::stop_token stopToken);
+
+private:
+	std::mutex mutex_;
+	std::condition_variable_any condition_;
+
+	// Ring buffer of pending tasks. It only grows, so a steady stream of
+	// submissions does not allocate once it has reached its working size.
+	std::vector<std::function<void()>> tasks_;
+	std::size_t head_ = 0;
+	std::size_t count_ = 0;
+
+	std::vector<std::jthread> workers_;
+};
+
+module :private;
+
+ThreadPool* ThreadPool::Default()
+{
+	static ThreadPool pool([] {
+		unsigned int hardwareThreads = std::thread::hardware_concurrency();
+		return hardwareThreads > 1 ? hardwareThreads - 1 : 1u;
+	}());
+	return &pool;
+}
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+	: tasks_(16)
+{
+	workers_.reserve(threadCount);
+	for (unsigned int i = 0; i < threadCount; ++i) {
+		workers_.emplace_back([this](std::stop_token stopToken) { WorkerLoop(stopToken); });
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	for (auto& worker : workers_) {
+		worker.request_stop();
+	}
+	workers_.clear();
+}
+
+void ThreadPool::Submit(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (count_ == tasks_.size()) {
+			std::vector<std::function<void()>> grown(tasks_.size() * 2);
+			for (std::size_t i = 0; i < count_; ++i) {
+				grown[i] = std::move(tasks_[(head_ + i) % tasks_.size()]);
+			}
+			tasks_ = std::move(grown);
+			head_ = 0;
+		}
+		tasks_[(head_ + count_) % tasks_.size()] = std::move(task);
+		++count_;
+	}
+	condition_.notify_one();
+}
+
+void ThreadPool::ParallelFor(std::size_t count, const std::function<void(std::size_t)>& body)
+{
+	if (count == 0) {
+		return;
+	}
+
+	std::atomic<std::size_t> next = 0;
+	auto run = [&next, &body, count] {
+		for (std::size_t i = next.fetch_add(1); i < count; i = next.fetch_add(1)) {
+			body(i);
+		}
+	};
+
+	// All of this state lives on the caller's stack, so the helpers must be
+	// accounted for before returning.
+	std::mutex helperMutex;
+	std::condition_variable helperFinished;
+	std::size_t pendingHelpers = std::min<std::size_t>(workers_.size(), count - 1);
+
+	for (std::size_t i = 0, n = pendingHelpers; i < n; ++i) {
+		Submit([&run, &helperMutex, &helperFinished, &pendingHelpers] {
+			run();
+			std::lock_guard<std::mutex> lock(helperMutex);
+			if (--pendingHelpers == 0) {
+				helperFinished.notify_all();
+			}
+		});
+	}
+
+	run();
+
+	std::unique_lock<std::mutex> lock(helperMutex);
+	helperFinished.wait(lock, [&pendingHelpers] { return pendingHelpers == 0; });
+}
+
+void ThreadPool::WorkerLoop(std::stop_token stopToken)
+{
+	while (true) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			if (!condition_.wait(lock, stopToken, [this] { return count_ > 0; })) {
+				return;
+			}
+			task = std::move(tasks_[head_]);
+			tasks_[head_] = nullptr;
+			head_ = (head_ + 1) % tasks_.size();
+			--count_;
+		}
+		task();
+	}
+}